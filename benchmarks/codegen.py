@@ -0,0 +1,305 @@
+#!/usr/bin/env python3
+"""Checks that ctpy compiles Python to the same machine code as the equivalent hand-written C++.
+
+Every case is a pair of a Python function of the int parameters `a` and `b` and a C++ function
+body doing the same. Both are compiled into an extern "C" function with optimizations, the
+function is disassembled with objdump and the instructions are compared after normalizing
+addresses, symbol names, comments, padding and the operand order of commutative instructions.
+Series of cases grow the number of operations, the number of variables, which become stack
+slots, and the loop nesting. The throughput of both functions is measured by linking them
+against a driver calling them in a loop. The results are written as JSON. The run fails if a
+pair expected to compile to the same code does not or, with --baseline, if ctpy got more than
+--tolerance slower relative to the hand-written code of a previous report.
+"""
+
+import argparse
+import json
+import re
+import shlex
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+
+def case(python, cpp, exact=True):
+    """Without `exact` only the time is compared, for code the compiler may lay out differently."""
+    return {"python": python, "cpp": cpp, "exact": exact}
+
+
+def operations_series(size):
+    """An expression with `size` additions, each of them an operation."""
+    terms = [("a", "b")[i % 2] for i in range(size + 1)]
+    return case(
+        f"def func(a, b):\n    return {' + '.join(terms)}",
+        f"return {' + '.join(terms)};",
+    )
+
+
+def stack_series(size):
+    """`size` variables each depending on the previous one, so all of them take a slot."""
+    python = ["def func(a, b):", "    v0 = a + b"]
+    cpp = ["int v0 = a + b;"]
+    for i in range(1, size):
+        python.append(f"    v{i} = v{i - 1} * {('a', 'b')[i % 2]} + {i}")
+        cpp.append(f"int v{i} = v{i - 1} * {('a', 'b')[i % 2]} + {i};")
+    python.append(f"    return v{size - 1}")
+    cpp.append(f"return v{size - 1};")
+    return case("\n".join(python), " ".join(cpp))
+
+
+def loop_series(size):
+    """`size` loops one after the other, whose blocks the compiler orders differently for both."""
+    python = ["def func(a, b):", "    total = 0"]
+    cpp = ["int total = 0;"]
+    for i in range(size):
+        python += [f"    for i in range(a):", f"        total = total + b * {i + 1}"]
+        cpp.append(f"for (int i = 0; i < a; ++i) {{ total = total + b * {i + 1}; }}")
+    python.append("    return total")
+    cpp.append("return total;")
+    return case("\n".join(python), " ".join(cpp), exact=False)
+
+
+# Functions generating the cases of a series and their default sizes
+SERIES = {
+    "operations": (operations_series, [1, 4, 16, 64]),
+    "stack": (stack_series, [1, 4, 16, 64]),
+    "loops": (loop_series, [1, 2, 4]),
+}
+
+# Single cases which do not scale
+CASES = {
+    "constant": case("def func(a, b):\n    return 123", "return 123;"),
+    "comparison": case("def func(a, b):\n    return a < b", "return a < b;"),
+}
+
+PYTHON_UNIT = """#include <ctpy/parser.h>
+
+static constexpr auto content = ctpy::Content{{R"ctpy({source})ctpy"}};
+static constexpr auto lexemes = ctpy::lex<content>();
+static constexpr auto function = ctpy::parse<lexemes, ctpy::Mode::lowered>();
+
+extern "C" [[gnu::noinline]] int
+ctpy_case(int a, int b) {{
+    return function(a, b);
+}}
+"""
+
+CPP_UNIT = """extern "C" [[gnu::noinline]] int
+ctpy_case(int a, int b) {{
+    {body}
+}}
+"""
+
+DRIVER_UNIT = """#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" int ctpy_case(int a, int b);
+
+int
+main(int argc, char** argv) {
+    auto const iterations = std::atol(argv[1]);
+    volatile int a = argc + 1;
+    volatile int b = argc;
+    auto sink = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for (auto i = 0L; i < iterations; ++i) {
+        sink += ctpy_case(a, b);
+    }
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%lld %d\\n",
+            static_cast<long long>(std::chrono::nanoseconds{elapsed}.count()), sink);
+}
+"""
+
+ADDRESS = re.compile(r"^\s*[0-9a-f]+:\s*")
+SYMBOL = re.compile(r"<[^>]*>")
+COMMENT = re.compile(r"\s*#.*$")
+UNSCALED_LEA = re.compile(r"^lea \((%\w+),(%\w+),1\),(%\w+)$")
+REGISTER_COMPARE = re.compile(r"^cmp (%\w+),(%\w+)$")
+FLAGS_USER = re.compile(r"^(set|j|cmov)(\w+?)( .*)?$")
+# Condition holding for swapped operands
+MIRRORED_CONDITIONS = {
+    "l": "g",
+    "g": "l",
+    "le": "ge",
+    "ge": "le",
+    "b": "a",
+    "a": "b",
+    "be": "ae",
+    "ae": "be",
+    "e": "e",
+    "ne": "ne",
+}
+
+
+def canonicalize(instructions):
+    """Puts the register operands of additions by lea and of comparisons in a fixed order, the
+    order the register allocator picks differs for equivalent sources."""
+    result = []
+    mirror = False
+    for instruction in instructions:
+        user = FLAGS_USER.match(instruction)
+        if mirror and user and user.group(2) in MIRRORED_CONDITIONS:
+            condition = MIRRORED_CONDITIONS[user.group(2)]
+            instruction = f"{user.group(1)}{condition}{user.group(3) or ''}"
+        elif lea := UNSCALED_LEA.match(instruction):
+            base, index = sorted((lea.group(1), lea.group(2)))
+            instruction = f"lea ({base},{index},1),{lea.group(3)}"
+            mirror = False
+        elif compare := REGISTER_COMPARE.match(instruction):
+            mirror = compare.group(1) > compare.group(2)
+            if mirror:
+                instruction = f"cmp {compare.group(2)},{compare.group(1)}"
+        elif not user:
+            mirror = False
+        result.append(instruction)
+    return result
+
+
+def disassemble(objdump, object_file):
+    """Instructions of ctpy_case without addresses, symbols, comments and padding."""
+    output = subprocess.run(
+        [objdump, "-d", "--no-show-raw-insn", "--disassemble=ctpy_case", str(object_file)],
+        capture_output=True,
+        text=True,
+        check=True,
+    ).stdout
+    instructions = []
+    inside = False
+    for line in output.splitlines():
+        if line.endswith("<ctpy_case>:"):
+            inside = True
+        elif inside and line.strip():
+            instruction = COMMENT.sub("", SYMBOL.sub("", ADDRESS.sub("", line))).split()
+            if instruction and instruction[0] not in ("nop", "xchg", "data16", "cs"):
+                instructions.append(" ".join(instruction))
+    return canonicalize(instructions)
+
+
+def compile_unit(options, source, output, flags):
+    result = subprocess.run(
+        [options.compiler, "-std=c++23", f"-I{options.include}", *flags, str(source), "-o", output],
+        capture_output=True,
+        text=True,
+    )
+    if result.returncode != 0:
+        raise RuntimeError(result.stderr.strip().splitlines()[:5])
+
+
+def measure(options, directory, driver, object_file):
+    """Nanoseconds per call, the best of --repetitions runs."""
+    executable = directory / f"{object_file.stem}.out"
+    compile_unit(options, driver, executable, [str(object_file), *shlex.split(options.cxx_flags)])
+    runs = []
+    for _ in range(options.repetitions):
+        output = subprocess.run(
+            [str(executable), str(options.iterations)],
+            capture_output=True,
+            text=True,
+            check=True,
+            cwd=directory,
+        ).stdout
+        runs.append(int(output.split()[0]) / options.iterations)
+    return min(runs)
+
+
+def run_case(options, directory, driver, name, size, sources):
+    result = {"case": name, "size": size}
+    flags = ["-c", *shlex.split(options.cxx_flags)]
+    instructions = {}
+    for side, unit in (
+        ("python", PYTHON_UNIT.format(source=sources["python"])),
+        ("cpp", CPP_UNIT.format(body=sources["cpp"])),
+    ):
+        source = directory / f"{name}_{size}_{side}.cpp"
+        source.write_text(unit)
+        object_file = source.with_suffix(".o")
+        try:
+            compile_unit(options, source, object_file, flags)
+        except RuntimeError as error:
+            result["error"] = error.args[0]
+            result["exact"] = True
+            result["equivalent"] = False
+            return result
+        instructions[side] = disassemble(options.objdump, object_file)
+        result[f"{side}_instructions"] = len(instructions[side])
+        if not options.skip_runtime:
+            result[f"{side}_ns_per_call"] = round(
+                measure(options, directory, driver, object_file), 3
+            )
+    result["exact"] = sources["exact"]
+    result["equivalent"] = instructions["python"] == instructions["cpp"]
+    if not result["equivalent"]:
+        result["python_code"] = instructions["python"]
+        result["cpp_code"] = instructions["cpp"]
+    return result
+
+
+def run(options):
+    results = []
+    with tempfile.TemporaryDirectory() as name:
+        directory = Path(name)
+        driver = directory / "driver.cpp"
+        driver.write_text(DRIVER_UNIT)
+        cases = [(name, None, sources) for name, sources in CASES.items()]
+        for series in options.series:
+            function, sizes = SERIES[series]
+            cases += [(series, size, function(size)) for size in options.sizes or sizes]
+        for name, size, sources in cases:
+            result = run_case(options, directory, driver, name, size, sources)
+            print(json.dumps(result), file=sys.stderr)
+            results.append(result)
+    return results
+
+
+def regressions(results, baseline, tolerance):
+    def key(result):
+        return result["case"], result["size"]
+
+    def ratio(result):
+        if result.get("python_ns_per_call") and result.get("cpp_ns_per_call"):
+            return result["python_ns_per_call"] / result["cpp_ns_per_call"]
+        return None
+
+    previous = {key(result): result for result in baseline}
+    for result in results:
+        if result["exact"] and not result["equivalent"]:
+            yield f"{key(result)} differs from the hand-written code"
+        old = previous.get(key(result))
+        if old is None or ratio(old) is None or ratio(result) is None:
+            continue
+        if ratio(result) > ratio(old) * (1 + tolerance):
+            yield f"{key(result)} relative time {ratio(old):.3f} -> {ratio(result):.3f}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--include", required=True, help="ctpy include directory")
+    parser.add_argument("--output", required=True, help="path of the JSON report")
+    parser.add_argument("--compiler", default="g++")
+    parser.add_argument("--objdump", default="objdump")
+    parser.add_argument("--series", nargs="+", choices=SERIES, default=list(SERIES))
+    parser.add_argument("--sizes", nargs="+", type=int, help="of every series")
+    parser.add_argument("--cxx-flags", default="-O2", help="flags both sides are compiled with")
+    parser.add_argument("--iterations", type=int, default=10_000_000, help="calls per run")
+    parser.add_argument("--repetitions", type=int, default=5, help="runs per measurement")
+    parser.add_argument("--skip-runtime", action="store_true", help="only compare the code")
+    parser.add_argument("--baseline", help="previous report to check for regressions")
+    parser.add_argument("--tolerance", type=float, default=0.2)
+    options = parser.parse_args()
+
+    results = run(options)
+    Path(options.output).write_text(json.dumps({"results": results}, indent=2))
+    baseline = []
+    if options.baseline:
+        baseline = json.loads(Path(options.baseline).read_text())["results"]
+    failures = list(regressions(results, baseline, options.tolerance))
+    for failure in failures:
+        print(f"regression: {failure}", file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Measures how expensive ctpy::lex<> and ctpy::parse<> are for the compiler.
+
+Generates Python sources of increasing size for several series (number of lines, expression
+length, nesting depth, number of loops), compiles a translation unit lexing and parsing each of
+them with every available compiler and records wall-clock time, peak compiler memory and the
+smallest constexpr evaluation limit the translation unit compiles with. The results are written
+as JSON. Passing a previous report as --baseline fails the run if any measurement regressed by
+more than --tolerance.
+"""
+
+import argparse
+import json
+import os
+import shlex
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+
+# Flag for the constexpr evaluation limit and its default value per compiler family
+LIMIT_FLAGS = {
+    "gcc": ("-fconstexpr-ops-limit=", 1 << 25),
+    "clang": ("-fconstexpr-steps=", 1 << 20),
+}
+
+
+def lines_series(size):
+    body = "".join(f"    return {i}\n" for i in range(size))
+    return f"def func():\n{body}"
+
+
+def expression_series(size):
+    terms = " + ".join(str(i) for i in range(size))
+    return f"def func():\n    return {terms}"
+
+
+def nesting_series(size):
+    return f"def func():\n    return {'(' * size}1{')' * size}"
+
+
+def loops_series(size):
+    loops = "".join(
+        f"    for i in range({i}):\n        total = total + i\n" for i in range(size)
+    )
+    return f"def func():\n    total = 0\n{loops}    return total"
+
+
+SERIES = {
+    "lines": lines_series,
+    "expression": expression_series,
+    "nesting": nesting_series,
+    "loops": loops_series,
+}
+
+TRANSLATION_UNIT = """#include <ctpy/parser.h>
+
+static constexpr auto content = ctpy::Content{{R"ctpy({source})ctpy"}};
+static constexpr auto lexemes = ctpy::lex<content>();
+#if CTPY_BENCHMARK_PARSE
+static constexpr auto function = ctpy::parse<lexemes>();
+#endif
+"""
+
+
+def compiler_family(compiler):
+    version = subprocess.run(
+        [compiler, "--version"], capture_output=True, text=True, check=True
+    ).stdout
+    return ("clang" if "clang" in version else "gcc"), version.splitlines()[0]
+
+
+def measure(compiler, arguments):
+    """Compiles with wait4 to get the peak resident memory of this single compiler run."""
+    start = time.perf_counter()
+    with tempfile.TemporaryFile(mode="w+") as stderr:
+        process = subprocess.Popen(
+            [compiler, *arguments], stdout=subprocess.DEVNULL, stderr=stderr
+        )
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+        stderr.seek(0)
+        diagnostics = stderr.read()
+    return os.waitstatus_to_exitcode(status) == 0, elapsed, usage.ru_maxrss, diagnostics
+
+
+def find_limit(compiler, arguments, flag, default, precision):
+    """Smallest constexpr limit the translation unit compiles with, None if not even 64x the
+    default is enough."""
+
+    def succeeds(limit):
+        return measure(compiler, [*arguments, f"{flag}{limit}"])[0]
+
+    low, high = 0, default
+    while not succeeds(high):
+        low, high = high, high * 4
+        if high > default * 64:
+            return None
+    while high - low > max(1, int(high * precision)):
+        middle = (low + high) // 2
+        if succeeds(middle):
+            high = middle
+        else:
+            low = middle
+    return high
+
+
+def run(options):
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        for compiler in options.compilers:
+            family, version = compiler_family(compiler)
+            flag, default = LIMIT_FLAGS[family]
+            for series in options.series:
+                for size in options.sizes:
+                    source = Path(directory) / f"{series}_{size}.cpp"
+                    source.write_text(TRANSLATION_UNIT.format(source=SERIES[series](size)))
+                    for stage in ("lex", "parse"):
+                        arguments = [
+                            "-std=c++23",
+                            "-fsyntax-only",
+                            f"-I{options.include}",
+                            f"-DCTPY_BENCHMARK_PARSE={int(stage == 'parse')}",
+                            *shlex.split(options.cxx_flags),
+                            str(source),
+                        ]
+                        unlimited = [*arguments, f"{flag}{default * 64}"]
+                        succeeded, seconds, memory, diagnostics = measure(compiler, unlimited)
+                        result = {
+                            "compiler": compiler,
+                            "compiler_version": version,
+                            "series": series,
+                            "size": size,
+                            "stage": stage,
+                            "succeeded": succeeded,
+                            "wall_seconds": round(seconds, 3),
+                            "peak_memory_kib": memory,
+                            "limit_flag": flag.rstrip("="),
+                            "constexpr_limit": None,
+                        }
+                        if succeeded and not options.skip_limit_search:
+                            result["constexpr_limit"] = find_limit(
+                                compiler, arguments, flag, default, options.precision
+                            )
+                        elif not succeeded:
+                            result["error"] = diagnostics.strip().splitlines()[:5]
+                        print(json.dumps(result), file=sys.stderr)
+                        results.append(result)
+    return results
+
+
+def regressions(results, baseline, tolerance):
+    def key(result):
+        return result["compiler"], result["series"], result["size"], result["stage"]
+
+    previous = {key(result): result for result in baseline}
+    for result in results:
+        old = previous.get(key(result))
+        if old is None or not old["succeeded"]:
+            continue
+        if not result["succeeded"]:
+            yield f"{key(result)} does not compile anymore"
+            continue
+        for metric in ("wall_seconds", "peak_memory_kib", "constexpr_limit"):
+            if old[metric] and result[metric] and result[metric] > old[metric] * (1 + tolerance):
+                yield f"{key(result)} {metric} {old[metric]} -> {result[metric]}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--include", required=True, help="ctpy include directory")
+    parser.add_argument("--output", required=True, help="path of the JSON report")
+    parser.add_argument(
+        "--compilers",
+        nargs="+",
+        default=[compiler for compiler in ("g++", "clang++") if shutil.which(compiler)],
+    )
+    parser.add_argument("--series", nargs="+", choices=SERIES, default=list(SERIES))
+    parser.add_argument("--sizes", nargs="+", type=int, default=[1, 10, 100, 1000])
+    parser.add_argument("--cxx-flags", default="", help="additional compiler flags")
+    parser.add_argument("--precision", type=float, default=0.05, help="of the limit search")
+    parser.add_argument("--skip-limit-search", action="store_true")
+    parser.add_argument("--baseline", help="previous report to check for regressions")
+    parser.add_argument("--tolerance", type=float, default=0.2)
+    options = parser.parse_args()
+
+    results = run(options)
+    Path(options.output).write_text(json.dumps({"results": results}, indent=2))
+    if options.baseline:
+        baseline = json.loads(Path(options.baseline).read_text())["results"]
+        failures = list(regressions(results, baseline, options.tolerance))
+        for failure in failures:
+            print(f"regression: {failure}", file=sys.stderr)
+        return 1 if failures else 0
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "function.h"
+#include "optimizer.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <cstddef>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace ctpy {
+
+namespace detail {
+
+    // Rows evaluated per operation at once, small enough for all columns of a typical stack to
+    // stay in L1
+    inline constexpr auto batch_size = std::size_t{256};
+
+    template<class T>
+    using Column = std::array<T, batch_size>;
+
+    template<auto const& layout, std::size_t... I>
+    constexpr auto
+    make_columns(std::index_sequence<I...>) noexcept {
+        return std::tuple<Column<TypeOf<layout.variables[I]>>...>{};
+    }
+
+    // Slots which are read before anything is written to them and hence have to start out as
+    // default Variables like in Stack
+    template<std::size_t stack_size>
+    constexpr std::array<bool, stack_size>
+    read_before_written(
+            std::span<Operation const> const operations,
+            std::size_t const parameters_count) noexcept {
+        auto written = std::array<bool, stack_size>{};
+        auto result = std::array<bool, stack_size>{};
+        std::fill_n(written.begin(), parameters_count, true);
+        for (auto const& operation: operations) {
+            for_each_read(operation, [&](std::size_t const index) {
+                result[index] = result[index] or not written[index];
+            });
+            if (auto const index = written_index(operation); index.has_value()) {
+                written[*index] = true;
+            }
+        }
+        return result;
+    }
+
+    // Whether a float is in the range of the int type Result, converting it is undefined otherwise
+    template<class Result>
+    constexpr bool
+    in_range(double const value) noexcept {
+        constexpr auto end = static_cast<double>(std::numeric_limits<Result>::max() / 2 + 1) * 2;
+        return value >= static_cast<double>(std::numeric_limits<Result>::min()) and value < end;
+    }
+
+    // Value as a Result, values which cannot be one, like strings for numeric results, become
+    // the default Result. Floats out of the range of an int Result throw.
+    template<class Result>
+    constexpr Result
+    convert(auto const& value) {
+        using Value = std::remove_cvref_t<decltype(value)>;
+        if constexpr (is_variable<Result> or not is_variable<Value>) {
+            if constexpr (std::is_constructible_v<Result, Value>) {
+                if constexpr (std::is_floating_point_v<Value> and is_int<Result>) {
+                    if (not in_range<Result>(value)) {
+                        throw std::out_of_range{"Float out of the range of the result type"};
+                    }
+                }
+                return static_cast<Result>(value);
+            } else {
+                return Result{};
+            }
+        } else {
+            return std::visit([](auto const& value_) { return convert<Result>(value_); }, value);
+        }
+    }
+
+    // Applies a binary operator to `count` rows of two columns
+    template<class Operator>
+    constexpr void
+    evaluate_columns(
+            Operator const operator_,
+            auto& target,
+            auto const& lhs,
+            auto const& rhs,
+            std::size_t const count) {
+        for (auto i = std::size_t{0}; i < count; ++i) {
+            target[i] = evaluate(operator_, lhs[i], rhs[i]);
+        }
+    }
+
+    // Int arithmetic on two int columns, computed in 64 bits like for single values but checked
+    // for overflow once for all rows by the range of the results, so that the loop has no branch
+    // and stays vectorizable, see narrow
+    template<class Arithmetic_>
+    constexpr void
+    evaluate_columns(
+            Arithmetic<Arithmetic_>,
+            Column<int>& target,
+            Column<int> const& lhs,
+            Column<int> const& rhs,
+            std::size_t const count) {
+        auto lowest = std::int64_t{0};
+        auto highest = std::int64_t{0};
+        for (auto i = std::size_t{0}; i < count; ++i) {
+            auto const wide = Arithmetic_{}(std::int64_t{lhs[i]}, std::int64_t{rhs[i]});
+            lowest = std::min(lowest, wide);
+            highest = std::max(highest, wide);
+            target[i] = static_cast<int>(wide);
+        }
+        narrow(lowest);
+        narrow(highest);
+    }
+
+    // Runs the operation at `index` on `count` rows of the columns, every operation is a plain
+    // loop over typed arrays which the compiler vectorizes for the target instruction set
+    template<auto const& function, std::size_t index, class Result>
+    constexpr void
+    execute_batched(
+            auto& columns,
+            std::span<Result> const results,
+            std::size_t const count) {
+        constexpr auto const& operation_variant = function.operations[index];
+        constexpr auto const& operation = std::get<operation_variant.index()>(operation_variant);
+        using T = std::remove_cvref_t<decltype(operation)>;
+        if constexpr (is_binary_operation<T>) {
+            evaluate_columns(
+                    typename T::operator_type{},
+                    std::get<operation.target>(columns),
+                    std::get<operation.lhs>(columns),
+                    std::get<operation.rhs>(columns),
+                    count);
+        } else if constexpr (std::is_same_v<T, AssignOperation>) {
+            auto const& from = std::get<operation.from>(columns);
+            std::copy_n(from.begin(), count, std::get<operation.to>(columns).begin());
+        } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+            auto& target = std::get<operation.index>(columns);
+            using Value = typename std::remove_cvref_t<decltype(target)>::value_type;
+            std::fill_n(target.begin(), count, convert<Value>(operation.value));
+        } else if constexpr (std::is_same_v<T, SelectOperation>) {
+            auto& target = std::get<operation.target>(columns);
+            auto const& condition = std::get<operation.condition>(columns);
+            auto const& if_true = std::get<operation.if_true>(columns);
+            auto const& if_false = std::get<operation.if_false>(columns);
+            using Value = typename std::remove_cvref_t<decltype(target)>::value_type;
+            for (auto i = std::size_t{0}; i < count; ++i) {
+                target[i] = truthy(condition[i]) ? convert<Value>(if_true[i])
+                                                 : convert<Value>(if_false[i]);
+            }
+        } else if constexpr (std::is_same_v<T, LengthOperation>) {
+            auto& target = std::get<operation.to>(columns);
+            auto const& from = std::get<operation.from>(columns);
+            for (auto i = std::size_t{0}; i < count; ++i) {
+                target[i] = length(from[i]);
+            }
+        } else if constexpr (std::is_same_v<T, SliceOperation>) {
+            auto& target = std::get<operation.target>(columns);
+            auto const& value = std::get<operation.value>(columns);
+            auto const& begin = std::get<operation.begin>(columns);
+            auto const& end = std::get<operation.end>(columns);
+            for (auto i = std::size_t{0}; i < count; ++i) {
+                target[i] = slice(value[i], begin[i], end[i]);
+            }
+        } else if constexpr (is_dictionary_operation<T>) {
+            auto& target = std::get<operation.target>(columns);
+            auto const& key = std::get<operation.key>(columns);
+            using Value = typename std::remove_cvref_t<decltype(target)>::value_type;
+            for (auto i = std::size_t{0}; i < count; ++i) {
+                target[i] = convert<Value>(
+                        typename T::probe_type{}(*operation.dictionary, key[i]));
+            }
+        } else if constexpr (std::is_same_v<T, ReturnOperation>) {
+            auto const& from = std::get<operation.stack_index>(columns);
+            for (auto i = std::size_t{0}; i < count; ++i) {
+                results[i] = convert<Result>(from[i]);
+            }
+        }
+    }
+
+    // Whether rows may take different paths through `function`, leave it for a callee or suspend
+    template<auto const& function>
+    inline constexpr auto has_control_flow = std::ranges::any_of(
+            function.operations, [](Operation const& operation) {
+                return jump_target(operation).has_value() or
+                       std::holds_alternative<CallOperation>(operation) or
+                       std::holds_alternative<YieldOperation>(operation);
+            });
+
+}  // namespace detail
+
+// Evaluates `function` for every row of the parameter columns (structure of arrays, one
+// contiguous range per parameter) and writes one result per row. Operations run column-wise over
+// blocks of rows, so each one is a vectorizable loop instead of a call per row. Functions with
+// loops or conditionals take different paths per row and are called row by row instead, as are
+// functions calling into their module.
+template<auto const& function, auto const& callees, class Results, class... Columns>
+    requires std::ranges::contiguous_range<Results> and
+             (std::ranges::contiguous_range<Columns const> and ...)
+void
+batch(LoweredFunction<function, callees> const function_,
+      Results&& results,
+      Columns const&... columns) {
+    using Traits = LoweredFunction<function, callees>::Traits;
+    using Result = std::ranges::range_value_t<Results>;
+    static_assert(
+            sizeof...(Columns) == Traits::parameters_count, "Wrong number of columns passed");
+    auto const rows = std::ranges::size(results);
+    if (((std::ranges::size(columns) != rows) or ...)) {
+        throw std::invalid_argument{"Columns and results differ in size"};
+    }
+    auto const result_view = std::span<Result>{results};
+    auto const parameter_views = std::tuple{std::span{columns}...};
+    if constexpr (detail::has_control_flow<function>) {
+        for (auto row = std::size_t{0}; row < rows; ++row) {
+            result_view[row] = detail::convert<Result>(std::apply(
+                    [&](auto const&... views) { return function_(views[row]...); },
+                    parameter_views));
+        }
+    } else {
+        static constexpr auto const& layout = LoweredFunction<function, callees>::template layout<
+                std::ranges::range_value_t<Columns>...>;
+        static constexpr auto initial = detail::read_before_written<Traits::stack_size>(
+                function.operations, sizeof...(Columns));
+        using Stack = decltype(detail::make_columns<layout>(
+                std::make_index_sequence<Traits::stack_size>{}));
+        auto const stack = std::make_unique<Stack>();
+        for (auto offset = std::size_t{0}; offset < rows; offset += detail::batch_size) {
+            auto const count = std::min(detail::batch_size, rows - offset);
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                ((std::copy_n(
+                         std::get<I>(parameter_views).begin() + offset,
+                         count,
+                         std::get<I>(*stack).begin())),
+                 ...);
+            }(std::index_sequence_for<Columns...>{});
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                ((initial[I] ? std::get<I>(*stack).fill({}) : void()), ...);
+            }(std::make_index_sequence<Traits::stack_size>{});
+            auto const result_rows = result_view.subspan(offset, count);
+            if constexpr (layout.return_value == Type::empty) {
+                std::ranges::fill(result_rows, detail::convert<Result>(Variable{}));
+            }
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                (detail::execute_batched<function, I>(*stack, result_rows, count), ...);
+            }(std::make_index_sequence<Traits::operation_count>{});
+        }
+    }
+}
+
+}  // namespace ctpy
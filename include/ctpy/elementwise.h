@@ -0,0 +1,195 @@
+#pragma once
+
+#include "batch.h"
+#include "function.h"
+#include <cstddef>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <version>
+#if __has_include(<mdspan>)
+#include <mdspan>
+#endif
+
+namespace ctpy {
+
+namespace detail {
+
+    // Argument passed on to every row, like a NumPy scalar. A string is one value, not a range of
+    // characters.
+    template<class T>
+    concept Broadcast =
+            std::is_arithmetic_v<std::remove_cvref_t<T>> or is_variable<T> or is_string<T>;
+
+    template<class T>
+    concept ElementwiseArgument = Broadcast<T> or std::ranges::contiguous_range<T const>;
+
+    // Pointer to the rows of a range, or the broadcast value itself
+    constexpr auto
+    elements(auto const& argument) noexcept {
+        if constexpr (Broadcast<decltype(argument)>) {
+            return argument;
+        } else {
+            return std::ranges::data(argument);
+        }
+    }
+
+    constexpr auto const&
+    element(auto const& elements, std::size_t const row) noexcept {
+        if constexpr (std::is_pointer_v<std::remove_cvref_t<decltype(elements)>>) {
+            return elements[row];
+        } else {
+            return elements;
+        }
+    }
+
+}  // namespace detail
+
+// Evaluates `function` for every row of its arguments, which are contiguous ranges of one value
+// per row or single values used for every row, and writes one result per row. Unlike batch, each
+// row runs the whole function before the next one starts: the lowered operations are inlined
+// into a single loop, so an expression such as a * b + c keeps its intermediate values in
+// registers instead of writing a column per operation. Straight-line functions and functions
+// whose conditionals became selects compile to a loop the compiler vectorizes, functions with
+// branches, loops or calls still run correctly with a branch per row. `results` may be one of
+// the arguments to update it in place.
+template<auto const& function, auto const& callees, class Results, class... Arguments>
+    requires std::ranges::contiguous_range<Results> and
+             (detail::ElementwiseArgument<Arguments> and ...)
+void
+elementwise(
+        LoweredFunction<function, callees> const function_,
+        Results&& results,
+        Arguments const&... arguments) {
+    using Traits = LoweredFunction<function, callees>::Traits;
+    using Result = std::ranges::range_value_t<Results>;
+    static_assert(
+            sizeof...(Arguments) == Traits::parameters_count, "Wrong number of arguments passed");
+    auto const rows = std::ranges::size(results);
+    auto const size_differs = [rows](auto const& argument) {
+        if constexpr (detail::Broadcast<decltype(argument)>) {
+            return false;
+        } else {
+            return std::ranges::size(argument) != rows;
+        }
+    };
+    if ((size_differs(arguments) or ...)) {
+        throw std::invalid_argument{"Arguments and results differ in size"};
+    }
+    auto* const result_elements = std::ranges::data(results);
+    [&](auto const... elements) {
+        for (auto row = std::size_t{0}; row < rows; ++row) {
+            result_elements[row] =
+                    detail::convert<Result>(function_(detail::element(elements, row)...));
+        }
+    }(detail::elements(arguments)...);
+}
+
+#ifdef __cpp_lib_mdspan
+
+namespace detail {
+
+    template<class T>
+    inline constexpr auto is_mdspan = false;
+
+    template<class T, class Extents, class Layout, class Accessor>
+    inline constexpr auto is_mdspan<std::mdspan<T, Extents, Layout, Accessor>> = true;
+
+    template<class T>
+    concept MdspanArgument = Broadcast<T> or is_mdspan<std::remove_cvref_t<T>>;
+
+    // Whether the elements of a View lie in one range in the order of `Layout`
+    template<class Layout, class View>
+    inline constexpr auto is_flat = [] {
+        if constexpr (Broadcast<View>) {
+            return true;
+        } else {
+            return std::is_same_v<typename View::layout_type, Layout> and
+                   (std::is_same_v<Layout, std::layout_right> or
+                    std::is_same_v<Layout, std::layout_left>) and
+                   std::is_same_v<
+                           typename View::accessor_type,
+                           std::default_accessor<typename View::element_type>>;
+        }
+    }();
+
+    // Contiguous range over the elements of a flat `view`, or the broadcast value itself
+    constexpr auto
+    flatten(auto const& view) noexcept {
+        if constexpr (Broadcast<decltype(view)>) {
+            return view;
+        } else {
+            return std::span{view.data_handle(), view.size()};
+        }
+    }
+
+    template<class T>
+    constexpr auto const&
+    element_at(T const& argument, auto const... indices) noexcept {
+        if constexpr (Broadcast<T>) {
+            return argument;
+        } else {
+            return argument[indices...];
+        }
+    }
+
+    // Calls `visitor` with every multidimensional index of `extents`, the last dimension innermost
+    template<std::size_t dimension = 0, class Extents>
+    constexpr void
+    for_each_index(Extents const& extents, auto const& visitor, auto const... indices) {
+        if constexpr (dimension == Extents::rank()) {
+            visitor(indices...);
+        } else {
+            using Index = typename Extents::index_type;
+            for (auto index = Index{0}; index < extents.extent(dimension); ++index) {
+                for_each_index<dimension + 1>(extents, visitor, indices..., index);
+            }
+        }
+    }
+
+}  // namespace detail
+
+// Like elementwise over ranges, for multidimensional arguments of the same extents as `results`.
+// When all of them share the row-major or column-major layout of `results`, which the layouts of
+// std::mdspan guarantee to be contiguous, they are evaluated as one flat range, otherwise each
+// index is visited on its own.
+template<
+        auto const& function,
+        auto const& callees,
+        class T,
+        class Extents,
+        class Layout,
+        class Accessor,
+        class... Arguments>
+    requires(detail::MdspanArgument<Arguments> and ...)
+void
+elementwise(
+        LoweredFunction<function, callees> const function_,
+        std::mdspan<T, Extents, Layout, Accessor> const results,
+        Arguments const&... arguments) {
+    auto const extents_differ = [&results](auto const& argument) {
+        if constexpr (detail::Broadcast<decltype(argument)>) {
+            return false;
+        } else {
+            return argument.extents() != results.extents();
+        }
+    };
+    if ((extents_differ(arguments) or ...)) {
+        throw std::invalid_argument{"Arguments and results differ in extents"};
+    }
+    using Results = std::mdspan<T, Extents, Layout, Accessor>;
+    if constexpr (
+            detail::is_flat<Layout, Results> and (detail::is_flat<Layout, Arguments> and ...)) {
+        elementwise(function_, detail::flatten(results), detail::flatten(arguments)...);
+    } else {
+        detail::for_each_index(results.extents(), [&](auto const... indices) {
+            results[indices...] = detail::convert<T>(
+                    function_(detail::element_at(arguments, indices...)...));
+        });
+    }
+}
+
+#endif
+
+}  // namespace ctpy
@@ -1,12 +1,36 @@
 #pragma once
 
+#include "perfect_hash.h"
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <variant>
 
 namespace ctpy {
 
-using Variable = std::variant<int, double>;
+// Python value: an int, a float or a str, which is a view of characters owned elsewhere, like the
+// source of a function for string literals or the caller for arguments
+using Variable = std::variant<int, double, std::string_view>;
+
+// Static type of a stack slot, `variable` when a slot can hold values of different types
+enum class Type { empty, int_, double_, string, variable };
+
+// Annotated parameter types of a function, `empty` for parameters without annotation
+template<std::size_t parameters_count>
+using Signature = std::array<Type, parameters_count>;
 
 template<std::size_t variable_count>
 struct Stack final {
@@ -28,6 +52,692 @@ struct Stack final {
 template<class... Ts>
 Stack(auto, Ts&&...) -> Stack<sizeof...(Ts)>;
 
+// Stack with plainly typed slots as produced by type inference
+template<class Return, class... Variables>
+struct TypedStack final {
+    Return return_value = {};
+    std::tuple<Variables...> variables = {};
+
+    constexpr bool
+    operator==(TypedStack const&) const noexcept = default;
+};
+
+namespace detail {
+
+    template<class T>
+    inline constexpr auto is_variable = std::is_same_v<std::remove_cvref_t<T>, Variable>;
+
+    template<class T>
+    inline constexpr auto is_string = std::is_same_v<std::remove_cvref_t<T>, std::string_view>;
+
+    template<class T>
+    concept Number = std::is_arithmetic_v<std::remove_cvref_t<T>>;
+
+    template<class T>
+    concept String = is_string<T>;
+
+    template<class T>
+    constexpr Type
+    type_of() noexcept {
+        using U = std::remove_cvref_t<T>;
+        if constexpr (std::is_convertible_v<U, std::string_view> and not is_variable<U>) {
+            return Type::string;
+        } else if constexpr (std::is_same_v<U, bool> || not std::is_arithmetic_v<U>) {
+            return Type::variable;
+        } else if constexpr (std::is_integral_v<U>) {
+            return Type::int_;
+        } else {
+            return Type::double_;
+        }
+    }
+
+    constexpr Type
+    type_of(Variable const& value) noexcept {
+        return std::holds_alternative<int>(value)      ? Type::int_
+               : std::holds_alternative<double>(value) ? Type::double_
+                                                       : Type::string;
+    }
+
+    template<Type type>
+    using TypeOf = std::conditional_t<
+            type == Type::int_ || type == Type::empty,
+            int,
+            std::conditional_t<
+                    type == Type::double_,
+                    double,
+                    std::conditional_t<type == Type::string, std::string_view, Variable>>>;
+
+    // Ends visit_variables once the values of all Variables are bound
+    template<class Visitor>
+    constexpr auto
+    visit_variables(Visitor&& visitor) {
+        return visitor();
+    }
+
+    // Calls `visitor` with the values of `variables` like std::visit, but switches over one
+    // Variable at a time. std::visit instantiates a table of all combinations of alternatives for
+    // every visitor, which took up a large part of compiling the operators for Variables.
+    template<class Visitor>
+    constexpr auto
+    visit_variables(Visitor&& visitor, Variable const& variable, auto const&... variables) {
+        static_assert(std::variant_size_v<Variable> == 3);
+        auto const bind = [&](auto const& value) {
+            return visit_variables(
+                    [&](auto const&... values) { return visitor(value, values...); },
+                    variables...);
+        };
+        switch (variable.index()) {
+            case 0:
+                return bind(*std::get_if<0>(&variable));
+            case 1:
+                return bind(*std::get_if<1>(&variable));
+            default:
+                return bind(*std::get_if<2>(&variable));
+        }
+    }
+
+    // Whether an argument of type `argument` may be passed for a parameter annotated with
+    // `annotation`, ints are accepted for floats like in Python's numeric tower and Variables are
+    // only known at run time
+    constexpr bool
+    accepts(Type const annotation, Type const argument) noexcept {
+        return annotation == Type::empty or argument == Type::variable or annotation == argument or
+               (annotation == Type::double_ and argument == Type::int_);
+    }
+
+    // Throws unless the value of a Variable may be passed for a parameter annotated with
+    // `annotation`, the types of other arguments are checked when they are compiled
+    constexpr void
+    check_annotation(Type const annotation, Variable const& value) {
+        if (not accepts(annotation, type_of(value))) {
+            throw std::invalid_argument{"Argument does not match the parameter annotation"};
+        }
+    }
+
+    // Converts an argument to the type its parameter is annotated with, only ints are widened
+    template<Type annotation, class T>
+    constexpr auto
+    annotate(T const& value) {
+        if constexpr (annotation == Type::empty) {
+            return value;
+        } else if constexpr (is_variable<T>) {
+            check_annotation(annotation, value);
+            return std::visit(
+                    []<class V>(V const value_) {
+                        // Arguments of other types were rejected above
+                        if constexpr (std::is_constructible_v<TypeOf<annotation>, V>) {
+                            return static_cast<TypeOf<annotation>>(value_);
+                        } else {
+                            return TypeOf<annotation>{};
+                        }
+                    },
+                    value);
+        } else {
+            return static_cast<TypeOf<annotation>>(value);
+        }
+    }
+
+    constexpr Variable
+    annotate(Type const annotation, Variable const& value) {
+        check_annotation(annotation, value);
+        if (auto const* const int_ = std::get_if<int>(&value);
+            int_ != nullptr and annotation == Type::double_) {
+            return Variable{static_cast<double>(*int_)};
+        }
+        return value;
+    }
+
+    // Least type able to hold values of both types
+    constexpr Type
+    join(Type const lhs, Type const rhs) noexcept {
+        if (lhs == Type::empty) {
+            return rhs;
+        } else if (rhs == Type::empty or lhs == rhs) {
+            return lhs;
+        }
+        return Type::variable;
+    }
+
+    // Result type of arithmetic on two types, arithmetic on strings is not supported
+    constexpr Type
+    promote(Type const lhs, Type const rhs) noexcept {
+        if (lhs == Type::variable or rhs == Type::variable or lhs == Type::string or
+            rhs == Type::string) {
+            return Type::variable;
+        } else if (lhs == Type::double_ or rhs == Type::double_) {
+            return Type::double_;
+        }
+        return Type::int_;
+    }
+
+    template<class T>
+    inline constexpr auto is_int = std::is_integral_v<T> and not std::is_same_v<T, bool>;
+
+    // Whether `Operator` does not take the values of `lhs` and `rhs`, like Python raises a
+    // TypeError for adding a number to a str
+    template<class Operator>
+    constexpr bool
+    mismatches(Variable const& lhs, Variable const& rhs) noexcept {
+        return visit_variables(
+                []<class Lhs, class Rhs>(Lhs const&, Rhs const&) {
+                    return not std::is_invocable_v<Operator, Lhs, Rhs>;
+                },
+                lhs,
+                rhs);
+    }
+
+    // Throws for operands an operator does not take, see mismatches, typed as its result
+    template<class Result>
+    constexpr Result
+    reject_operands() {
+        throw std::invalid_argument{"Unsupported operand types"};
+    }
+
+    // Whether the result of an int operation computed in 64 bits fits an int
+    constexpr bool
+    fits_int(std::int64_t const wide) noexcept {
+        return wide >= std::numeric_limits<int>::min() and wide <= std::numeric_limits<int>::max();
+    }
+
+    // Python ints never overflow but Variable holds a C++ int, so int operations are computed in
+    // 64 bits, where two ints cannot overflow, and results which do not fit an int throw instead
+    // of wrapping or silently losing precision as a float
+    constexpr int
+    narrow(std::int64_t const wide) {
+        if (not fits_int(wide)) [[unlikely]] {
+            throw std::overflow_error{"Integer overflow"};
+        }
+        return static_cast<int>(wide);
+    }
+
+    // Python arithmetic whose result is an int for two ints and a float otherwise, like C++'s.
+    // Results of two ints which do not fit an int throw, see narrow.
+    template<class Arithmetic_>
+    struct Arithmetic final {
+        static constexpr Type
+        result(Type const lhs, Type const rhs) noexcept {
+            return promote(lhs, rhs);
+        }
+
+        static constexpr bool
+        fails(Variable const& lhs, Variable const& rhs) noexcept {
+            auto const* const lhs_int = std::get_if<int>(&lhs);
+            auto const* const rhs_int = std::get_if<int>(&rhs);
+            return mismatches<Arithmetic>(lhs, rhs) or
+                   (lhs_int != nullptr and rhs_int != nullptr and
+                    not fits_int(Arithmetic_{}(std::int64_t{*lhs_int}, std::int64_t{*rhs_int})));
+        }
+
+        constexpr auto
+        operator()(Number auto const lhs, Number auto const rhs) const {
+            if constexpr (is_int<decltype(lhs)> and is_int<decltype(rhs)>) {
+                return narrow(Arithmetic_{}(std::int64_t{lhs}, std::int64_t{rhs}));
+            } else {
+                return Arithmetic_{}(lhs, rhs);
+            }
+        }
+    };
+
+    using Plus = Arithmetic<std::plus<>>;
+    using Minus = Arithmetic<std::minus<>>;
+    using Multiplies = Arithmetic<std::multiplies<>>;
+
+    // Python raises a ZeroDivisionError for a divisor of zero, an int or a float alike
+    constexpr void
+    check_divisor(Number auto const divisor) {
+        if (divisor == 0) {
+            throw std::domain_error{"Division by zero"};
+        }
+    }
+
+    // Whether check_divisor throws for `divisor`
+    constexpr bool
+    divides_by_zero(Variable const& divisor) noexcept {
+        return divisor == Variable{0} or divisor == Variable{0.0};
+    }
+
+    // Python true division, always a float
+    struct Divides final {
+        static constexpr Type
+        result(Type, Type) noexcept {
+            return Type::double_;
+        }
+
+        static constexpr bool
+        fails(Variable const& lhs, Variable const& rhs) noexcept {
+            return mismatches<Divides>(lhs, rhs) or divides_by_zero(rhs);
+        }
+
+        constexpr double
+        operator()(Number auto const lhs, Number auto const rhs) const {
+            check_divisor(rhs);
+            return static_cast<double>(lhs) / static_cast<double>(rhs);
+        }
+    };
+
+    // Python floor division, rounding towards negative infinity unlike C++'s integer division.
+    // Ints are divided in 64 bits, where the minimum int divided by -1 overflows an int instead
+    // of trapping, see narrow.
+    struct FloorDivides final {
+        static constexpr Type
+        result(Type const lhs, Type const rhs) noexcept {
+            return promote(lhs, rhs);
+        }
+
+        static constexpr bool
+        fails(Variable const& lhs, Variable const& rhs) noexcept {
+            return mismatches<FloorDivides>(lhs, rhs) or divides_by_zero(rhs) or
+                   (lhs == Variable{std::numeric_limits<int>::min()} and rhs == Variable{-1});
+        }
+
+        constexpr auto
+        operator()(Number auto const lhs, Number auto const rhs) const {
+            check_divisor(rhs);
+            if constexpr (is_int<decltype(lhs)> and is_int<decltype(rhs)>) {
+                auto const wide_lhs = std::int64_t{lhs};
+                auto const quotient = wide_lhs / rhs;
+                return narrow(
+                        wide_lhs % rhs != 0 and (lhs < 0) != (rhs < 0) ? quotient - 1 : quotient);
+            } else {
+                return std::floor(static_cast<double>(lhs) / static_cast<double>(rhs));
+            }
+        }
+    };
+
+    // Python modulo, the result takes the sign of the divisor unlike C++'s remainder
+    struct Modulus final {
+        static constexpr Type
+        result(Type const lhs, Type const rhs) noexcept {
+            return promote(lhs, rhs);
+        }
+
+        static constexpr bool
+        fails(Variable const& lhs, Variable const& rhs) noexcept {
+            return mismatches<Modulus>(lhs, rhs) or divides_by_zero(rhs);
+        }
+
+        constexpr auto
+        operator()(Number auto const lhs, Number auto const rhs) const {
+            check_divisor(rhs);
+            if constexpr (is_int<decltype(lhs)> and is_int<decltype(rhs)>) {
+                // In 64 bits, where the minimum int modulo -1 is 0 instead of trapping
+                auto const remainder = static_cast<int>(std::int64_t{lhs} % rhs);
+                return remainder != 0 and (remainder < 0) != (rhs < 0) ? remainder + rhs
+                                                                       : remainder;
+            } else {
+                auto const remainder =
+                        std::fmod(static_cast<double>(lhs), static_cast<double>(rhs));
+                return remainder != 0 and (remainder < 0) != (rhs < 0) ? remainder + rhs
+                                                                       : remainder;
+            }
+        }
+    };
+
+    // Base to the power of a non-negative exponent by repeated squaring in 64 bits, stops at the
+    // first square or product which does not fit an int, so the result only fits one if the power
+    // does. A square of the base is only taken if it is multiplied into the result later.
+    constexpr std::int64_t
+    integer_power(std::int64_t base, int exponent) noexcept {
+        auto result = std::int64_t{1};
+        for (; exponent > 0; exponent /= 2) {
+            if (exponent % 2 == 1) {
+                result *= base;
+                if (not fits_int(result)) {
+                    return result;
+                }
+            }
+            if (exponent > 1) {
+                base *= base;
+                if (not fits_int(base)) {
+                    return base;
+                }
+            }
+        }
+        return result;
+    }
+
+    // Python power: an int for two ints unless the exponent is negative, so its static type for
+    // two ints is only known at run time. Int results which do not fit an int throw, see narrow.
+    struct Power final {
+        static constexpr Type
+        result(Type const lhs, Type const rhs) noexcept {
+            auto const type = promote(lhs, rhs);
+            return type == Type::int_ ? Type::variable : type;
+        }
+
+        static constexpr bool
+        fails(Variable const& lhs, Variable const& rhs) noexcept {
+            auto const* const lhs_int = std::get_if<int>(&lhs);
+            auto const* const rhs_int = std::get_if<int>(&rhs);
+            return mismatches<Power>(lhs, rhs) or
+                   (lhs_int != nullptr and rhs_int != nullptr and *rhs_int >= 0 and
+                    not fits_int(integer_power(*lhs_int, *rhs_int)));
+        }
+
+        constexpr auto
+        operator()(Number auto const lhs, Number auto const rhs) const {
+            if constexpr (is_int<decltype(lhs)> and is_int<decltype(rhs)>) {
+                if (rhs < 0) {
+                    return Variable{std::pow(static_cast<double>(lhs), static_cast<double>(rhs))};
+                }
+                return Variable{narrow(integer_power(lhs, rhs))};
+            } else {
+                return std::pow(static_cast<double>(lhs), static_cast<double>(rhs));
+            }
+        }
+    };
+
+    // Operators which throw for some operands like Python raises for them, `fails` tells for
+    // which without throwing, so that the optimizer can leave them to run time. The left operand
+    // of probes is a Dictionary.
+    template<class Operator, class Lhs = Variable>
+    concept Raising = requires(Lhs const& lhs, Variable const& rhs) {
+        { Operator::fails(lhs, rhs) } -> std::same_as<bool>;
+    };
+
+    // Whether applying `Operator` to `lhs` and `rhs` throws
+    template<class Operator, class Lhs>
+    constexpr bool
+    fails(Lhs const& lhs, Variable const& rhs) noexcept {
+        if constexpr (Raising<Operator, Lhs>) {
+            return Operator::fails(lhs, rhs);
+        } else {
+            return false;
+        }
+    }
+
+    template<class Compare>
+    inline constexpr auto is_equality = std::is_same_v<Compare, std::equal_to<>> or
+                                        std::is_same_v<Compare, std::not_equal_to<>>;
+
+    // Python comparison, the result is stored as int 1 or 0 since Variable has no bool. Numbers
+    // compare with numbers and strings with strings, a number is never equal to a string and
+    // ordering one and a string throws.
+    template<class Compare>
+    struct Comparison final {
+        static constexpr Type
+        result(Type, Type) noexcept {
+            return Type::int_;
+        }
+
+        static constexpr bool
+        fails(Variable const& lhs, Variable const& rhs) noexcept
+            requires(not is_equality<Compare>)
+        {
+            return mismatches<Comparison>(lhs, rhs);
+        }
+
+        template<class Lhs, class Rhs>
+            requires(Number<Lhs> == Number<Rhs> or is_equality<Compare>)
+        constexpr int
+        operator()(Lhs const lhs, Rhs const rhs) const noexcept {
+            if constexpr (Number<Lhs> == Number<Rhs>) {
+                return Compare{}(lhs, rhs) ? 1 : 0;
+            } else {
+                return std::is_same_v<Compare, std::not_equal_to<>> ? 1 : 0;
+            }
+        }
+    };
+
+    // Python str.startswith
+    struct StartsWith final {
+        static constexpr Type
+        result(Type, Type) noexcept {
+            return Type::int_;
+        }
+
+        static constexpr bool
+        fails(Variable const& value, Variable const& prefix) noexcept {
+            return mismatches<StartsWith>(value, prefix);
+        }
+
+        constexpr int
+        operator()(String auto const value, String auto const prefix) const noexcept {
+            return value.starts_with(prefix) ? 1 : 0;
+        }
+    };
+
+    // Python str.endswith
+    struct EndsWith final {
+        static constexpr Type
+        result(Type, Type) noexcept {
+            return Type::int_;
+        }
+
+        static constexpr bool
+        fails(Variable const& value, Variable const& suffix) noexcept {
+            return mismatches<EndsWith>(value, suffix);
+        }
+
+        constexpr int
+        operator()(String auto const value, String auto const suffix) const noexcept {
+            return value.ends_with(suffix) ? 1 : 0;
+        }
+    };
+
+    // Position of a Python index into a sequence of `size` elements, negative ones count from the
+    // end and the result is clamped to the sequence like for slices
+    constexpr std::size_t
+    clamp_index(int const index, std::size_t const size) noexcept {
+        auto const signed_size = static_cast<std::ptrdiff_t>(size);
+        auto const position = index < 0 ? signed_size + index : std::ptrdiff_t{index};
+        return static_cast<std::size_t>(std::clamp(position, std::ptrdiff_t{0}, signed_size));
+    }
+
+    // Position of the character a Python index into a str of `size` characters refers to,
+    // negative ones count from the end, nothing if it is past either end
+    constexpr std::optional<std::size_t>
+    character_position(int const index, std::size_t const size) noexcept {
+        auto const signed_size = static_cast<std::ptrdiff_t>(size);
+        auto const position = index < 0 ? signed_size + index : std::ptrdiff_t{index};
+        if (position < 0 or position >= signed_size) {
+            return std::nullopt;
+        }
+        return static_cast<std::size_t>(position);
+    }
+
+    // Python indexing of a str, the character is a view of the indexed string. Indexes past
+    // either end throw like Python raises an IndexError for them.
+    struct Subscript final {
+        static constexpr Type
+        result(Type, Type) noexcept {
+            return Type::string;
+        }
+
+        static constexpr bool
+        fails(Variable const& value, Variable const& index) noexcept {
+            auto const* const string = std::get_if<std::string_view>(&value);
+            auto const* const int_ = std::get_if<int>(&index);
+            return mismatches<Subscript>(value, index) or
+                   (string != nullptr and int_ != nullptr and
+                    not character_position(*int_, string->size()).has_value());
+        }
+
+        constexpr std::string_view
+        operator()(String auto const value, auto const index) const
+            requires is_int<decltype(index)>
+        {
+            auto const position = character_position(index, value.size());
+            if (not position.has_value()) {
+                throw std::out_of_range{"String index out of range"};
+            }
+            return value.substr(*position, 1);
+        }
+    };
+
+    // Applies a binary operator, only visits when one of the operands is not statically typed. The
+    // result stays plainly typed when the operator's result type does not depend on its operands.
+    // Operands the operator does not take throw, see mismatches.
+    template<class Operator>
+    constexpr auto
+    evaluate(Operator const operator_, auto const& lhs, auto const& rhs) {
+        if constexpr (is_variable<decltype(lhs)> || is_variable<decltype(rhs)>) {
+            using Result = TypeOf<Operator::result(Type::variable, Type::variable)>;
+            return visit_variables(
+                    [operator_]<class Lhs, class Rhs>(Lhs const& lhs_, Rhs const& rhs_) -> Result {
+                        if constexpr (std::is_invocable_v<Operator, Lhs, Rhs>) {
+                            return Result{operator_(lhs_, rhs_)};
+                        } else {
+                            return reject_operands<Result>();
+                        }
+                    },
+                    Variable{lhs},
+                    Variable{rhs});
+        } else if constexpr (std::is_invocable_v<Operator, decltype(lhs), decltype(rhs)>) {
+            return operator_(lhs, rhs);
+        } else {
+            return reject_operands<
+                    TypeOf<Operator::result(type_of<decltype(lhs)>(), type_of<decltype(rhs)>())>>();
+        }
+    }
+
+    // Python truth value of a number or string
+    constexpr bool
+    truthy(auto const& value) noexcept {
+        if constexpr (is_variable<decltype(value)>) {
+            return std::visit([](auto const value_) { return truthy(value_); }, value);
+        } else if constexpr (is_string<decltype(value)>) {
+            return not value.empty();
+        } else {
+            return value != 0;
+        }
+    }
+
+    // Python len of a string, which is the only sized value. Numbers have a length of 0 like
+    // empty strings instead of raising a TypeError.
+    constexpr int
+    length(auto const& value) noexcept {
+        if constexpr (is_variable<decltype(value)>) {
+            return std::visit([](auto const value_) { return length(value_); }, value);
+        } else if constexpr (is_string<decltype(value)>) {
+            return static_cast<int>(value.size());
+        } else {
+            return 0;
+        }
+    }
+
+    // Python slice value[begin:end] of a string, a view of it. Slices of numbers or with bounds
+    // other than ints are empty.
+    constexpr std::string_view
+    slice(auto const& value, auto const& begin, auto const& end) noexcept {
+        if constexpr (is_variable<decltype(value)> or is_variable<decltype(begin)> or
+                      is_variable<decltype(end)>) {
+            return visit_variables(
+                    [](auto const value_, auto const begin_, auto const end_) {
+                        return slice(value_, begin_, end_);
+                    },
+                    Variable{value},
+                    Variable{begin},
+                    Variable{end});
+        } else if constexpr (
+                is_string<decltype(value)> and is_int<std::remove_cvref_t<decltype(begin)>> and
+                is_int<std::remove_cvref_t<decltype(end)>>) {
+            auto const first = clamp_index(begin, value.size());
+            auto const last = clamp_index(end, value.size());
+            return first < last ? value.substr(first, last - first) : std::string_view{};
+        } else {
+            return {};
+        }
+    }
+
+    // Hash of a dictionary key, numbers which compare equal hash equally like in Python
+    constexpr std::uint64_t
+    hash_key(auto const& key, std::uint64_t const seed) noexcept {
+        using Key = std::remove_cvref_t<decltype(key)>;
+        if constexpr (is_variable<Key>) {
+            return std::visit([seed](auto const key_) { return hash_key(key_, seed); }, key);
+        } else if constexpr (std::is_floating_point_v<Key>) {
+            if (key >= -0x1p63 and key < 0x1p63 and
+                static_cast<double>(static_cast<std::int64_t>(key)) == key) {
+                return hash(static_cast<std::int64_t>(key), seed);
+            }
+            return hash(std::bit_cast<std::uint64_t>(static_cast<double>(key)), seed);
+        } else {
+            return hash(key, seed);
+        }
+    }
+
+    // Whether two dictionary keys are the same key, which numbers are when they compare equal
+    constexpr bool
+    same_key(auto const& lhs, auto const& rhs) noexcept {
+        return evaluate(Comparison<std::equal_to<>>{}, lhs, rhs) == 1;
+    }
+
+}  // namespace detail
+
+// Python dict of constant keys and values, frozen into a perfect hash table when its function is
+// compiled: a lookup hashes its key once, displaces it by the displacement of its bucket and
+// compares the one entry its slot refers to, without probing or chasing pointers. The arrays are
+// stored next to the functions like the strings they build, see collect_dictionaries.
+struct Dictionary final {
+    std::uint64_t seed = 0;
+    std::span<std::uint64_t const> displacements;  // Of every bucket, see DisplacedLayout
+    std::span<std::size_t const> slots;            // Index of the entry in every slot
+    std::span<std::pair<Variable, Variable> const> entries;  // In the order they were written
+    Type value_type = Type::int_;  // Join of the types of the values
+
+    // Value of `key` if the dictionary contains it
+    [[nodiscard]] constexpr Variable const*
+    find(auto const& key) const noexcept {
+        if (entries.empty()) {
+            return nullptr;
+        }
+        auto const hash = detail::hash_key(key, seed);
+        auto const displacement =
+                displacements[detail::displaced_bucket(hash, displacements.size())];
+        auto const entry = slots[detail::displaced_slot(hash, displacement, slots.size())];
+        if (entry == entries.size() or not detail::same_key(entries[entry].first, key)) {
+            return nullptr;
+        }
+        return &entries[entry].second;
+    }
+
+    // Value of `key`, keys the dictionary does not contain throw like Python raises a KeyError
+    // for them
+    [[nodiscard]] constexpr Variable
+    operator[](auto const& key) const {
+        if (auto const* const value = find(key)) {
+            return *value;
+        }
+        throw std::out_of_range{"Key not in dictionary"};
+    }
+};
+
+namespace detail {
+
+    // Python d[key] on a Dictionary
+    struct Lookup final {
+        static constexpr Type
+        result(Dictionary const& dictionary) noexcept {
+            return dictionary.value_type;
+        }
+
+        static constexpr bool
+        fails(Dictionary const& dictionary, Variable const& key) noexcept {
+            return dictionary.find(key) == nullptr;
+        }
+
+        constexpr Variable
+        operator()(Dictionary const& dictionary, auto const& key) const {
+            return dictionary[key];
+        }
+    };
+
+    // Python key in d on a Dictionary, stored as int 1 or 0 like comparisons
+    struct Contains final {
+        static constexpr Type
+        result(Dictionary const&) noexcept {
+            return Type::int_;
+        }
+
+        constexpr int
+        operator()(Dictionary const& dictionary, auto const& key) const noexcept {
+            return dictionary.find(key) != nullptr ? 1 : 0;
+        }
+    };
+
+}  // namespace detail
+
 struct ReturnOperation final {
     std::size_t stack_index;
 
@@ -53,21 +763,93 @@ struct AssignOperation final {
     operator==(AssignOperation const&) const noexcept = default;
 };
 
-struct AdditionOperation final {
+template<class Operator>
+struct BinaryOperation final {
+    using operator_type = Operator;
+
     std::size_t lhs;
     std::size_t rhs;
     std::size_t target;
 
+    constexpr void
+    operator()(auto& stack) const {
+        stack.variables[target] =
+                detail::evaluate(Operator{}, stack.variables[lhs], stack.variables[rhs]);
+    }
+
+    constexpr bool
+    operator==(BinaryOperation const&) const noexcept = default;
+};
+
+using AdditionOperation = BinaryOperation<detail::Plus>;
+using SubtractionOperation = BinaryOperation<detail::Minus>;
+using MultiplicationOperation = BinaryOperation<detail::Multiplies>;
+using DivisionOperation = BinaryOperation<detail::Divides>;
+using FloorDivisionOperation = BinaryOperation<detail::FloorDivides>;
+using ModuloOperation = BinaryOperation<detail::Modulus>;
+using PowerOperation = BinaryOperation<detail::Power>;
+using EqualOperation = BinaryOperation<detail::Comparison<std::equal_to<>>>;
+using NotEqualOperation = BinaryOperation<detail::Comparison<std::not_equal_to<>>>;
+using LessOperation = BinaryOperation<detail::Comparison<std::less<>>>;
+using LessEqualOperation = BinaryOperation<detail::Comparison<std::less_equal<>>>;
+using GreaterOperation = BinaryOperation<detail::Comparison<std::greater<>>>;
+using GreaterEqualOperation = BinaryOperation<detail::Comparison<std::greater_equal<>>>;
+using StartsWithOperation = BinaryOperation<detail::StartsWith>;
+using EndsWithOperation = BinaryOperation<detail::EndsWith>;
+using SubscriptOperation = BinaryOperation<detail::Subscript>;
+
+// Stores the length of the string at `from` to `to`
+struct LengthOperation final {
+    std::size_t from;
+    std::size_t to;
+
     constexpr void
     operator()(auto& stack) const noexcept {
-        stack.variables[target] = std::visit(
-                [](auto&& lhs_, auto&& rhs_) { return Variable{lhs_ + rhs_}; },
-                stack.variables[lhs],
-                stack.variables[rhs]);
+        stack.variables[to] = detail::length(stack.variables[from]);
+    }
+
+    constexpr bool
+    operator==(LengthOperation const&) const noexcept = default;
+};
+
+// Probes `dictionary`, a Dictionary stored as long as the function, with the value at `key` and
+// stores the result to `target`
+template<class Probe>
+struct DictionaryOperation final {
+    using probe_type = Probe;
+
+    std::size_t key;
+    Dictionary const* dictionary;
+    std::size_t target;
+
+    constexpr void
+    operator()(auto& stack) const noexcept(not detail::Raising<Probe, Dictionary>) {
+        stack.variables[target] = Probe{}(*dictionary, stack.variables[key]);
     }
 
     constexpr bool
-    operator==(AdditionOperation const&) const noexcept = default;
+    operator==(DictionaryOperation const&) const noexcept = default;
+};
+
+using LookupOperation = DictionaryOperation<detail::Lookup>;
+using ContainsOperation = DictionaryOperation<detail::Contains>;
+
+// Stores the slice [begin:end] of the string at `value` to `target`, the bounds are the values at
+// `begin` and `end`
+struct SliceOperation final {
+    std::size_t value;
+    std::size_t begin;
+    std::size_t end;
+    std::size_t target;
+
+    constexpr void
+    operator()(auto& stack) const noexcept {
+        auto& variables = stack.variables;
+        variables[target] = detail::slice(variables[value], variables[begin], variables[end]);
+    }
+
+    constexpr bool
+    operator==(SliceOperation const&) const noexcept = default;
 };
 
 struct ConstantOperation final {
@@ -83,12 +865,286 @@ struct ConstantOperation final {
     operator==(ConstantOperation const&) const noexcept = default;
 };
 
-using Operation =
-        std::variant<AdditionOperation, AssignOperation, ConstantOperation, ReturnOperation>;
+inline constexpr auto max_call_arguments = std::size_t{4};
+
+// Calls the module function at index `function` with the values at the first `arguments_count`
+// `arguments` and stores its return value to `target`
+struct CallOperation final {
+    std::size_t function;
+    std::array<std::size_t, max_call_arguments> arguments;
+    std::size_t arguments_count;
+    std::size_t target;
+
+    constexpr bool
+    operator==(CallOperation const&) const noexcept = default;
+};
+
+// Continues with the operation at `target`
+struct JumpOperation final {
+    std::size_t target;
+
+    constexpr bool
+    operator==(JumpOperation const&) const noexcept = default;
+};
+
+// Continues with the operation at `target` if the value at `condition` is falsy, with the next
+// operation otherwise
+struct BranchOperation final {
+    std::size_t condition;
+    std::size_t target;
+
+    constexpr bool
+    operator==(BranchOperation const&) const noexcept = default;
+};
+
+// Stores the value at `if_true` to `target` if the value at `condition` is truthy and the value
+// at `if_false` otherwise. Both values are computed in front of it, so it needs no branch and
+// becomes a conditional move or a blend of vectors.
+struct SelectOperation final {
+    std::size_t condition;
+    std::size_t if_true;
+    std::size_t if_false;
+    std::size_t target;
+
+    constexpr void
+    operator()(auto& stack) const noexcept {
+        auto& variables = stack.variables;
+        variables[target] = detail::truthy(variables[condition]) ? variables[if_true]
+                                                                   : variables[if_false];
+    }
+
+    constexpr bool
+    operator==(SelectOperation const&) const noexcept = default;
+};
+
+// Suspends a generator, which produces the value at `stack_index`, see Generator
+struct YieldOperation final {
+    std::size_t stack_index;
+
+    constexpr bool
+    operator==(YieldOperation const&) const noexcept = default;
+};
+
+// Marks where the statement of the following operations starts, `lexeme` indexes the lexemes of
+// the whole source. Only emitted when profiling and removed again before a Function is built.
+struct LocationOperation final {
+    std::size_t lexeme;
+
+    constexpr bool
+    operator==(LocationOperation const&) const noexcept = default;
+};
 
-template<std::size_t stack_size, std::size_t parameters_count, std::size_t operation_count>
+using Operation = std::variant<
+        AdditionOperation,
+        AssignOperation,
+        BranchOperation,
+        CallOperation,
+        ConstantOperation,
+        ContainsOperation,
+        DivisionOperation,
+        EndsWithOperation,
+        EqualOperation,
+        FloorDivisionOperation,
+        GreaterEqualOperation,
+        GreaterOperation,
+        JumpOperation,
+        LengthOperation,
+        LessEqualOperation,
+        LessOperation,
+        LocationOperation,
+        LookupOperation,
+        ModuloOperation,
+        MultiplicationOperation,
+        NotEqualOperation,
+        PowerOperation,
+        ReturnOperation,
+        SelectOperation,
+        SliceOperation,
+        StartsWithOperation,
+        SubscriptOperation,
+        SubtractionOperation,
+        YieldOperation>;
+
+namespace detail {
+
+    template<class>
+    inline constexpr auto is_binary_operation = false;
+
+    template<class Operator>
+    inline constexpr auto is_binary_operation<BinaryOperation<Operator>> = true;
+
+    template<class>
+    inline constexpr auto is_dictionary_operation = false;
+
+    template<class Probe>
+    inline constexpr auto is_dictionary_operation<DictionaryOperation<Probe>> = true;
+
+    template<class T>
+    inline constexpr auto is_control_operation =
+            std::is_same_v<T, JumpOperation> or std::is_same_v<T, BranchOperation>;
+
+    // Resolves the CallOperations of functions outside of a module, which never contain any
+    struct NoCallees final {
+        [[noreturn]] Variable
+        operator()(std::size_t, std::span<Variable const>) const noexcept {
+            std::unreachable();
+        }
+    };
+
+    inline constexpr auto no_callees = NoCallees{};
+
+    // Passes the arguments of `operation` to `callees` and returns the result
+    constexpr Variable
+    call(CallOperation const& operation, auto const& variables, auto const& callees) {
+        auto arguments = std::array<Variable, max_call_arguments>{};
+        for (auto i = std::size_t{0}; i < operation.arguments_count; ++i) {
+            arguments[i] = Variable{variables[operation.arguments[i]]};
+        }
+        return callees(
+                operation.function,
+                std::span<Variable const>{arguments}.first(operation.arguments_count));
+    }
+
+    // Runs `operation` and returns the index of the operation to run next, a return continues
+    // past the last operation
+    template<class T>
+    constexpr std::size_t
+    step(T const& operation,
+         auto& stack,
+         auto const& callees,
+         std::size_t const index,
+         std::size_t const operation_count) {
+        if constexpr (std::is_same_v<T, JumpOperation>) {
+            return operation.target;
+        } else if constexpr (std::is_same_v<T, BranchOperation>) {
+            return truthy(stack.variables[operation.condition]) ? index + 1 : operation.target;
+        } else if constexpr (std::is_same_v<T, CallOperation>) {
+            stack.variables[operation.target] = call(operation, stack.variables, callees);
+            return index + 1;
+        } else if constexpr (std::is_same_v<T, YieldOperation>) {
+            return index + 1;  // Only a Generator suspends
+        } else if constexpr (std::is_same_v<T, LocationOperation>) {
+            return index + 1;
+        } else {
+            std::invoke(operation, stack);
+            return std::is_same_v<T, ReturnOperation> ? operation_count : index + 1;
+        }
+    }
+
+    template<auto signature, class... Parameters>
+    constexpr bool
+    accepts_arguments() noexcept {
+        if constexpr (sizeof...(Parameters) != signature.size()) {
+            return true;  // Reported as wrong number of parameters
+        } else {
+            return [&]<std::size_t... I>(std::index_sequence<I...>) {
+                return (accepts(signature[I], type_of<Parameters>()) and ...);
+            }(std::index_sequence_for<Parameters...>{});
+        }
+    }
+
+    template<class StackType, auto signature, class... Parameters>
+    constexpr auto
+    make_stack(Parameters&&... parameters) {
+        static_assert(
+                sizeof...(parameters) == signature.size(), "Wrong number of parameters passed");
+        static_assert(
+                accepts_arguments<signature, Parameters...>(),
+                "Argument does not match the parameter annotation");
+        auto stack = StackType{};
+        [&stack]<std::size_t... I>(auto&& parameters, std::index_sequence<I...> const indexes) {
+            ((std::get<I>(stack.variables) = annotate<signature[I]>(std::get<I>(parameters))),
+             ...);
+        }(std::tuple{std::forward<Parameters>(parameters)...},
+          std::make_index_sequence<signature.size()>{});
+        return stack;
+    }
+
+}  // namespace detail
+
+// Execution policies of a Function: Unprofiled only runs the operations, Profiled also counts how
+// often every operation runs and how long it takes, see profile.h
+struct Unprofiled final {};
+struct Profiled final {};
+
+// Line and column of the statement an operation was compiled from, both counted from 1
+struct SourceLocation final {
+    std::size_t line = 0;
+    std::size_t column = 0;
+
+    constexpr bool
+    operator==(SourceLocation const&) const noexcept = default;
+};
+
+struct OperationCounters final {
+    std::uint64_t hits = 0;
+    std::chrono::steady_clock::duration time = {};
+};
+
+template<std::size_t operation_count>
+using ProfileCounters = std::array<OperationCounters, operation_count>;
+
+namespace detail {
+
+    // What a Function stores for its policy, nothing unless it is profiled
+    template<class Policy, std::size_t operation_count>
+    struct ProfileData final {
+        constexpr bool
+        operator==(ProfileData const&) const noexcept = default;
+    };
+
+    // The counters live outside of the Function since functions are constants, runs at compile
+    // time and functions without counters are not recorded
+    template<std::size_t operation_count>
+    struct ProfileData<Profiled, operation_count> final {
+        std::array<SourceLocation, operation_count> locations = {};
+        ProfileCounters<operation_count>* counters = nullptr;
+
+        constexpr bool
+        operator==(ProfileData const&) const noexcept = default;
+    };
+
+    // Runs `execute` for the operation at `index` and records it in `profile`, returns what
+    // `execute` returns
+    template<std::size_t operation_count>
+    constexpr auto
+    record(ProfileData<Profiled, operation_count> const& profile,
+           std::size_t const index,
+           auto&& execute) {
+        if consteval {
+            return execute();
+        } else {
+            if (profile.counters == nullptr) {
+                return execute();
+            }
+            auto const start = std::chrono::steady_clock::now();
+            auto const result = execute();
+            auto& counters = (*profile.counters)[index];
+            ++counters.hits;
+            counters.time += std::chrono::steady_clock::now() - start;
+            return result;
+        }
+    }
+
+    // Runs `execute` for the operation at `index`, recorded if `profile` belongs to a Profiled
+    // function and nothing more than the call otherwise
+    template<class Policy, std::size_t operation_count>
+    constexpr auto
+    record(ProfileData<Policy, operation_count> const&, std::size_t, auto&& execute) {
+        return execute();
+    }
+
+}  // namespace detail
+
+template<
+        std::size_t stack_size,
+        std::size_t parameters_count,
+        std::size_t operation_count,
+        Signature<parameters_count> signature = {},
+        class Policy = Unprofiled>
 struct Function final {
     std::array<Operation, operation_count> operations;
+    [[no_unique_address]] detail::ProfileData<Policy, operation_count> profile = {};
 
     template<class... Operations>
     explicit constexpr Function(Operations const&... operations) noexcept
@@ -97,22 +1153,403 @@ struct Function final {
 
     template<class... Parameters>
     constexpr auto
-    operator()(Parameters&&... parameters) const noexcept {
-        static_assert(
-                sizeof...(parameters) == parameters_count, "Wrong number of parameters passed");
+    operator()(Parameters&&... parameters) const {
+        auto stack = detail::make_stack<Stack<stack_size>, signature>(
+                std::forward<Parameters>(parameters)...);
+        return run(stack, detail::no_callees);
+    }
+
+    // Runs the function with CallOperations resolved by `callees`, which is called with the index
+    // of the callee and the arguments
+    constexpr Variable
+    call(auto const& callees, std::span<Variable const> const arguments) const {
         auto stack = Stack<stack_size>{};
-        [&stack]<std::size_t... I>(auto&& parameters, std::index_sequence<I...> const indexes) {
-            ((std::get<I>(stack.variables) = std::get<I>(parameters)), ...);
-        }(std::tuple{std::forward<Parameters>(parameters)...},
-          std::make_index_sequence<parameters_count>{});
+        std::ranges::transform(
+                arguments, signature, stack.variables.begin(), [](auto const& argument, auto type) {
+                    return detail::annotate(type, argument);
+                });
+        return run(stack, callees);
+    }
+
+    constexpr bool
+    operator==(Function const&) const noexcept = default;
+
+  private:
+    constexpr Variable
+    run(Stack<stack_size>& stack, auto const& callees) const {
+        for (auto index = std::size_t{0}; index < operation_count;) {
+            index = detail::record(profile, index, [&] {
+                return std::visit(
+                        [&](auto const& operation_) {
+                            return detail::step(
+                                    operation_, stack, callees, index, operation_count);
+                        },
+                        operations[index]);
+            });
+        }
+        return std::move(stack.return_value);
+    }
+};
+
+namespace detail {
+
+    template<class>
+    struct FunctionTraits;
+
+    template<
+            std::size_t stack_size_,
+            std::size_t parameters_count_,
+            std::size_t operation_count_,
+            Signature<parameters_count_> signature_,
+            class Policy>
+    struct FunctionTraits<
+            Function<stack_size_, parameters_count_, operation_count_, signature_, Policy>>
+            final {
+        static constexpr auto stack_size = stack_size_;
+        static constexpr auto parameters_count = parameters_count_;
+        static constexpr auto operation_count = operation_count_;
+        static constexpr auto signature = signature_;
+        using policy = Policy;
+    };
+
+    // Types of the parameter slots, annotated parameters take the annotated type and the others
+    // the type of the argument at the call site
+    template<auto signature, class... Parameters>
+    constexpr auto
+    parameter_types() noexcept {
+        return []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<Type, sizeof...(Parameters)>{
+                    (I < signature.size() and signature[I] != Type::empty
+                             ? signature[I]
+                             : type_of<Parameters>())...};
+        }(std::index_sequence_for<Parameters...>{});
+    }
+
+    template<std::size_t stack_size>
+    struct TypeLayout final {
+        Type return_value = Type::empty;
+        std::array<Type, stack_size> variables = {};
+
+        constexpr bool
+        operator==(TypeLayout const&) const noexcept = default;
+    };
+
+    // Value of a plain type, to ask an operator whether it takes values of that type
+    constexpr Variable
+    value_of(Type const type) noexcept {
+        return type == Type::double_  ? Variable{0.0}
+               : type == Type::string ? Variable{std::string_view{}}
+                                      : Variable{0};
+    }
+
+    // Assigns every slot the join of all types ever written to it, iterated to a fixpoint so
+    // that reads observe the slot's final type. Binary operations on plain types their operator
+    // does not take are rejected, they could only throw.
+    template<std::size_t stack_size>
+    constexpr TypeLayout<stack_size>
+    infer_types(
+            std::span<Operation const> const operations,
+            std::span<Type const> const parameters) {
+        auto layout = TypeLayout<stack_size>{};
+        std::ranges::copy(parameters, layout.variables.begin());
+        auto const read = [&layout](std::size_t const index) {
+            auto const type = layout.variables[index];
+            return type == Type::empty ? Type::int_ : type;
+        };
+        auto changed = true;
+        while (changed) {
+            auto const previous = layout;
+            for (auto const& operation: operations) {
+                std::visit(
+                        [&]<class T>(T const& operation) {
+                            if constexpr (is_binary_operation<T>) {
+                                layout.variables[operation.target] = join(
+                                        layout.variables[operation.target],
+                                        T::operator_type::result(
+                                                read(operation.lhs), read(operation.rhs)));
+                            } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                                layout.variables[operation.to] =
+                                        join(layout.variables[operation.to], read(operation.from));
+                            } else if constexpr (std::is_same_v<T, CallOperation>) {
+                                // Callees return Variables
+                                layout.variables[operation.target] = Type::variable;
+                            } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+                                layout.variables[operation.index] = join(
+                                        layout.variables[operation.index],
+                                        type_of(operation.value));
+                            } else if constexpr (std::is_same_v<T, ReturnOperation>) {
+                                layout.return_value =
+                                        join(layout.return_value, read(operation.stack_index));
+                            } else if constexpr (std::is_same_v<T, SelectOperation>) {
+                                layout.variables[operation.target] = join(
+                                        layout.variables[operation.target],
+                                        join(read(operation.if_true), read(operation.if_false)));
+                            } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                                layout.variables[operation.to] =
+                                        join(layout.variables[operation.to], Type::int_);
+                            } else if constexpr (std::is_same_v<T, SliceOperation>) {
+                                layout.variables[operation.target] =
+                                        join(layout.variables[operation.target], Type::string);
+                            } else if constexpr (is_dictionary_operation<T>) {
+                                layout.variables[operation.target] = join(
+                                        layout.variables[operation.target],
+                                        T::probe_type::result(*operation.dictionary));
+                            }
+                        },
+                        operation);
+            }
+            changed = layout != previous;
+        }
         for (auto const& operation: operations) {
-            std::visit([&](auto&& operation_) { std::invoke(operation_, stack); }, operation);
+            std::visit(
+                    [&]<class T>(T const& operation) {
+                        if constexpr (is_binary_operation<T>) {
+                            auto const lhs = read(operation.lhs);
+                            auto const rhs = read(operation.rhs);
+                            if (lhs != Type::variable and rhs != Type::variable and
+                                mismatches<typename T::operator_type>(
+                                        value_of(lhs), value_of(rhs))) {
+                                throw std::invalid_argument{"Unsupported operand types"};
+                            }
+                        }
+                    },
+                    operation);
+        }
+        return layout;
+    }
+
+    template<auto const& layout, std::size_t... I>
+    constexpr auto
+    make_typed_stack(std::index_sequence<I...>) noexcept {
+        // A function without a return operation returns an empty Variable like Function does
+        using Return = std::conditional_t<
+                layout.return_value == Type::empty,
+                Variable,
+                TypeOf<layout.return_value>>;
+        return TypedStack<Return, TypeOf<layout.variables[I]>...>{};
+    }
+
+    // Runs the operation at `index` on the typed stack with all slot indices resolved at compile
+    // time, so plainly typed slots compile down to native arithmetic. Returns whether the function
+    // continues after the operation.
+    template<auto const& function, auto const& callees, std::size_t index>
+    constexpr bool
+    execute_lowered(auto& stack) {
+        constexpr auto const& operation_variant = function.operations[index];
+        constexpr auto const& operation = std::get<operation_variant.index()>(operation_variant);
+        using T = std::remove_cvref_t<decltype(operation)>;
+        static_assert(
+                not std::is_same_v<T, YieldOperation>, "Generators can only be interpreted");
+        auto& variables = stack.variables;
+        if constexpr (is_binary_operation<T>) {
+            std::get<operation.target>(variables) = evaluate(
+                    typename T::operator_type{},
+                    std::get<operation.lhs>(variables),
+                    std::get<operation.rhs>(variables));
+        } else if constexpr (std::is_same_v<T, AssignOperation>) {
+            std::get<operation.to>(variables) = std::get<operation.from>(variables);
+        } else if constexpr (std::is_same_v<T, CallOperation>) {
+            auto const arguments = [&variables]<std::size_t... I>(std::index_sequence<I...>) {
+                return std::array<Variable, sizeof...(I)>{
+                        Variable{std::get<operation.arguments[I]>(variables)}...};
+            }(std::make_index_sequence<operation.arguments_count>{});
+            std::get<operation.target>(variables) = callees(operation.function, arguments);
+        } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+            auto& variable = std::get<operation.index>(variables);
+            if constexpr (is_variable<decltype(variable)>) {
+                variable = operation.value;
+            } else {
+                variable = std::get<std::remove_cvref_t<decltype(variable)>>(operation.value);
+            }
+        } else if constexpr (std::is_same_v<T, ReturnOperation>) {
+            stack.return_value = std::get<operation.stack_index>(variables);
+            return false;
+        } else if constexpr (std::is_same_v<T, SelectOperation>) {
+            auto& target = std::get<operation.target>(variables);
+            using Target = std::remove_cvref_t<decltype(target)>;
+            target = truthy(std::get<operation.condition>(variables))
+                             ? Target{std::get<operation.if_true>(variables)}
+                             : Target{std::get<operation.if_false>(variables)};
+        } else if constexpr (std::is_same_v<T, LengthOperation>) {
+            std::get<operation.to>(variables) = length(std::get<operation.from>(variables));
+        } else if constexpr (std::is_same_v<T, SliceOperation>) {
+            std::get<operation.target>(variables) = slice(
+                    std::get<operation.value>(variables),
+                    std::get<operation.begin>(variables),
+                    std::get<operation.end>(variables));
+        } else if constexpr (is_dictionary_operation<T>) {
+            auto& target = std::get<operation.target>(variables);
+            using Target = std::remove_cvref_t<decltype(target)>;
+            auto const value = typename T::probe_type{}(
+                    *operation.dictionary, std::get<operation.key>(variables));
+            if constexpr (is_variable<Target> or not is_variable<decltype(value)>) {
+                target = value;
+            } else {
+                // All values are of the target's type
+                target = std::get<Target>(value);
+            }
+        }
+        return true;
+    }
+
+    enum class SegmentKind { straight, loop, branch };
+
+    // Structured piece of the operations starting at some index: a run without control flow, a
+    // loop as emitted for while and for statements, or a conditional with an optional else block
+    struct Segment final {
+        SegmentKind kind;
+        std::size_t branch;      // BranchOperation deciding whether the loop or then block runs,
+                                 // the jump back for loops only left by returning
+        std::size_t then_end;    // End of the loop body or then block
+        std::size_t else_begin;  // Begin of the else block, equals `end` without one
+        std::size_t end;         // First operation after the segment
+    };
+
+    // Index of the jump back to `header` if a loop starts there
+    constexpr std::optional<std::size_t>
+    find_loop_end(
+            std::span<Operation const> const operations,
+            std::size_t const header,
+            std::size_t const end) noexcept {
+        for (auto index = header + 1; index < end; ++index) {
+            auto const* const jump = std::get_if<JumpOperation>(&operations[index]);
+            if (jump != nullptr and jump->target == header) {
+                return index;
+            }
+        }
+        return std::nullopt;
+    }
+
+    constexpr Segment
+    find_segment(
+            std::span<Operation const> const operations,
+            std::size_t const begin,
+            std::size_t const end) {
+        if (auto const loop_end = find_loop_end(operations, begin, end); loop_end.has_value()) {
+            for (auto index = begin; index < *loop_end; ++index) {
+                auto const* const branch = std::get_if<BranchOperation>(&operations[index]);
+                if (branch != nullptr and branch->target == *loop_end + 1) {
+                    return {SegmentKind::loop, index, *loop_end, *loop_end, *loop_end + 1};
+                }
+            }
+            return {SegmentKind::loop, *loop_end, *loop_end, *loop_end, *loop_end + 1};
+        } else if (auto const* const branch = std::get_if<BranchOperation>(&operations[begin])) {
+            auto const target = branch->target;
+            auto const* const jump = target - 1 > begin
+                                             ? std::get_if<JumpOperation>(&operations[target - 1])
+                                             : nullptr;
+            if (jump != nullptr and jump->target >= target and jump->target <= end) {
+                return {SegmentKind::branch, begin, target - 1, target, jump->target};
+            }
+            return {SegmentKind::branch, begin, target, target, target};
+        } else if (std::holds_alternative<JumpOperation>(operations[begin])) {
+            throw "Unstructured jump";  // NOLINT(*-exception-baseclass)
+        }
+        auto index = begin + 1;
+        while (index < end and not std::holds_alternative<JumpOperation>(operations[index]) and
+               not std::holds_alternative<BranchOperation>(operations[index]) and
+               not find_loop_end(operations, index, end).has_value()) {
+            ++index;
         }
+        return {SegmentKind::straight, begin, index, index, index};
+    }
+
+    // Runs the operations in [begin, end) with runs of plain operations expanded by a fold
+    // expression and loops and conditionals turned back into C++ loops and conditionals. Returns
+    // whether the function continues after the range.
+    template<auto const& function, auto const& callees, std::size_t begin, std::size_t end>
+    constexpr bool
+    execute_range(auto& stack) {
+        if constexpr (begin == end) {
+            return true;
+        } else {
+            constexpr auto segment = find_segment(function.operations, begin, end);
+            constexpr auto const& operation_variant = function.operations[segment.branch];
+            if constexpr (segment.kind == SegmentKind::straight) {
+                auto const continues = [&stack]<std::size_t... I>(std::index_sequence<I...>) {
+                    return (record(function.profile,
+                                   begin + I,
+                                   [&stack] {
+                                       return execute_lowered<function, callees, begin + I>(
+                                               stack);
+                                   }) and
+                            ...);
+                }(std::make_index_sequence<segment.end - begin>{});
+                if (not continues) {
+                    return false;
+                }
+            } else if constexpr (segment.kind == SegmentKind::loop and
+                                 segment.branch == segment.then_end) {
+                while (execute_range<function, callees, begin, segment.then_end>(stack)) {
+                }
+                return false;
+            } else if constexpr (segment.kind == SegmentKind::loop) {
+                constexpr auto condition = std::get<BranchOperation>(operation_variant).condition;
+                while (true) {
+                    if (not execute_range<function, callees, begin, segment.branch>(stack)) {
+                        return false;
+                    } else if (not truthy(std::get<condition>(stack.variables))) {
+                        break;
+                    } else if (not execute_range<
+                                       function,
+                                       callees,
+                                       segment.branch + 1,
+                                       segment.then_end>(stack)) {
+                        return false;
+                    }
+                }
+            } else {
+                constexpr auto condition = std::get<BranchOperation>(operation_variant).condition;
+                auto const continues =
+                        truthy(std::get<condition>(stack.variables))
+                                ? execute_range<function, callees, begin + 1, segment.then_end>(
+                                          stack)
+                                : execute_range<
+                                          function,
+                                          callees,
+                                          segment.else_begin,
+                                          segment.end>(stack);
+                if (not continues) {
+                    return false;
+                }
+            }
+            return execute_range<function, callees, segment.end, end>(stack);
+        }
+    }
+
+}  // namespace detail
+
+// Function whose operations are lowered into a compile-time sequence: every operation becomes its
+// own template instantiation and the sequence is expanded with a fold expression, so a call is
+// straight-line code apart from loops and conditionals, which become native C++ loops and
+// conditionals. Slot types are inferred from the operations and the parameter annotations, or the
+// argument types at the call site for parameters without annotation, so the stack holds plain
+// values instead of Variables wherever possible. CallOperations are resolved by `callees` like in
+// Function::call. A Profiled function records every operation but its branches and jumps, which
+// became the native control flow.
+template<auto const& function, auto const& callees = detail::no_callees>
+struct LoweredFunction final {
+    using Traits = detail::FunctionTraits<std::remove_cvref_t<decltype(function)>>;
+
+    template<class... Parameters>
+    static constexpr auto layout = detail::infer_types<Traits::stack_size>(
+            function.operations, detail::parameter_types<Traits::signature, Parameters...>());
+
+    template<class... Parameters>
+    using StackType = decltype(detail::make_typed_stack<layout<Parameters...>>(
+            std::make_index_sequence<Traits::stack_size>{}));
+
+    template<class... Parameters>
+    constexpr auto
+    operator()(Parameters&&... parameters) const {
+        auto stack = detail::make_stack<StackType<Parameters...>, Traits::signature>(
+                std::forward<Parameters>(parameters)...);
+        detail::execute_range<function, callees, 0, Traits::operation_count>(stack);
         return std::move(stack.return_value);
     }
 
     constexpr bool
-    operator==(Function const&) const noexcept = default;
+    operator==(LoweredFunction const&) const noexcept = default;
 };
 
 }  // namespace ctpy
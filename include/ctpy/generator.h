@@ -0,0 +1,121 @@
+#pragma once
+
+#include "function.h"
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace ctpy {
+
+// Python generator compiled to a state machine: the stack of its function and the index of the
+// operation to resume at are the whole state, so a generator is a plain value without any frame
+// allocated for it. Every resumption runs the operations up to the next YieldOperation. A
+// generator is an input range of the values it yields.
+template<auto const& function, auto const& callees = detail::no_callees>
+class Generator final {
+    using Traits = detail::FunctionTraits<std::remove_cvref_t<decltype(function)>>;
+
+  public:
+    class iterator final {
+      public:
+        using value_type = Variable;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        constexpr explicit iterator(Generator& generator)
+            : generator{&generator},
+              value{generator.next()} {
+        }
+
+        constexpr Variable const&
+        operator*() const noexcept {
+            return *value;
+        }
+
+        constexpr iterator&
+        operator++() {
+            value = generator->next();
+            return *this;
+        }
+
+        constexpr void
+        operator++(int) {
+            ++*this;
+        }
+
+        constexpr bool
+        operator==(std::default_sentinel_t) const noexcept {
+            return not value.has_value();
+        }
+
+      private:
+        Generator* generator = nullptr;
+        std::optional<Variable> value;
+    };
+
+    constexpr explicit Generator(Stack<Traits::stack_size> const& stack) noexcept : stack{stack} {
+    }
+
+    // Resumes until the next yield and returns its value, nothing once the generator returned
+    constexpr std::optional<Variable>
+    next() {
+        while (index < Traits::operation_count) {
+            auto const& operation = function.operations[index];
+            if (auto const* const yield = std::get_if<YieldOperation>(&operation)) {
+                ++index;
+                return stack.variables[yield->stack_index];
+            }
+            index = detail::record(function.profile, index, [this, &operation] {
+                return std::visit(
+                        [this](auto const& operation_) {
+                            return detail::step(
+                                    operation_, stack, callees, index, Traits::operation_count);
+                        },
+                        operation);
+            });
+        }
+        return std::nullopt;
+    }
+
+    // Starts the iteration, which resumes the generator like next()
+    constexpr iterator
+    begin() {
+        return iterator{*this};
+    }
+
+    constexpr std::default_sentinel_t
+    end() const noexcept {
+        return {};
+    }
+
+    constexpr bool
+    operator==(Generator const&) const noexcept = default;
+
+  private:
+    Stack<Traits::stack_size> stack;
+    std::size_t index = 0;
+};
+
+// Function containing yields, calling it binds the arguments to a new Generator without running
+// any of its operations
+template<auto const& function, auto const& callees = detail::no_callees>
+struct GeneratorFunction final {
+    using Traits = detail::FunctionTraits<std::remove_cvref_t<decltype(function)>>;
+
+    template<class... Parameters>
+    constexpr Generator<function, callees>
+    operator()(Parameters&&... parameters) const {
+        return Generator<function, callees>{
+                detail::make_stack<Stack<Traits::stack_size>, Traits::signature>(
+                        std::forward<Parameters>(parameters)...)};
+    }
+
+    constexpr bool
+    operator==(GeneratorFunction const&) const noexcept = default;
+};
+
+}  // namespace ctpy
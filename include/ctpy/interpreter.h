@@ -0,0 +1,695 @@
+#pragma once
+
+#include "function.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ctpy {
+
+enum class Opcode : std::uint8_t {
+    add,            // [c] = [a] + [b]
+    subtract,       // [c] = [a] - [b]
+    multiply,       // [c] = [a] * [b]
+    divide,         // [c] = [a] / [b]
+    floor_divide,   // [c] = [a] // [b]
+    modulo,         // [c] = [a] % [b]
+    power,          // [c] = [a] ** [b]
+    assign,         // [b] = [a]
+    constant,       // [b] = constants[a]
+    return_,        // return [a]
+    equal,          // [c] = [a] == [b]
+    not_equal,      // [c] = [a] != [b]
+    less,           // [c] = [a] < [b]
+    less_equal,     // [c] = [a] <= [b]
+    greater,        // [c] = [a] > [b]
+    greater_equal,  // [c] = [a] >= [b]
+    jump,           // continue at instruction a
+    branch,         // continue at instruction b if [a] is falsy
+    select,         // [c] = [b] if [a] is truthy
+    starts_with,    // [c] = [a].startswith([b])
+    ends_with,      // [c] = [a].endswith([b])
+    subscript,      // [c] = [a][[b]]
+    length,         // [b] = len([a])
+    slice,          // [c] = [a][[b]:[b + 1]]
+    lookup,         // [c] = dictionaries[b][[a]]
+    contains,       // [c] = [a] in dictionaries[b]
+    call,           // [c] = functions[a]([b], [b + 1], ...)
+    // Superinstructions for common operation pairs
+    add_constant,     // [c] = [a] + constants[b]
+    add_return,       // return [a] + [b]
+    constant_return,  // return constants[a]
+};
+
+// Flat bytecode instruction, operands are stack, constant pool or dictionary indexes depending on
+// the opcode
+struct Instruction final {
+    Opcode opcode;
+    std::uint16_t a = 0;
+    std::uint16_t b = 0;
+    std::uint16_t c = 0;
+
+    constexpr bool
+    operator==(Instruction const&) const noexcept = default;
+};
+
+// Bytecode of a function compiled at run time, wherever its arrays are stored
+struct RuntimeFunctionView final {
+    std::span<Instruction const> instructions;
+    std::span<Variable const> constants;
+    std::size_t stack_size = 0;
+    std::size_t parameters_count = 0;
+    std::span<Type const> signature;  // Parameter annotations, empty when there are none
+    std::span<Dictionary const* const> dictionaries;
+    std::span<RuntimeFunctionView const> functions;  // Callees of calls, empty when there are none
+
+    Variable
+    operator()(std::span<Variable const> parameters) const;
+
+    template<class... Parameters>
+    Variable
+    operator()(Parameters&&... parameters) const {
+        auto const variables =
+                std::array<Variable, sizeof...(Parameters)>{Variable{parameters}...};
+        return (*this)(std::span<Variable const>{variables});
+    }
+};
+
+// Function compiled at run time from a source only known at run time
+struct RuntimeFunction final {
+    std::vector<Instruction> instructions;
+    std::vector<Variable> constants;
+    std::size_t stack_size = 0;
+    std::size_t parameters_count = 0;
+    std::vector<Type> signature;  // Parameter annotations, empty when there are none
+    std::vector<Dictionary const*> dictionaries;  // Owned by a RuntimeModule
+
+    [[nodiscard]] RuntimeFunctionView
+    view() const noexcept {
+        return {instructions, constants, stack_size, parameters_count, signature, dictionaries, {}};
+    }
+
+    Variable
+    operator()(std::span<Variable const> const parameters) const {
+        return view()(parameters);
+    }
+
+    template<class... Parameters>
+    Variable
+    operator()(Parameters&&... parameters) const {
+        return view()(std::forward<Parameters>(parameters)...);
+    }
+};
+
+namespace detail {
+
+    constexpr std::uint16_t
+    narrow_operand(std::size_t const operand) {
+        if (operand > std::numeric_limits<std::uint16_t>::max()) {
+            throw std::length_error{"Function too large for bytecode operands"};
+        }
+        return static_cast<std::uint16_t>(operand);
+    }
+
+    constexpr std::uint16_t
+    intern_constant(std::vector<Variable>& constants, Variable const& value) {
+        auto const existing = std::ranges::find(constants, value);
+        if (existing == constants.end()) {
+            constants.push_back(value);
+            return narrow_operand(constants.size() - 1);
+        }
+        return narrow_operand(static_cast<std::size_t>(existing - constants.begin()));
+    }
+
+    constexpr std::uint16_t
+    intern_dictionary(std::vector<Dictionary const*>& dictionaries, Dictionary const* dictionary) {
+        auto const existing = std::ranges::find(dictionaries, dictionary);
+        if (existing == dictionaries.end()) {
+            dictionaries.push_back(dictionary);
+            return narrow_operand(dictionaries.size() - 1);
+        }
+        return narrow_operand(static_cast<std::size_t>(existing - dictionaries.begin()));
+    }
+
+    template<class Operator>
+    constexpr Opcode
+    binary_opcode() noexcept {
+        if constexpr (std::is_same_v<Operator, Plus>) {
+            return Opcode::add;
+        } else if constexpr (std::is_same_v<Operator, Minus>) {
+            return Opcode::subtract;
+        } else if constexpr (std::is_same_v<Operator, Multiplies>) {
+            return Opcode::multiply;
+        } else if constexpr (std::is_same_v<Operator, Divides>) {
+            return Opcode::divide;
+        } else if constexpr (std::is_same_v<Operator, FloorDivides>) {
+            return Opcode::floor_divide;
+        } else if constexpr (std::is_same_v<Operator, Modulus>) {
+            return Opcode::modulo;
+        } else if constexpr (std::is_same_v<Operator, Power>) {
+            return Opcode::power;
+        } else if constexpr (std::is_same_v<Operator, Comparison<std::equal_to<>>>) {
+            return Opcode::equal;
+        } else if constexpr (std::is_same_v<Operator, Comparison<std::not_equal_to<>>>) {
+            return Opcode::not_equal;
+        } else if constexpr (std::is_same_v<Operator, Comparison<std::less<>>>) {
+            return Opcode::less;
+        } else if constexpr (std::is_same_v<Operator, Comparison<std::less_equal<>>>) {
+            return Opcode::less_equal;
+        } else if constexpr (std::is_same_v<Operator, Comparison<std::greater<>>>) {
+            return Opcode::greater;
+        } else if constexpr (std::is_same_v<Operator, Comparison<std::greater_equal<>>>) {
+            return Opcode::greater_equal;
+        } else if constexpr (std::is_same_v<Operator, StartsWith>) {
+            return Opcode::starts_with;
+        } else if constexpr (std::is_same_v<Operator, EndsWith>) {
+            return Opcode::ends_with;
+        } else {
+            static_assert(std::is_same_v<Operator, Subscript>);
+            return Opcode::subscript;
+        }
+    }
+
+    // Appends the instructions for `operation` but the last one, which is returned. The select
+    // instruction only overwrites its target if the condition holds, so the target takes the
+    // other value first. When the target is read by the select as well, the value is chosen in
+    // `scratch`, a slot past the function's own.
+    constexpr Instruction
+    encode_select(
+            RuntimeFunction& function,
+            SelectOperation const& operation,
+            std::size_t const scratch) {
+        auto const condition = narrow_operand(operation.condition);
+        auto const if_true = narrow_operand(operation.if_true);
+        auto const if_false = narrow_operand(operation.if_false);
+        auto const target = narrow_operand(operation.target);
+        if (operation.target == operation.if_false) {
+            return {Opcode::select, condition, if_true, target};
+        } else if (operation.target != operation.condition and
+                   operation.target != operation.if_true) {
+            function.instructions.push_back({Opcode::assign, if_false, target});
+            return {Opcode::select, condition, if_true, target};
+        }
+        auto const chosen = narrow_operand(scratch);
+        function.stack_size = std::max(function.stack_size, scratch + 1);
+        function.instructions.push_back({Opcode::assign, if_false, chosen});
+        function.instructions.push_back({Opcode::select, condition, if_true, chosen});
+        return {Opcode::assign, chosen, target};
+    }
+
+    // Appends the instructions for `operation` but the last one, which is returned. The slice
+    // instruction reads its bounds from two adjacent slots, unless they are already adjacent
+    // they are copied to `scratch` and the slot after it.
+    constexpr Instruction
+    encode_slice(
+            RuntimeFunction& function,
+            SliceOperation const& operation,
+            std::size_t const scratch) {
+        auto const value = narrow_operand(operation.value);
+        auto const target = narrow_operand(operation.target);
+        if (operation.end == operation.begin + 1) {
+            return {Opcode::slice, value, narrow_operand(operation.begin), target};
+        }
+        auto const bounds = narrow_operand(scratch);
+        function.stack_size = std::max(function.stack_size, scratch + 2);
+        function.instructions.push_back({Opcode::assign, narrow_operand(operation.begin), bounds});
+        function.instructions.push_back(
+                {Opcode::assign, narrow_operand(operation.end), narrow_operand(scratch + 1)});
+        return {Opcode::slice, value, bounds, target};
+    }
+
+    // Appends the instructions for `operation` but the last one, which is returned. The call
+    // instruction reads its arguments from adjacent slots, unless they are already adjacent
+    // they are copied to `scratch` and the slots after it.
+    constexpr Instruction
+    encode_call(
+            RuntimeFunction& function,
+            CallOperation const& operation,
+            std::size_t const scratch) {
+        auto const callee = narrow_operand(operation.function);
+        auto const target = narrow_operand(operation.target);
+        auto const arguments = std::span{operation.arguments}.first(operation.arguments_count);
+        if (arguments.empty()) {
+            return {Opcode::call, callee, 0, target};
+        } else if (std::ranges::adjacent_find(arguments, [](auto const lhs, auto const rhs) {
+                       return rhs != lhs + 1;
+                   }) == arguments.end()) {
+            return {Opcode::call, callee, narrow_operand(arguments.front()), target};
+        }
+        function.stack_size = std::max(function.stack_size, scratch + arguments.size());
+        for (auto i = std::size_t{0}; i < arguments.size(); ++i) {
+            function.instructions.push_back(
+                    {Opcode::assign, narrow_operand(arguments[i]), narrow_operand(scratch + i)});
+        }
+        return {Opcode::call, callee, narrow_operand(scratch), target};
+    }
+
+    // Encodes operations into bytecode, fusing constant/addition/return pairs into
+    // superinstructions unless the second operation is a jump target. Jump targets are operation
+    // indexes until all instructions are known.
+    constexpr RuntimeFunction
+    encode(std::span<Operation const> const operations, std::size_t const parameters_count) {
+        auto function = RuntimeFunction{};
+        function.stack_size = std::max(determine_stack_size(operations), parameters_count);
+        function.parameters_count = parameters_count;
+        narrow_operand(function.stack_size);
+        narrow_operand(operations.size());
+        auto const scratch = function.stack_size;
+        auto const live = find_live_slots(operations, function.stack_size);
+        auto const jump_targets = find_jump_targets(operations);
+        auto instruction_indexes = std::vector<std::size_t>(operations.size() + 1);
+        auto& constants = function.constants;
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            instruction_indexes[i] = function.instructions.size();
+            auto const fusable = i + 1 < operations.size() and not jump_targets[i + 1];
+            auto const* const next = fusable ? &operations[i + 1] : nullptr;
+            auto const* const next_return =
+                    next != nullptr ? std::get_if<ReturnOperation>(next) : nullptr;
+            auto const* const next_addition =
+                    next != nullptr ? std::get_if<AdditionOperation>(next) : nullptr;
+            auto const instruction = std::visit(
+                    [&]<class T>(T const& operation) -> Instruction {
+                        if constexpr (std::is_same_v<T, AdditionOperation>) {
+                            if (next_return != nullptr and
+                                next_return->stack_index == operation.target) {
+                                ++i;
+                                return {Opcode::add_return,
+                                        narrow_operand(operation.lhs),
+                                        narrow_operand(operation.rhs)};
+                            }
+                        }
+                        if constexpr (is_binary_operation<T>) {
+                            return {binary_opcode<typename T::operator_type>(),
+                                    narrow_operand(operation.lhs),
+                                    narrow_operand(operation.rhs),
+                                    narrow_operand(operation.target)};
+                        } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                            return {Opcode::assign,
+                                    narrow_operand(operation.from),
+                                    narrow_operand(operation.to)};
+                        } else if constexpr (std::is_same_v<T, BranchOperation>) {
+                            return {Opcode::branch,
+                                    narrow_operand(operation.condition),
+                                    narrow_operand(operation.target)};
+                        } else if constexpr (std::is_same_v<T, CallOperation>) {
+                            return encode_call(function, operation, scratch);
+                        } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+                            auto const constant = intern_constant(constants, operation.value);
+                            if (next_return != nullptr and
+                                next_return->stack_index == operation.index) {
+                                ++i;
+                                return {Opcode::constant_return, constant};
+                            } else if (
+                                    next_addition != nullptr and
+                                    (next_addition->lhs == operation.index) !=
+                                            (next_addition->rhs == operation.index) and
+                                    (next_addition->target == operation.index or
+                                     not live_after(live, operations, i + 1)
+                                                 .contains(operation.index))) {
+                                ++i;
+                                auto const other = next_addition->lhs == operation.index
+                                                           ? next_addition->rhs
+                                                           : next_addition->lhs;
+                                return {Opcode::add_constant,
+                                        narrow_operand(other),
+                                        constant,
+                                        narrow_operand(next_addition->target)};
+                            }
+                            return {Opcode::constant, constant, narrow_operand(operation.index)};
+                        } else if constexpr (std::is_same_v<T, JumpOperation>) {
+                            return {Opcode::jump, narrow_operand(operation.target)};
+                        } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                            return {Opcode::length,
+                                    narrow_operand(operation.from),
+                                    narrow_operand(operation.to)};
+                        } else if constexpr (std::is_same_v<T, ReturnOperation>) {
+                            return {Opcode::return_, narrow_operand(operation.stack_index)};
+                        } else if constexpr (std::is_same_v<T, SelectOperation>) {
+                            return encode_select(function, operation, scratch);
+                        } else if constexpr (std::is_same_v<T, SliceOperation>) {
+                            return encode_slice(function, operation, scratch);
+                        } else if constexpr (is_dictionary_operation<T>) {
+                            return {std::is_same_v<T, LookupOperation> ? Opcode::lookup
+                                                                       : Opcode::contains,
+                                    narrow_operand(operation.key),
+                                    intern_dictionary(function.dictionaries, operation.dictionary),
+                                    narrow_operand(operation.target)};
+                        } else if constexpr (std::is_same_v<T, YieldOperation>) {
+                            throw std::invalid_argument{"Generators are not supported at run time"};
+                        } else if constexpr (std::is_same_v<T, LocationOperation>) {
+                            throw std::invalid_argument{"Profiling is not supported at run time"};
+                        }
+                    },
+                    operations[i]);
+            function.instructions.push_back(instruction);
+        }
+        // Functions without a return return an empty Variable like Function, so every bytecode
+        // ends with a return and dispatch never has to check for the end
+        auto& instructions = function.instructions;
+        instruction_indexes.back() = instructions.size();
+        if (instructions.empty() or jump_targets.back() or
+            (instructions.back().opcode != Opcode::return_ and
+             instructions.back().opcode != Opcode::add_return and
+             instructions.back().opcode != Opcode::constant_return)) {
+            instructions.push_back(
+                    {Opcode::constant_return, intern_constant(constants, Variable{})});
+        }
+        for (auto& instruction: instructions) {
+            if (instruction.opcode == Opcode::jump) {
+                instruction.a = narrow_operand(instruction_indexes[instruction.a]);
+            } else if (instruction.opcode == Opcode::branch) {
+                instruction.b = narrow_operand(instruction_indexes[instruction.b]);
+            }
+        }
+        return function;
+    }
+
+    // Binary operation with a fast path for the common case of two ints, if the operator takes
+    // them, Raising operators throw like in the other functions
+    template<class Operator>
+    inline Variable
+    evaluate_variables(Variable const& lhs, Variable const& rhs) noexcept(not Raising<Operator>) {
+        if constexpr (std::is_invocable_v<Operator, int, int>) {
+            auto const* const lhs_int = std::get_if<int>(&lhs);
+            auto const* const rhs_int = std::get_if<int>(&rhs);
+            if (lhs_int != nullptr and rhs_int != nullptr) {
+                return Variable{Operator{}(*lhs_int, *rhs_int)};
+            }
+        }
+        return evaluate(Operator{}, lhs, rhs);
+    }
+
+    // Runs the bytecode with direct-threaded dispatch where computed goto is available (every
+    // handler jumps straight to the next handler) and a switch loop otherwise
+    inline Variable
+    execute(RuntimeFunctionView const& function, Variable* const stack) {
+        auto const* instruction = function.instructions.data();
+        auto const* const constants = function.constants.data();
+#if defined(__GNUC__)
+        static void* const handlers[] = {
+                &&handle_add,
+                &&handle_subtract,
+                &&handle_multiply,
+                &&handle_divide,
+                &&handle_floor_divide,
+                &&handle_modulo,
+                &&handle_power,
+                &&handle_assign,
+                &&handle_constant,
+                &&handle_return_,
+                &&handle_equal,
+                &&handle_not_equal,
+                &&handle_less,
+                &&handle_less_equal,
+                &&handle_greater,
+                &&handle_greater_equal,
+                &&handle_jump,
+                &&handle_branch,
+                &&handle_select,
+                &&handle_starts_with,
+                &&handle_ends_with,
+                &&handle_subscript,
+                &&handle_length,
+                &&handle_slice,
+                &&handle_lookup,
+                &&handle_contains,
+                &&handle_call,
+                &&handle_add_constant,
+                &&handle_add_return,
+                &&handle_constant_return};
+#define CTPY_DISPATCH() goto* handlers[static_cast<std::uint8_t>(instruction->opcode)]
+#define CTPY_HANDLER(opcode) handle_##opcode
+        CTPY_DISPATCH();
+#else
+#define CTPY_DISPATCH() continue
+#define CTPY_HANDLER(opcode) case Opcode::opcode
+        while (true) {
+            switch (instruction->opcode) {
+#endif
+#define CTPY_BINARY_HANDLER(opcode, Operator)                                                      \
+    CTPY_HANDLER(opcode) : {                                                                       \
+        stack[instruction->c] =                                                                    \
+                evaluate_variables<Operator>(stack[instruction->a], stack[instruction->b]);        \
+        ++instruction;                                                                             \
+        CTPY_DISPATCH();                                                                           \
+    }
+        CTPY_BINARY_HANDLER(add, Plus)
+        CTPY_BINARY_HANDLER(subtract, Minus)
+        CTPY_BINARY_HANDLER(multiply, Multiplies)
+        CTPY_BINARY_HANDLER(divide, Divides)
+        CTPY_BINARY_HANDLER(floor_divide, FloorDivides)
+        CTPY_BINARY_HANDLER(modulo, Modulus)
+        CTPY_BINARY_HANDLER(power, Power)
+        CTPY_BINARY_HANDLER(equal, Comparison<std::equal_to<>>)
+        CTPY_BINARY_HANDLER(not_equal, Comparison<std::not_equal_to<>>)
+        CTPY_BINARY_HANDLER(less, Comparison<std::less<>>)
+        CTPY_BINARY_HANDLER(less_equal, Comparison<std::less_equal<>>)
+        CTPY_BINARY_HANDLER(greater, Comparison<std::greater<>>)
+        CTPY_BINARY_HANDLER(greater_equal, Comparison<std::greater_equal<>>)
+        CTPY_BINARY_HANDLER(starts_with, StartsWith)
+        CTPY_BINARY_HANDLER(ends_with, EndsWith)
+        CTPY_BINARY_HANDLER(subscript, Subscript)
+        CTPY_HANDLER(length) : {
+            stack[instruction->b] = length(stack[instruction->a]);
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(slice) : {
+            stack[instruction->c] = slice(
+                    stack[instruction->a], stack[instruction->b], stack[instruction->b + 1]);
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(lookup) : {
+            stack[instruction->c] = (*function.dictionaries[instruction->b])[stack[instruction->a]];
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(contains) : {
+            stack[instruction->c] =
+                    Contains{}(*function.dictionaries[instruction->b], stack[instruction->a]);
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(call) : {
+            auto const& callee = function.functions[instruction->a];
+            auto const arguments =
+                    std::span<Variable const>{stack + instruction->b, callee.parameters_count};
+            stack[instruction->c] = callee(arguments);
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(jump) : {
+            instruction = function.instructions.data() + instruction->a;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(branch) : {
+            instruction = truthy(stack[instruction->a])
+                                  ? instruction + 1
+                                  : function.instructions.data() + instruction->b;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(select) : {
+            if (truthy(stack[instruction->a])) {
+                stack[instruction->c] = stack[instruction->b];
+            }
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(assign) : {
+            stack[instruction->b] = stack[instruction->a];
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(constant) : {
+            stack[instruction->b] = constants[instruction->a];
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(return_) : {
+            return stack[instruction->a];
+        }
+        CTPY_HANDLER(add_constant) : {
+            stack[instruction->c] =
+                    evaluate_variables<Plus>(stack[instruction->a], constants[instruction->b]);
+            ++instruction;
+            CTPY_DISPATCH();
+        }
+        CTPY_HANDLER(add_return) : {
+            return evaluate_variables<Plus>(stack[instruction->a], stack[instruction->b]);
+        }
+        CTPY_HANDLER(constant_return) : {
+            return constants[instruction->a];
+        }
+#if !defined(__GNUC__)
+            }
+        }
+#endif
+#undef CTPY_BINARY_HANDLER
+#undef CTPY_HANDLER
+#undef CTPY_DISPATCH
+    }
+
+}  // namespace detail
+
+inline Variable
+RuntimeFunctionView::operator()(std::span<Variable const> const parameters) const {
+    if (parameters.size() != parameters_count) {
+        throw std::invalid_argument{"Wrong number of parameters passed"};
+    }
+    auto const copy_parameters = [this, parameters](Variable* const stack) {
+        std::ranges::copy(parameters, stack);
+        for (auto i = std::size_t{0}; i < signature.size(); ++i) {
+            stack[i] = detail::annotate(signature[i], stack[i]);
+        }
+    };
+    constexpr auto inline_stack_size = std::size_t{32};
+    if (stack_size <= inline_stack_size) {
+        auto stack = std::array<Variable, inline_stack_size>{};
+        copy_parameters(stack.data());
+        return detail::execute(*this, stack.data());
+    }
+    auto stack = std::vector<Variable>(stack_size);
+    copy_parameters(stack.data());
+    return detail::execute(*this, stack.data());
+}
+
+// Lexes, parses, optimizes and encodes a function at run time. String constants are views of
+// `source`, which has to outlive the function, strings built from constants like concatenated
+// literals and dictionaries need a RuntimeModule, which keeps them.
+inline RuntimeFunction
+compile(std::string_view const source) {
+    auto const lexemes = lex(source);
+    auto const declaration = detail::parse_function_header(lexemes);
+    auto function = detail::encode(
+            detail::compile_operations<>(
+                    declaration.body, {declaration.parameters, {}, {}, {}, {}}),
+            declaration.parameters.size());
+    function.signature = declaration.annotations;
+    return function;
+}
+
+// Functions compiled at run time from the source of a module. The source, the strings its
+// functions build from constants, their dictionaries and the bytecode of all functions are stored
+// one after another in a monotonic arena owned by the module, so string constants stay valid as
+// long as the module, the functions are cache-local and dropping a module releases its memory in
+// bulk instead of freeing every array on its own. Lexemes live in a second arena which is
+// released once the module is compiled. Calls between the functions are inlined where they can
+// be, the others, like recursive ones, run the bytecode of the callee.
+class RuntimeModule final {
+  public:
+    explicit RuntimeModule(
+            std::string_view const source,
+            std::pmr::memory_resource* const upstream = std::pmr::get_default_resource())
+        : arena{initial_arena_size(source), upstream},
+          functions{&arena} {
+        auto const content = store(std::span{source});
+        auto lexeme_arena = std::pmr::monotonic_buffer_resource{upstream};
+        auto lexemes = std::pmr::vector<Lexeme>{&lexeme_arena};
+        detail::lex_into(
+                std::string_view{content.data(), content.size()},
+                detail::is_lexeme<>,
+                [&lexemes](Lexeme const& lexeme) { lexemes.push_back(lexeme); });
+        auto const declarations = detail::parse_declarations(lexemes);
+        auto strings = std::pmr::vector<std::string_view>{&lexeme_arena};
+        for (auto const& string: detail::collect_strings(declarations)) {
+            auto const stored = store(std::span{string});
+            strings.emplace_back(stored.data(), stored.size());
+        }
+        auto frozen = std::pmr::vector<Dictionary>{&lexeme_arena};
+        for (auto const& entries: detail::collect_dictionaries(declarations, strings)) {
+            auto const layout = detail::dictionary_layout(entries);
+            frozen.push_back(Dictionary{
+                    layout.seed,
+                    store(std::span{layout.displacements}),
+                    store(std::span{layout.slots}),
+                    store(std::span{entries}),
+                    detail::dictionary_value_type(entries)});
+        }
+        auto const dictionaries = store(std::span<Dictionary const>{frozen});
+        // Calls refer to their callees by index, so the views are placed before they are known
+        auto const callees = std::span{
+                std::pmr::polymorphic_allocator<>{&arena}.allocate_object<RuntimeFunctionView>(
+                        declarations.size()),
+                declarations.size()};
+        functions.reserve(declarations.size());
+        for (auto i = std::size_t{0}; i < declarations.size(); ++i) {
+            auto const& declaration = declarations[i];
+            auto const function = detail::encode(
+                    detail::compile_operations<>(
+                            declaration.body,
+                            {declaration.parameters, declarations, {}, strings, dictionaries}),
+                    declaration.parameters.size());
+            auto const* const view = std::construct_at(
+                    &callees[i],
+                    RuntimeFunctionView{
+                            store(std::span{function.instructions}),
+                            store(std::span{function.constants}),
+                            function.stack_size,
+                            function.parameters_count,
+                            store(std::span{declaration.annotations}),
+                            store(std::span{function.dictionaries}),
+                            callees});
+            functions.emplace_back(declaration.name, *view);
+        }
+    }
+
+    RuntimeModule(RuntimeModule const&) = delete;
+    RuntimeModule&
+    operator=(RuntimeModule const&) = delete;
+
+    // Function of the module called `name`, valid as long as the module
+    [[nodiscard]] RuntimeFunctionView
+    function(std::string_view const name) const {
+        auto const found = std::ranges::find(functions, name, &NamedFunction::first);
+        if (found == functions.end()) {
+            throw std::out_of_range{"No function with this name"};
+        }
+        return found->second;
+    }
+
+    [[nodiscard]] std::size_t
+    size() const noexcept {
+        return functions.size();
+    }
+
+  private:
+    using NamedFunction = std::pair<std::string_view, RuntimeFunctionView>;
+
+    // Room for the source and about one instruction per character, so most modules fit into
+    // the first buffer of the arena
+    static std::size_t
+    initial_arena_size(std::string_view const source) noexcept {
+        return source.size() * (1 + sizeof(Instruction)) + 1024;
+    }
+
+    // Copy of `values` in the arena, which never runs destructors
+    template<class T>
+        requires std::is_trivially_destructible_v<T>
+    std::span<T const>
+    store(std::span<T const> const values) {
+        auto* const stored =
+                std::pmr::polymorphic_allocator<>{&arena}.allocate_object<T>(values.size());
+        std::ranges::uninitialized_copy(values, std::span{stored, values.size()});
+        return {stored, values.size()};
+    }
+
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<NamedFunction> functions;
+};
+
+}  // namespace ctpy
@@ -1,21 +1,55 @@
 #pragma once
 
+#include "perfect_hash.h"
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstdint>
 #include <optional>
+#include <stdexcept>
 #include <string_view>
 #include <type_traits>
 #include <variant>
+#include <vector>
+// Only the header of the instruction set simd_span_length uses, immintrin.h alone takes longer to
+// compile than the rest of the lexer
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 namespace ctpy {
 
-enum class Keyword { def, return_ };  // TODO: Test return parsing
+// TODO: Test return parsing
+enum class Keyword { def, elif, else_, for_, if_, in, return_, while_, yield_ };
 
 enum class Operator {
+    at,
+    asterisk,
+    asteriskasterisk,
+    braceleft,
+    braceright,
     bracketleft,
     bracketright,
+    comma,
+    equal,
+    equalequal,
+    exclamequal,
+    greater,
+    greaterequal,
+    less,
+    lessequal,
     linebreak,
+    minus,
+    percent,
+    period,
     plus,
-    semicolon
+    semicolon,
+    slash,
+    slashslash,
+    squarebracketleft,
+    squarebracketright
 };  // TODO: Test bracketleft, bracketright, linebreak, semicolon parsing
 
 struct Identifier final {
@@ -25,6 +59,7 @@ struct Identifier final {
     operator==(Identifier const&) const noexcept = default;
 };
 
+// Number or string literal, string literals keep their quotes
 struct Literal final {  // TODO: Test
     std::string_view value;
 
@@ -32,7 +67,16 @@ struct Literal final {  // TODO: Test
     operator==(Literal const&) const noexcept = default;
 };
 
-using Lexeme = std::variant<Identifier, Keyword, Literal, Operator>;
+// Width of the leading whitespace of a line, emitted after every linebreak followed by an indented
+// line so that the parser can delimit blocks
+struct Indentation final {
+    std::size_t width;
+
+    constexpr bool
+    operator==(Indentation const&) const noexcept = default;
+};
+
+using Lexeme = std::variant<Identifier, Indentation, Keyword, Literal, Operator>;
 
 template<std::size_t N>
 struct Lexemes final {
@@ -71,57 +115,287 @@ struct Content final {
 
 namespace detail {
 
+    enum CharacterClass : std::uint8_t {
+        space = 1U << 0U,
+        digit = 1U << 1U,
+        identifier_start = 1U << 2U,
+        identifier_continue = 1U << 3U,
+    };
+
+    inline constexpr auto character_classes = [] {
+        auto table = std::array<std::uint8_t, 256>{};
+        for (auto const c: std::string_view{" \t\r"}) {
+            table[static_cast<unsigned char>(c)] |= space;
+        }
+        for (auto c = '0'; c <= '9'; ++c) {
+            table[static_cast<unsigned char>(c)] |= digit | identifier_continue;
+        }
+        for (auto c = 'a'; c <= 'z'; ++c) {
+            table[static_cast<unsigned char>(c)] |= identifier_start | identifier_continue;
+            table[static_cast<unsigned char>(c - 'a' + 'A')] |=
+                    identifier_start | identifier_continue;
+        }
+        table[static_cast<unsigned char>('_')] |= identifier_start | identifier_continue;
+        return table;
+    }();
+
+    inline constexpr auto operators = [] {
+        auto table = std::array<std::optional<Operator>, 256>{};
+        table[static_cast<unsigned char>('+')] = Operator::plus;
+        table[static_cast<unsigned char>('-')] = Operator::minus;
+        table[static_cast<unsigned char>('*')] = Operator::asterisk;
+        table[static_cast<unsigned char>('/')] = Operator::slash;
+        table[static_cast<unsigned char>('%')] = Operator::percent;
+        table[static_cast<unsigned char>('(')] = Operator::bracketleft;
+        table[static_cast<unsigned char>(')')] = Operator::bracketright;
+        table[static_cast<unsigned char>(':')] = Operator::semicolon;
+        table[static_cast<unsigned char>('\n')] = Operator::linebreak;
+        table[static_cast<unsigned char>(',')] = Operator::comma;
+        table[static_cast<unsigned char>('=')] = Operator::equal;
+        table[static_cast<unsigned char>('<')] = Operator::less;
+        table[static_cast<unsigned char>('>')] = Operator::greater;
+        table[static_cast<unsigned char>('@')] = Operator::at;
+        table[static_cast<unsigned char>('.')] = Operator::period;
+        table[static_cast<unsigned char>('[')] = Operator::squarebracketleft;
+        table[static_cast<unsigned char>(']')] = Operator::squarebracketright;
+        table[static_cast<unsigned char>('{')] = Operator::braceleft;
+        table[static_cast<unsigned char>('}')] = Operator::braceright;
+        return table;
+    }();
+
+    // Operators spelled as their first character followed by '='
+    inline constexpr auto compound_operators = [] {
+        auto table = std::array<std::optional<Operator>, 256>{};
+        table[static_cast<unsigned char>('=')] = Operator::equalequal;
+        table[static_cast<unsigned char>('!')] = Operator::exclamequal;
+        table[static_cast<unsigned char>('<')] = Operator::lessequal;
+        table[static_cast<unsigned char>('>')] = Operator::greaterequal;
+        return table;
+    }();
+
+    // Operators spelled as their character twice
+    constexpr std::optional<Operator>
+    doubled_operator(char const c) noexcept {
+        switch (c) {
+            case '*':
+                return Operator::asteriskasterisk;
+            case '/':
+                return Operator::slashslash;
+            default:
+                return std::nullopt;
+        }
+    }
+
+    inline constexpr auto keywords = make_perfect_hash_map(std::array{
+            std::pair{std::string_view{"def"}, Keyword::def},
+            std::pair{std::string_view{"elif"}, Keyword::elif},
+            std::pair{std::string_view{"else"}, Keyword::else_},
+            std::pair{std::string_view{"for"}, Keyword::for_},
+            std::pair{std::string_view{"if"}, Keyword::if_},
+            std::pair{std::string_view{"in"}, Keyword::in},
+            std::pair{std::string_view{"return"}, Keyword::return_},
+            std::pair{std::string_view{"while"}, Keyword::while_},
+            std::pair{std::string_view{"yield"}, Keyword::yield_}});
+
+    constexpr bool
+    has_class(char const c, CharacterClass const character_class) noexcept {
+        return (character_classes[static_cast<unsigned char>(c)] & character_class) != 0U;
+    }
+
+    // Characters first to last of one character class
+    struct CharacterRange final {
+        unsigned char first;
+        unsigned char last;
+    };
+
+    constexpr std::size_t
+    count_character_ranges(CharacterClass const character_class) noexcept {
+        auto count = std::size_t{0};
+        for (auto c = 0; c < 256; ++c) {
+            auto const starts = (character_classes[c] & character_class) != 0U and
+                                (c == 0 or (character_classes[c - 1] & character_class) == 0U);
+            count += starts ? 1 : 0;
+        }
+        return count;
+    }
+
+    // The character classes as runs of consecutive characters, which SIMD scans compare against
+    template<CharacterClass character_class>
+    inline constexpr auto character_ranges = [] {
+        auto ranges = std::array<CharacterRange, count_character_ranges(character_class)>{};
+        auto count = std::size_t{0};
+        for (auto c = 0; c < 256; ++c) {
+            if ((character_classes[c] & character_class) == 0U) {
+                continue;
+            } else if (c == 0 or (character_classes[c - 1] & character_class) == 0U) {
+                ranges[count++].first = static_cast<unsigned char>(c);
+            }
+            ranges[count - 1].last = static_cast<unsigned char>(c);
+        }
+        return ranges;
+    }();
+
+    constexpr std::size_t
+    scalar_span_length(
+            std::string_view const content,
+            CharacterClass const character_class,
+            std::size_t length = 0) noexcept {
+        while (length < content.size() and has_class(content[length], character_class)) {
+            ++length;
+        }
+        return length;
+    }
+
+    // Like scalar_span_length, but compares 32 (AVX2) or 16 (SSE2) characters at once against
+    // the ranges of `character_class` and finds the first one outside of them in the mask of the
+    // comparisons. Characters after the last full block are compared one by one.
+    template<CharacterClass character_class>
+    inline std::size_t
+    simd_span_length(std::string_view const content) noexcept {
+        auto length = std::size_t{0};
+#if defined(__AVX2__)
+        for (; length + 32 <= content.size(); length += 32) {
+            auto const block = _mm256_loadu_si256(
+                    reinterpret_cast<__m256i const*>(content.data() + length));  // NOLINT
+            auto matches = _mm256_setzero_si256();
+            for (auto const range: character_ranges<character_class>) {
+                auto const offset =
+                        _mm256_sub_epi8(block, _mm256_set1_epi8(static_cast<char>(range.first)));
+                auto const width = _mm256_set1_epi8(static_cast<char>(range.last - range.first));
+                matches = _mm256_or_si256(
+                        matches, _mm256_cmpeq_epi8(_mm256_min_epu8(offset, width), offset));
+            }
+            auto const outside = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(matches));
+            if (outside != 0U) {
+                return length + static_cast<std::size_t>(std::countr_zero(outside));
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        for (; length + 16 <= content.size(); length += 16) {
+            auto const block = _mm_loadu_si128(
+                    reinterpret_cast<__m128i const*>(content.data() + length));  // NOLINT
+            auto matches = _mm_setzero_si128();
+            for (auto const range: character_ranges<character_class>) {
+                auto const offset =
+                        _mm_sub_epi8(block, _mm_set1_epi8(static_cast<char>(range.first)));
+                auto const width = _mm_set1_epi8(static_cast<char>(range.last - range.first));
+                matches = _mm_or_si128(
+                        matches, _mm_cmpeq_epi8(_mm_min_epu8(offset, width), offset));
+            }
+            auto const outside = ~static_cast<std::uint32_t>(_mm_movemask_epi8(matches)) & 0xFFFFU;
+            if (outside != 0U) {
+                return length + static_cast<std::size_t>(std::countr_zero(outside));
+            }
+        }
+#endif
+        return scalar_span_length(content, character_class, length);
+    }
+
+    // Length of the prefix of `content` consisting of characters of `character_class`, scanned
+    // with SIMD instructions at run time
+    constexpr std::size_t
+    span_length(std::string_view const content, CharacterClass const character_class) noexcept {
+        if not consteval {
+            switch (character_class) {
+                case space:
+                    return simd_span_length<space>(content);
+                case digit:
+                    return simd_span_length<digit>(content);
+                case identifier_continue:
+                    return simd_span_length<identifier_continue>(content);
+                default:
+                    break;
+            }
+        }
+        return scalar_span_length(content, character_class);
+    }
+
+    constexpr std::size_t
+    identifier_length(std::string_view const content) noexcept {
+        if (content.empty() or not has_class(content.front(), identifier_start)) {
+            return 0;
+        }
+        return 1 + span_length(content.substr(1), identifier_continue);
+    }
+
     inline constexpr auto is_keyword = [](std::string_view const content) constexpr noexcept
             -> std::optional<std::pair<Keyword, std::string_view>> {
-        constexpr auto def = std::string_view{"def"};
-        constexpr auto return_ = std::string_view{"return"};
-        if (content.starts_with(def)) {
-            return std::optional<std::pair<Keyword, std::string_view>>{
-                    std::in_place, Keyword::def, content.substr(def.size())};
-        } else if (content.starts_with(return_)) {
-            return std::optional<std::pair<Keyword, std::string_view>>{
-                    std::in_place, Keyword::return_, content.substr(return_.size())};
-        }
-        return std::nullopt;
+        auto const length = identifier_length(content);
+        if (length == 0) {
+            return std::nullopt;
+        }
+        auto const* const keyword = keywords.find(content.substr(0, length));
+        if (keyword == nullptr) {
+            return std::nullopt;
+        }
+        return std::optional<std::pair<Keyword, std::string_view>>{
+                std::in_place, *keyword, content.substr(length)};
     };
 
     inline constexpr auto is_operator = [](std::string_view const content) constexpr noexcept
             -> std::optional<std::pair<Operator, std::string_view>> {
-        if (content.starts_with('+')) {
-            return std::optional<std::pair<Operator, std::string_view>>{
-                    std::in_place, Operator::plus, content.substr(1)};
-        } else if (content.starts_with('(')) {
-            return std::optional<std::pair<Operator, std::string_view>>{
-                    std::in_place, Operator::bracketleft, content.substr(1)};
-        } else if (content.starts_with(')')) {
-            return std::optional<std::pair<Operator, std::string_view>>{
-                    std::in_place, Operator::bracketright, content.substr(1)};
-        } else if (content.starts_with(':')) {
-            return std::optional<std::pair<Operator, std::string_view>>{
-                    std::in_place, Operator::semicolon, content.substr(1)};
-        } else if (content.starts_with('\n')) {
-            return std::optional<std::pair<Operator, std::string_view>>{
-                    std::in_place, Operator::linebreak, content.substr(1)};
-        }
-        return std::nullopt;
+        if (content.empty()) {
+            return std::nullopt;
+        }
+        if (content.size() > 1) {
+            auto const compound =
+                    content[1] == '=' ? compound_operators[static_cast<unsigned char>(content[0])]
+                    : content[1] == content[0] ? doubled_operator(content[0])
+                                               : std::nullopt;
+            if (compound.has_value()) {
+                return std::optional<std::pair<Operator, std::string_view>>{
+                        std::in_place, *compound, content.substr(2)};
+            }
+        }
+        auto const operator_ = operators[static_cast<unsigned char>(content.front())];
+        if (not operator_.has_value()) {
+            return std::nullopt;
+        }
+        return std::optional<std::pair<Operator, std::string_view>>{
+                std::in_place, *operator_, content.substr(1)};
     };
 
     inline constexpr auto is_literal = [](std::string_view const content) constexpr noexcept
             -> std::optional<std::pair<Literal, std::string_view>> {
-        auto const end = static_cast<std::size_t>(
-                std::ranges::find_if_not(
-                        content, [](auto const c) { return c >= '0' && c <= '9'; }) -
-                content.begin());
+        auto const end = span_length(content, digit);
+        if (end == 0) {
+            return std::nullopt;
+        }
         return std::optional<std::pair<Literal, std::string_view>>{
                 std::in_place, Literal{content.substr(0, end)}, content.substr(end)};
     };
 
+    constexpr bool
+    is_quote(char const c) noexcept {
+        return c == '\'' or c == '"';
+    }
+
+    // String literal in single or double quotes on one line. Escape sequences are rejected, so
+    // the value of a literal is always the text between its quotes.
+    inline constexpr auto is_string_literal = [](std::string_view const content) constexpr
+            -> std::optional<std::pair<Literal, std::string_view>> {
+        if (content.empty() or not is_quote(content.front())) {
+            return std::nullopt;
+        }
+        auto const quote = content.front();
+        for (auto end = std::size_t{1}; end < content.size(); ++end) {
+            if (content[end] == quote) {
+                return std::optional<std::pair<Literal, std::string_view>>{
+                        std::in_place,
+                        Literal{content.substr(0, end + 1)},
+                        content.substr(end + 1)};
+            } else if (content[end] == '\\') {
+                throw std::invalid_argument{"Escape sequences are not supported"};
+            } else if (content[end] == '\n') {
+                break;
+            }
+        }
+        throw std::invalid_argument{"Unterminated string literal"};
+    };
+
     inline constexpr auto is_identifier = [](std::string_view const content) constexpr noexcept
             -> std::optional<std::pair<Identifier, std::string_view>> {
-        auto const end = static_cast<std::size_t>(
-                std::ranges::find_if_not(
-                        content, [](auto const c) { return c >= 'A' && c <= 'z'; }) -
-                content.begin());
+        auto const end = identifier_length(content);
         if (end == 0) {
             return std::nullopt;
         }
@@ -129,6 +403,8 @@ namespace detail {
                 std::in_place, Identifier{content.substr(0, end)}, content.substr(end)};
     };
 
+    // Dispatches on the character class of the first character, so every lexeme is only
+    // examined by the function which can match it
     template<
             auto is_keyword_func = is_keyword,
             auto is_operator_func = is_operator,
@@ -146,46 +422,129 @@ namespace detail {
         }
     inline constexpr auto is_lexeme =
             [](std::string_view strings) constexpr -> std::pair<Lexeme, std::string_view> {
-                strings.remove_prefix(std::min(strings.find_first_not_of(' '), strings.size()));
-                auto result = std::optional<std::pair<Lexeme, std::string_view>>{
-                        is_keyword_func(strings)};
-                if (not result.has_value()) {
+                strings.remove_prefix(span_length(strings, space));
+                auto result = std::optional<std::pair<Lexeme, std::string_view>>{};
+                if (strings.empty()) {
+                    throw std::invalid_argument{"Expected lexeme"};
+                } else if (has_class(strings.front(), identifier_start)) {
+                    result = is_keyword_func(strings);
+                    if (not result.has_value()) {
+                        result = is_identifier_func(strings);
+                    }
+                } else if (has_class(strings.front(), digit)) {
+                    result = is_literal(strings);
+                } else if (is_quote(strings.front())) {
+                    result = is_string_literal(strings);
+                } else {
                     result = is_operator_func(strings);
                 }
                 if (not result.has_value()) {
-                    result = is_identifier_func(strings);
-                }
-                if (not result.has_value()) {
-                    result = is_literal(strings);
+                    throw std::invalid_argument{"Unexpected character"};
                 }
-                return result.value();
+                return *result;
             };
 
-    constexpr std::size_t
-    lexeme_length(std::string_view content) {
-        auto length = 0ULL;
-        while (not content.empty()) {
-            auto const lexeme = is_lexeme<>(content);
-            ++length;
-            content = lexeme.second;
+    // Lexemes of a source with `capacity` characters: every lexeme consumes at least one
+    // character, so the result never needs more than `capacity` elements
+    template<std::size_t capacity>
+    struct BoundedLexemes final {
+        std::array<Lexeme, capacity> elements = {};
+        std::size_t size = 0;
+    };
+
+}  // namespace detail
+
+// Pull stream of the lexemes of `content`, which are produced one at a time and refer to
+// `content` instead of copying it. Lines are measured before their leading whitespace is skipped
+// and non-blank indented lines start with an Indentation, which consumes at least one character
+// like every other lexeme.
+template<class IsLexeme = decltype(detail::is_lexeme<>)>
+class LexemeStream final {
+  public:
+    constexpr explicit LexemeStream(
+            std::string_view const content, IsLexeme const is_lexeme_func = {}) noexcept
+        : content{content},
+          is_lexeme_func{is_lexeme_func} {
+    }
+
+    // The next lexeme, or nothing at the end of the content
+    constexpr std::optional<Lexeme>
+    next() {
+        auto const width = detail::span_length(content, detail::space);
+        content.remove_prefix(width);
+        if (content.empty()) {
+            return std::nullopt;
+        } else if (line_start and width > 0 and content.front() != '\n') {
+            line_start = false;
+            return Lexeme{Indentation{width}};
         }
-        return length;
+        auto const is_lexeme_result = is_lexeme_func(content);
+        if (is_lexeme_result.second.size() >= content.size()) {
+            throw "Lexeme did not consume any character";  // NOLINT(*-exception-baseclass)
+        }
+        line_start = is_lexeme_result.first == Lexeme{Operator::linebreak};
+        content = is_lexeme_result.second;
+        return is_lexeme_result.first;
+    }
+
+    // Content not lexed yet
+    [[nodiscard]] constexpr std::string_view
+    rest() const noexcept {
+        return content;
+    }
+
+  private:
+    std::string_view content;
+    IsLexeme is_lexeme_func;
+    bool line_start = true;
+};
+
+namespace detail {
+
+    // Single pass over `content` passing every lexeme to `emit`
+    template<class Emit>
+    constexpr void
+    lex_into(std::string_view const content, auto const is_lexeme_func, Emit&& emit) {
+        auto stream = LexemeStream{content, is_lexeme_func};
+        while (auto const lexeme = stream.next()) {
+            emit(*lexeme);
+        }
+    }
+
+    template<std::size_t capacity>
+    constexpr BoundedLexemes<capacity>
+    lex_bounded(std::string_view const content, auto const is_lexeme_func) {
+        auto result = BoundedLexemes<capacity>{};
+        lex_into(content, is_lexeme_func, [&result](Lexeme const& lexeme) {
+            if (result.size == capacity) {
+                throw "More lexemes than characters";  // NOLINT(*-exception-baseclass)
+            }
+            result.elements[result.size++] = lexeme;
+        });
+        return result;
     }
 
 }  // namespace detail
 
+// Runtime counterpart of lex() for sources only known at run time
+inline std::vector<Lexeme>
+lex(std::string_view const content) {
+    auto lexemes = std::vector<Lexeme>{};
+    detail::lex_into(content, detail::is_lexeme<>, [&lexemes](Lexeme const& lexeme) {
+        lexemes.push_back(lexeme);
+    });
+    return lexemes;
+}
+
+// Lexes `content` in a single pass into an over-allocated buffer which is then trimmed to the
+// number of lexemes found
 template<Content const& content, auto is_lexeme_func = detail::is_lexeme<>>
 constexpr auto
 lex() noexcept {
-    constexpr auto size = detail::lexeme_length(content);
-    auto content_view = std::string_view{content};
-    auto elements = std::array<Lexeme, size>{};
-    for (auto& element: elements) {
-        auto const is_lexeme_result = is_lexeme_func(content_view);
-        element = is_lexeme_result.first;
-        content_view = is_lexeme_result.second;
-    }
-    return Lexemes<size>{elements};
+    constexpr auto bounded = detail::lex_bounded<content.size>(content, is_lexeme_func);
+    auto elements = std::array<Lexeme, bounded.size>{};
+    std::copy_n(bounded.elements.begin(), bounded.size, elements.begin());
+    return Lexemes<bounded.size>{elements};
 }
 
 }  // namespace ctpy
\ No newline at end of file
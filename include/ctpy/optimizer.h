@@ -0,0 +1,888 @@
+#pragma once
+
+#include "function.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ctpy {
+
+namespace detail {
+
+    // Calls `func` with every stack index read by `operation`
+    template<class Func>
+    constexpr void
+    for_each_read(Operation const& operation, Func&& func) noexcept {
+        std::visit(
+                [&]<class T>(T const& operation) {
+                    if constexpr (is_binary_operation<T>) {
+                        func(operation.lhs);
+                        func(operation.rhs);
+                    } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                        func(operation.from);
+                    } else if constexpr (std::is_same_v<T, BranchOperation>) {
+                        func(operation.condition);
+                    } else if constexpr (std::is_same_v<T, CallOperation>) {
+                        for (auto i = std::size_t{0}; i < operation.arguments_count; ++i) {
+                            func(operation.arguments[i]);
+                        }
+                    } else if constexpr (std::is_same_v<T, ReturnOperation> or
+                                         std::is_same_v<T, YieldOperation>) {
+                        func(operation.stack_index);
+                    } else if constexpr (std::is_same_v<T, SelectOperation>) {
+                        func(operation.condition);
+                        func(operation.if_true);
+                        func(operation.if_false);
+                    } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                        func(operation.from);
+                    } else if constexpr (std::is_same_v<T, SliceOperation>) {
+                        func(operation.value);
+                        func(operation.begin);
+                        func(operation.end);
+                    } else if constexpr (is_dictionary_operation<T>) {
+                        func(operation.key);
+                    }
+                },
+                operation);
+    }
+
+    // Stack index written by `operation`, if any
+    constexpr std::optional<std::size_t>
+    written_index(Operation const& operation) noexcept {
+        return std::visit(
+                []<class T>(T const& operation) -> std::optional<std::size_t> {
+                    if constexpr (is_binary_operation<T>) {
+                        return operation.target;
+                    } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                        return operation.to;
+                    } else if constexpr (std::is_same_v<T, CallOperation>) {
+                        return operation.target;
+                    } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+                        return operation.index;
+                    } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                        return operation.to;
+                    } else if constexpr (
+                            std::is_same_v<T, SelectOperation> or
+                            std::is_same_v<T, SliceOperation> or is_dictionary_operation<T>) {
+                        return operation.target;
+                    } else {
+                        return std::nullopt;
+                    }
+                },
+                operation);
+    }
+
+    // Copy of `operation` with every read index passed through `map_read`
+    template<class MapRead>
+    constexpr Operation
+    map_reads(Operation operation, MapRead&& map_read) noexcept {
+        std::visit(
+                [&]<class T>(T& operation) {
+                    if constexpr (is_binary_operation<T>) {
+                        operation.lhs = map_read(operation.lhs);
+                        operation.rhs = map_read(operation.rhs);
+                    } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                        operation.from = map_read(operation.from);
+                    } else if constexpr (std::is_same_v<T, BranchOperation>) {
+                        operation.condition = map_read(operation.condition);
+                    } else if constexpr (std::is_same_v<T, CallOperation>) {
+                        for (auto i = std::size_t{0}; i < operation.arguments_count; ++i) {
+                            operation.arguments[i] = map_read(operation.arguments[i]);
+                        }
+                    } else if constexpr (std::is_same_v<T, ReturnOperation> or
+                                         std::is_same_v<T, YieldOperation>) {
+                        operation.stack_index = map_read(operation.stack_index);
+                    } else if constexpr (std::is_same_v<T, SelectOperation>) {
+                        operation.condition = map_read(operation.condition);
+                        operation.if_true = map_read(operation.if_true);
+                        operation.if_false = map_read(operation.if_false);
+                    } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                        operation.from = map_read(operation.from);
+                    } else if constexpr (std::is_same_v<T, SliceOperation>) {
+                        operation.value = map_read(operation.value);
+                        operation.begin = map_read(operation.begin);
+                        operation.end = map_read(operation.end);
+                    } else if constexpr (is_dictionary_operation<T>) {
+                        operation.key = map_read(operation.key);
+                    }
+                },
+                operation);
+        return operation;
+    }
+
+    // Copy of `operation` with its written index passed through `map_write`
+    template<class MapWrite>
+    constexpr Operation
+    map_write(Operation operation, MapWrite&& map_write) noexcept {
+        std::visit(
+                [&]<class T>(T& operation) {
+                    if constexpr (is_binary_operation<T>) {
+                        operation.target = map_write(operation.target);
+                    } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                        operation.to = map_write(operation.to);
+                    } else if constexpr (std::is_same_v<T, CallOperation>) {
+                        operation.target = map_write(operation.target);
+                    } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+                        operation.index = map_write(operation.index);
+                    } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                        operation.to = map_write(operation.to);
+                    } else if constexpr (
+                            std::is_same_v<T, SelectOperation> or
+                            std::is_same_v<T, SliceOperation> or is_dictionary_operation<T>) {
+                        operation.target = map_write(operation.target);
+                    }
+                },
+                operation);
+        return operation;
+    }
+
+    // Whether `operation` may fail, which Raising operators do and calls of functions using them
+    constexpr bool
+    may_fail(Operation const& operation) noexcept {
+        return std::visit(
+                []<class T>(T const&) {
+                    if constexpr (is_binary_operation<T>) {
+                        return Raising<typename T::operator_type>;
+                    } else if constexpr (is_dictionary_operation<T>) {
+                        return Raising<typename T::probe_type, Dictionary>;
+                    } else {
+                        return std::is_same_v<T, CallOperation>;
+                    }
+                },
+                operation);
+    }
+
+    // Index of the operation `operation` may continue at instead of the next one, if any
+    constexpr std::optional<std::size_t>
+    jump_target(Operation const& operation) noexcept {
+        if (auto const* const jump = std::get_if<JumpOperation>(&operation)) {
+            return jump->target;
+        } else if (auto const* const branch = std::get_if<BranchOperation>(&operation)) {
+            return branch->target;
+        }
+        return std::nullopt;
+    }
+
+    // Copy of `operation` with its jump target passed through `map_target`
+    template<class MapTarget>
+    constexpr Operation
+    map_target(Operation operation, MapTarget&& map_target) noexcept {
+        if (auto* const jump = std::get_if<JumpOperation>(&operation)) {
+            jump->target = map_target(jump->target);
+        } else if (auto* const branch = std::get_if<BranchOperation>(&operation)) {
+            branch->target = map_target(branch->target);
+        }
+        return operation;
+    }
+
+    // Whether execution may continue with the operation after `operation`
+    constexpr bool
+    falls_through(Operation const& operation) noexcept {
+        return not std::holds_alternative<JumpOperation>(operation) and
+               not std::holds_alternative<ReturnOperation>(operation);
+    }
+
+    // Marks the operations which are continued at by a jump, one past the end included
+    constexpr std::vector<bool>
+    find_jump_targets(std::span<Operation const> const operations) noexcept {
+        auto result = std::vector<bool>(operations.size() + 1);
+        for (auto const& operation: operations) {
+            if (auto const target = jump_target(operation); target.has_value()) {
+                result[*target] = true;
+            }
+        }
+        return result;
+    }
+
+    constexpr std::size_t
+    determine_stack_size(std::span<Operation const> const operations) noexcept {
+        auto stack_size = std::size_t{0};
+        auto const update = [&stack_size](std::size_t const index) {
+            stack_size = std::max(stack_size, index + 1);
+        };
+        for (auto const& operation: operations) {
+            for_each_read(operation, update);
+            if (auto const written = written_index(operation); written.has_value()) {
+                update(*written);
+            }
+        }
+        return stack_size;
+    }
+
+    using OptimizeReturn = std::vector<Operation>;
+
+    // Removes the operations not marked in `keep`, jumps to a removed operation continue at the
+    // next kept one
+    constexpr OptimizeReturn
+    remove_operations(
+            std::span<Operation const> const operations,
+            std::vector<bool> const& keep) noexcept {
+        auto indexes = std::vector<std::size_t>(operations.size() + 1);
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            indexes[i + 1] = indexes[i] + (keep[i] ? 1 : 0);
+        }
+        auto result = OptimizeReturn{};
+        result.reserve(indexes.back());
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            if (keep[i]) {
+                result.push_back(map_target(
+                        operations[i], [&indexes](std::size_t const target) {
+                            return indexes[target];
+                        }));
+            }
+        }
+        return result;
+    }
+
+    // Lexeme index of the last LocationOperation in front of every other operation
+    constexpr std::vector<std::size_t>
+    find_locations(std::span<Operation const> const operations) noexcept {
+        auto result = std::vector<std::size_t>{};
+        auto lexeme = std::size_t{0};
+        for (auto const& operation: operations) {
+            if (auto const* const location = std::get_if<LocationOperation>(&operation)) {
+                lexeme = location->lexeme;
+            } else {
+                result.push_back(lexeme);
+            }
+        }
+        return result;
+    }
+
+    constexpr OptimizeReturn
+    remove_locations(std::span<Operation const> const operations) noexcept {
+        auto keep = std::vector<bool>(operations.size());
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            keep[i] = not std::holds_alternative<LocationOperation>(operations[i]);
+        }
+        return remove_operations(operations, keep);
+    }
+
+    // Set of stack slots with one bit per slot, whole words are merged at once which keeps the
+    // dataflow iterations cheap during constant evaluation
+    struct SlotSet final {
+        std::vector<std::uint64_t> words;
+
+        constexpr explicit SlotSet(std::size_t const stack_size = 0)
+            : words((stack_size + 63) / 64) {
+        }
+
+        [[nodiscard]] constexpr bool
+        contains(std::size_t const slot) const noexcept {
+            return ((words[slot / 64] >> (slot % 64)) & 1U) != 0U;
+        }
+
+        constexpr void
+        insert(std::size_t const slot) noexcept {
+            words[slot / 64] |= std::uint64_t{1} << (slot % 64);
+        }
+
+        constexpr void
+        erase(std::size_t const slot) noexcept {
+            words[slot / 64] &= ~(std::uint64_t{1} << (slot % 64));
+        }
+
+        constexpr void
+        merge(SlotSet const& other) noexcept {
+            for (auto i = std::size_t{0}; i < words.size(); ++i) {
+                words[i] |= other.words[i];
+            }
+        }
+
+        constexpr bool
+        operator==(SlotSet const&) const noexcept = default;
+    };
+
+    // Slots whose value may still be read when the operation at each index starts, one past the
+    // end stands for leaving the function
+    using LiveSlots = std::vector<SlotSet>;
+
+    // Slots live right after the operation at `index` given the slots live at every operation
+    constexpr SlotSet
+    live_after(
+            LiveSlots const& live,
+            std::span<Operation const> const operations,
+            std::size_t const index) noexcept {
+        auto result = SlotSet{};
+        result.words.resize(live.back().words.size());
+        if (falls_through(operations[index])) {
+            result.merge(live[index + 1]);
+        }
+        if (auto const target = jump_target(operations[index]); target.has_value()) {
+            result.merge(live[*target]);
+        }
+        return result;
+    }
+
+    // Backward liveness, iterated to a fixpoint since loops make values flow backwards
+    constexpr LiveSlots
+    find_live_slots(
+            std::span<Operation const> const operations,
+            std::size_t const stack_size) noexcept {
+        auto live = LiveSlots(operations.size() + 1, SlotSet{stack_size});
+        auto changed = true;
+        while (changed) {
+            changed = false;
+            for (auto i = operations.size(); i-- > 0;) {
+                auto next = live_after(live, operations, i);
+                if (auto const written = written_index(operations[i]); written.has_value()) {
+                    next.erase(*written);
+                }
+                for_each_read(operations[i], [&next](std::size_t const index) {
+                    next.insert(index);
+                });
+                if (next != live[i]) {
+                    live[i] = std::move(next);
+                    changed = true;
+                }
+            }
+        }
+        return live;
+    }
+
+    // Removes operations no path from the first operation reaches
+    constexpr OptimizeReturn
+    eliminate_unreachable_operations(std::span<Operation const> const operations) noexcept {
+        auto reachable = std::vector<bool>(operations.size());
+        auto pending = std::vector<std::size_t>{0};
+        while (not pending.empty()) {
+            auto const index = pending.back();
+            pending.pop_back();
+            if (index >= operations.size() or reachable[index]) {
+                continue;
+            }
+            reachable[index] = true;
+            if (falls_through(operations[index])) {
+                pending.push_back(index + 1);
+            }
+            if (auto const target = jump_target(operations[index]); target.has_value()) {
+                pending.push_back(*target);
+            }
+        }
+        return remove_operations(operations, reachable);
+    }
+
+    // Replaces binary operations, lengths, slices, dictionary probes and copies of values known at
+    // compile time with constants, squares with multiplications and selections by a known
+    // condition with copies. Operations which fail are left for run time. What is known is
+    // forgotten at jump targets, which can be reached with other values.
+    constexpr OptimizeReturn
+    fold_constants(std::span<Operation const> const operations) noexcept {
+        auto constants = std::vector<std::optional<Variable>>(determine_stack_size(operations));
+        auto const jump_targets = find_jump_targets(operations);
+        auto result = OptimizeReturn{};
+        result.reserve(operations.size());
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            if (jump_targets[i]) {
+                std::ranges::fill(constants, std::nullopt);
+            }
+            auto folded = std::visit(
+                    [&]<class T>(T const& operation) -> Operation {
+                        if constexpr (is_binary_operation<T>) {
+                            using Operator = T::operator_type;
+                            auto const& lhs = constants[operation.lhs];
+                            auto const& rhs = constants[operation.rhs];
+                            if (std::is_same_v<Operator, Power> and not lhs.has_value() and
+                                rhs == Variable{2}) {
+                                return MultiplicationOperation{
+                                        operation.lhs, operation.lhs, operation.target};
+                            }
+                            if (lhs.has_value() and rhs.has_value() and
+                                not fails<Operator>(*lhs, *rhs)) {
+                                return ConstantOperation{
+                                        operation.target, evaluate(Operator{}, *lhs, *rhs)};
+                            }
+                        } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                            if (constants[operation.from].has_value()) {
+                                return ConstantOperation{operation.to, *constants[operation.from]};
+                            }
+                        } else if constexpr (std::is_same_v<T, SelectOperation>) {
+                            auto const& condition = constants[operation.condition];
+                            auto const from =
+                                    condition.has_value() and truthy(*condition)
+                                            ? operation.if_true
+                                            : operation.if_false;
+                            if (condition.has_value() or operation.if_true == operation.if_false) {
+                                if (constants[from].has_value()) {
+                                    return ConstantOperation{operation.target, *constants[from]};
+                                }
+                                return AssignOperation{from, operation.target};
+                            }
+                        } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                            if (constants[operation.from].has_value()) {
+                                return ConstantOperation{
+                                        operation.to, length(*constants[operation.from])};
+                            }
+                        } else if constexpr (std::is_same_v<T, SliceOperation>) {
+                            auto const& value = constants[operation.value];
+                            auto const& begin = constants[operation.begin];
+                            auto const& end = constants[operation.end];
+                            if (value.has_value() and begin.has_value() and end.has_value()) {
+                                return ConstantOperation{
+                                        operation.target, slice(*value, *begin, *end)};
+                            }
+                        } else if constexpr (is_dictionary_operation<T>) {
+                            // Keys known at compile time are looked up at compile time unless
+                            // they are missing
+                            auto const& key = constants[operation.key];
+                            if (key.has_value() and
+                                not fails<typename T::probe_type>(*operation.dictionary, *key)) {
+                                return ConstantOperation{
+                                        operation.target,
+                                        Variable{typename T::probe_type{}(
+                                                *operation.dictionary, *key)}};
+                            }
+                        }
+                        return operation;
+                    },
+                    operations[i]);
+            if (auto const written = written_index(folded); written.has_value()) {
+                auto const* const constant = std::get_if<ConstantOperation>(&folded);
+                constants[*written] = constant != nullptr ? std::optional<Variable>{constant->value}
+                                                          : std::nullopt;
+            }
+            result.push_back(folded);
+        }
+        return result;
+    }
+
+    // Binary operator and the value numbers of its operands
+    struct Expression final {
+        std::size_t operator_index;
+        std::size_t lhs;
+        std::size_t rhs;
+
+        constexpr bool
+        operator==(Expression const&) const noexcept = default;
+    };
+
+    template<class Operator>
+    inline constexpr auto is_commutative =
+            std::is_same_v<Operator, Plus> or std::is_same_v<Operator, Multiplies> or
+            std::is_same_v<Operator, Comparison<std::equal_to<>>> or
+            std::is_same_v<Operator, Comparison<std::not_equal_to<>>>;
+
+    // Value numbering: every value a slot takes gets a number, equal for copies and equal
+    // constants, and a binary operation on values some slot already holds the result of becomes a
+    // copy of that slot. Numbers are forgotten at jump targets like in fold_constants, so common
+    // subexpressions are found across straight-line code and conditionals but not across merges.
+    constexpr OptimizeReturn
+    eliminate_common_subexpressions(std::span<Operation const> const operations) noexcept {
+        auto const stack_size = determine_stack_size(operations);
+        auto const jump_targets = find_jump_targets(operations);
+        auto values = std::vector<std::size_t>(stack_size);
+        auto constants = std::vector<std::pair<Variable, std::size_t>>{};
+        auto expressions = std::vector<std::pair<Expression, std::size_t>>{};
+        auto next_value = std::size_t{0};
+        auto const forget = [&]() {
+            for (auto& value: values) {
+                value = next_value++;
+            }
+            constants.clear();
+            expressions.clear();
+        };
+        auto result = OptimizeReturn{};
+        result.reserve(operations.size());
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            if (i == 0 or jump_targets[i]) {
+                forget();
+            }
+            auto const written = written_index(operations[i]);
+            auto value = next_value;
+            auto replaced = std::visit(
+                    [&]<class T>(T const& operation) -> Operation {
+                        if constexpr (is_binary_operation<T>) {
+                            auto expression = Expression{
+                                    operations[i].index(),
+                                    values[operation.lhs],
+                                    values[operation.rhs]};
+                            if (is_commutative<typename T::operator_type> and
+                                expression.lhs > expression.rhs) {
+                                std::swap(expression.lhs, expression.rhs);
+                            }
+                            auto const known = std::ranges::find(
+                                    expressions,
+                                    expression,
+                                    &decltype(expressions)::value_type::first);
+                            if (known == expressions.end()) {
+                                expressions.emplace_back(expression, value);
+                            } else {
+                                value = known->second;
+                                auto const holder = std::ranges::find(values, value);
+                                if (holder != values.end()) {
+                                    return AssignOperation{
+                                            static_cast<std::size_t>(holder - values.begin()),
+                                            operation.target};
+                                }
+                            }
+                        } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                            value = values[operation.from];
+                        } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+                            auto const known = std::ranges::find(
+                                    constants,
+                                    operation.value,
+                                    &decltype(constants)::value_type::first);
+                            if (known == constants.end()) {
+                                constants.emplace_back(operation.value, value);
+                            } else {
+                                value = known->second;
+                            }
+                        }
+                        return operation;
+                    },
+                    operations[i]);
+            if (written.has_value()) {
+                values[*written] = value;
+                next_value += value == next_value ? 1 : 0;
+            }
+            result.push_back(replaced);
+        }
+        return result;
+    }
+
+    // Reads from copies are redirected to the original while neither of them is overwritten or a
+    // jump target is reached
+    constexpr OptimizeReturn
+    propagate_copies(std::span<Operation const> const operations) noexcept {
+        auto const stack_size = determine_stack_size(operations);
+        auto const jump_targets = find_jump_targets(operations);
+        auto sources = std::vector<std::size_t>(stack_size);
+        auto const forget = [&sources]() {
+            for (auto i = std::size_t{0}; i < sources.size(); ++i) {
+                sources[i] = i;
+            }
+        };
+        forget();
+        auto result = OptimizeReturn{};
+        result.reserve(operations.size());
+        auto keep = std::vector<bool>(operations.size(), true);
+        for (auto index = std::size_t{0}; index < operations.size(); ++index) {
+            if (jump_targets[index]) {
+                forget();
+            }
+            auto propagated = map_reads(
+                    operations[index],
+                    [&sources](std::size_t const read) { return sources[read]; });
+            if (auto const written = written_index(propagated); written.has_value()) {
+                for (auto i = std::size_t{0}; i < stack_size; ++i) {
+                    if (sources[i] == *written) {
+                        sources[i] = i;
+                    }
+                }
+                sources[*written] = *written;
+                if (auto const* const assign = std::get_if<AssignOperation>(&propagated)) {
+                    keep[index] = assign->from != assign->to;
+                    sources[assign->to] = assign->from;
+                }
+            }
+            result.push_back(propagated);
+        }
+        return remove_operations(result, keep);
+    }
+
+    // Removes stores whose value is never read on any path before being overwritten, repeated
+    // until the removed stores do not leave the stores of their operands dead. Operations which
+    // may fail stay even if their value is dead, since removing them would hide their error.
+    constexpr OptimizeReturn
+    eliminate_dead_stores(std::span<Operation const> const operations) noexcept {
+        auto result = OptimizeReturn(operations.begin(), operations.end());
+        while (true) {
+            auto const live = find_live_slots(result, determine_stack_size(result));
+            auto keep = std::vector<bool>(result.size(), true);
+            for (auto i = std::size_t{0}; i < result.size(); ++i) {
+                if (auto const written = written_index(result[i]); written.has_value()) {
+                    keep[i] = may_fail(result[i]) or live_after(live, result, i).contains(*written);
+                }
+            }
+            if (std::ranges::find(keep, false) == keep.end()) {
+                return result;
+            }
+            result = remove_operations(result, keep);
+        }
+    }
+
+    // Index of the branch leaving the loop from `header` to `end`, its back jump, if the
+    // operations in front of it only compute its condition: they are not continued at by other
+    // jumps than to the header, neither jump, call nor return and overwrite no slot they read
+    // first, so a copy of them in front of the loop tests whether it is entered
+    constexpr std::optional<std::size_t>
+    find_loop_test(
+            std::span<Operation const> const operations,
+            std::vector<bool> const& jump_targets,
+            std::size_t const header,
+            std::size_t const end) noexcept {
+        auto read_first = std::vector<bool>(determine_stack_size(operations));
+        auto written = std::vector<bool>(read_first.size());
+        for (auto i = header; i < end; ++i) {
+            if (i != header and jump_targets[i]) {
+                return std::nullopt;
+            }
+            auto const* const branch = std::get_if<BranchOperation>(&operations[i]);
+            if (branch != nullptr and branch->target == end + 1) {
+                return i;
+            }
+            if (jump_target(operations[i]).has_value() or not falls_through(operations[i]) or
+                std::holds_alternative<CallOperation>(operations[i]) or
+                std::holds_alternative<YieldOperation>(operations[i])) {
+                return std::nullopt;
+            }
+            for_each_read(operations[i], [&](std::size_t const index) {
+                read_first[index] = read_first[index] or not written[index];
+            });
+            if (auto const index = written_index(operations[i]); index.has_value()) {
+                if (read_first[*index]) {
+                    return std::nullopt;
+                }
+                written[*index] = true;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Whether the operation at `end` is only reached through the operations from `begin` on,
+    // which run one after another without failing
+    constexpr bool
+    runs_through(
+            std::span<Operation const> const operations,
+            std::vector<bool> const& jump_targets,
+            std::size_t const begin,
+            std::size_t const end) noexcept {
+        for (auto i = begin; i <= end; ++i) {
+            if (jump_targets[i]) {
+                return false;
+            }
+        }
+        return std::ranges::none_of(
+                operations.subspan(begin, end - begin), [](Operation const& operation) {
+                    return jump_target(operation).has_value() or not falls_through(operation) or
+                           may_fail(operation) or std::holds_alternative<YieldOperation>(operation);
+                });
+    }
+
+    // Moves an operation out of a loop if it computes the same value in every iteration: it only
+    // reads slots the loop never writes, it is the only write to its slot in the loop and that
+    // slot is neither live when the loop starts nor after it, so computing it once in front of
+    // the loop, even if the loop is never entered, cannot be observed. Operations which may fail
+    // must not fail for loops which are never entered or before the operations they follow, so
+    // they are only moved if they run right after the loop test, see find_loop_test, and behind
+    // a copy of it. Moves one operation per call, optimize iterates.
+    constexpr OptimizeReturn
+    hoist_loop_invariants(std::span<Operation const> const operations) noexcept {
+        auto const stack_size = determine_stack_size(operations);
+        auto const live = find_live_slots(operations, stack_size);
+        auto const jump_targets = find_jump_targets(operations);
+        for (auto end = std::size_t{0}; end < operations.size(); ++end) {
+            auto const* const jump = std::get_if<JumpOperation>(&operations[end]);
+            if (jump == nullptr or jump->target > end) {
+                continue;
+            }
+            auto const header = jump->target;
+            auto writes = std::vector<std::size_t>(stack_size);
+            for (auto i = header; i < end; ++i) {
+                if (auto const written = written_index(operations[i]); written.has_value()) {
+                    ++writes[*written];
+                }
+            }
+            auto const test = find_loop_test(operations, jump_targets, header, end);
+            for (auto i = header; i < end; ++i) {
+                auto const written = written_index(operations[i]);
+                if (not written.has_value() or writes[*written] != 1 or
+                    live[header].contains(*written) or live[end + 1].contains(*written)) {
+                    continue;
+                }
+                auto invariant = true;
+                for_each_read(operations[i], [&](std::size_t const index) {
+                    invariant = invariant and writes[index] == 0;
+                });
+                if (not invariant) {
+                    continue;
+                }
+                // Operations of the loop test copied in front of the moved operation
+                auto guard = std::size_t{0};
+                if (may_fail(operations[i])) {
+                    if (not test.has_value() or *test > i or
+                        not runs_through(operations, jump_targets, *test + 1, i)) {
+                        continue;
+                    }
+                    guard = *test - header + 1;
+                }
+                auto const map = [&](std::size_t const target, bool const inside) {
+                    if (target == header) {
+                        return inside ? header + guard + 1 : header;
+                    } else if (target > header and target <= i) {
+                        return target + guard + 1;
+                    }
+                    return target > i ? target + guard : target;
+                };
+                auto result = OptimizeReturn{};
+                result.reserve(operations.size() + guard);
+                for (auto index = std::size_t{0}; index < operations.size(); ++index) {
+                    if (index == header) {
+                        for (auto copied = header; copied < header + guard; ++copied) {
+                            result.push_back(map_target(
+                                    operations[copied],
+                                    [&](std::size_t const target) { return map(target, false); }));
+                        }
+                        result.push_back(operations[i]);
+                    }
+                    if (index == i) {
+                        continue;
+                    }
+                    auto const inside = index >= header and index <= end;
+                    result.push_back(map_target(
+                            operations[index],
+                            [&](std::size_t const target) { return map(target, inside); }));
+                }
+                return result;
+            }
+        }
+        return OptimizeReturn(operations.begin(), operations.end());
+    }
+
+    // Register allocation over the stack: every slot's live range spans from the first to the
+    // last position where its value is written or live and ranges are assigned the lowest slot
+    // free at their start, so temporaries share slots and the used slots stay dense in order of
+    // first use. Position 2i stands for the reads of operation i and 2i + 1 for its write, so a
+    // value may take over the slot of an operand read by the same operation. Parameters keep the
+    // first `parameters_count` slots until their last read.
+    constexpr OptimizeReturn
+    allocate_slots(
+            std::span<Operation const> const operations,
+            std::size_t const parameters_count = 0) noexcept {
+        auto const stack_size = std::max(determine_stack_size(operations), parameters_count);
+        auto const live = find_live_slots(operations, stack_size);
+        constexpr auto unassigned = std::numeric_limits<std::size_t>::max();
+        auto first = std::vector<std::size_t>(stack_size, unassigned);
+        auto last = std::vector<std::size_t>(stack_size);
+        auto const extend = [&](std::size_t const slot, std::size_t const position) {
+            first[slot] = std::min(first[slot], position);
+            last[slot] = std::max(last[slot], position);
+        };
+        for (auto i = std::size_t{0}; i < operations.size(); ++i) {
+            for (auto slot = std::size_t{0}; slot < stack_size; ++slot) {
+                if (live[i].contains(slot)) {
+                    extend(slot, 2 * i);
+                }
+            }
+            if (auto const written = written_index(operations[i]); written.has_value()) {
+                extend(*written, 2 * i + 1);
+            }
+        }
+        auto assignments = std::vector<std::size_t>(stack_size, unassigned);
+        auto occupied_until = std::vector<std::size_t>{};
+        for (auto slot = std::size_t{0}; slot < parameters_count; ++slot) {
+            extend(slot, 0);
+            assignments[slot] = slot;
+            occupied_until.push_back(last[slot]);
+        }
+        auto order = std::vector<std::size_t>{};
+        for (auto slot = parameters_count; slot < stack_size; ++slot) {
+            if (first[slot] != unassigned) {
+                order.push_back(slot);
+            }
+        }
+        std::ranges::sort(order, [&first](std::size_t const lhs, std::size_t const rhs) {
+            return std::pair{first[lhs], lhs} < std::pair{first[rhs], rhs};
+        });
+        for (auto const slot: order) {
+            auto const free = std::ranges::find_if(
+                    occupied_until, [&](std::size_t const until) { return until < first[slot]; });
+            assignments[slot] = static_cast<std::size_t>(free - occupied_until.begin());
+            if (free == occupied_until.end()) {
+                occupied_until.push_back(last[slot]);
+            } else {
+                *free = last[slot];
+            }
+        }
+        auto result = OptimizeReturn{};
+        result.reserve(operations.size());
+        auto const assigned = [&assignments](std::size_t const slot) { return assignments[slot]; };
+        for (auto const& operation: operations) {
+            result.push_back(map_write(map_reads(operation, assigned), assigned));
+        }
+        return result;
+    }
+
+    // Callees with more operations are called instead of inlined
+    inline constexpr auto inline_operation_limit = std::size_t{16};
+
+    // Whether the optimized operations of a callee can be spliced into a caller: they are small,
+    // call nothing themselves, return only at the end, so leaving them needs no jump, and do not
+    // yield. Source locations do not count, so profiling inlines the same calls.
+    constexpr bool
+    is_inlinable(std::span<Operation const> const operations) noexcept {
+        auto const locations = std::ranges::count_if(operations, [](auto const& op) {
+            return std::holds_alternative<LocationOperation>(op);
+        });
+        auto const size = operations.size() - static_cast<std::size_t>(locations);
+        return not operations.empty() and size <= inline_operation_limit and
+               std::holds_alternative<ReturnOperation>(operations.back()) and
+               std::ranges::none_of(operations.first(operations.size() - 1), [](auto const& op) {
+                   return std::holds_alternative<ReturnOperation>(op) or
+                          std::holds_alternative<CallOperation>(op) or
+                          std::holds_alternative<YieldOperation>(op);
+               });
+    }
+
+    // Replaces the CallOperation at `index` with `callee`, an inlinable function whose slots are
+    // moved past the caller's: the arguments are copied into the callee's parameter slots and its
+    // return becomes a copy into the call's target
+    constexpr OptimizeReturn
+    inline_call(
+            std::span<Operation const> const operations,
+            std::size_t const index,
+            std::span<Operation const> const callee,
+            std::size_t const parameters_count = 0) noexcept {
+        auto const& call = std::get<CallOperation>(operations[index]);
+        auto const offset = std::max(determine_stack_size(operations), parameters_count);
+        auto const inlined_count = call.arguments_count + callee.size();
+        auto const shift = [&](std::size_t const target) {
+            return target > index ? target + inlined_count - 1 : target;
+        };
+        auto const move_slot = [offset](std::size_t const slot) { return slot + offset; };
+        auto result = OptimizeReturn{};
+        result.reserve(operations.size() + inlined_count - 1);
+        for (auto i = std::size_t{0}; i < index; ++i) {
+            result.push_back(map_target(operations[i], shift));
+        }
+        for (auto i = std::size_t{0}; i < call.arguments_count; ++i) {
+            result.emplace_back(AssignOperation{call.arguments[i], offset + i});
+        }
+        auto const begin = result.size();
+        for (auto const& operation: callee.first(callee.size() - 1)) {
+            result.push_back(map_target(
+                    map_write(map_reads(operation, move_slot), move_slot),
+                    [begin](std::size_t const target) { return target + begin; }));
+        }
+        result.emplace_back(AssignOperation{
+                move_slot(std::get<ReturnOperation>(callee.back()).stack_index), call.target});
+        for (auto i = index + 1; i < operations.size(); ++i) {
+            result.push_back(map_target(operations[i], shift));
+        }
+        return result;
+    }
+
+    // Runs all passes until none of them changes the operations anymore
+    inline constexpr auto optimize =
+            [](std::span<Operation const> const operations) constexpr noexcept -> OptimizeReturn {
+        auto result = OptimizeReturn(operations.begin(), operations.end());
+        while (true) {
+            auto next = hoist_loop_invariants(eliminate_dead_stores(propagate_copies(
+                    eliminate_common_subexpressions(
+                            fold_constants(eliminate_unreachable_operations(result))))));
+            if (next == result) {
+                return result;
+            }
+            result = std::move(next);
+        }
+    };
+
+}  // namespace detail
+
+}  // namespace ctpy
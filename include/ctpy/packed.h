@@ -0,0 +1,300 @@
+#pragma once
+
+#include "function.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ctpy {
+
+// Operation in at most four narrow fields: the index of its alternative in Operation as opcode
+// and up to three operands. Constants, call arguments, the values a SelectOperation chooses from,
+// the bounds of a SliceOperation and the dictionaries probed live in pools next to the
+// operations.
+template<class Index>
+struct PackedOperation final {
+    std::uint8_t opcode = 0;
+    Index a = 0;
+    Index b = 0;
+    Index c = 0;
+
+    constexpr bool
+    operator==(PackedOperation const&) const noexcept = default;
+};
+
+// Smallest unsigned type holding every operand up to `max_operand`
+template<std::size_t max_operand>
+using PackedIndex = std::conditional_t<
+        max_operand <= std::numeric_limits<std::uint8_t>::max(),
+        std::uint8_t,
+        std::conditional_t<
+                max_operand <= std::numeric_limits<std::uint16_t>::max(),
+                std::uint16_t,
+                std::uint32_t>>;
+
+// Operations of a function with their deduplicated constants and further operands: the argument
+// slots of their calls, every argument list preceded by its length, both values of their
+// selections, both bounds of their slices and the deduplicated dictionaries they probe
+template<
+        class Index,
+        std::size_t operation_count,
+        std::size_t constant_count,
+        std::size_t argument_count,
+        std::size_t dictionary_count>
+struct PackedOperations final {
+    std::array<PackedOperation<Index>, operation_count> operations = {};
+    std::array<Variable, constant_count> constants = {};
+    std::array<Index, argument_count> arguments = {};
+    std::array<Dictionary const*, dictionary_count> dictionaries = {};
+
+    constexpr bool
+    operator==(PackedOperations const&) const noexcept = default;
+};
+
+namespace detail {
+
+    static_assert(std::variant_size_v<Operation> <= std::numeric_limits<std::uint8_t>::max());
+
+    // Packed operations before their operands are narrowed
+    struct Packing final {
+        std::vector<PackedOperation<std::size_t>> operations;
+        std::vector<Variable> constants;
+        std::vector<std::size_t> arguments;
+        std::vector<Dictionary const*> dictionaries;
+        std::size_t max_operand = 0;
+    };
+
+    constexpr PackedOperation<std::size_t>
+    pack_operation(Operation const& operation, Packing& packing) {
+        auto packed = std::visit(
+                [&packing]<class T>(T const& operation) -> PackedOperation<std::size_t> {
+                    if constexpr (is_binary_operation<T>) {
+                        return {0, operation.lhs, operation.rhs, operation.target};
+                    } else if constexpr (std::is_same_v<T, AssignOperation>) {
+                        return {0, operation.from, operation.to};
+                    } else if constexpr (std::is_same_v<T, BranchOperation>) {
+                        return {0, operation.condition, operation.target};
+                    } else if constexpr (std::is_same_v<T, CallOperation>) {
+                        auto const offset = packing.arguments.size();
+                        packing.arguments.push_back(operation.arguments_count);
+                        packing.arguments.insert(
+                                packing.arguments.end(),
+                                operation.arguments.begin(),
+                                operation.arguments.begin() +
+                                        static_cast<std::ptrdiff_t>(operation.arguments_count));
+                        return {0, operation.function, offset, operation.target};
+                    } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+                        auto& constants = packing.constants;
+                        auto const existing = std::ranges::find(constants, operation.value);
+                        auto const pool_index =
+                                static_cast<std::size_t>(existing - constants.begin());
+                        if (existing == constants.end()) {
+                            constants.push_back(operation.value);
+                        }
+                        return {0, pool_index, operation.index};
+                    } else if constexpr (is_dictionary_operation<T>) {
+                        auto& dictionaries = packing.dictionaries;
+                        auto const existing = std::ranges::find(dictionaries, operation.dictionary);
+                        auto const pool_index =
+                                static_cast<std::size_t>(existing - dictionaries.begin());
+                        if (existing == dictionaries.end()) {
+                            dictionaries.push_back(operation.dictionary);
+                        }
+                        return {0, operation.key, pool_index, operation.target};
+                    } else if constexpr (std::is_same_v<T, JumpOperation>) {
+                        return {0, operation.target};
+                    } else if constexpr (std::is_same_v<T, LengthOperation>) {
+                        return {0, operation.from, operation.to};
+                    } else if constexpr (std::is_same_v<T, LocationOperation>) {
+                        return {0, operation.lexeme};
+                    } else if constexpr (std::is_same_v<T, SelectOperation>) {
+                        auto const offset = packing.arguments.size();
+                        packing.arguments.push_back(operation.if_true);
+                        packing.arguments.push_back(operation.if_false);
+                        return {0, operation.condition, offset, operation.target};
+                    } else if constexpr (std::is_same_v<T, SliceOperation>) {
+                        auto const offset = packing.arguments.size();
+                        packing.arguments.push_back(operation.begin);
+                        packing.arguments.push_back(operation.end);
+                        return {0, operation.value, offset, operation.target};
+                    } else {
+                        static_assert(
+                                std::is_same_v<T, ReturnOperation> or
+                                std::is_same_v<T, YieldOperation>);
+                        return {0, operation.stack_index};
+                    }
+                },
+                operation);
+        packed.opcode = static_cast<std::uint8_t>(operation.index());
+        return packed;
+    }
+
+    constexpr Packing
+    pack_operations(std::span<Operation const> const operations) {
+        auto packing = Packing{};
+        packing.max_operand = operations.size();
+        for (auto const& operation: operations) {
+            packing.operations.push_back(pack_operation(operation, packing));
+            auto const& packed = packing.operations.back();
+            packing.max_operand = std::max({packing.max_operand, packed.a, packed.b, packed.c});
+        }
+        for (auto const argument: packing.arguments) {
+            packing.max_operand = std::max(packing.max_operand, argument);
+        }
+        return packing;
+    }
+
+    struct PackingSizes final {
+        std::size_t constant_count;
+        std::size_t argument_count;
+        std::size_t dictionary_count;
+        std::size_t max_operand;
+    };
+
+    template<auto const& function>
+    inline constexpr auto packing_sizes = [] {
+        auto const packing = pack_operations(function.operations);
+        return PackingSizes{
+                packing.constants.size(),
+                packing.arguments.size(),
+                packing.dictionaries.size(),
+                packing.max_operand};
+    }();
+
+    template<auto const& function>
+    constexpr auto
+    pack() {
+        using Index = PackedIndex<packing_sizes<function>.max_operand>;
+        auto const packing = pack_operations(function.operations);
+        auto result = PackedOperations<
+                Index,
+                function.operations.size(),
+                packing_sizes<function>.constant_count,
+                packing_sizes<function>.argument_count,
+                packing_sizes<function>.dictionary_count>{};
+        auto const narrow = [](std::size_t const operand) { return static_cast<Index>(operand); };
+        std::ranges::transform(
+                packing.operations,
+                result.operations.begin(),
+                [&narrow](PackedOperation<std::size_t> const& operation) {
+                    return PackedOperation<Index>{
+                            operation.opcode,
+                            narrow(operation.a),
+                            narrow(operation.b),
+                            narrow(operation.c)};
+                });
+        std::ranges::copy(packing.constants, result.constants.begin());
+        std::ranges::transform(packing.arguments, result.arguments.begin(), narrow);
+        std::ranges::copy(packing.dictionaries, result.dictionaries.begin());
+        return result;
+    }
+
+    // The operation `operation` was packed from
+    template<class T>
+    constexpr T
+    unpack(auto const& packed, auto const& operation) noexcept {
+        if constexpr (is_binary_operation<T>) {
+            return T{operation.a, operation.b, operation.c};
+        } else if constexpr (
+                std::is_same_v<T, AssignOperation> or std::is_same_v<T, BranchOperation> or
+                std::is_same_v<T, LengthOperation>) {
+            return T{operation.a, operation.b};
+        } else if constexpr (std::is_same_v<T, CallOperation>) {
+            auto call = CallOperation{operation.a, {}, packed.arguments[operation.b], operation.c};
+            for (auto i = std::size_t{0}; i < call.arguments_count; ++i) {
+                call.arguments[i] = packed.arguments[operation.b + 1 + i];
+            }
+            return call;
+        } else if constexpr (std::is_same_v<T, ConstantOperation>) {
+            return T{operation.b, packed.constants[operation.a]};
+        } else if constexpr (is_dictionary_operation<T>) {
+            return T{operation.a, packed.dictionaries[operation.b], operation.c};
+        } else if constexpr (std::is_same_v<T, SelectOperation>) {
+            return T{operation.a,
+                     packed.arguments[operation.b],
+                     packed.arguments[operation.b + 1],
+                     operation.c};
+        } else if constexpr (std::is_same_v<T, SliceOperation>) {
+            return T{operation.a,
+                     packed.arguments[operation.b],
+                     packed.arguments[operation.b + 1],
+                     operation.c};
+        } else {
+            return T{operation.a};
+        }
+    }
+
+    // Runs the packed operation at `index` like step and returns the index of the operation to
+    // run next
+    template<auto const& packed>
+    constexpr std::size_t
+    step_packed(auto& stack, auto const& callees, std::size_t const index) {
+        auto const& operation = packed.operations[index];
+        return [&]<std::size_t... I>(std::index_sequence<I...>) {
+            auto next = std::size_t{0};
+            ((operation.opcode == I and
+              (next = step(unpack<std::variant_alternative_t<I, Operation>>(packed, operation),
+                           stack,
+                           callees,
+                           index,
+                           packed.operations.size()),
+               true)) or
+             ...);
+            return next;
+        }(std::make_index_sequence<std::variant_size_v<Operation>>{});
+    }
+
+}  // namespace detail
+
+// Function interpreting a packed copy of the operations of `function`: operands are narrowed to
+// the smallest type holding the largest stack slot, jump target, pool index or callee and
+// constants are moved to a deduplicated pool, so an operation takes 4 bytes for most functions
+// instead of the size of the Operation variant. Behaves like Function otherwise, CallOperations
+// are resolved by `callees` like in Function::call.
+template<auto const& function, auto const& callees = detail::no_callees>
+struct PackedFunction final {
+    using Traits = detail::FunctionTraits<std::remove_cvref_t<decltype(function)>>;
+
+    static constexpr auto packed = detail::pack<function>();
+
+    template<class... Parameters>
+    constexpr Variable
+    operator()(Parameters&&... parameters) const {
+        auto stack = detail::make_stack<Stack<Traits::stack_size>, Traits::signature>(
+                std::forward<Parameters>(parameters)...);
+        return run(stack);
+    }
+
+    constexpr Variable
+    call(std::span<Variable const> const arguments) const {
+        auto stack = Stack<Traits::stack_size>{};
+        std::ranges::transform(
+                arguments,
+                Traits::signature,
+                stack.variables.begin(),
+                [](auto const& argument, auto type) { return detail::annotate(type, argument); });
+        return run(stack);
+    }
+
+    constexpr bool
+    operator==(PackedFunction const&) const noexcept = default;
+
+  private:
+    static constexpr Variable
+    run(Stack<Traits::stack_size>& stack) {
+        for (auto index = std::size_t{0}; index < Traits::operation_count;) {
+            index = detail::record(function.profile, index, [&stack, index] {
+                return detail::step_packed<packed>(stack, callees, index);
+            });
+        }
+        return std::move(stack.return_value);
+    }
+};
+
+}  // namespace ctpy
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "batch.h"
+#include "function.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ctpy {
+
+// Thread pool with one task queue per worker: tasks are spread over the queues, a worker takes
+// the newest task of its own queue and steals the oldest one of another queue when its own is
+// empty, so uneven chunks keep every worker busy
+class ThreadPool final {
+  public:
+    explicit ThreadPool(std::size_t const thread_count = default_thread_count())
+        : queues(std::max(thread_count, std::size_t{1})) {
+        threads.reserve(queues.size());
+        for (auto worker = std::size_t{0}; worker < queues.size(); ++worker) {
+            threads.emplace_back(
+                    [this, worker](std::stop_token const stop) { work(stop, worker); });
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool&
+    operator=(ThreadPool const&) = delete;
+
+    ~ThreadPool() {
+        for (auto& thread: threads) {
+            thread.request_stop();
+        }
+        wakeup.notify_all();
+    }
+
+    // Pool shared by the parallel functions called without one, with a thread per core
+    static ThreadPool&
+    shared() {
+        static auto pool = ThreadPool{};
+        return pool;
+    }
+
+    [[nodiscard]] std::size_t
+    size() const noexcept {
+        return queues.size();
+    }
+
+    void
+    submit(std::function<void()> task) {
+        auto& queue = queues[next_queue++ % queues.size()];
+        {
+            auto const lock = std::scoped_lock{queue.mutex};
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            auto const lock = std::scoped_lock{sleep_mutex};
+            ++pending;
+        }
+        wakeup.notify_one();
+    }
+
+  private:
+    struct Queue final {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    static std::size_t
+    default_thread_count() noexcept {
+        return std::max(std::thread::hardware_concurrency(), 1U);
+    }
+
+    std::optional<std::function<void()>>
+    take(std::size_t const worker) {
+        for (auto i = std::size_t{0}; i < queues.size(); ++i) {
+            auto& queue = queues[(worker + i) % queues.size()];
+            auto const lock = std::scoped_lock{queue.mutex};
+            if (queue.tasks.empty()) {
+                continue;
+            } else if (i == 0) {
+                auto task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                return task;
+            }
+            auto task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return task;
+        }
+        return std::nullopt;
+    }
+
+    void
+    work(std::stop_token const stop, std::size_t const worker) {
+        while (true) {
+            {
+                auto lock = std::unique_lock{sleep_mutex};
+                if (not wakeup.wait(lock, stop, [this] { return pending > 0; })) {
+                    return;
+                }
+                --pending;
+            }
+            // Tasks are queued before they are counted, so every pending task is in some queue
+            if (auto task = take(worker); task.has_value()) {
+                (*task)();
+            }
+        }
+    }
+
+    std::vector<Queue> queues;
+    std::atomic<std::size_t> next_queue = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable_any wakeup;
+    std::size_t pending = 0;  // Guarded by sleep_mutex
+    std::vector<std::jthread> threads;  // Last, so the workers stop before the queues go
+};
+
+namespace detail {
+
+    // Rows below which batches run on the calling thread, splitting them costs more than it saves
+    inline constexpr auto parallel_threshold = std::size_t{1} << 16;
+
+    // Rows per task, a multiple of batch_size with a few tasks per thread so stealing can even
+    // out threads which fall behind
+    constexpr std::size_t
+    chunk_size(std::size_t const rows, std::size_t const thread_count) noexcept {
+        auto const chunks = thread_count * 4;
+        auto const size = (rows + chunks - 1) / chunks;
+        return std::max((size + batch_size - 1) / batch_size, std::size_t{1}) * batch_size;
+    }
+
+}  // namespace detail
+
+// Like batch, but large inputs are split into chunks which run on the threads of `pool`. The
+// rows are independent since functions have no side effects, so every chunk writes its own
+// range of `results`. The first exception a chunk throws, like for a division by zero, is
+// rethrown once all chunks are done.
+template<auto const& function, auto const& callees, class Results, class... Columns>
+    requires std::ranges::contiguous_range<Results> and
+             (std::ranges::contiguous_range<Columns const> and ...)
+void
+parallel_batch(
+        ThreadPool& pool,
+        LoweredFunction<function, callees> const function_,
+        Results&& results,
+        Columns const&... columns) {
+    auto const rows = std::ranges::size(results);
+    if (((std::ranges::size(columns) != rows) or ...)) {
+        throw std::invalid_argument{"Columns and results differ in size"};
+    }
+    if (rows < detail::parallel_threshold or pool.size() == 1) {
+        batch(function_, results, columns...);
+        return;
+    }
+    auto const chunk = detail::chunk_size(rows, pool.size());
+    auto const result_view = std::span{results};
+    auto done = std::latch{static_cast<std::ptrdiff_t>((rows + chunk - 1) / chunk)};
+    auto error = std::exception_ptr{};
+    auto error_mutex = std::mutex{};
+    for (auto offset = std::size_t{0}; offset < rows; offset += chunk) {
+        auto const count = std::min(chunk, rows - offset);
+        pool.submit([=, &done, &error, &error_mutex, ... views = std::span{columns}] {
+            try {
+                batch(function_,
+                      result_view.subspan(offset, count),
+                      views.subspan(offset, count)...);
+            } catch (...) {
+                auto const lock = std::scoped_lock{error_mutex};
+                if (error == nullptr) {
+                    error = std::current_exception();
+                }
+            }
+            done.count_down();
+        });
+    }
+    done.wait();
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    }
+}
+
+template<auto const& function, auto const& callees, class Results, class... Columns>
+    requires std::ranges::contiguous_range<Results> and
+             (std::ranges::contiguous_range<Columns const> and ...)
+void
+parallel_batch(
+        LoweredFunction<function, callees> const function_,
+        Results&& results,
+        Columns const&... columns) {
+    parallel_batch(ThreadPool::shared(), function_, std::forward<Results>(results), columns...);
+}
+
+// Python's map(function, values) over a single column into a new vector
+template<class Result, auto const& function, auto const& callees, class Values>
+    requires std::ranges::contiguous_range<Values const>
+std::vector<Result>
+parallel_map(LoweredFunction<function, callees> const function_, Values const& values) {
+    auto results = std::vector<Result>(std::ranges::size(values));
+    parallel_batch(function_, results, values);
+    return results;
+}
+
+}  // namespace ctpy
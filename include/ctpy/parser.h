@@ -1,147 +1,1835 @@
 #pragma once
 
 #include "function.h"
+#include "generator.h"
 #include "lexer.h"
+#include "optimizer.h"
+#include "packed.h"
+#include "table.h"
+#include <algorithm>
 #include <charconv>
+#include <limits>
+#include <optional>
 #include <span>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace ctpy {
 
 namespace detail {
 
-    // TODO: do more than integer parsing
+    // TODO: parse float literals
+    // Int literals which do not fit an int are rejected like int results which do not, see
+    // detail::narrow
     constexpr Variable
-    parse_literal_to_variable(Literal const& literal) noexcept {
+    parse_literal_to_variable(Literal const& literal) {
+        if (is_quote(literal.value.front())) {
+            // A view of the source, which the function keeps referring to
+            return Variable{literal.value.substr(1, literal.value.size() - 2)};
+        }
         auto value = 0;
-        std::from_chars(literal.value.data(), literal.value.data() + literal.value.size(), value);
+        auto const* const end = literal.value.data() + literal.value.size();
+        auto const [rest, error] = std::from_chars(literal.value.data(), end, value);
+        if (error == std::errc::result_out_of_range) {
+            throw std::out_of_range{"Integer literal does not fit an int"};
+        } else if (error != std::errc{} or rest != end) {
+            throw std::invalid_argument{"Could not parse literal"};
+        }
         return Variable{value};
     }
 
-    struct ParseReturnSubExpressionReturn final {
-        Operation operation;
-        std::size_t return_index;
+    // Function definition: its name, parameter names and annotations, the lexemes of its body and
+    // the domain of its `@table` decorator
+    struct Declaration final {
+        std::string_view name;
+        std::vector<std::string_view> parameters;
+        std::vector<Type> annotations;
+        std::span<Lexeme const> body;
+        std::optional<Domain> table;
+    };
+
+    // What a function body is parsed against: its parameters, which take the first stack slots in
+    // order, the functions it may call, which CallOperations refer to by index, the lexemes of
+    // the whole source when every statement is to be marked with a LocationOperation, the pool
+    // of the strings its functions build from constants, see collect_strings, and the pool of
+    // the dictionaries they probe, see collect_dictionaries
+    struct Scope final {
+        std::span<std::string_view const> parameters;
+        std::span<Declaration const> functions;
+        std::span<Lexeme const> source;
+        std::span<std::string_view const> strings;
+        std::span<Dictionary const> dictionaries;
+    };
+
+    // Entries of a dictionary literal in the order they are written
+    using DictionaryEntries = std::vector<std::pair<Variable, Variable>>;
+
+    // Names of variables and the stack slots holding their values
+    using Bindings = std::vector<std::pair<std::string_view, std::size_t>>;
+
+    // Operations of the function being parsed and the stack slots of its named variables, every
+    // intermediate value gets a fresh slot which allocate_slots compacts later. While parsing
+    // speculatively, assignments bind variables to fresh slots instead of overwriting them.
+    // Strings built from constants which are missing from the pool are kept in `built` for as
+    // long as the state lives, dictionaries missing from theirs in `dictionary_literals`.
+    // Dictionaries are not values, names bound to them refer to them for the rest of the
+    // function instead of to a stack slot.
+    struct ParseState final {
+        std::vector<Operation> operations;
+        Bindings variables;
+        std::size_t stack_size = 0;
+        std::span<Declaration const> functions;
+        std::span<Lexeme const> source;
+        std::span<std::string_view const> strings;
+        std::vector<std::vector<char>> built;
+        std::span<Dictionary const> dictionaries;
+        std::vector<DictionaryEntries> dictionary_literals;
+        std::vector<std::pair<std::string_view, Dictionary const*>> dictionary_names;
+        bool speculative = false;
+
+        constexpr explicit ParseState(Scope const& scope = {})
+            : functions{scope.functions},
+              source{scope.source},
+              strings{scope.strings},
+              dictionaries{scope.dictionaries} {
+            for (auto const parameter: scope.parameters) {
+                variable(parameter);
+            }
+        }
+
+        constexpr std::size_t
+        allocate() noexcept {
+            return stack_size++;
+        }
+
+        [[nodiscard]] constexpr std::optional<std::size_t>
+        find_variable(std::string_view const name) const noexcept {
+            auto const variable =
+                    std::ranges::find(variables, name, &decltype(variables)::value_type::first);
+            if (variable == variables.end()) {
+                return std::nullopt;
+            }
+            return variable->second;
+        }
+
+        [[nodiscard]] constexpr bool
+        is_variable(std::size_t const index) const noexcept {
+            return std::ranges::find(variables, index, &decltype(variables)::value_type::second) !=
+                   variables.end();
+        }
+
+        // Slot of the variable `name`, allocated on its first assignment
+        constexpr std::size_t
+        variable(std::string_view const name) noexcept {
+            if (auto const index = find_variable(name); index.has_value()) {
+                return *index;
+            }
+            variables.emplace_back(name, allocate());
+            return variables.back().second;
+        }
+
+        // Slot a value assigned to the variable `name` is stored to
+        constexpr std::size_t
+        bind(std::string_view const name) noexcept {
+            if (not speculative) {
+                return variable(name);
+            }
+            auto const slot = allocate();
+            auto const variable =
+                    std::ranges::find(variables, name, &decltype(variables)::value_type::first);
+            if (variable == variables.end()) {
+                variables.emplace_back(name, slot);
+            } else {
+                variable->second = slot;
+            }
+            return slot;
+        }
+
+        // Whether control flow merges after the last operation, which then may not be the only
+        // one computing its value
+        [[nodiscard]] constexpr bool
+        at_merge() const noexcept {
+            return std::ranges::any_of(operations, [this](Operation const& operation) {
+                return jump_target(operation) == operations.size();
+            });
+        }
+
+        // Constant the last operation stores to the temporary `index`, if it does
+        [[nodiscard]] constexpr ConstantOperation*
+        temporary_constant(std::size_t const index) noexcept {
+            auto* const constant =
+                    operations.empty() or is_variable(index)
+                            ? nullptr
+                            : std::get_if<ConstantOperation>(&operations.back());
+            return constant != nullptr and constant->index == index ? constant : nullptr;
+        }
+
+        // View of `lhs` followed by `rhs` in the string pool
+        constexpr std::string_view
+        concatenate(std::string_view const lhs, std::string_view const rhs) {
+            auto text = std::string{lhs};
+            text += rhs;
+            if (auto const pooled = std::ranges::find(strings, text); pooled != strings.end()) {
+                return *pooled;
+            }
+            auto const existing = std::ranges::find_if(built, [&text](auto const& string) {
+                return std::string_view{string.data(), string.size()} == text;
+            });
+            auto const& string = existing != built.end()
+                                         ? *existing
+                                         : built.emplace_back(text.begin(), text.end());
+            return {string.data(), string.size()};
+        }
+
+        // Dictionary of `entries` in the pool, null if it is missing from the pool
+        constexpr Dictionary const*
+        dictionary(DictionaryEntries const& entries) {
+            auto const pooled =
+                    std::ranges::find_if(dictionaries, [&entries](Dictionary const& dictionary) {
+                        return std::ranges::equal(dictionary.entries, entries);
+                    });
+            if (pooled != dictionaries.end()) {
+                return &*pooled;
+            } else if (std::ranges::find(dictionary_literals, entries) ==
+                       dictionary_literals.end()) {
+                dictionary_literals.push_back(entries);
+            }
+            return nullptr;
+        }
+
+        [[nodiscard]] constexpr std::optional<Dictionary const*>
+        find_dictionary(std::string_view const name) const noexcept {
+            auto const bound = std::ranges::find(
+                    dictionary_names, name, &decltype(dictionary_names)::value_type::first);
+            if (bound == dictionary_names.end()) {
+                return std::nullopt;
+            }
+            return bound->second;
+        }
+
+        // Binds `name` to `dictionary`, binding it again to the same one is allowed since blocks
+        // may be parsed twice
+        constexpr void
+        bind_dictionary(std::string_view const name, Dictionary const* dictionary) {
+            if (find_variable(name).has_value()) {
+                throw std::invalid_argument{"Variables cannot be assigned dictionaries"};
+            } else if (auto const bound = find_dictionary(name); bound.has_value()) {
+                if (*bound != dictionary) {
+                    throw std::invalid_argument{"Dictionaries cannot be reassigned"};
+                }
+                return;
+            }
+            dictionary_names.emplace_back(name, dictionary);
+        }
+
+        // Stores the value at `from` to `to`, by retargeting the operation which just computed
+        // the value when it is a temporary
+        constexpr void
+        store(std::size_t const from, std::size_t const to) noexcept {
+            if (not operations.empty() and not is_variable(from) and
+                written_index(operations.back()) == from and not at_merge()) {
+                operations.back() =
+                        map_write(operations.back(), [to](std::size_t) { return to; });
+            } else {
+                operations.emplace_back(AssignOperation{from, to});
+            }
+        }
+    };
+
+    struct ParseExpressionReturn final {
+        std::size_t index;  // Slot holding the value of the expression
+        std::span<Lexeme const> remaining_lexemes;
+    };
+
+    inline constexpr auto conditional_precedence = 0;  // Of `value if condition else other`
+    inline constexpr auto comparison_precedence = 1;
+    inline constexpr auto unary_precedence = 4;  // Between multiplicative operators and power
+    inline constexpr auto power_precedence = 5;
+
+    // Precedence of the binary operator `lexeme` stands for, 0 if it is none
+    constexpr int
+    binary_precedence(Lexeme const& lexeme) noexcept {
+        if (lexeme == Lexeme{Keyword::in}) {
+            return comparison_precedence;
+        }
+        auto const* const operator_ = std::get_if<Operator>(&lexeme);
+        if (operator_ == nullptr) {
+            return 0;
+        }
+        switch (*operator_) {
+            case Operator::equalequal:
+            case Operator::exclamequal:
+            case Operator::greater:
+            case Operator::greaterequal:
+            case Operator::less:
+            case Operator::lessequal:
+                return comparison_precedence;
+            case Operator::minus:
+            case Operator::plus:
+                return 2;
+            case Operator::asterisk:
+            case Operator::percent:
+            case Operator::slash:
+            case Operator::slashslash:
+                return 3;
+            case Operator::asteriskasterisk:
+                return power_precedence;
+            default:
+                return 0;
+        }
+    }
+
+    constexpr Operation
+    make_binary_operation(
+            Operator const operator_,
+            std::size_t const lhs,
+            std::size_t const rhs,
+            std::size_t const target) noexcept {
+        switch (operator_) {
+            case Operator::asterisk:
+                return MultiplicationOperation{lhs, rhs, target};
+            case Operator::asteriskasterisk:
+                return PowerOperation{lhs, rhs, target};
+            case Operator::equalequal:
+                return EqualOperation{lhs, rhs, target};
+            case Operator::exclamequal:
+                return NotEqualOperation{lhs, rhs, target};
+            case Operator::greater:
+                return GreaterOperation{lhs, rhs, target};
+            case Operator::greaterequal:
+                return GreaterEqualOperation{lhs, rhs, target};
+            case Operator::less:
+                return LessOperation{lhs, rhs, target};
+            case Operator::lessequal:
+                return LessEqualOperation{lhs, rhs, target};
+            case Operator::minus:
+                return SubtractionOperation{lhs, rhs, target};
+            case Operator::percent:
+                return ModuloOperation{lhs, rhs, target};
+            case Operator::slash:
+                return DivisionOperation{lhs, rhs, target};
+            case Operator::slashslash:
+                return FloorDivisionOperation{lhs, rhs, target};
+            default:
+                return AdditionOperation{lhs, rhs, target};
+        }
+    }
+
+    constexpr std::span<Lexeme const>
+    expect(std::span<Lexeme const> const lexemes,
+           Lexeme const& expected,
+           char const* const message) {
+        if (lexemes.empty() or lexemes.front() != expected) {
+            throw std::invalid_argument{message};
+        }
+        return lexemes.subspan<1>();
+    }
+
+    constexpr ParseExpressionReturn
+    parse_expression(
+            ParseState& state,
+            std::span<Lexeme const> lexemes,
+            int minimum_precedence = conditional_precedence);
+
+    struct ParseArgumentsReturn final {
+        std::vector<std::size_t> indexes;  // Slots holding the values of the arguments
         std::span<Lexeme const> remaining_lexemes;
     };
-    inline constexpr auto parse_return_subexpression =
-            [](std::span<Lexeme const> const lexemes) constexpr noexcept
-            -> ParseReturnSubExpressionReturn {
+
+    // Comma separated expressions in brackets
+    constexpr ParseArgumentsReturn
+    parse_arguments(ParseState& state, std::span<Lexeme const> lexemes) {
+        lexemes = expect(lexemes, Operator::bracketleft, "Expected '('");
+        auto result = ParseArgumentsReturn{};
+        while (lexemes.empty() or lexemes.front() != Lexeme{Operator::bracketright}) {
+            if (not result.indexes.empty()) {
+                lexemes = expect(lexemes, Operator::comma, "Expected ','");
+            }
+            auto const argument = parse_expression(state, lexemes);
+            result.indexes.push_back(argument.index);
+            lexemes = argument.remaining_lexemes;
+        }
+        result.remaining_lexemes = lexemes.subspan<1>();
+        return result;
+    }
+
+    // Whether a function body yields, which makes the function a generator
+    constexpr bool
+    is_generator(std::span<Lexeme const> const body) noexcept {
+        return std::ranges::find(body, Lexeme{Keyword::yield_}) != body.end();
+    }
+
+    // `len(value)`, the only builtin function
+    constexpr ParseExpressionReturn
+    parse_length(ParseState& state, std::span<Lexeme const> const lexemes) {
+        auto const arguments = parse_arguments(state, lexemes);
+        if (arguments.indexes.size() != 1) {
+            throw std::invalid_argument{"len() takes 1 argument"};
+        }
+        auto const target = state.allocate();
+        state.operations.emplace_back(LengthOperation{arguments.indexes[0], target});
+        return {target, arguments.remaining_lexemes};
+    }
+
+    // `name(arguments)` calling one of the functions in scope, or len unless the module defines
+    // a function of that name
+    constexpr ParseExpressionReturn
+    parse_call(
+            ParseState& state,
+            std::string_view const name,
+            std::span<Lexeme const> const lexemes) {
+        auto const callee = std::ranges::find(state.functions, name, &Declaration::name);
+        if (callee == state.functions.end() and name == "len") {
+            return parse_length(state, lexemes);
+        } else if (callee == state.functions.end()) {
+            throw std::invalid_argument{"Undefined function"};
+        } else if (is_generator(callee->body)) {
+            throw std::invalid_argument{"Calling generators is not supported"};
+        }
+        auto const arguments = parse_arguments(state, lexemes);
+        if (arguments.indexes.size() != callee->parameters.size()) {
+            throw std::invalid_argument{"Wrong number of arguments"};
+        } else if (arguments.indexes.size() > max_call_arguments) {
+            throw std::invalid_argument{"Too many arguments"};
+        }
+        auto call = CallOperation{
+                static_cast<std::size_t>(callee - state.functions.begin()),
+                {},
+                arguments.indexes.size(),
+                state.allocate()};
+        std::ranges::copy(arguments.indexes, call.arguments.begin());
+        state.operations.emplace_back(call);
+        return {call.target, arguments.remaining_lexemes};
+    }
+
+    // Literal, where string literals written next to each other are one like in Python
+    constexpr ParseExpressionReturn
+    parse_literal(ParseState& state, std::span<Lexeme const> lexemes) {
+        auto value = parse_literal_to_variable(std::get<Literal>(lexemes.front()));
+        lexemes = lexemes.subspan<1>();
+        while (std::holds_alternative<std::string_view>(value) and not lexemes.empty() and
+               std::holds_alternative<Literal>(lexemes.front())) {
+            auto const next = parse_literal_to_variable(std::get<Literal>(lexemes.front()));
+            if (not std::holds_alternative<std::string_view>(next)) {
+                break;
+            }
+            value = state.concatenate(
+                    std::get<std::string_view>(value), std::get<std::string_view>(next));
+            lexemes = lexemes.subspan<1>();
+        }
+        auto const index = state.allocate();
+        state.operations.emplace_back(ConstantOperation{index, value});
+        return {index, lexemes};
+    }
+
+    // `[index]`, `[begin:end]` with optional bounds, `.startswith(prefix)` or `.endswith(suffix)`
+    // applied to `value`, followed by further ones
+    constexpr ParseExpressionReturn
+    parse_postfix(ParseState& state, ParseExpressionReturn value) {
+        while (not value.remaining_lexemes.empty()) {
+            auto const& next = value.remaining_lexemes.front();
+            auto lexemes = value.remaining_lexemes.subspan<1>();
+            if (next == Lexeme{Operator::period}) {
+                if (lexemes.empty() or not std::holds_alternative<Identifier>(lexemes.front())) {
+                    throw std::invalid_argument{"Expected method name"};
+                }
+                auto const method = std::get<Identifier>(lexemes.front()).value;
+                if (method != "startswith" and method != "endswith") {
+                    throw std::invalid_argument{"Unknown method"};
+                }
+                auto const arguments = parse_arguments(state, lexemes.subspan<1>());
+                if (arguments.indexes.size() != 1) {
+                    throw std::invalid_argument{"Methods take 1 argument"};
+                }
+                auto const target = state.allocate();
+                if (method == "startswith") {
+                    state.operations.emplace_back(
+                            StartsWithOperation{value.index, arguments.indexes[0], target});
+                } else {
+                    state.operations.emplace_back(
+                            EndsWithOperation{value.index, arguments.indexes[0], target});
+                }
+                value = {target, arguments.remaining_lexemes};
+            } else if (next == Lexeme{Operator::squarebracketleft}) {
+                auto const starts_with = [&lexemes](Operator const operator_) {
+                    return not lexemes.empty() and lexemes.front() == Lexeme{operator_};
+                };
+                if (starts_with(Operator::squarebracketright)) {
+                    throw std::invalid_argument{"Expected index"};
+                }
+                // Missing bounds of a slice are the start and anything past the end
+                auto const bound = [&](int const missing) {
+                    if (starts_with(Operator::semicolon) or
+                        starts_with(Operator::squarebracketright)) {
+                        auto const index = state.allocate();
+                        state.operations.emplace_back(ConstantOperation{index, missing});
+                        return index;
+                    }
+                    auto const parsed = parse_expression(state, lexemes);
+                    lexemes = parsed.remaining_lexemes;
+                    return parsed.index;
+                };
+                auto const begin = bound(0);
+                if (starts_with(Operator::semicolon)) {
+                    lexemes = lexemes.subspan<1>();
+                    auto const end = bound(std::numeric_limits<int>::max());
+                    auto const target = state.allocate();
+                    state.operations.emplace_back(SliceOperation{value.index, begin, end, target});
+                    value.index = target;
+                } else {
+                    auto const target = state.allocate();
+                    state.operations.emplace_back(SubscriptOperation{value.index, begin, target});
+                    value.index = target;
+                }
+                value.remaining_lexemes =
+                        expect(lexemes, Operator::squarebracketright, "Expected ']'");
+            } else {
+                break;
+            }
+        }
+        return value;
+    }
+
+    // Value of an expression of constants, which parsing folds into a single constant
+    constexpr std::pair<Variable, std::span<Lexeme const>>
+    parse_constant(ParseState& state, std::span<Lexeme const> const lexemes) {
+        auto const begin = state.operations.size();
+        auto const parsed = parse_expression(state, lexemes);
+        auto const* const constant = state.operations.size() == begin + 1
+                                             ? state.temporary_constant(parsed.index)
+                                             : nullptr;
+        if (constant == nullptr) {
+            throw std::invalid_argument{"Dictionary keys and values must be constants"};
+        }
+        auto const value = constant->value;
+        state.operations.pop_back();
+        return {value, parsed.remaining_lexemes};
+    }
+
+    // `{key: value, ...}` of constant keys and values, which may span several lines. A key
+    // written again replaces the value of the first one like in Python.
+    constexpr std::pair<Dictionary const*, std::span<Lexeme const>>
+    parse_dictionary(ParseState& state, std::span<Lexeme const> lexemes) {
+        auto const skip_lines = [&lexemes] {
+            while (not lexemes.empty() and (lexemes.front() == Lexeme{Operator::linebreak} or
+                                            std::holds_alternative<Indentation>(lexemes.front()))) {
+                lexemes = lexemes.subspan<1>();
+            }
+        };
+        lexemes = expect(lexemes, Operator::braceleft, "Expected '{'");
+        auto entries = DictionaryEntries{};
+        for (skip_lines(); lexemes.empty() or lexemes.front() != Lexeme{Operator::braceright};
+             skip_lines()) {
+            if (not entries.empty()) {
+                lexemes = expect(lexemes, Operator::comma, "Expected ','");
+                skip_lines();
+                if (not lexemes.empty() and lexemes.front() == Lexeme{Operator::braceright}) {
+                    break;
+                }
+            }
+            auto const [key, after_key] = parse_constant(state, lexemes);
+            lexemes = expect(after_key, Operator::semicolon, "Expected ':'");
+            skip_lines();
+            auto const [value, after_value] = parse_constant(state, lexemes);
+            lexemes = after_value;
+            auto const existing = std::ranges::find_if(
+                    entries, [&key](auto const& entry) { return same_key(entry.first, key); });
+            if (existing != entries.end()) {
+                existing->second = value;
+            } else {
+                entries.emplace_back(key, value);
+            }
+        }
+        return {state.dictionary(entries), lexemes.subspan<1>()};
+    }
+
+    // Dictionary literal or name bound to a dictionary
+    constexpr std::pair<Dictionary const*, std::span<Lexeme const>>
+    parse_dictionary_operand(ParseState& state, std::span<Lexeme const> const lexemes) {
+        if (not lexemes.empty() and std::holds_alternative<Identifier>(lexemes.front())) {
+            auto const dictionary = state.find_dictionary(std::get<Identifier>(lexemes[0]).value);
+            if (dictionary.has_value()) {
+                return {*dictionary, lexemes.subspan<1>()};
+            }
+        } else if (not lexemes.empty() and lexemes.front() == Lexeme{Operator::braceleft}) {
+            return parse_dictionary(state, lexemes);
+        }
+        throw std::invalid_argument{"Expected dictionary"};
+    }
+
+    // `[key]` looking up a key of `dictionary`, which is all a dictionary can be used for apart
+    // from `in`, followed by postfix operations on the value
+    constexpr ParseExpressionReturn
+    parse_lookup(
+            ParseState& state,
+            Dictionary const* dictionary,
+            std::span<Lexeme const> const lexemes) {
+        auto const key = parse_expression(
+                state,
+                expect(lexemes,
+                       Operator::squarebracketleft,
+                       "Dictionaries can only be subscripted or searched with 'in'"));
+        auto const target = state.allocate();
+        state.operations.emplace_back(LookupOperation{key.index, dictionary, target});
+        return parse_postfix(
+                state,
+                {target,
+                 expect(key.remaining_lexemes, Operator::squarebracketright, "Expected ']'")});
+    }
+
+    // Literal, variable, call, parenthesized expression, each of them with postfix operations, or
+    // negation, which binds looser than power like in Python: -x ** 2 is -(x ** 2)
+    constexpr ParseExpressionReturn
+    parse_primary(ParseState& state, std::span<Lexeme const> const lexemes) {
+        if (lexemes.empty()) {
+            throw std::invalid_argument{"Missing expression"};
+        }
         return std::visit(
-                [&]<class T>(T const& first_lexeme) -> ParseReturnSubExpressionReturn {
+                [&]<class T>(T const& first_lexeme) -> ParseExpressionReturn {
                     if constexpr (std::is_same_v<T, Literal>) {
-                        return ParseReturnSubExpressionReturn{
-                                ConstantOperation{0, parse_literal_to_variable(first_lexeme)},
-                                0,
-                                lexemes.subspan<1>()};
-                    } else {
-                        throw "Could not parse return sub-expression";  // NOLINT(*-exception-baseclass)
+                        return parse_postfix(state, parse_literal(state, lexemes));
+                    } else if constexpr (std::is_same_v<T, Identifier>) {
+                        if (lexemes.size() > 1 and lexemes[1] == Lexeme{Operator::bracketleft}) {
+                            return parse_postfix(
+                                    state,
+                                    parse_call(state, first_lexeme.value, lexemes.subspan<1>()));
+                        } else if (auto const dictionary =
+                                           state.find_dictionary(first_lexeme.value);
+                                   dictionary.has_value()) {
+                            return parse_lookup(state, *dictionary, lexemes.subspan<1>());
+                        }
+                        auto const index = state.find_variable(first_lexeme.value);
+                        if (not index.has_value()) {
+                            throw std::invalid_argument{"Undefined name"};
+                        }
+                        return parse_postfix(state, {*index, lexemes.subspan<1>()});
+                    } else if constexpr (std::is_same_v<T, Operator>) {
+                        if (first_lexeme == Operator::minus) {
+                            auto const operand =
+                                    parse_expression(state, lexemes.subspan<1>(), unary_precedence);
+                            if (auto* const constant = state.temporary_constant(operand.index)) {
+                                // Negative literals stay literals, which range() steps rely on
+                                constant->value = std::visit(
+                                        []<class V>(V const value) -> Variable {
+                                            if constexpr (is_string<V>) {
+                                                throw std::invalid_argument{
+                                                        "Strings cannot be negated"};
+                                            } else {
+                                                return Variable{-value};
+                                            }
+                                        },
+                                        constant->value);
+                                return operand;
+                            }
+                            // -x is -1 * x, which keeps the type of x and negates zeros
+                            auto const minus_one = state.allocate();
+                            state.operations.emplace_back(ConstantOperation{minus_one, -1});
+                            auto const target = state.allocate();
+                            state.operations.emplace_back(
+                                    MultiplicationOperation{minus_one, operand.index, target});
+                            return {target, operand.remaining_lexemes};
+                        } else if (first_lexeme == Operator::bracketleft) {
+                            auto const inner = parse_expression(state, lexemes.subspan<1>());
+                            return parse_postfix(
+                                    state,
+                                    {inner.index,
+                                     expect(inner.remaining_lexemes,
+                                            Operator::bracketright,
+                                            "Expected ')'")});
+                        } else if (first_lexeme == Operator::braceleft) {
+                            auto const [dictionary, remaining_lexemes] =
+                                    parse_dictionary(state, lexemes);
+                            return parse_lookup(state, dictionary, remaining_lexemes);
+                        }
                     }
+                    throw std::invalid_argument{"Could not parse expression"};
                 },
                 lexemes.front());
-    };
+    }
 
-    using BuildOperationsReturn = std::vector<Operation>;
-    inline constexpr auto build_operations =
-            [](std::span<Lexeme const> lexemes) constexpr noexcept -> BuildOperationsReturn {
-        auto operations = BuildOperationsReturn{};
-        while (not lexemes.empty()) {
-            std::visit(
-                    [&]<class T>(T const& first_lexeme) {
-                        if constexpr (std::is_same_v<T, Keyword>) {
-                            if (first_lexeme == Keyword::return_) {
-                                auto next_operations =
-                                        parse_return_subexpression(lexemes.subspan<1>());
-                                operations.emplace_back(next_operations.operation);
-                                operations.emplace_back(
-                                        ReturnOperation{next_operations.return_index});
-                                lexemes = next_operations.remaining_lexemes;
-                            } else {
-                                if consteval {
-                                    lexemes = {};
-                                } else {
-                                    abort();
-                                }
-                            }
+    // Operations of each alternative of a conditional up to which all alternatives are computed
+    // and selected from instead of branching
+    inline constexpr auto speculation_limit = std::size_t{8};
+
+    // Whether the operations of an alternative may run although their results end up unused:
+    // they are few and cannot fail, unlike Raising operators like divisions, which may divide by
+    // zero, int arithmetic, which may overflow, or operators given operands of types they do not
+    // take, and calls, which may also recurse endlessly
+    constexpr bool
+    can_speculate(std::span<Operation const> const operations) noexcept {
+        auto size = std::size_t{0};
+        auto const speculatable = std::ranges::all_of(operations, [&size](auto const& operation) {
+            return std::visit(
+                    [&size]<class T>(T const&) {
+                        if constexpr (std::is_same_v<T, LocationOperation>) {
+                            return true;
+                        } else if constexpr (is_binary_operation<T>) {
+                            ++size;
+                            return not Raising<typename T::operator_type> and
+                                   not std::is_same_v<typename T::operator_type, Power>;
+                        } else if constexpr (is_dictionary_operation<T>) {
+                            ++size;
+                            return not Raising<typename T::probe_type, Dictionary>;
                         } else {
-                            if consteval {
-                                lexemes = {};
-                            } else {
-                                abort();
-                            }
+                            ++size;
+                            return std::is_same_v<T, AssignOperation> or
+                                   std::is_same_v<T, ConstantOperation> or
+                                   std::is_same_v<T, LengthOperation> or
+                                   std::is_same_v<T, SelectOperation> or
+                                   std::is_same_v<T, SliceOperation>;
                         }
                     },
-                    lexemes.front());
+                    operation);
+        });
+        return speculatable and size <= speculation_limit;
+    }
+
+    // `value if condition else other` where `lexemes` start with the value, whose operations from
+    // `begin` on are already parsed into `value`. Cheap values which cannot fail are both computed
+    // and selected from, otherwise all of it is parsed again behind a branch so that only the
+    // chosen value is computed.
+    constexpr ParseExpressionReturn
+    parse_conditional_expression(
+            ParseState& state,
+            std::span<Lexeme const> const lexemes,
+            std::size_t const begin,
+            ParseExpressionReturn const& value) {
+        auto const value_end = state.operations.size();
+        auto const condition_lexemes = value.remaining_lexemes.subspan<1>();
+        auto const condition = parse_expression(state, condition_lexemes, comparison_precedence);
+        auto const other_lexemes =
+                expect(condition.remaining_lexemes, Keyword::else_, "Expected 'else'");
+        auto const other_begin = state.operations.size();
+        auto const other = parse_expression(state, other_lexemes);
+        auto const operations = std::span<Operation const>{state.operations};
+        auto const target = state.allocate();
+        if (can_speculate(operations.subspan(begin, value_end - begin)) and
+            can_speculate(operations.subspan(other_begin))) {
+            state.operations.emplace_back(
+                    SelectOperation{condition.index, value.index, other.index, target});
+            return {target, other.remaining_lexemes};
+        }
+        state.operations.erase(
+                state.operations.begin() + static_cast<std::ptrdiff_t>(begin),
+                state.operations.end());
+        auto const branch_condition =
+                parse_expression(state, condition_lexemes, comparison_precedence);
+        auto const branch = state.operations.size();
+        state.operations.emplace_back(BranchOperation{branch_condition.index, 0});
+        state.store(parse_expression(state, lexemes, comparison_precedence).index, target);
+        auto const jump = state.operations.size();
+        state.operations.emplace_back(JumpOperation{0});
+        std::get<BranchOperation>(state.operations[branch]).target = state.operations.size();
+        auto const branch_other = parse_expression(state, other_lexemes);
+        state.store(branch_other.index, target);
+        std::get<JumpOperation>(state.operations[jump]).target = state.operations.size();
+        return {target, branch_other.remaining_lexemes};
+    }
+
+    // Folds `lhs + rhs` of two string constants which the last two operations compute into one
+    // constant, the concatenation, since functions cannot build strings at run time
+    constexpr bool
+    concatenate_constants(
+            ParseState& state,
+            Operator const operator_,
+            std::size_t const lhs,
+            std::size_t const rhs) {
+        auto& operations = state.operations;
+        if (operator_ != Operator::plus or operations.size() < 2 or state.is_variable(lhs) or
+            state.is_variable(rhs)) {
+            return false;
+        }
+        auto* const lhs_constant = std::get_if<ConstantOperation>(&operations.end()[-2]);
+        auto const* const rhs_constant = std::get_if<ConstantOperation>(&operations.back());
+        if (lhs_constant == nullptr or rhs_constant == nullptr or lhs_constant->index != lhs or
+            rhs_constant->index != rhs) {
+            return false;
+        }
+        auto const* const lhs_string = std::get_if<std::string_view>(&lhs_constant->value);
+        auto const* const rhs_string = std::get_if<std::string_view>(&rhs_constant->value);
+        if (lhs_string == nullptr or rhs_string == nullptr) {
+            return false;
+        }
+        lhs_constant->value = state.concatenate(*lhs_string, *rhs_string);
+        operations.pop_back();
+        return true;
+    }
+
+    // Precedence climbing: binary operators binding at least as tight as `minimum_precedence`
+    // are folded into the left operand, tighter ones recurse for the right operand. Power is right
+    // associative and its right operand may be negated, so it recurses at unary precedence. A
+    // conditional expression binds loosest and its alternative may be one again.
+    constexpr ParseExpressionReturn
+    parse_expression(
+            ParseState& state,
+            std::span<Lexeme const> const lexemes,
+            int const minimum_precedence) {
+        auto const begin = state.operations.size();
+        auto lhs = parse_primary(state, lexemes);
+        while (not lhs.remaining_lexemes.empty()) {
+            auto const& next = lhs.remaining_lexemes.front();
+            auto const precedence = binary_precedence(next);
+            if (precedence == 0 or precedence < minimum_precedence) {
+                break;
+            } else if (next == Lexeme{Keyword::in}) {
+                auto const [dictionary, remaining_lexemes] =
+                        parse_dictionary_operand(state, lhs.remaining_lexemes.subspan<1>());
+                auto const target = state.allocate();
+                state.operations.emplace_back(ContainsOperation{lhs.index, dictionary, target});
+                lhs = {target, remaining_lexemes};
+            } else {
+                auto const rhs = parse_expression(
+                        state,
+                        lhs.remaining_lexemes.subspan<1>(),
+                        precedence == power_precedence ? unary_precedence : precedence + 1);
+                if (concatenate_constants(
+                            state, std::get<Operator>(next), lhs.index, rhs.index)) {
+                    lhs.remaining_lexemes = rhs.remaining_lexemes;
+                    continue;
+                }
+                auto const target = state.allocate();
+                state.operations.push_back(make_binary_operation(
+                        std::get<Operator>(next), lhs.index, rhs.index, target));
+                lhs = {target, rhs.remaining_lexemes};
+            }
+            if (precedence == comparison_precedence and not lhs.remaining_lexemes.empty() and
+                binary_precedence(lhs.remaining_lexemes.front()) == comparison_precedence) {
+                throw std::invalid_argument{"Chained comparisons are not supported"};
+            }
+        }
+        if (minimum_precedence == conditional_precedence and not lhs.remaining_lexemes.empty() and
+            lhs.remaining_lexemes.front() == Lexeme{Keyword::if_}) {
+            return parse_conditional_expression(state, lexemes, begin, lhs);
+        }
+        return lhs;
+    }
+
+    constexpr std::span<Lexeme const>
+    skip_blank_lines(std::span<Lexeme const> lexemes) noexcept {
+        while (not lexemes.empty() and lexemes.front() == Lexeme{Operator::linebreak}) {
+            lexemes = lexemes.subspan<1>();
+        }
+        return lexemes;
+    }
+
+    constexpr std::size_t
+    line_indentation(std::span<Lexeme const> const lexemes) noexcept {
+        auto const* const indentation =
+                lexemes.empty() ? nullptr : std::get_if<Indentation>(&lexemes.front());
+        return indentation != nullptr ? indentation->width : 0;
+    }
+
+    constexpr std::span<Lexeme const>
+    expect_end_of_statement(std::span<Lexeme const> const lexemes) {
+        if (lexemes.empty()) {
+            return lexemes;
+        }
+        return expect(lexemes, Operator::linebreak, "Expected end of line");
+    }
+
+    constexpr std::span<Lexeme const>
+    parse_block(ParseState& state, std::span<Lexeme const> lexemes, std::size_t indentation);
+
+    // `:`, a linebreak and a block indented deeper than the statement it belongs to
+    constexpr std::span<Lexeme const>
+    parse_nested_block(
+            ParseState& state,
+            std::span<Lexeme const> lexemes,
+            std::size_t const indentation) {
+        lexemes = expect(lexemes, Operator::semicolon, "Expected ':'");
+        lexemes = skip_blank_lines(expect(lexemes, Operator::linebreak, "Expected linebreak"));
+        auto const nested_indentation = line_indentation(lexemes);
+        if (nested_indentation <= indentation) {
+            throw std::invalid_argument{"Expected an indented block"};
+        }
+        return parse_block(state, lexemes, nested_indentation);
+    }
+
+    // Operations of a loop running the block after the loop condition as long as the value
+    // computed by the operations from `header` on is truthy
+    constexpr std::span<Lexeme const>
+    parse_loop(
+            ParseState& state,
+            std::size_t const header,
+            std::size_t const condition,
+            std::span<Lexeme const> const lexemes,
+            std::size_t const indentation,
+            auto&& emit_body_prologue,
+            auto&& emit_body_epilogue) {
+        auto const branch = state.operations.size();
+        state.operations.emplace_back(BranchOperation{condition, 0});
+        emit_body_prologue();
+        auto const remaining_lexemes = parse_nested_block(state, lexemes, indentation);
+        emit_body_epilogue();
+        state.operations.emplace_back(JumpOperation{header});
+        std::get<BranchOperation>(state.operations[branch]).target = state.operations.size();
+        return remaining_lexemes;
+    }
+
+    constexpr std::span<Lexeme const>
+    parse_while(
+            ParseState& state,
+            std::span<Lexeme const> const lexemes,
+            std::size_t const indentation) {
+        auto const header = state.operations.size();
+        auto const condition = parse_expression(state, lexemes);
+        return parse_loop(
+                state,
+                header,
+                condition.index,
+                condition.remaining_lexemes,
+                indentation,
+                [] {},
+                [] {});
+    }
+
+    // `for name in range(...)` counting a hidden counter from start to stop, so that assigning
+    // to the loop variable in the body does not change the iteration as in Python. The step has
+    // to be a literal since its sign decides the loop condition.
+    constexpr std::span<Lexeme const>
+    parse_for(
+            ParseState& state,
+            std::span<Lexeme const> lexemes,
+            std::size_t const indentation) {
+        if (lexemes.empty() or not std::holds_alternative<Identifier>(lexemes.front())) {
+            throw std::invalid_argument{"Expected loop variable"};
+        }
+        auto const name = std::get<Identifier>(lexemes.front()).value;
+        lexemes = expect(lexemes.subspan<1>(), Keyword::in, "Expected 'in'");
+        lexemes = expect(lexemes, Identifier{"range"}, "Expected 'range'");
+        auto const parsed_arguments = parse_arguments(state, lexemes);
+        auto const& arguments = parsed_arguments.indexes;
+        lexemes = parsed_arguments.remaining_lexemes;
+        if (arguments.empty() or arguments.size() > 3) {
+            throw std::invalid_argument{"range() takes 1 to 3 arguments"};
         }
-        return operations;
+        auto const counter = state.allocate();
+        if (arguments.size() == 1) {
+            state.operations.emplace_back(ConstantOperation{counter, 0});
+        } else {
+            state.store(arguments[0], counter);
+        }
+        auto stop = arguments.size() == 1 ? arguments[0] : arguments[1];
+        if (state.is_variable(stop)) {
+            auto const copy = state.allocate();
+            state.operations.emplace_back(AssignOperation{stop, copy});
+            stop = copy;
+        }
+        auto step = 1;
+        auto step_index = std::size_t{0};
+        if (arguments.size() == 3) {
+            step_index = arguments[2];
+            auto const definition = std::ranges::find_if(
+                    state.operations.rbegin(),
+                    state.operations.rend(),
+                    [step_index](Operation const& operation) {
+                        return written_index(operation) == step_index;
+                    });
+            auto const* const constant = state.is_variable(step_index)
+                                                 ? nullptr
+                                                 : std::get_if<ConstantOperation>(&*definition);
+            if (constant == nullptr or not std::holds_alternative<int>(constant->value)) {
+                throw std::invalid_argument{"range() step must be an integer literal"};
+            }
+            step = std::get<int>(constant->value);
+            if (step == 0) {
+                throw std::invalid_argument{"range() step must not be zero"};
+            }
+        } else {
+            step_index = state.allocate();
+            state.operations.emplace_back(ConstantOperation{step_index, step});
+        }
+        auto const header = state.operations.size();
+        auto const condition = state.allocate();
+        if (step > 0) {
+            state.operations.emplace_back(LessOperation{counter, stop, condition});
+        } else {
+            state.operations.emplace_back(GreaterOperation{counter, stop, condition});
+        }
+        auto const variable = state.variable(name);
+        return parse_loop(
+                state,
+                header,
+                condition,
+                lexemes,
+                indentation,
+                [&] { state.operations.emplace_back(AssignOperation{counter, variable}); },
+                [&] {
+                    state.operations.emplace_back(AdditionOperation{counter, step_index, counter});
+                });
+    }
+
+    // `elif` or `else` continuing an if statement at `indentation` and the lexemes after it
+    constexpr std::optional<std::pair<Keyword, std::span<Lexeme const>>>
+    find_else_clause(std::span<Lexeme const> lexemes, std::size_t const indentation) noexcept {
+        lexemes = skip_blank_lines(lexemes);
+        if (lexemes.empty() or line_indentation(lexemes) != indentation) {
+            return std::nullopt;
+        } else if (indentation > 0) {
+            lexemes = lexemes.subspan<1>();
+        }
+        for (auto const keyword: {Keyword::elif, Keyword::else_}) {
+            if (not lexemes.empty() and lexemes.front() == Lexeme{keyword}) {
+                return std::pair{keyword, lexemes.subspan<1>()};
+            }
+        }
+        return std::nullopt;
+    }
+
+    // `if condition:` and its block, optionally followed by `elif` and `else` clauses. The blocks
+    // are first parsed speculatively. If every block only assigns variables with a few operations
+    // which cannot fail, all of them run and every variable changed by any block is selected from
+    // its value after each block, so no branch is needed. Otherwise the blocks are parsed again
+    // behind branches.
+    constexpr std::span<Lexeme const>
+    parse_if(
+            ParseState& state,
+            std::span<Lexeme const> const lexemes,
+            std::size_t const indentation) {
+        auto const begin = state.operations.size();
+        auto const stack_size = state.stack_size;
+        auto const bindings = state.variables;
+        auto const speculative = std::exchange(state.speculative, true);
+        auto condition = parse_expression(state, lexemes);
+        if (state.is_variable(condition.index)) {
+            // The selects below may overwrite the variable
+            auto const copy = state.allocate();
+            state.operations.emplace_back(AssignOperation{condition.index, copy});
+            condition.index = copy;
+        }
+        auto const then_begin = state.operations.size();
+        auto remaining_lexemes =
+                parse_nested_block(state, condition.remaining_lexemes, indentation);
+        auto const then_bindings = std::exchange(state.variables, bindings);
+        auto const else_begin = state.operations.size();
+        auto const clause = find_else_clause(remaining_lexemes, indentation);
+        if (clause.has_value() and clause->first == Keyword::elif) {
+            remaining_lexemes = parse_if(state, clause->second, indentation);
+        } else if (clause.has_value()) {
+            remaining_lexemes = parse_nested_block(state, clause->second, indentation);
+        }
+        auto const else_bindings = std::exchange(state.variables, bindings);
+        state.speculative = speculative;
+        auto const operations = std::span<Operation const>{state.operations};
+        if (can_speculate(operations.subspan(then_begin, else_begin - then_begin)) and
+            can_speculate(operations.subspan(else_begin))) {
+            auto const find = [](Bindings const& bindings, std::string_view const name) {
+                auto const binding =
+                        std::ranges::find(bindings, name, &Bindings::value_type::first);
+                return binding != bindings.end() ? std::optional{binding->second}
+                                                 : std::nullopt;
+            };
+            auto changed = std::vector<std::string_view>{};
+            for (auto const* const block_bindings: {&then_bindings, &else_bindings}) {
+                for (auto const& [name, slot]: *block_bindings) {
+                    if (find(bindings, name) != slot and
+                        std::ranges::find(changed, name) == changed.end()) {
+                        changed.push_back(name);
+                    }
+                }
+            }
+            for (auto const name: changed) {
+                // Variables only assigned in some blocks keep the value they had, or hold the
+                // default value if they were not assigned before
+                auto const unchanged = state.variable(name);
+                state.operations.emplace_back(SelectOperation{
+                        condition.index,
+                        find(then_bindings, name).value_or(unchanged),
+                        find(else_bindings, name).value_or(unchanged),
+                        state.bind(name)});
+            }
+            return remaining_lexemes;
+        }
+        state.operations.erase(
+                state.operations.begin() + static_cast<std::ptrdiff_t>(begin),
+                state.operations.end());
+        state.stack_size = stack_size;
+        auto const branch_condition = parse_expression(state, lexemes);
+        auto const branch = state.operations.size();
+        state.operations.emplace_back(BranchOperation{branch_condition.index, 0});
+        remaining_lexemes =
+                parse_nested_block(state, branch_condition.remaining_lexemes, indentation);
+        if (not clause.has_value()) {
+            std::get<BranchOperation>(state.operations[branch]).target = state.operations.size();
+            return remaining_lexemes;
+        }
+        auto const jump = state.operations.size();
+        state.operations.emplace_back(JumpOperation{0});
+        std::get<BranchOperation>(state.operations[branch]).target = state.operations.size();
+        if (clause->first == Keyword::elif) {
+            remaining_lexemes = parse_if(state, clause->second, indentation);
+        } else {
+            remaining_lexemes = parse_nested_block(state, clause->second, indentation);
+        }
+        std::get<JumpOperation>(state.operations[jump]).target = state.operations.size();
+        return remaining_lexemes;
+    }
+
+    // Returns the lexemes after the statement. Unknown statements end parsing at compile time
+    // and throw at run time.
+    constexpr std::span<Lexeme const>
+    parse_statement(
+            ParseState& state,
+            std::span<Lexeme const> const lexemes,
+            std::size_t const indentation) {
+        auto const& first_lexeme = lexemes.front();
+        if (first_lexeme == Lexeme{Keyword::return_}) {
+            auto const value = parse_expression(state, lexemes.subspan<1>());
+            state.operations.emplace_back(ReturnOperation{value.index});
+            return expect_end_of_statement(value.remaining_lexemes);
+        } else if (first_lexeme == Lexeme{Keyword::yield_}) {
+            auto const value = parse_expression(state, lexemes.subspan<1>());
+            state.operations.emplace_back(YieldOperation{value.index});
+            return expect_end_of_statement(value.remaining_lexemes);
+        } else if (first_lexeme == Lexeme{Keyword::while_}) {
+            return parse_while(state, lexemes.subspan<1>(), indentation);
+        } else if (first_lexeme == Lexeme{Keyword::for_}) {
+            return parse_for(state, lexemes.subspan<1>(), indentation);
+        } else if (first_lexeme == Lexeme{Keyword::if_}) {
+            return parse_if(state, lexemes.subspan<1>(), indentation);
+        } else if (std::holds_alternative<Identifier>(first_lexeme) and lexemes.size() > 1 and
+                   lexemes[1] == Lexeme{Operator::equal}) {
+            auto const name = std::get<Identifier>(first_lexeme).value;
+            if (lexemes.size() > 2 and lexemes[2] == Lexeme{Operator::braceleft}) {
+                auto const [dictionary, remaining_lexemes] =
+                        parse_dictionary(state, lexemes.subspan<2>());
+                if (remaining_lexemes.empty() or
+                    remaining_lexemes.front() != Lexeme{Operator::squarebracketleft}) {
+                    state.bind_dictionary(name, dictionary);
+                    return expect_end_of_statement(remaining_lexemes);
+                }
+            }
+            if (state.find_dictionary(name).has_value()) {
+                throw std::invalid_argument{"Dictionaries cannot be reassigned"};
+            }
+            auto const value = parse_expression(state, lexemes.subspan<2>());
+            state.store(value.index, state.bind(name));
+            return expect_end_of_statement(value.remaining_lexemes);
+        }
+        if consteval {
+            return {};
+        } else {
+            throw std::invalid_argument{"Unexpected lexeme"};
+        }
+    }
+
+    // Parses the statements of lines indented by `indentation` until a line is indented less
+    constexpr std::span<Lexeme const>
+    parse_block(
+            ParseState& state,
+            std::span<Lexeme const> lexemes,
+            std::size_t const indentation) {
+        for (lexemes = skip_blank_lines(lexemes); not lexemes.empty();
+             lexemes = skip_blank_lines(lexemes)) {
+            auto const line = line_indentation(lexemes);
+            if (line < indentation) {
+                return lexemes;
+            } else if (line > indentation) {
+                throw std::invalid_argument{"Unexpected indentation"};
+            } else if (line > 0) {
+                lexemes = lexemes.subspan<1>();
+            }
+            if (not state.source.empty()) {
+                state.operations.emplace_back(LocationOperation{
+                        static_cast<std::size_t>(lexemes.data() - state.source.data())});
+            }
+            lexemes = parse_statement(state, lexemes, indentation);
+        }
+        return lexemes;
+    }
+
+    constexpr void
+    parse_body(ParseState& state, std::span<Lexeme const> const lexemes) {
+        auto const body = skip_blank_lines(lexemes);
+        if (not parse_block(state, body, line_indentation(body)).empty()) {
+            if not consteval {
+                throw std::invalid_argument{"Unexpected dedent"};
+            }
+        }
+    }
+
+    using BuildOperationsReturn = std::vector<Operation>;
+    inline constexpr auto build_operations =
+            [](std::span<Lexeme const> const lexemes,
+               Scope const& scope = {}) constexpr -> BuildOperationsReturn {
+        auto state = ParseState{scope};
+        parse_body(state, lexemes);
+        if (not state.built.empty()) {
+            // The operations would refer to strings which are gone with the state
+            throw std::invalid_argument{"Strings built from constants are missing from the pool"};
+        } else if (not state.dictionary_literals.empty()) {
+            throw std::invalid_argument{"Dictionaries are missing from the pool"};
+        }
+        return std::move(state.operations);
     };
 
+    // Strings the functions declared in a source build from constants, like concatenated
+    // literals. They are collected in a first pass, stored in a pool which lives as long as the
+    // compiled functions do, a static one at compile time, and passed on in the Scope of the
+    // functions, whose string constants then refer to the pool. Literals need no pool, they
+    // refer to the source.
+    constexpr std::vector<std::string>
+    collect_strings(std::span<Declaration const> const declarations) {
+        auto strings = std::vector<std::string>{};
+        for (auto const& declaration: declarations) {
+            auto state = ParseState{Scope{declaration.parameters, declarations, {}, {}, {}}};
+            parse_body(state, declaration.body);
+            for (auto const& string: state.built) {
+                auto text = std::string{string.begin(), string.end()};
+                if (std::ranges::find(strings, text) == strings.end()) {
+                    strings.push_back(std::move(text));
+                }
+            }
+        }
+        return strings;
+    }
+
+    // Dictionaries the functions declared in a source probe, collected in a first pass like the
+    // strings they build, whose pool `strings` is, since their keys and values may be such
+    // strings. They are frozen into perfect hash tables stored as long as the functions, see
+    // Dictionary, and passed on in the Scope of the functions, whose dictionary operations then
+    // refer to them.
+    constexpr std::vector<DictionaryEntries>
+    collect_dictionaries(
+            std::span<Declaration const> const declarations,
+            std::span<std::string_view const> const strings) {
+        auto dictionaries = std::vector<DictionaryEntries>{};
+        for (auto const& declaration: declarations) {
+            auto state = ParseState{Scope{declaration.parameters, declarations, {}, strings, {}}};
+            parse_body(state, declaration.body);
+            for (auto& entries: state.dictionary_literals) {
+                if (std::ranges::find(dictionaries, entries) == dictionaries.end()) {
+                    dictionaries.push_back(std::move(entries));
+                }
+            }
+        }
+        return dictionaries;
+    }
+
+    // Perfect hash layout of the keys of `entries`
+    constexpr DisplacedLayout
+    dictionary_layout(DictionaryEntries const& entries) {
+        return make_displaced_layout(
+                entries.size(), [&entries](std::size_t const index, std::uint64_t const seed) {
+                    return hash_key(entries[index].first, seed);
+                });
+    }
+
+    constexpr Type
+    dictionary_value_type(DictionaryEntries const& entries) noexcept {
+        auto type = Type::empty;
+        for (auto const& entry: entries) {
+            type = join(type, type_of(entry.second));
+        }
+        return type == Type::empty ? Type::int_ : type;
+    }
+
     struct FunctionParameters final {
         std::size_t stack_size;
         std::size_t parameters_count;
         std::size_t operation_count;
     };
 
-    constexpr std::size_t
-    determine_stack_size(std::span<Operation const> const operations) noexcept {
-        auto stack_size = std::size_t{0};
-        for (auto const& operation: operations) {
-            stack_size = std::max(
-                    stack_size,
-                    std::visit(
-                            []<class T>(T const& operation) -> std::size_t {
-                                if constexpr (std::is_same_v<T, AdditionOperation>) {
-                                    return std::max(
-                                                   operation.lhs,
-                                                   std::max(operation.rhs, operation.target)) +
-                                           1;
-                                } else if constexpr (std::is_same_v<T, AssignOperation>) {
-                                    return std::max(operation.from, operation.to) + 1;
-                                } else if constexpr (std::is_same_v<T, ConstantOperation>) {
-                                    return operation.index + 1;
-                                } else if constexpr (std::is_same_v<T, ReturnOperation>) {
-                                    return operation.stack_index + 1;
-                                }
-                            },
-                            operation));
-        }
-        return stack_size;
-    }
-
-    template<auto build_operations_func = build_operations>
+    // Calls are inlined this many levels deep, which also stops recursive functions from being
+    // expanded endlessly
+    inline constexpr auto inline_depth = std::size_t{3};
+
+    // Builds and optimizes the operations of a function body with calls to small functions in
+    // scope replaced by their operations
+    template<auto build_operations_func = build_operations, auto optimize_func = optimize>
+    constexpr std::vector<Operation>
+    build_inlined_operations(
+            std::span<Lexeme const> const lexemes,
+            Scope const& scope,
+            std::size_t const depth = inline_depth) {
+        auto operations = build_operations_func(lexemes, scope);
+        auto callees = std::vector<std::optional<std::vector<Operation>>>(scope.functions.size());
+        for (auto index = operations.size(); depth > 0 and index-- > 0;) {
+            auto const* const call = std::get_if<CallOperation>(&operations[index]);
+            if (call == nullptr) {
+                continue;
+            }
+            auto const& declaration = scope.functions[call->function];
+            if (declaration.table.has_value()) {
+                continue;  // Calls to tabulated functions look up their tables
+            } else if (std::ranges::any_of(declaration.annotations, [](Type const annotation) {
+                           return annotation != Type::empty;
+                       })) {
+                continue;  // Calls to annotated functions check and convert their arguments
+            }
+            auto& callee = callees[call->function];
+            if (not callee.has_value()) {
+                callee = build_inlined_operations<build_operations_func, optimize_func>(
+                        declaration.body,
+                        {declaration.parameters,
+                         scope.functions,
+                         scope.source,
+                         scope.strings,
+                         scope.dictionaries},
+                        depth - 1);
+            }
+            if (is_inlinable(*callee)) {
+                operations = inline_call(operations, index, *callee, scope.parameters.size());
+            }
+        }
+        return optimize_func(operations);
+    }
+
+    // Full pipeline from the function body to the operations stored in the Function
+    template<auto build_operations_func = build_operations, auto optimize_func = optimize>
+    constexpr std::vector<Operation>
+    compile_operations(std::span<Lexeme const> const lexemes, Scope const& scope = {}) {
+        return allocate_slots(
+                build_inlined_operations<build_operations_func, optimize_func>(lexemes, scope),
+                scope.parameters.size());
+    }
+
+    template<auto build_operations_func = build_operations, auto optimize_func = optimize>
     constexpr FunctionParameters
-    calculate_function_parameters(std::span<Lexeme const> const lexemes) noexcept {
-        auto const operations = build_operations_func(lexemes);
-        return {determine_stack_size(operations), 0U, operations.size()};
+    calculate_function_parameters(
+            std::span<Lexeme const> const lexemes,
+            Scope const& scope = {}) noexcept {
+        auto const operations = remove_locations(
+                compile_operations<build_operations_func, optimize_func>(lexemes, scope));
+        // Parameters take their slots even if they are never read
+        auto const stack_size = std::max(determine_stack_size(operations), scope.parameters.size());
+        return {stack_size, scope.parameters.size(), operations.size()};
     }
 
-    template<auto const& lexemes>
-    constexpr std::span<Lexeme const>
-    check_function_header() noexcept {
-        constexpr auto lexemes_view = std::span<Lexeme const>{lexemes.elements};
-        static_assert(lexemes_view[0] == Lexeme{Keyword::def});
-        static_assert(std::holds_alternative<Identifier>(lexemes_view[1]));
-        static_assert(lexemes_view[2] == Lexeme{Operator::bracketleft});
-        static_assert(lexemes_view[3] == Lexeme{Operator::bracketright});
-        static_assert(lexemes_view[4] == Lexeme{Operator::semicolon});
-        static_assert(lexemes_view[5] == Lexeme{Operator::linebreak});
-        return lexemes_view.subspan<6>();
+    // Type named by an annotation, only the types a Variable can hold are supported
+    constexpr Type
+    parse_annotation(std::span<Lexeme const> const lexemes) {
+        if (not lexemes.empty() and std::holds_alternative<Identifier>(lexemes.front())) {
+            auto const name = std::get<Identifier>(lexemes.front()).value;
+            if (name == "int") {
+                return Type::int_;
+            } else if (name == "float") {
+                return Type::double_;
+            } else if (name == "str") {
+                return Type::string;
+            }
+        }
+        throw std::invalid_argument{"Expected annotation 'int', 'float' or 'str'"};
+    }
+
+    // Integer literal, optionally negated
+    constexpr std::pair<int, std::span<Lexeme const>>
+    parse_bound(std::span<Lexeme const> lexemes) {
+        auto const negative = not lexemes.empty() and lexemes.front() == Lexeme{Operator::minus};
+        if (negative) {
+            lexemes = lexemes.subspan<1>();
+        }
+        if (lexemes.empty() or not std::holds_alternative<Literal>(lexemes.front())) {
+            throw std::invalid_argument{"Expected integer bound"};
+        }
+        auto const value = std::get<int>(parse_literal_to_variable(std::get<Literal>(lexemes[0])));
+        return {negative ? -value : value, lexemes.subspan<1>()};
+    }
+
+    // `@table(begin, end)` and a linebreak
+    constexpr std::pair<Domain, std::span<Lexeme const>>
+    parse_table_decorator(std::span<Lexeme const> lexemes) {
+        if (lexemes.size() < 2 or lexemes[1] != Lexeme{Identifier{"table"}}) {
+            throw std::invalid_argument{"Expected decorator '@table(begin, end)'"};
+        }
+        lexemes = expect(lexemes.subspan<2>(), Operator::bracketleft, "Expected '('");
+        auto const [begin, after_begin] = parse_bound(lexemes);
+        lexemes = expect(after_begin, Operator::comma, "Expected ','");
+        auto const [end, after_end] = parse_bound(lexemes);
+        if (begin >= end) {
+            throw std::invalid_argument{"Empty table domain"};
+        }
+        lexemes = expect(after_end, Operator::bracketright, "Expected ')'");
+        return {Domain{begin, end}, expect(lexemes, Operator::linebreak, "Expected linebreak")};
     }
 
+    // `def name(parameters):` and a linebreak, the body reaches up to the end of `lexemes`. Every
+    // parameter may be annotated as `name: type`. A function of one parameter may be preceded by
+    // `@table(begin, end)` to look up its results for the arguments in range(begin, end) in a
+    // table computed at compile time.
+    constexpr Declaration
+    parse_function_header(std::span<Lexeme const> lexemes) {
+        auto table = std::optional<Domain>{};
+        if (not lexemes.empty() and lexemes.front() == Lexeme{Operator::at}) {
+            auto const [domain, remaining_lexemes] = parse_table_decorator(lexemes);
+            table = domain;
+            lexemes = remaining_lexemes;
+        }
+        if (lexemes.size() < 2 or lexemes[0] != Lexeme{Keyword::def} or
+            not std::holds_alternative<Identifier>(lexemes[1])) {
+            throw std::invalid_argument{"Expected function header 'def name(parameters):'"};
+        }
+        auto declaration = Declaration{std::get<Identifier>(lexemes[1]).value, {}, {}, {}, {}};
+        lexemes = expect(lexemes.subspan<2>(), Operator::bracketleft, "Expected '('");
+        while (lexemes.empty() or lexemes.front() != Lexeme{Operator::bracketright}) {
+            if (not declaration.parameters.empty()) {
+                lexemes = expect(lexemes, Operator::comma, "Expected ','");
+            }
+            if (lexemes.empty() or not std::holds_alternative<Identifier>(lexemes.front())) {
+                throw std::invalid_argument{"Expected parameter name"};
+            }
+            auto const name = std::get<Identifier>(lexemes.front()).value;
+            if (std::ranges::find(declaration.parameters, name) !=
+                declaration.parameters.end()) {
+                throw std::invalid_argument{"Duplicate parameter"};
+            }
+            declaration.parameters.push_back(name);
+            lexemes = lexemes.subspan<1>();
+            auto annotation = Type::empty;
+            if (not lexemes.empty() and lexemes.front() == Lexeme{Operator::semicolon}) {
+                annotation = parse_annotation(lexemes.subspan<1>());
+                lexemes = lexemes.subspan<2>();
+            }
+            declaration.annotations.push_back(annotation);
+        }
+        lexemes = expect(lexemes.subspan<1>(), Operator::semicolon, "Expected ':'");
+        declaration.body = expect(lexemes, Operator::linebreak, "Expected linebreak");
+        if (table.has_value() and declaration.parameters.size() != 1) {
+            throw std::invalid_argument{"Only functions of one parameter can be tabulated"};
+        } else if (table.has_value() and is_generator(declaration.body)) {
+            throw std::invalid_argument{"Generators cannot be tabulated"};
+        }
+        declaration.table = table;
+        return declaration;
+    }
+
+    // Function definitions of a module, every unindented line starts the next one
+    constexpr std::vector<Declaration>
+    parse_declarations(std::span<Lexeme const> lexemes) {
+        auto declarations = std::vector<Declaration>{};
+        for (lexemes = skip_blank_lines(lexemes); not lexemes.empty();
+             lexemes = skip_blank_lines(lexemes)) {
+            auto declaration = parse_function_header(lexemes);
+            auto const body = declaration.body;
+            auto end = std::size_t{0};
+            while (end < body.size() and
+                   (end == 0 or body[end - 1] != Lexeme{Operator::linebreak} or
+                    std::holds_alternative<Indentation>(body[end]) or
+                    body[end] == Lexeme{Operator::linebreak})) {
+                ++end;
+            }
+            declaration.body = body.first(end);
+            lexemes = body.subspan(end);
+            if (std::ranges::find(declarations, declaration.name, &Declaration::name) !=
+                declarations.end()) {
+                throw std::invalid_argument{"Duplicate function"};
+            }
+            declarations.push_back(std::move(declaration));
+        }
+        return declarations;
+    }
+
+    // Line and column of the lexeme at `index` of `source`, which starts a statement
+    constexpr SourceLocation
+    locate(std::span<Lexeme const> const source, std::size_t const index) noexcept {
+        auto const linebreaks =
+                std::ranges::count(source.first(index), Lexeme{Operator::linebreak});
+        auto const* const indentation =
+                index > 0 ? std::get_if<Indentation>(&source[index - 1]) : nullptr;
+        return {static_cast<std::size_t>(linebreaks) + 1,
+                indentation != nullptr ? indentation->width + 1 : 1};
+    }
+
+    // Declarations in `lexemes`, which are either a module or a single function
+    template<auto const& lexemes, bool is_module>
+    constexpr std::vector<Declaration>
+    declarations() {
+        if constexpr (is_module) {
+            return parse_declarations(lexemes.elements);
+        } else {
+            return {parse_function_header(lexemes.elements)};
+        }
+    }
+
+    struct StringPoolSizes final {
+        std::size_t string_count;
+        std::size_t character_count;
+    };
+
+    template<auto const& lexemes, bool is_module>
+    inline constexpr auto string_pool_sizes = [] {
+        auto const strings = collect_strings(declarations<lexemes, is_module>());
+        auto sizes = StringPoolSizes{strings.size(), 0};
+        for (auto const& string: strings) {
+            sizes.character_count += string.size();
+        }
+        return sizes;
+    }();
+
+    // Characters of the strings built by the functions in `lexemes`, one after another
+    template<auto const& lexemes, bool is_module>
+    inline constexpr auto string_characters = [] {
+        auto characters =
+                std::array<char, string_pool_sizes<lexemes, is_module>.character_count>{};
+        auto end = characters.begin();
+        for (auto const& string: collect_strings(declarations<lexemes, is_module>())) {
+            end = std::ranges::copy(string, end).out;
+        }
+        return characters;
+    }();
+
+    // Static pool of the strings built by the functions in `lexemes`
+    template<auto const& lexemes, bool is_module>
+    inline constexpr auto string_pool = [] {
+        constexpr auto sizes = string_pool_sizes<lexemes, is_module>;
+        auto pool = std::array<std::string_view, sizes.string_count>{};
+        auto const* characters = string_characters<lexemes, is_module>.data();
+        auto const strings = collect_strings(declarations<lexemes, is_module>());
+        for (auto i = std::size_t{0}; i < pool.size(); ++i) {
+            pool[i] = std::string_view{characters, strings[i].size()};
+            characters += strings[i].size();
+        }
+        return pool;
+    }();
+
+    struct DictionaryPoolSizes final {
+        std::size_t dictionary_count = 0;
+        std::size_t entry_count = 0;
+        std::size_t bucket_count = 0;
+        std::size_t slot_count = 0;
+    };
+
+    template<auto const& lexemes, bool is_module>
+    inline constexpr auto dictionary_pool_sizes = [] {
+        auto const dictionaries = collect_dictionaries(
+                declarations<lexemes, is_module>(), string_pool<lexemes, is_module>);
+        auto sizes = DictionaryPoolSizes{dictionaries.size()};
+        for (auto const& entries: dictionaries) {
+            sizes.entry_count += entries.size();
+            sizes.bucket_count += displaced_bucket_count(entries.size());
+            sizes.slot_count += displaced_capacity(entries.size());
+        }
+        return sizes;
+    }();
+
+    // Arrays of all dictionaries of a source one after another and what else every dictionary
+    // consists of
+    template<DictionaryPoolSizes sizes>
+    struct DictionaryStorage final {
+        std::array<std::pair<Variable, Variable>, sizes.entry_count> entries = {};
+        std::array<std::uint64_t, sizes.bucket_count> displacements = {};
+        std::array<std::size_t, sizes.slot_count> slots = {};
+        std::array<std::size_t, sizes.dictionary_count> entry_counts = {};
+        std::array<std::uint64_t, sizes.dictionary_count> seeds = {};
+        std::array<Type, sizes.dictionary_count> value_types = {};
+    };
+
+    template<auto const& lexemes, bool is_module>
+    inline constexpr auto dictionary_storage = [] {
+        auto storage = DictionaryStorage<dictionary_pool_sizes<lexemes, is_module>>{};
+        auto entries = storage.entries.begin();
+        auto displacements = storage.displacements.begin();
+        auto slots = storage.slots.begin();
+        auto const dictionaries = collect_dictionaries(
+                declarations<lexemes, is_module>(), string_pool<lexemes, is_module>);
+        for (auto i = std::size_t{0}; i < dictionaries.size(); ++i) {
+            auto const layout = dictionary_layout(dictionaries[i]);
+            entries = std::ranges::copy(dictionaries[i], entries).out;
+            displacements = std::ranges::copy(layout.displacements, displacements).out;
+            slots = std::ranges::copy(layout.slots, slots).out;
+            storage.entry_counts[i] = dictionaries[i].size();
+            storage.seeds[i] = layout.seed;
+            storage.value_types[i] = dictionary_value_type(dictionaries[i]);
+        }
+        return storage;
+    }();
+
+    // Static pool of the dictionaries probed by the functions in `lexemes`
+    template<auto const& lexemes, bool is_module>
+    inline constexpr auto dictionary_pool = [] {
+        auto const& storage = dictionary_storage<lexemes, is_module>;
+        auto pool = std::array<
+                Dictionary,
+                dictionary_pool_sizes<lexemes, is_module>.dictionary_count>{};
+        auto entries = std::span<std::pair<Variable, Variable> const>{storage.entries};
+        auto displacements = std::span<std::uint64_t const>{storage.displacements};
+        auto slots = std::span<std::size_t const>{storage.slots};
+        for (auto i = std::size_t{0}; i < pool.size(); ++i) {
+            auto const entry_count = storage.entry_counts[i];
+            auto const bucket_count = displaced_bucket_count(entry_count);
+            auto const capacity = displaced_capacity(entry_count);
+            pool[i] = Dictionary{
+                    storage.seeds[i],
+                    displacements.first(bucket_count),
+                    slots.first(capacity),
+                    entries.first(entry_count),
+                    storage.value_types[i]};
+            entries = entries.subspan(entry_count);
+            displacements = displacements.subspan(bucket_count);
+            slots = slots.subspan(capacity);
+        }
+        return pool;
+    }();
+
+    // Counters of a Profiled function compiled from `lexemes`
+    template<auto const& lexemes, bool is_module, std::size_t index, std::size_t operation_count>
+    inline auto profile_counters = ProfileCounters<operation_count>{};
+
+    // Compiles the function at `index` of the declarations in `lexemes`, which are either a
+    // module whose functions may call each other or a single function. A Profiled function gets
+    // the source location of every operation and its counters.
+    template<auto const& lexemes, bool is_module, std::size_t index = 0, class Policy = Unprofiled>
+    constexpr auto
+    compile_function() noexcept {
+        auto const compile = [](auto const compile_func) {
+            auto const source = std::is_same_v<Policy, Profiled>
+                                        ? std::span<Lexeme const>{lexemes.elements}
+                                        : std::span<Lexeme const>{};
+            auto const& strings = string_pool<lexemes, is_module>;
+            auto const& dictionaries = dictionary_pool<lexemes, is_module>;
+            auto const declarations_ = declarations<lexemes, is_module>();
+            auto const& declaration = declarations_[index];
+            return compile_func(
+                    declaration,
+                    Scope{declaration.parameters,
+                          is_module ? std::span{declarations_} : std::span<Declaration const>{},
+                          source,
+                          strings,
+                          dictionaries});
+        };
+        constexpr auto function_parameters =
+                compile([](auto const& declaration, auto const& scope) {
+                    return calculate_function_parameters<>(declaration.body, scope);
+                });
+        constexpr auto signature = compile([](auto const& declaration, auto const&) {
+            auto signature = Signature<function_parameters.parameters_count>{};
+            std::ranges::copy(declaration.annotations, signature.begin());
+            return signature;
+        });
+        constexpr auto operation_count = function_parameters.operation_count;
+        auto function = Function<
+                function_parameters.stack_size,
+                function_parameters.parameters_count,
+                operation_count,
+                signature,
+                Policy>{};
+        auto const operations = compile([](auto const& declaration, auto const& scope) {
+            return compile_operations<>(declaration.body, scope);
+        });
+        std::ranges::copy(remove_locations(operations), function.operations.begin());
+        if constexpr (std::is_same_v<Policy, Profiled>) {
+            std::ranges::transform(
+                    find_locations(operations),
+                    function.profile.locations.begin(),
+                    [](std::size_t const lexeme) { return locate(lexemes.elements, lexeme); });
+            function.profile.counters =
+                    &profile_counters<lexemes, is_module, index, operation_count>;
+        }
+        return function;
+    }
+
+    // Name of a module function usable as template argument
+    template<std::size_t size>
+    struct FunctionName final {
+        std::array<char, size - 1> value;
+
+        constexpr FunctionName(char const (&name)[size]) noexcept {  // NOLINT(*-explicit-*)
+            std::copy_n(name, size - 1, value.begin());
+        }
+
+        constexpr operator std::string_view() const noexcept {  // NOLINT(*-explicit-*)
+            return {value.data(), value.size()};
+        }
+    };
+
 }  // namespace detail
 
-template<auto const& lexemes>
+enum class Mode {
+    interpreted,  // Function visiting its operation array
+    lowered,      // LoweredFunction with one template instantiation per operation
+    packed        // PackedFunction interpreting narrow operations
+};
+
+template<auto const& lexemes, Mode mode = Mode::interpreted, class Policy = Unprofiled>
+constexpr auto parse() noexcept;
+
+template<auto const& lexemes, Mode mode>
+struct Module;
+
+namespace detail {
+
+    // Static storage for the interpreted function a LoweredFunction or GeneratorFunction refers to
+    template<auto const& lexemes, class Policy = Unprofiled>
+    inline constexpr auto interpreted_function = compile_function<lexemes, false, 0, Policy>();
+
+    template<auto const& lexemes, std::size_t index>
+    inline constexpr auto module_function = compile_function<lexemes, true, index>();
+
+    template<auto const& lexemes, std::size_t index>
+    inline constexpr auto is_module_generator =
+            is_generator(parse_declarations(lexemes.elements)[index].body);
+
+    template<auto const& lexemes, std::size_t index>
+    inline constexpr auto module_table = parse_declarations(lexemes.elements)[index].table;
+
+    // Static storage for the module its functions resolve their calls with
+    template<auto const& lexemes, Mode mode>
+    inline constexpr auto module_instance = Module<lexemes, mode>{};
+
+    // The function in `lexemes` ignoring its `@table` decorator
+    template<auto const& lexemes, Mode mode, class Policy>
+    constexpr auto
+    parse_untabulated() noexcept {
+        if constexpr (is_generator(lexemes.elements)) {
+            return GeneratorFunction<interpreted_function<lexemes, Policy>>{};
+        } else if constexpr (mode == Mode::lowered) {
+            return LoweredFunction<interpreted_function<lexemes, Policy>>{};
+        } else if constexpr (mode == Mode::packed) {
+            return PackedFunction<interpreted_function<lexemes, Policy>>{};
+        } else {
+            return compile_function<lexemes, false, 0, Policy>();
+        }
+    }
+
+    // Static storage for the function a TabulatedFunction passes the arguments outside its
+    // domain on to
+    template<auto const& lexemes, Mode mode, class Policy>
+    inline constexpr auto untabulated_function = parse_untabulated<lexemes, mode, Policy>();
+
+    template<auto const& lexemes>
+    inline constexpr auto function_table = parse_function_header(lexemes.elements).table;
+
+}  // namespace detail
+
+// Compiles the single function in `lexemes`, a Profiled function records its runs, see profile.h.
+// A function decorated with `@table(begin, end)` becomes a TabulatedFunction.
+template<auto const& lexemes, Mode mode, class Policy>
 constexpr auto
 parse() noexcept {
-    constexpr auto lexemes_view = detail::check_function_header<lexemes>();
-    constexpr auto function_parameters = detail::calculate_function_parameters<>(lexemes_view);
-    auto function = Function<
-            function_parameters.stack_size,
-            function_parameters.parameters_count,
-            function_parameters.operation_count>{};
-    auto const operations = detail::build_operations(lexemes_view);
-    std::ranges::copy(operations, function.operations.begin());
-    return function;
+    if constexpr (detail::function_table<lexemes>.has_value()) {
+        return TabulatedFunction<
+                detail::untabulated_function<lexemes, mode, Policy>,
+                *detail::function_table<lexemes>>{};
+    } else {
+        return detail::parse_untabulated<lexemes, mode, Policy>();
+    }
+}
+
+// Function of a module, calls to the other functions of the module are resolved by `module`
+template<auto const& function, auto const& module>
+struct ModuleFunction final {
+    template<class... Parameters>
+    constexpr Variable
+    operator()(Parameters&&... parameters) const {
+        using Traits = detail::FunctionTraits<std::remove_cvref_t<decltype(function)>>;
+        static_assert(
+                sizeof...(Parameters) == Traits::parameters_count,
+                "Wrong number of parameters passed");
+        static_assert(
+                detail::accepts_arguments<Traits::signature, Parameters...>(),
+                "Argument does not match the parameter annotation");
+        auto const arguments = std::array<Variable, sizeof...(Parameters)>{
+                Variable{std::forward<Parameters>(parameters)}...};
+        return function.call(module, arguments);
+    }
+
+    constexpr bool
+    operator==(ModuleFunction const&) const noexcept = default;
+};
+
+// Several functions parsed from one source which may call each other. Every function is compiled
+// on its own, calls to small functions are inlined and the remaining ones go through the module.
+template<auto const& lexemes, Mode mode>
+struct Module final {
+    static constexpr auto function_count = detail::parse_declarations(lexemes.elements).size();
+
+    // Index of the function called `name`
+    static constexpr std::size_t
+    find(std::string_view const name) {
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        auto const declaration = std::ranges::find(declarations, name, &detail::Declaration::name);
+        if (declaration == declarations.end()) {
+            throw std::invalid_argument{"Undefined function"};
+        }
+        return static_cast<std::size_t>(declaration - declarations.begin());
+    }
+
+    template<std::size_t index>
+    static constexpr auto
+    function() noexcept {
+        if constexpr (detail::module_table<lexemes, index>.has_value()) {
+            return TabulatedFunction<
+                    untabulated_function<index>,
+                    *detail::module_table<lexemes, index>>{};
+        } else {
+            return untabulated<index>();
+        }
+    }
+
+    template<detail::FunctionName name>
+    static constexpr auto
+    function() noexcept {
+        return function<find(name)>();
+    }
+
+    // Resolves the calls of the module's functions
+    constexpr Variable
+    operator()(std::size_t const index, std::span<Variable const> const arguments) const {
+        return [&]<std::size_t... I>(std::index_sequence<I...>) {
+            auto result = Variable{};
+            ((index == I and (result = call<I>(arguments), true)) or ...);
+            return result;
+        }(std::make_index_sequence<function_count>{});
+    }
+
+    constexpr bool
+    operator==(Module const&) const noexcept = default;
+
+  private:
+    template<std::size_t index>
+    static constexpr auto
+    untabulated() noexcept {
+        constexpr auto const& compiled = detail::module_function<lexemes, index>;
+        constexpr auto const& module = detail::module_instance<lexemes, mode>;
+        if constexpr (detail::is_module_generator<lexemes, index>) {
+            return GeneratorFunction<compiled, module>{};
+        } else if constexpr (mode == Mode::lowered) {
+            return LoweredFunction<compiled, module>{};
+        } else if constexpr (mode == Mode::packed) {
+            return PackedFunction<compiled, module>{};
+        } else {
+            return ModuleFunction<compiled, module>{};
+        }
+    }
+
+    template<std::size_t index>
+    static constexpr auto untabulated_function = untabulated<index>();
+
+    template<std::size_t index>
+    static constexpr Variable
+    call(std::span<Variable const> const arguments) {
+        constexpr auto const& compiled = detail::module_function<lexemes, index>;
+        if constexpr (detail::module_table<lexemes, index>.has_value()) {
+            if (auto const* const argument = std::get_if<int>(&arguments[0]);
+                argument != nullptr) {
+                if (auto const result = decltype(function<index>())::lookup(*argument);
+                    result.has_value()) {
+                    return Variable{*result};
+                }
+            }
+        }
+        if constexpr (detail::is_module_generator<lexemes, index>) {
+            return Variable{};  // The parser rejects calls to generators
+        } else if constexpr (mode == Mode::lowered) {
+            using Traits = detail::FunctionTraits<std::remove_cvref_t<decltype(compiled)>>;
+            return [&]<std::size_t... I>(std::index_sequence<I...>) {
+                return Variable{untabulated<index>()(arguments[I]...)};
+            }(std::make_index_sequence<Traits::parameters_count>{});
+        } else if constexpr (mode == Mode::packed) {
+            return untabulated<index>().call(arguments);
+        } else {
+            return compiled.call(detail::module_instance<lexemes, mode>, arguments);
+        }
+    }
+};
+
+template<auto const& lexemes, Mode mode = Mode::interpreted>
+constexpr auto
+parse_module() noexcept {
+    return Module<lexemes, mode>{};
 }
 
-}  // namespace ctpy
\ No newline at end of file
+}  // namespace ctpy
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ctpy {
+
+namespace detail {
+
+    // Seeded FNV-1a
+    constexpr std::uint64_t
+    hash(std::string_view const key, std::uint64_t const seed) noexcept {
+        auto result = 0xcbf29ce484222325ULL ^ seed;
+        for (auto const c: key) {
+            result = (result ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+        }
+        return result;
+    }
+
+    constexpr std::uint64_t
+    hash(std::integral auto const key, std::uint64_t const seed) noexcept {
+        auto result = (static_cast<std::uint64_t>(key) ^ seed) * 0x9e3779b97f4a7c15ULL;
+        return result ^ (result >> 32U);
+    }
+
+}  // namespace detail
+
+// Immutable map whose hash seed is searched at compile time so that no two keys share a slot:
+// a lookup is one hash, one table load and one key comparison
+template<class Key, class Value, std::size_t N>
+struct PerfectHashMap final {
+    static constexpr auto capacity = std::bit_ceil(2 * N + 1);
+    static constexpr auto empty = N;
+
+    std::uint64_t seed = 0;
+    std::array<std::size_t, capacity> slots = {};
+    std::array<std::pair<Key, Value>, N> entries = {};
+
+    [[nodiscard]] constexpr Value const*
+    find(auto const& key) const noexcept {
+        auto const entry = slots[detail::hash(key, seed) & (capacity - 1)];
+        if (entry == empty or entries[entry].first != key) {
+            return nullptr;
+        }
+        return &entries[entry].second;
+    }
+
+    [[nodiscard]] constexpr bool
+    contains(auto const& key) const noexcept {
+        return find(key) != nullptr;
+    }
+
+    [[nodiscard]] static constexpr std::size_t
+    size() noexcept {
+        return N;
+    }
+
+    constexpr bool
+    operator==(PerfectHashMap const&) const noexcept = default;
+};
+
+template<class Key, class Value, std::size_t N>
+constexpr PerfectHashMap<Key, Value, N>
+make_perfect_hash_map(std::array<std::pair<Key, Value>, N> const& entries) {
+    using Map = PerfectHashMap<Key, Value, N>;
+    constexpr auto max_seed = 1U << 16U;
+    for (auto seed = std::uint64_t{0}; seed < max_seed; ++seed) {
+        auto map = Map{seed, {}, entries};
+        map.slots.fill(Map::empty);
+        auto collision = false;
+        for (auto i = std::size_t{0}; i < N and not collision; ++i) {
+            auto& slot = map.slots[detail::hash(entries[i].first, seed) & (Map::capacity - 1)];
+            if (slot != Map::empty) {
+                if (entries[slot].first == entries[i].first) {
+                    throw "Duplicate key in perfect hash map";  // NOLINT(*-exception-baseclass)
+                }
+                collision = true;
+            }
+            slot = i;
+        }
+        if (not collision) {
+            return map;
+        }
+    }
+    throw "Could not find a perfect hash seed";  // NOLINT(*-exception-baseclass)
+}
+
+namespace detail {
+
+    // Hash-and-displace layout of a perfect hash table: the keys are spread over buckets by their
+    // hash and every bucket gets a displacement which sends all of its keys to free slots. Unlike
+    // the single seed of a PerfectHashMap, which is only found for a few dozen keys, a layout is
+    // found for thousands of them, and a lookup still hashes its key once.
+    struct DisplacedLayout final {
+        std::uint64_t seed = 0;
+        std::vector<std::uint64_t> displacements;  // Of every bucket
+        std::vector<std::size_t> slots;            // Index of the key in every slot, the key count
+                                                   // for empty slots
+    };
+
+    constexpr std::size_t
+    displaced_bucket_count(std::size_t const key_count) noexcept {
+        return std::bit_ceil(key_count / 2 + 1);
+    }
+
+    constexpr std::size_t
+    displaced_capacity(std::size_t const key_count) noexcept {
+        return std::bit_ceil(2 * key_count + 1);
+    }
+
+    constexpr std::size_t
+    displaced_bucket(std::uint64_t const hash, std::size_t const bucket_count) noexcept {
+        return static_cast<std::size_t>(hash) & (bucket_count - 1);
+    }
+
+    // Slot of a key in a table of `capacity` slots, the keys of a bucket share its low bits, so
+    // the slot is taken from the high bits of the displaced hash
+    constexpr std::size_t
+    displaced_slot(
+            std::uint64_t const hash,
+            std::uint64_t const displacement,
+            std::size_t const capacity) noexcept {
+        auto const mixed = (hash ^ displacement) * 0x9e3779b97f4a7c15ULL;
+        return static_cast<std::size_t>(mixed >> 32U) & (capacity - 1);
+    }
+
+    // Layout for `key_count` distinct keys, where `hash(index, seed)` hashes the key at `index`.
+    // Fuller buckets have fewer displacements to choose from, so they are placed first.
+    constexpr DisplacedLayout
+    make_displaced_layout(std::size_t const key_count, auto const& hash) {
+        constexpr auto max_seed = std::uint64_t{1} << 8U;
+        constexpr auto max_displacement = std::uint64_t{1} << 12U;
+        auto const bucket_count = displaced_bucket_count(key_count);
+        auto const capacity = displaced_capacity(key_count);
+        for (auto seed = std::uint64_t{0}; seed < max_seed; ++seed) {
+            auto hashes = std::vector<std::uint64_t>(key_count);
+            auto buckets = std::vector<std::vector<std::size_t>>(bucket_count);
+            for (auto i = std::size_t{0}; i < key_count; ++i) {
+                hashes[i] = hash(i, seed);
+                buckets[displaced_bucket(hashes[i], bucket_count)].push_back(i);
+            }
+            auto order = std::vector<std::size_t>(bucket_count);
+            for (auto i = std::size_t{0}; i < bucket_count; ++i) {
+                order[i] = i;
+            }
+            std::ranges::sort(order, [&buckets](std::size_t const lhs, std::size_t const rhs) {
+                return buckets[lhs].size() != buckets[rhs].size()
+                               ? buckets[lhs].size() > buckets[rhs].size()
+                               : lhs < rhs;
+            });
+            auto layout = DisplacedLayout{
+                    seed,
+                    std::vector<std::uint64_t>(bucket_count),
+                    std::vector<std::size_t>(capacity, key_count)};
+            auto const place = [&](std::vector<std::size_t> const& bucket) {
+                auto taken = std::vector<std::size_t>{};
+                for (auto displacement = std::uint64_t{0}; displacement < max_displacement;
+                     ++displacement) {
+                    taken.clear();
+                    for (auto const key: bucket) {
+                        auto const slot = displaced_slot(hashes[key], displacement, capacity);
+                        if (layout.slots[slot] != key_count or
+                            std::ranges::find(taken, slot) != taken.end()) {
+                            break;
+                        }
+                        taken.push_back(slot);
+                    }
+                    if (taken.size() == bucket.size()) {
+                        for (auto i = std::size_t{0}; i < bucket.size(); ++i) {
+                            layout.slots[taken[i]] = bucket[i];
+                        }
+                        return displacement;
+                    }
+                }
+                return max_displacement;
+            };
+            auto placed = true;
+            for (auto const bucket: order) {
+                layout.displacements[bucket] = place(buckets[bucket]);
+                if (layout.displacements[bucket] == max_displacement) {
+                    // Keys of equal hashes, try the next seed
+                    placed = false;
+                    break;
+                }
+            }
+            if (placed) {
+                return layout;
+            }
+        }
+        throw "Could not find a perfect hash layout";  // NOLINT(*-exception-baseclass)
+    }
+
+}  // namespace detail
+
+}  // namespace ctpy
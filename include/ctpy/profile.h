@@ -0,0 +1,113 @@
+#pragma once
+
+#include "function.h"
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+namespace ctpy {
+
+namespace detail {
+
+    // Names of the operations in the order of the Operation alternatives
+    inline constexpr auto operation_names = std::array<std::string_view, 29>{
+            "add",
+            "assign",
+            "branch",
+            "call",
+            "constant",
+            "contains",
+            "divide",
+            "endswith",
+            "equal",
+            "floor_divide",
+            "greater_equal",
+            "greater",
+            "jump",
+            "length",
+            "less_equal",
+            "less",
+            "location",
+            "lookup",
+            "modulo",
+            "multiply",
+            "not_equal",
+            "power",
+            "return",
+            "select",
+            "slice",
+            "startswith",
+            "subscript",
+            "subtract",
+            "yield"};
+
+    static_assert(std::variant_size_v<Operation> == operation_names.size());
+
+    template<class FunctionType>
+    inline constexpr auto is_profiled =
+            std::is_same_v<typename FunctionTraits<FunctionType>::policy, Profiled>;
+
+}  // namespace detail
+
+constexpr std::string_view
+operation_name(Operation const& operation) noexcept {
+    return detail::operation_names[operation.index()];
+}
+
+// Clears the counters of a Profiled function
+template<class FunctionType>
+    requires detail::is_profiled<FunctionType>
+void
+reset_profile(FunctionType const& function) noexcept {
+    if (function.profile.counters != nullptr) {
+        *function.profile.counters = {};
+    }
+}
+
+// One line per operation in the order of the operations: its source location, name, how often it
+// ran and the time spent in it in nanoseconds, which includes the callee for calls
+template<class FunctionType>
+    requires detail::is_profiled<FunctionType>
+void
+write_flat_profile(std::ostream& stream, FunctionType const& function) {
+    stream << "line:column operation         hits    time[ns]\n";
+    for (auto index = std::size_t{0}; index < function.operations.size(); ++index) {
+        auto const& location = function.profile.locations[index];
+        auto const counters = function.profile.counters != nullptr
+                                      ? (*function.profile.counters)[index]
+                                      : OperationCounters{};
+        auto const nanoseconds =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(counters.time).count();
+        stream << std::right << std::setw(4) << location.line << ':' << std::left
+               << std::setw(6) << location.column << ' ' << std::setw(13)
+               << operation_name(function.operations[index]) << std::right << std::setw(10)
+               << counters.hits << std::setw(12) << nanoseconds << '\n';
+    }
+}
+
+// Folded stacks as read by flamegraph.pl and speedscope: `name;line N;operation` followed by the
+// nanoseconds spent in the operation, operations which never ran are left out
+template<class FunctionType>
+    requires detail::is_profiled<FunctionType>
+void
+write_folded_profile(std::ostream& stream, FunctionType const& function, std::string_view name) {
+    if (function.profile.counters == nullptr) {
+        return;
+    }
+    for (auto index = std::size_t{0}; index < function.operations.size(); ++index) {
+        auto const& counters = (*function.profile.counters)[index];
+        if (counters.hits == 0) {
+            continue;
+        }
+        stream << name << ";line " << function.profile.locations[index].line << ';'
+               << operation_name(function.operations[index]) << ' '
+               << std::chrono::duration_cast<std::chrono::nanoseconds>(counters.time).count()
+               << '\n';
+    }
+}
+
+}  // namespace ctpy
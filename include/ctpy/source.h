@@ -0,0 +1,126 @@
+#pragma once
+
+#include "lexer.h"
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#include <string>
+#endif
+
+namespace ctpy {
+
+// Read-only view of a source file. Where the system supports it the file is memory-mapped, so
+// its text is paged in on demand instead of being copied, otherwise it is read into memory. The
+// lexemes of a LexemeStream over content() refer to the mapping and stay valid as long as the
+// MappedFile does.
+class MappedFile final {
+  public:
+    explicit MappedFile(std::filesystem::path const& path) {
+#if __has_include(<sys/mman.h>)
+        auto const file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file == -1) {
+            throw std::system_error{errno, std::generic_category(), path.string()};
+        }
+        struct ::stat status = {};
+        if (::fstat(file, &status) == -1) {
+            auto const error = errno;
+            ::close(file);
+            throw std::system_error{error, std::generic_category(), path.string()};
+        }
+        size = static_cast<std::size_t>(status.st_size);
+        // Mapping nothing fails, empty files keep a null mapping
+        if (size > 0) {
+            auto* const mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (mapping == MAP_FAILED) {
+                auto const error = errno;
+                ::close(file);
+                throw std::system_error{error, std::generic_category(), path.string()};
+            }
+            // The lexer reads the file once from start to end
+            ::madvise(mapping, size, MADV_SEQUENTIAL);
+            data = static_cast<char const*>(mapping);
+        }
+        ::close(file);
+#else
+        auto stream = std::ifstream{path, std::ios::binary};
+        if (not stream) {
+            throw std::system_error{
+                    std::make_error_code(std::errc::no_such_file_or_directory), path.string()};
+        }
+        text.assign(std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{});
+        data = text.data();
+        size = text.size();
+#endif
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : data{std::exchange(other.data, nullptr)},
+          size{std::exchange(other.size, 0)} {
+#if !__has_include(<sys/mman.h>)
+        text = std::move(other.text);
+        data = text.data();
+#endif
+    }
+
+    MappedFile&
+    operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data = std::exchange(other.data, nullptr);
+            size = std::exchange(other.size, 0);
+#if !__has_include(<sys/mman.h>)
+            text = std::move(other.text);
+            data = text.data();
+#endif
+        }
+        return *this;
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile&
+    operator=(MappedFile const&) = delete;
+
+    ~MappedFile() {
+        unmap();
+    }
+
+    [[nodiscard]] std::string_view
+    content() const noexcept {
+        return {data, size};
+    }
+
+    // Pull stream of the lexemes of the file
+    [[nodiscard]] LexemeStream<>
+    lexemes() const noexcept {
+        return LexemeStream{content()};
+    }
+
+  private:
+    void
+    unmap() noexcept {
+#if __has_include(<sys/mman.h>)
+        if (data != nullptr) {
+            ::munmap(const_cast<char*>(data), size);  // NOLINT(*-const-cast)
+        }
+#endif
+    }
+
+    char const* data = nullptr;
+    std::size_t size = 0;
+#if !__has_include(<sys/mman.h>)
+    std::string text;
+#endif
+};
+
+}  // namespace ctpy
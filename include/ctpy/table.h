@@ -0,0 +1,70 @@
+#pragma once
+
+#include "function.h"
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace ctpy {
+
+// Arguments [begin, end) a function is tabulated for, like range(begin, end)
+struct Domain final {
+    int begin = 0;
+    int end = 0;
+
+    constexpr bool
+    operator==(Domain const&) const noexcept = default;
+};
+
+// Function of one parameter whose results for every int argument of `domain` are computed at
+// compile time: a call inside the domain loads the result from a table, any other argument is
+// passed on to `function`, which may be a Function, LoweredFunction or any other function of the
+// parser. Functions have no side effects, so the table gives the same results as the calls.
+template<auto const& function, Domain domain>
+struct TabulatedFunction final {
+    static_assert(domain.begin < domain.end, "Empty domain");
+
+    using Result = decltype(function(domain.begin));
+
+    static constexpr auto table = [] {
+        auto table = std::array<Result, static_cast<std::size_t>(domain.end - domain.begin)>{};
+        for (auto index = std::size_t{0}; index < table.size(); ++index) {
+            table[index] = function(domain.begin + static_cast<int>(index));
+        }
+        return table;
+    }();
+
+    // Result for `argument` if it lies in the domain
+    static constexpr std::optional<Result>
+    lookup(int const argument) noexcept {
+        if (argument < domain.begin or argument >= domain.end) {
+            return std::nullopt;
+        }
+        return table[static_cast<std::size_t>(argument - domain.begin)];
+    }
+
+    template<class Parameter>
+    constexpr auto
+    operator()(Parameter&& parameter) const {
+        if constexpr (std::is_same_v<std::remove_cvref_t<Parameter>, int>) {
+            if (auto const result = lookup(parameter); result.has_value()) {
+                return *result;
+            }
+        } else if constexpr (detail::is_variable<Parameter>) {
+            if (auto const* const argument = std::get_if<int>(&parameter); argument != nullptr) {
+                if (auto const result = lookup(*argument); result.has_value()) {
+                    return decltype(function(parameter)){*result};
+                }
+            }
+        }
+        return function(std::forward<Parameter>(parameter));
+    }
+
+    constexpr bool
+    operator==(TabulatedFunction const&) const noexcept = default;
+};
+
+}  // namespace ctpy
@@ -0,0 +1,132 @@
+#include "batch.h"
+#include <doctest/doctest.h>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace ctpy {
+
+namespace {
+
+    // [2] = 5, [3] = [0] + [1], [3] = [2] + [3], return [3]
+    constexpr auto sum_plus_five = Function<4, 2, 4>{
+            ConstantOperation{2, 5},
+            AdditionOperation{0, 1, 3},
+            AdditionOperation{2, 3, 3},
+            ReturnOperation{3}};
+
+    TEST_CASE("batch over several blocks") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto lhs = std::vector<int>(1000);
+        auto rhs = std::vector<int>(1000);
+        for (auto i = 0; i < 1000; ++i) {
+            lhs[i] = i;
+            rhs[i] = 2 * i;
+        }
+        auto results = std::vector<int>(1000);
+        batch(func, results, lhs, rhs);
+        for (auto i = 0; i < 1000; ++i) {
+            REQUIRE(results[i] == func(lhs[i], rhs[i]));
+        }
+    }
+
+    TEST_CASE("batch with mixed column types") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto const lhs = std::vector<int>{1, 2, 3};
+        auto const rhs = std::vector<double>{0.5, 1.5, 2.5};
+        auto results = std::vector<double>(3);
+        batch(func, results, lhs, rhs);
+        REQUIRE(results == std::vector<double>{6.5, 8.5, 10.5});
+    }
+
+    TEST_CASE("batch with Variable columns") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto const lhs = std::vector<Variable>{1, 2.5};
+        auto const rhs = std::vector<int>{1, 1};
+        auto results = std::vector<Variable>(2);
+        batch(func, results, lhs, rhs);
+        REQUIRE(results == std::vector<Variable>{7, 8.5});
+    }
+
+    constexpr auto without_return = Function<1, 1, 1>{ConstantOperation{0, 5}};
+
+    TEST_CASE("batch without return") {
+        static constexpr auto func = LoweredFunction<without_return>{};
+        auto const parameters = std::vector<int>{1, 2};
+        auto results = std::vector<int>{7, 7};
+        batch(func, results, parameters);
+        REQUIRE(results == std::vector<int>{0, 0});
+    }
+
+    // Reads slot 1 before anything is written to it
+    constexpr auto reads_default = Function<3, 1, 3>{
+            AdditionOperation{0, 1, 2}, ConstantOperation{1, 4}, ReturnOperation{2}};
+
+    TEST_CASE("batch starts slots from default values in every block") {
+        static constexpr auto func = LoweredFunction<reads_default>{};
+        auto const parameters = std::vector<int>(600, 1);
+        auto results = std::vector<int>(600);
+        batch(func, results, parameters);
+        REQUIRE(std::ranges::all_of(results, [](auto const result) { return result == 1; }));
+    }
+
+    TEST_CASE("batch size mismatch") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto const lhs = std::vector<int>(2);
+        auto const rhs = std::vector<int>(3);
+        auto results = std::vector<int>(2);
+        REQUIRE_THROWS(batch(func, results, lhs, rhs));
+    }
+
+    TEST_CASE("batch throws for results which do not fit an int") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto const lhs = std::vector<int>{1, std::numeric_limits<int>::max()};
+        auto const rhs = std::vector<int>{1, 1};
+        auto results = std::vector<int>(2);
+        REQUIRE_THROWS_AS(batch(func, results, lhs, rhs), std::overflow_error);
+        auto const floats = std::vector<double>{1.0, 1e10};
+        REQUIRE_THROWS_AS(batch(func, results, floats, rhs), std::out_of_range);
+    }
+
+    // [1] = 0, while [1] < [0]: [1] = [1] + [2] with [2] = 3, return [1]
+    constexpr auto round_up_to_three = Function<4, 1, 7>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 3},
+            LessOperation{1, 0, 3},
+            BranchOperation{3, 6},
+            AdditionOperation{1, 2, 1},
+            JumpOperation{2},
+            ReturnOperation{1}};
+
+    // return [0] if [0] > 0 else 0
+    constexpr auto relu = Function<3, 1, 4>{
+            ConstantOperation{1, 0},
+            GreaterOperation{0, 1, 2},
+            SelectOperation{2, 0, 1, 0},
+            ReturnOperation{0}};
+
+    TEST_CASE("batch with selects runs column-wise") {
+        static constexpr auto func = LoweredFunction<relu>{};
+        REQUIRE_FALSE(detail::has_control_flow<relu>);
+        auto values = std::vector<double>(300);
+        for (auto i = std::size_t{0}; i < values.size(); ++i) {
+            values[i] = static_cast<double>(i) - 150.5;
+        }
+        auto results = std::vector<double>(300);
+        batch(func, results, values);
+        REQUIRE(results[0] == 0.0);
+        REQUIRE(results[151] == 0.5);
+        REQUIRE(results[299] == 148.5);
+    }
+
+    TEST_CASE("batch with a loop runs row by row") {
+        static constexpr auto func = LoweredFunction<round_up_to_three>{};
+        auto const values = std::vector<int>{0, 1, 3, 7};
+        auto results = std::vector<int>(4);
+        batch(func, results, values);
+        REQUIRE(results == std::vector<int>{0, 3, 3, 9});
+    }
+
+}  // namespace
+
+}  // namespace ctpy
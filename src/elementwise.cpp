@@ -0,0 +1,103 @@
+#include "elementwise.h"
+#include "parser.h"
+#include <doctest/doctest.h>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace ctpy {
+
+namespace {
+
+    constexpr auto fma_code = Content{R"(def func(a, b, c):
+    return a * b + c)"};
+    constexpr auto fma_lexed = lex<fma_code>();
+    constexpr auto fma = parse<fma_lexed, Mode::lowered>();
+
+    TEST_CASE("elementwise over ranges") {
+        auto const a = std::vector<int>{1, 2, 3, 4};
+        auto const b = std::vector<double>{0.5, 1.5, 2.5, 3.5};
+        auto const c = std::vector<int>{10, 20, 30, 40};
+        auto results = std::vector<double>(4);
+        elementwise(fma, results, a, b, c);
+        REQUIRE(results == std::vector<double>{10.5, 23, 37.5, 54});
+        auto wrong_size = std::vector<double>(3);
+        REQUIRE_THROWS_AS(elementwise(fma, wrong_size, a, b, c), std::invalid_argument);
+    }
+
+    TEST_CASE("elementwise broadcasts single values") {
+        auto values = std::vector<int>(1000);
+        for (auto i = 0; i < 1000; ++i) {
+            values[static_cast<std::size_t>(i)] = i;
+        }
+        elementwise(fma, values, values, 3, 1);
+        for (auto i = 0; i < 1000; ++i) {
+            REQUIRE(values[static_cast<std::size_t>(i)] == 3 * i + 1);
+        }
+        auto results = std::vector<Variable>(2);
+        elementwise(fma, results, Variable{1.5}, std::vector<int>{2, 4}, 0);
+        REQUIRE(results == std::vector<Variable>{3.0, 6.0});
+    }
+
+    constexpr auto clamp_code = Content{R"(def func(x, limit):
+    if x > limit:
+        return limit
+    return 0 if x < 0 else x)"};
+    constexpr auto clamp_lexed = lex<clamp_code>();
+    constexpr auto clamp = parse<clamp_lexed, Mode::lowered>();
+
+    TEST_CASE("elementwise with branches") {
+        auto const values = std::vector<int>{-5, 3, 12};
+        auto results = std::vector<int>(3);
+        elementwise(clamp, results, values, 10);
+        REQUIRE(results == std::vector<int>{0, 3, 10});
+    }
+
+    constexpr auto prefix_code = Content{R"(def func(s, prefix):
+    return s.startswith(prefix))"};
+    constexpr auto prefix_lexed = lex<prefix_code>();
+    constexpr auto has_prefix = parse<prefix_lexed, Mode::lowered>();
+
+    TEST_CASE("elementwise broadcasts strings") {
+        auto const tags = std::vector<std::string_view>{"#a", "b", "#c"};
+        auto results = std::vector<int>(3);
+        elementwise(has_prefix, results, tags, std::string_view{"#"});
+        REQUIRE(results == std::vector<int>{1, 0, 1});
+    }
+
+#ifdef __cpp_lib_mdspan
+
+    TEST_CASE("elementwise over mdspans") {
+        auto a = std::vector<int>{1, 2, 3, 4, 5, 6};
+        auto b = std::vector<int>{6, 5, 4, 3, 2, 1};
+        auto results = std::vector<int>(6);
+        auto const result_view = std::mdspan<int, std::dextents<std::size_t, 2>>{
+                results.data(), 2, 3};
+        elementwise(fma,
+                    result_view,
+                    std::mdspan<int const, std::dextents<std::size_t, 2>>{a.data(), 2, 3},
+                    std::mdspan<int const, std::dextents<std::size_t, 2>>{b.data(), 2, 3},
+                    1);
+        REQUIRE(results == std::vector<int>{7, 11, 13, 13, 11, 7});
+        // Column-major b, so every index is visited on its own
+        elementwise(fma,
+                    result_view,
+                    std::mdspan<int const, std::dextents<std::size_t, 2>>{a.data(), 2, 3},
+                    std::mdspan<int const, std::dextents<std::size_t, 2>, std::layout_left>{
+                            b.data(), 2, 3},
+                    0);
+        REQUIRE(results == std::vector<int>{6, 8, 6, 20, 15, 6});
+        REQUIRE_THROWS_AS(
+                elementwise(fma,
+                            result_view,
+                            std::mdspan<int const, std::dextents<std::size_t, 2>>{a.data(), 3, 2},
+                            1,
+                            1),
+                std::invalid_argument);
+    }
+
+#endif
+
+}  // namespace
+
+}  // namespace ctpy
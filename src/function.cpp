@@ -1,7 +1,12 @@
 #include "function.h"
 #include <doctest/doctest.h>
+#include <limits>
 #include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 namespace ctpy {
 
@@ -30,6 +35,14 @@ namespace {
         REQUIRE(stack.variables == std::array{Variable{1.23}});
     }
 
+    TEST_CASE("SelectOperation") {
+        auto stack = Stack{0, 0, 1, 2, 3};
+        SelectOperation{0, 1, 2, 3}(stack);
+        REQUIRE(stack.variables[3] == Variable{2});
+        SelectOperation{3, 1, 2, 3}(stack);
+        REQUIRE(stack.variables[3] == Variable{1});
+    }
+
     TEST_CASE("Function with some real operations") {
         auto const func = Function<4, 2, 4>{
                 ConstantOperation{2, 5}, // [2] = 5
@@ -39,6 +52,348 @@ namespace {
         REQUIRE(func(1, 2) == Variable{8});
     }
 
+    constexpr auto lowered_operations = Function<4, 2, 4>{
+            ConstantOperation{2, 5},
+            AdditionOperation{0, 1, 3},
+            AdditionOperation{2, 3, 3},
+            ReturnOperation{3}};
+
+    TEST_CASE("LoweredFunction with some real operations") {
+        static constexpr auto func = LoweredFunction<lowered_operations>{};
+        static constexpr auto result = func(1, 2);
+        REQUIRE(result == 8);
+        REQUIRE(func(3, 4) == 12);
+    }
+
+    TEST_CASE("LoweredFunction returns the inferred type") {
+        static constexpr auto func = LoweredFunction<lowered_operations>{};
+        REQUIRE(std::is_same_v<decltype(func(1, 2)), int>);
+        REQUIRE(std::is_same_v<decltype(func(1, 2.5)), double>);
+        REQUIRE(std::is_same_v<decltype(func(Variable{1}, 2)), Variable>);
+        REQUIRE(func(1, 2.5) == 8.5);
+        REQUIRE(func(Variable{1.5}, 2) == Variable{8.5});
+    }
+
+    constexpr auto annotated_operations = Function<4, 2, 4, Signature<2>{Type::double_}>{
+            ConstantOperation{2, 5},
+            AdditionOperation{0, 1, 3},
+            AdditionOperation{2, 3, 3},
+            ReturnOperation{3}};
+
+    TEST_CASE("annotated parameters take the annotated type") {
+        static constexpr auto func = LoweredFunction<annotated_operations>{};
+        REQUIRE(std::is_same_v<decltype(func(1, 2)), double>);
+        REQUIRE(func(1, 2) == 8.0);
+        REQUIRE(std::is_same_v<decltype(func(Variable{1}, 2)), double>);
+        REQUIRE(std::is_same_v<decltype(func(1.5, 2.5)), double>);
+        REQUIRE(annotated_operations(1, 2) == Variable{8.0});
+        auto const arguments = std::array{Variable{1}, Variable{2}};
+        REQUIRE(annotated_operations.call(detail::no_callees, arguments) == Variable{8.0});
+        REQUIRE(detail::accepts(Type::double_, Type::int_));
+        REQUIRE(not detail::accepts(Type::int_, Type::double_));
+        REQUIRE(detail::accepts(Type::int_, Type::variable));
+    }
+
+    TEST_CASE("arithmetic follows Python") {
+        REQUIRE(detail::FloorDivides{}(-7, 2) == -4);
+        REQUIRE(detail::FloorDivides{}(7, -2) == -4);
+        REQUIRE(detail::FloorDivides{}(7.5, 2) == 3.0);
+        REQUIRE(detail::Modulus{}(-7, 2) == 1);
+        REQUIRE(detail::Modulus{}(7, -2) == -1);
+        REQUIRE(detail::Modulus{}(-7.5, 2) == 0.5);
+        REQUIRE(detail::Divides{}(7, 2) == 3.5);
+        REQUIRE(detail::Power{}(2, 10) == Variable{1024});
+        REQUIRE(detail::Power{}(2, -1) == Variable{0.5});
+        REQUIRE(detail::Power{}(2.0, 3) == 8.0);
+        REQUIRE(detail::Power::result(Type::int_, Type::int_) == Type::variable);
+        REQUIRE(detail::Divides::result(Type::int_, Type::int_) == Type::double_);
+    }
+
+    // return [0] // [1] + [0] % [1]
+    constexpr auto division_operations = Function<4, 2, 4>{
+            FloorDivisionOperation{0, 1, 2},
+            ModuloOperation{0, 1, 3},
+            AdditionOperation{2, 3, 3},
+            ReturnOperation{3}};
+
+    TEST_CASE("divisions by zero throw") {
+        REQUIRE(division_operations(-7, 2) == Variable{-3});
+        REQUIRE_THROWS_AS(division_operations(7, 0), std::domain_error);
+        REQUIRE_THROWS_AS(division_operations(7.5, 0.0), std::domain_error);
+        static constexpr auto lowered = LoweredFunction<division_operations>{};
+        REQUIRE(Variable{lowered(-7, 2)} == Variable{-3});
+        REQUIRE_THROWS_AS(lowered(7, 0), std::domain_error);
+        REQUIRE_THROWS_AS(lowered(Variable{7}, 0.0), std::domain_error);
+        REQUIRE_THROWS_AS(detail::Divides{}(1, 0), std::domain_error);
+    }
+
+    TEST_CASE("int results which do not fit an int throw") {
+        constexpr auto max = std::numeric_limits<int>::max();
+        constexpr auto min = std::numeric_limits<int>::min();
+        REQUIRE(detail::Plus{}(max - 1, 1) == max);
+        REQUIRE_THROWS_AS(detail::Plus{}(max, 1), std::overflow_error);
+        REQUIRE_THROWS_AS(detail::Minus{}(min, 1), std::overflow_error);
+        REQUIRE(detail::Multiplies{}(65536, -32768) == min);
+        REQUIRE_THROWS_AS(detail::Multiplies{}(65536, 65536), std::overflow_error);
+        REQUIRE(detail::Power{}(-2, 31) == Variable{min});
+        REQUIRE_THROWS_AS(detail::Power{}(2, 31), std::overflow_error);
+        REQUIRE_THROWS_AS(detail::Power{}(3, 40), std::overflow_error);
+        REQUIRE(detail::Power{}(1, max) == Variable{1});
+        REQUIRE(detail::Power{}(2, -1) == Variable{0.5});
+        REQUIRE(detail::Plus{}(max, 1.0) == 2147483648.0);
+        REQUIRE(detail::fails<detail::Plus>(Variable{max}, Variable{1}));
+        REQUIRE_FALSE(detail::fails<detail::Plus>(Variable{max}, Variable{0}));
+        REQUIRE(detail::fails<detail::Power>(Variable{2}, Variable{31}));
+        static constexpr auto func = LoweredFunction<lowered_operations>{};
+        REQUIRE(func(max - 5, 0) == max);
+        REQUIRE_THROWS_AS(func(max, 1), std::overflow_error);
+        REQUIRE_THROWS_AS(lowered_operations(max, 1), std::overflow_error);
+    }
+
+    TEST_CASE("the minimum int divided by -1") {
+        constexpr auto min = std::numeric_limits<int>::min();
+        REQUIRE_THROWS_AS(detail::FloorDivides{}(min, -1), std::overflow_error);
+        REQUIRE(detail::FloorDivides{}(min, 1) == min);
+        REQUIRE(detail::FloorDivides{}(min + 1, -1) == std::numeric_limits<int>::max());
+        REQUIRE(detail::Modulus{}(min, -1) == 0);
+        REQUIRE(detail::Modulus{}(min, 3) == 1);
+        REQUIRE(detail::fails<detail::FloorDivides>(Variable{min}, Variable{-1}));
+        REQUIRE_FALSE(detail::fails<detail::Modulus>(Variable{min}, Variable{-1}));
+        static constexpr auto lowered = LoweredFunction<division_operations>{};
+        REQUIRE_THROWS_AS(lowered(min, -1), std::overflow_error);
+        REQUIRE_THROWS_AS(division_operations(min, -1), std::overflow_error);
+    }
+
+    TEST_CASE("infer_types from constants") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                ConstantOperation{0, 1}, ConstantOperation{1, 2.5}, AdditionOperation{0, 1, 2}};
+        static constexpr auto result = detail::infer_types<3>(operations, {});
+        REQUIRE(result.variables == std::array{Type::int_, Type::double_, Type::double_});
+        REQUIRE(result.return_value == Type::empty);
+    }
+
+    TEST_CASE("infer_types from parameters") {
+        static constexpr auto operations =
+                std::array<Operation, 2>{AdditionOperation{0, 1, 1}, ReturnOperation{1}};
+        static constexpr auto parameters = std::array{Type::int_, Type::int_};
+        static constexpr auto result = detail::infer_types<2>(operations, parameters);
+        REQUIRE(result.variables == std::array{Type::int_, Type::int_});
+        REQUIRE(result.return_value == Type::int_);
+    }
+
+    TEST_CASE("infer_types slot written with different types") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                ConstantOperation{0, 1}, ReturnOperation{0}, ConstantOperation{0, 2.5}};
+        static constexpr auto result = detail::infer_types<1>(operations, {});
+        REQUIRE(result.variables == std::array{Type::variable});
+        REQUIRE(result.return_value == Type::variable);
+    }
+
+    // return [0] if [0] else 2.5
+    constexpr auto select_function = Function<3, 1, 3>{
+            ConstantOperation{1, 2.5}, SelectOperation{0, 0, 1, 2}, ReturnOperation{2}};
+
+    TEST_CASE("infer_types joins both values of a select") {
+        static constexpr auto parameters = std::array{Type::int_};
+        static constexpr auto result =
+                detail::infer_types<3>(select_function.operations, parameters);
+        REQUIRE(result.variables[2] == Type::variable);
+        static constexpr auto lowered = LoweredFunction<select_function>{};
+        REQUIRE(lowered(4) == Variable{4});
+        REQUIRE(lowered(0) == Variable{2.5});
+    }
+
+    // [0] = 0, [1] = 1, then 300 times [0] = [0] + [1]
+    constexpr auto long_operations = [] {
+        auto function = Function<2, 0, 303>{};
+        function.operations.front() = ConstantOperation{0, 0};
+        function.operations[1] = ConstantOperation{1, 1};
+        for (auto i = 2U; i < function.operations.size() - 1; ++i) {
+            function.operations[i] = AdditionOperation{0, 1, 0};
+        }
+        function.operations.back() = ReturnOperation{0};
+        return function;
+    }();
+
+    TEST_CASE("LoweredFunction with hundreds of operations") {
+        static constexpr auto func = LoweredFunction<long_operations>{};
+        static constexpr auto result = func();
+        REQUIRE(result == 300);
+        REQUIRE(Variable{func()} == long_operations());
+    }
+
+    TEST_CASE("LessOperation") {
+        auto stack = Stack{0, 2, 2.5, 0};
+        LessOperation{0, 1, 2}(stack);
+        REQUIRE(stack.variables[2] == Variable{1});
+        GreaterEqualOperation{0, 1, 2}(stack);
+        REQUIRE(stack.variables[2] == Variable{0});
+        REQUIRE(std::is_same_v<decltype(detail::evaluate(
+                                       detail::Comparison<std::less<>>{}, Variable{1}, 2)),
+                               int>);
+    }
+
+    // total = 0, i = 0, while i < [0]: total = total + i, i = i + 1, return total
+    constexpr auto loop_operations = Function<5, 1, 10>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 0},
+            ConstantOperation{3, 1},
+            LessOperation{2, 0, 4},  // loop header
+            BranchOperation{4, 8},
+            AdditionOperation{1, 2, 1},
+            AdditionOperation{2, 3, 2},
+            JumpOperation{3},
+            ReturnOperation{1},
+            ReturnOperation{0}};
+
+    TEST_CASE("Function with a loop") {
+        REQUIRE(loop_operations(5) == Variable{10});
+        REQUIRE(loop_operations(0) == Variable{0});
+    }
+
+    TEST_CASE("LoweredFunction with a loop") {
+        static constexpr auto func = LoweredFunction<loop_operations>{};
+        static constexpr auto result = func(5);
+        REQUIRE(result == 10);
+        REQUIRE(std::is_same_v<decltype(func(5)), int>);
+        REQUIRE(func(100) == 4950);
+    }
+
+    // Returns the first i with i + i > [0] from inside the loop
+    constexpr auto early_return_operations = Function<4, 1, 8>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 1},
+            AdditionOperation{1, 1, 3},  // loop header
+            GreaterOperation{3, 0, 3},
+            BranchOperation{3, 6},
+            ReturnOperation{1},
+            AdditionOperation{1, 2, 1},
+            JumpOperation{2}};
+
+    TEST_CASE("Function returns from inside a loop") {
+        REQUIRE(early_return_operations(7) == Variable{4});
+        static constexpr auto func = LoweredFunction<early_return_operations>{};
+        REQUIRE(func(7) == 4);
+        REQUIRE(func(0) == 1);
+    }
+
+    // if [0] == 1: [1] = 10 else: [1] = 20, return [1]
+    constexpr auto conditional_operations = Function<3, 1, 7>{
+            ConstantOperation{1, 1},
+            EqualOperation{0, 1, 2},
+            BranchOperation{2, 5},
+            ConstantOperation{1, 10},
+            JumpOperation{6},
+            ConstantOperation{1, 20},
+            ReturnOperation{1}};
+
+    TEST_CASE("LoweredFunction with a conditional") {
+        static constexpr auto func = LoweredFunction<conditional_operations>{};
+        REQUIRE(func(1) == 10);
+        REQUIRE(func(2) == 20);
+        REQUIRE(conditional_operations(2) == Variable{20});
+    }
+
+    TEST_CASE("find_segment") {
+        using detail::SegmentKind;
+        static constexpr auto loop = detail::find_segment(loop_operations.operations, 3, 10);
+        REQUIRE(loop.kind == SegmentKind::loop);
+        REQUIRE(loop.branch == 4);
+        REQUIRE(loop.then_end == 7);
+        REQUIRE(loop.end == 8);
+        static constexpr auto straight = detail::find_segment(loop_operations.operations, 0, 10);
+        REQUIRE(straight.kind == SegmentKind::straight);
+        REQUIRE(straight.end == 3);
+        static constexpr auto branch =
+                detail::find_segment(conditional_operations.operations, 2, 7);
+        REQUIRE(branch.kind == SegmentKind::branch);
+        REQUIRE(branch.then_end == 4);
+        REQUIRE(branch.else_begin == 5);
+        REQUIRE(branch.end == 6);
+    }
+
+    // return [0] + callees[1]([0])
+    constexpr auto calling_operations = Function<2, 1, 3>{
+            CallOperation{1, {0}, 1, 1}, AdditionOperation{0, 1, 1}, ReturnOperation{1}};
+
+    constexpr auto twice = [](std::size_t const function, std::span<Variable const> arguments) {
+        return function == 1 ? detail::evaluate(detail::Plus{}, arguments[0], arguments[0])
+                             : Variable{};
+    };
+
+    TEST_CASE("Function::call resolves calls with the callees") {
+        REQUIRE(calling_operations.call(twice, std::array{Variable{2}}) == Variable{6});
+        static constexpr auto func = LoweredFunction<calling_operations, twice>{};
+        REQUIRE(func(2) == Variable{6});
+        REQUIRE(func(2.5) == Variable{7.5});
+    }
+
+    TEST_CASE("string operations follow Python") {
+        using namespace std::string_view_literals;
+        REQUIRE(detail::type_of<std::string_view>() == Type::string);
+        REQUIRE(detail::type_of<char const (&)[4]>() == Type::string);
+        REQUIRE(detail::type_of(Variable{"abc"sv}) == Type::string);
+        REQUIRE(detail::evaluate(detail::Comparison<std::equal_to<>>{}, "ab"sv, "ab"sv) == 1);
+        REQUIRE(detail::evaluate(detail::Comparison<std::less<>>{}, "ab"sv, "b"sv) == 1);
+        REQUIRE(detail::evaluate(
+                        detail::Comparison<std::not_equal_to<>>{}, Variable{"1"sv}, Variable{1}) ==
+                1);
+        REQUIRE(detail::evaluate(detail::Comparison<std::equal_to<>>{}, Variable{"1"sv}, 1) == 0);
+        REQUIRE(detail::evaluate(detail::StartsWith{}, "prefix"sv, "pre"sv) == 1);
+        REQUIRE(detail::evaluate(detail::EndsWith{}, "prefix"sv, "pre"sv) == 0);
+        REQUIRE(detail::Subscript{}("abc"sv, -1) == "c"sv);
+        REQUIRE_THROWS_AS(detail::Subscript{}("abc"sv, 3), std::out_of_range);
+        REQUIRE_THROWS_AS(detail::Subscript{}("abc"sv, -4), std::out_of_range);
+        REQUIRE(detail::fails<detail::Subscript>(Variable{"abc"sv}, Variable{3}));
+        REQUIRE_FALSE(detail::fails<detail::Subscript>(Variable{"abc"sv}, Variable{-3}));
+        REQUIRE(detail::slice("abcdef"sv, 1, -2) == "bcd"sv);
+        REQUIRE(detail::slice(Variable{"abc"sv}, Variable{-10}, Variable{10}) == "abc"sv);
+        REQUIRE(detail::slice("abc"sv, 2, 1).empty());
+        REQUIRE(detail::length(Variable{"abc"sv}) == 3);
+        REQUIRE(detail::truthy(Variable{""sv}) == false);
+        REQUIRE(detail::truthy("0"sv));
+        // Python raises TypeErrors for these
+        REQUIRE_THROWS_AS(
+                detail::evaluate(detail::Plus{}, Variable{"a"sv}, Variable{"b"sv}),
+                std::invalid_argument);
+        REQUIRE_THROWS_AS(
+                detail::evaluate(detail::Multiplies{}, Variable{"a"sv}, 2), std::invalid_argument);
+        REQUIRE_THROWS_AS(
+                detail::evaluate(detail::Comparison<std::less<>>{}, Variable{"a"sv}, 1),
+                std::invalid_argument);
+        REQUIRE_THROWS_AS(
+                detail::evaluate(detail::StartsWith{}, Variable{1}, "a"sv), std::invalid_argument);
+        REQUIRE(detail::fails<detail::Plus>(Variable{"a"sv}, Variable{"b"sv}));
+        REQUIRE(detail::fails<detail::Subscript>(Variable{1}, Variable{0}));
+        REQUIRE_FALSE(detail::Raising<detail::Comparison<std::equal_to<>>>);
+        static constexpr auto concatenation =
+                std::array<Operation, 2>{AdditionOperation{0, 1, 2}, ReturnOperation{2}};
+        auto const strings = std::array{Type::string, Type::string};
+        REQUIRE_THROWS_AS(detail::infer_types<3>(concatenation, strings), std::invalid_argument);
+        auto const variables = std::array{Type::string, Type::variable};
+        REQUIRE(detail::infer_types<3>(concatenation, variables).return_value == Type::variable);
+        REQUIRE(detail::promote(Type::string, Type::int_) == Type::variable);
+    }
+
+    // return [0][len('ab'):[1]] if [0].startswith('ab') else 'ab'
+    constexpr auto strip_prefix = Function<6, 2, 6>{
+            ConstantOperation{2, std::string_view{"ab"}},
+            LengthOperation{2, 3},
+            SliceOperation{0, 3, 1, 4},
+            StartsWithOperation{0, 2, 5},
+            SelectOperation{5, 4, 2, 4},
+            ReturnOperation{4}};
+
+    TEST_CASE("LoweredFunction with strings") {
+        using namespace std::string_view_literals;
+        static constexpr auto lowered = LoweredFunction<strip_prefix>{};
+        static constexpr auto result = lowered("abcdef"sv, 100);
+        REQUIRE(std::is_same_v<std::remove_cvref_t<decltype(result)>, std::string_view>);
+        REQUIRE(result == "cdef"sv);
+        REQUIRE(lowered("xyz"sv, 100) == "ab"sv);
+        REQUIRE(strip_prefix("abcdef", 4) == Variable{"cd"sv});
+    }
+
 }  // namespace
 
 }  // namespace ctpy
\ No newline at end of file
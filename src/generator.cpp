@@ -0,0 +1,63 @@
+#include "generator.h"
+#include <doctest/doctest.h>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <vector>
+
+namespace ctpy {
+
+namespace {
+
+    // i = 0, while i < [0]: yield i * i, i = i + 1
+    constexpr auto squares = Function<5, 1, 9>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 1},
+            LessOperation{1, 0, 3},  // loop header
+            BranchOperation{3, 8},
+            MultiplicationOperation{1, 1, 4},
+            YieldOperation{4},
+            AdditionOperation{1, 2, 1},
+            JumpOperation{2},
+            ReturnOperation{1}};
+
+    TEST_CASE("Generator yields values one by one") {
+        auto generator = GeneratorFunction<squares>{}(2);
+        REQUIRE(generator.next() == Variable{0});
+        REQUIRE(generator.next() == Variable{1});
+        REQUIRE(generator.next() == std::nullopt);
+        REQUIRE(generator.next() == std::nullopt);
+    }
+
+    TEST_CASE("Generator is an input range") {
+        static_assert(std::ranges::input_range<Generator<squares>>);
+        auto values = std::vector<Variable>{};
+        for (auto const& value: GeneratorFunction<squares>{}(4)) {
+            values.push_back(value);
+        }
+        REQUIRE(values == std::vector<Variable>{0, 1, 4, 9});
+    }
+
+    TEST_CASE("Generator in constant evaluation") {
+        static constexpr auto sum = [] {
+            auto result = 0;
+            for (auto const& value: GeneratorFunction<squares>{}(10)) {
+                result += std::get<int>(value);
+            }
+            return result;
+        }();
+        REQUIRE(sum == 285);
+    }
+
+    TEST_CASE("Generator without yields") {
+        auto generator = GeneratorFunction<squares>{}(0);
+        REQUIRE(generator.begin() == std::default_sentinel);
+    }
+
+    TEST_CASE("Function skips yields") {
+        REQUIRE(squares(3) == Variable{3});
+    }
+
+}  // namespace
+
+}  // namespace ctpy
@@ -1,5 +1,11 @@
 #include "parser.h"
+#include <algorithm>
+#include <array>
 #include <doctest/doctest.h>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
 
 namespace {
 
@@ -12,4 +18,331 @@ TEST_CASE("simple immediate return") {
     REQUIRE(std::get<int>(result) == 123);
 }
 
-}  // namespace
\ No newline at end of file
+TEST_CASE("simple immediate return lowered") {
+    static constexpr auto python_code = ctpy::Content{R"(def func():
+    return 123)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    static constexpr auto result = func();
+    REQUIRE(result == 123);
+}
+
+TEST_CASE("unused parameters") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(a, b):
+    return 123)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered(1, 2) == 123);
+    REQUIRE(ctpy::parse<lexed>()(1, 2.5) == ctpy::Variable{123});
+}
+
+TEST_CASE("for loop over range") {
+    static constexpr auto python_code = ctpy::Content{R"(def func():
+    total = 0
+    for i in range(10):
+        total = total + i
+    return total)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    static constexpr auto result = lowered();
+    REQUIRE(result == 45);
+    REQUIRE(func() == ctpy::Variable{45});
+    static constexpr auto packed = ctpy::parse<lexed, ctpy::Mode::packed>();
+    REQUIRE(packed() == ctpy::Variable{45});
+}
+
+TEST_CASE("for loop with start and step") {
+    static constexpr auto python_code = ctpy::Content{R"(def func():
+    total = 0
+    for i in range(0, 10, 3):
+        total = total + i
+    last = 0
+    for i in range(3, 10, 2):
+        last = i
+    return total + last)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered() == 27);
+}
+
+TEST_CASE("nested loops with invariant and early return") {
+    static constexpr auto python_code = ctpy::Content{R"(def func():
+    count = 0
+    i = 0
+    while i < 100:
+        for j in range(i):
+            limit = 40 + 2
+            count = count + 1
+            if_reached = count == limit
+            while if_reached == 1:
+                return i + j
+        i = i + 1
+    return 0)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    static constexpr auto result = lowered();
+    REQUIRE(result == 14);
+    REQUIRE(func() == ctpy::Variable{14});
+}
+
+TEST_CASE("module with inlined helpers") {
+    static constexpr auto python_code = ctpy::Content{R"(def add(a, b):
+    return a + b
+
+def add3(a, b, c):
+    return add(add(a, b), c)
+
+def func(n):
+    total = 0
+    for i in range(n):
+        total = add3(total, i, 1)
+    return total)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto module = ctpy::parse_module<lexed>();
+    static constexpr auto func = module.function<"func">();
+    REQUIRE(func(4) == ctpy::Variable{10});
+    static constexpr auto lowered = ctpy::parse_module<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered.function<"func">()(4) == 10);
+    REQUIRE(std::ranges::none_of(
+            ctpy::detail::module_function<lexed, module.find("func")>.operations,
+            [](ctpy::Operation const& operation) {
+                return std::holds_alternative<ctpy::CallOperation>(operation);
+            }));
+}
+
+TEST_CASE("annotated parameters") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(n: int, scale: float, offset):
+    total = offset
+    for i in range(n):
+        total = total + scale
+    return total)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(3, 2, 1) == ctpy::Variable{7.0});
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    static constexpr auto result = lowered(3, 2, 1.0);
+    REQUIRE(std::is_same_v<decltype(result), double const>);
+    REQUIRE(result == 7.0);
+    REQUIRE(lowered(3, 2, 1) == ctpy::Variable{7.0});
+}
+
+TEST_CASE("module calling an annotated function") {
+    static constexpr auto python_code = ctpy::Content{R"(def shift(x: float):
+    while x < 10:
+        return shift(x + 4)
+    return x
+
+def func():
+    return shift(1) + shift(12))"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto module = ctpy::parse_module<lexed>();
+    REQUIRE(module.function<"func">()() == ctpy::Variable{25.0});
+    static constexpr auto lowered = ctpy::parse_module<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered.function<"func">()() == ctpy::Variable{25.0});
+}
+
+TEST_CASE("annotated parameters check Variable arguments") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(n: int, scale: float):
+    return n * scale)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(ctpy::Variable{3}, ctpy::Variable{2}) == ctpy::Variable{6.0});
+    REQUIRE_THROWS_AS(func(ctpy::Variable{2.5}, 1.0), std::invalid_argument);
+    REQUIRE_THROWS_AS(func(ctpy::Variable{"x"}, 1.0), std::invalid_argument);
+    REQUIRE_THROWS_AS(func(3, ctpy::Variable{"x"}), std::invalid_argument);
+    auto const arguments = std::array{ctpy::Variable{3}, ctpy::Variable{2}};
+    REQUIRE(func.call(ctpy::detail::no_callees, arguments) == ctpy::Variable{6.0});
+    auto const truncated = std::array{ctpy::Variable{2.5}, ctpy::Variable{2}};
+    REQUIRE_THROWS_AS(func.call(ctpy::detail::no_callees, truncated), std::invalid_argument);
+    auto const string = std::array{ctpy::Variable{"x"}, ctpy::Variable{2}};
+    REQUIRE_THROWS_AS(func.call(ctpy::detail::no_callees, string), std::invalid_argument);
+}
+
+TEST_CASE("module calling an annotated function which could be inlined") {
+    static constexpr auto python_code = ctpy::Content{R"(def half(x: float):
+    return x // 2
+
+def func(a):
+    return half(a))"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto module = ctpy::parse_module<lexed>();
+    REQUIRE(module.function<"half">()(7) == ctpy::Variable{3.0});
+    REQUIRE(module.function<"func">()(7) == ctpy::Variable{3.0});
+    REQUIRE_THROWS_AS(module.function<"func">()(ctpy::Variable{"x"}), std::invalid_argument);
+    static constexpr auto lowered = ctpy::parse_module<lexed, ctpy::Mode::lowered>();
+    REQUIRE(ctpy::Variable{lowered.function<"func">()(7)} == ctpy::Variable{3.0});
+    static constexpr auto packed = ctpy::parse_module<lexed, ctpy::Mode::packed>();
+    REQUIRE(packed.function<"func">()(7) == ctpy::Variable{3.0});
+}
+
+TEST_CASE("operands of the wrong types throw") {
+    using namespace std::string_view_literals;
+    static constexpr auto python_code = ctpy::Content{R"(def func(a, b):
+    return a + b)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(1, 2) == ctpy::Variable{3});
+    REQUIRE_THROWS_AS(func("a"sv, "b"sv), std::invalid_argument);
+    REQUIRE_THROWS_AS(func("a"sv, 2), std::invalid_argument);
+    static constexpr auto packed = ctpy::parse<lexed, ctpy::Mode::packed>();
+    REQUIRE_THROWS_AS(packed("a"sv, "b"sv), std::invalid_argument);
+    static constexpr auto constants = ctpy::Content{R"(def func():
+    return 'a' * 2)"};
+    static constexpr auto constants_lexed = ctpy::lex<constants>();
+    REQUIRE_THROWS_AS(ctpy::parse<constants_lexed>()(), std::invalid_argument);
+}
+
+TEST_CASE("expression with repeated terms") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(x, y):
+    d = (x - y) * (x - y)
+    return (d + 1) ** 2 - (x - y) * (x - y) // 3 + -(y % 4) / 2)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(5, 2) == ctpy::Variable{100 - 3 - 1.0});
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered(5, 2) == ctpy::Variable{96.0});
+    REQUIRE(std::ranges::count_if(func.operations, [](auto const& operation) {
+                return std::holds_alternative<ctpy::SubtractionOperation>(operation);
+            }) == 2);
+}
+
+TEST_CASE("generator") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(n):
+    a = 0
+    b = 1
+    for i in range(n):
+        yield a
+        c = a + b
+        a = b
+        b = c
+    yield -1)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    auto values = std::vector<ctpy::Variable>{};
+    std::ranges::copy(func(7), std::back_inserter(values));
+    REQUIRE(values == std::vector<ctpy::Variable>{0, 1, 1, 2, 3, 5, 8, -1});
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE(std::is_same_v<decltype(lowered), decltype(func)>);
+}
+
+TEST_CASE("module generator calling a function") {
+    static constexpr auto python_code = ctpy::Content{R"(def square(x):
+    return x * x
+
+def squares(n):
+    i = 0
+    while i < n:
+        yield square(i)
+        i = i + 1)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto module = ctpy::parse_module<lexed, ctpy::Mode::lowered>();
+    static constexpr auto sum = [] {
+        auto result = 0;
+        for (auto const& value: module.function<"squares">()(4)) {
+            result += std::get<int>(value);
+        }
+        return result;
+    }();
+    REQUIRE(sum == 14);
+}
+
+TEST_CASE("if elif else") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(n):
+    total = 0
+    for i in range(n):
+        if i % 3 == 0:
+            total = total + i
+        elif i % 3 == 1:
+            total = total - 1
+            scaled = i * 2
+        else:
+            total = total * 2 if total < 100 else total
+    return total)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(10) == ctpy::Variable{19});
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    static constexpr auto result = lowered(10);
+    REQUIRE(result == 19);
+    static constexpr auto packed = ctpy::parse<lexed, ctpy::Mode::packed>();
+    REQUIRE(packed(10) == ctpy::Variable{19});
+}
+
+TEST_CASE("if with early return and guarded division") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(a, b):
+    if b == 0:
+        return 0
+    elif a < 0:
+        a = 0 - a
+    quotient = a // b if b > 0 else 0
+    if quotient > 3:
+        return quotient
+    return a + quotient)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(7, 0) == ctpy::Variable{0});
+    REQUIRE(func(-7, 2) == ctpy::Variable{10});
+    REQUIRE(func(9, 2) == ctpy::Variable{4});
+    REQUIRE(func(9, -2) == ctpy::Variable{9});
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered(7, 0) == 0);
+    REQUIRE(lowered(-7, 2) == 10);
+    static constexpr auto packed = ctpy::parse<lexed, ctpy::Mode::packed>();
+    REQUIRE(packed(9, 2) == ctpy::Variable{4});
+}
+
+TEST_CASE("unused division still fails") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(a):
+    b = 1 // a
+    return 5)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(2) == ctpy::Variable{5});
+    REQUIRE_THROWS_AS(func(0), std::domain_error);
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE_THROWS_AS(lowered(0), std::domain_error);
+    static constexpr auto packed = ctpy::parse<lexed, ctpy::Mode::packed>();
+    REQUIRE_THROWS_AS(packed(0), std::domain_error);
+}
+
+TEST_CASE("invariant division in a loop which may not run") {
+    static constexpr auto python_code = ctpy::Content{R"(def func(n, a):
+    total = 0
+    for i in range(n):
+        total = total + 10 // a + i // a
+    return total)"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto func = ctpy::parse<lexed>();
+    REQUIRE(func(0, 0) == ctpy::Variable{0});
+    REQUIRE(func(3, 2) == ctpy::Variable{16});
+    REQUIRE_THROWS_AS(func(3, 0), std::domain_error);
+    static constexpr auto lowered = ctpy::parse<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered(0, 0) == 0);
+    REQUIRE_THROWS_AS(lowered(1, 0), std::domain_error);
+    static constexpr auto packed = ctpy::parse<lexed, ctpy::Mode::packed>();
+    REQUIRE(packed(0, 0) == ctpy::Variable{0});
+    REQUIRE(packed(3, 2) == ctpy::Variable{16});
+}
+
+TEST_CASE("module with recursive calls") {
+    static constexpr auto python_code = ctpy::Content{R"(def count(n):
+    while n < 5:
+        return count(n + 1)
+    return n
+
+def func():
+    return count(0) + count(3))"};
+    static constexpr auto lexed = ctpy::lex<python_code>();
+    static constexpr auto module = ctpy::parse_module<lexed>();
+    static constexpr auto result = module.function<"func">()();
+    REQUIRE(result == ctpy::Variable{10});
+    static constexpr auto lowered = ctpy::parse_module<lexed, ctpy::Mode::lowered>();
+    REQUIRE(lowered.function<"count">()(1) == ctpy::Variable{5});
+    REQUIRE(lowered.function<"func">()() == ctpy::Variable{10});
+    static constexpr auto packed = ctpy::parse_module<lexed, ctpy::Mode::packed>();
+    REQUIRE(packed.function<"func">()() == ctpy::Variable{10});
+}
+
+}  // namespace
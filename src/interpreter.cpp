@@ -0,0 +1,361 @@
+#include "interpreter.h"
+#include <algorithm>
+#include <doctest/doctest.h>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace ctpy {
+
+namespace {
+
+    TEST_CASE("runtime lex") {
+        auto const result = lex("def func():\n    return 123");
+        auto const expected = std::vector<Lexeme>{
+                Keyword::def,
+                Identifier{"func"},
+                Operator::bracketleft,
+                Operator::bracketright,
+                Operator::semicolon,
+                Operator::linebreak,
+                Indentation{4},
+                Keyword::return_,
+                Literal{"123"}};
+        REQUIRE(result == expected);
+    }
+
+    TEST_CASE("compile returning constant") {
+        auto const function = compile("def func():\n    return 123\n");
+        REQUIRE(function.instructions ==
+                std::vector<Instruction>{Instruction{Opcode::constant_return, 0}});
+        REQUIRE(function.constants == std::vector<Variable>{123});
+        REQUIRE(function() == Variable{123});
+    }
+
+    TEST_CASE("compile empty function") {
+        auto const function = compile("def func():\n");
+        REQUIRE(function() == Variable{});
+    }
+
+    TEST_CASE("compile rejects invalid header") {
+        REQUIRE_THROWS(compile("func():\n    return 1"));
+        REQUIRE_THROWS(compile("def func(:\n    return 1"));
+    }
+
+    TEST_CASE("compile rejects invalid body") {
+        REQUIRE_THROWS(compile("def func():\n    return"));
+        REQUIRE_THROWS(compile("def func():\n    abc"));
+        REQUIRE_THROWS(compile("def func():\n    return $"));
+    }
+
+    TEST_CASE("compile loops") {
+        auto const function = compile(R"(def func():
+    total = 0
+    i = 0
+    while i < 5:
+        for j in range(i, 4):
+            total = total + j
+        i = i + 1
+    return total
+)");
+        REQUIRE(function() == Variable{20});
+    }
+
+    TEST_CASE("compile conditionals") {
+        auto const function = compile(R"(def func(a, b):
+    if a < b:
+        a = b
+    elif a > 2 * b:
+        return a // b
+    else:
+        b = 0
+    return a - b if a > 1 else b
+)");
+        REQUIRE(function(1, 3) == Variable{0});
+        REQUIRE(function(9, 2) == Variable{4});
+        REQUIRE(function(3, 2) == Variable{3});
+        REQUIRE(function(1, 1) == Variable{0});
+    }
+
+    TEST_CASE("encode selects into a scratch slot") {
+        static constexpr auto operations =
+                std::array<Operation, 2>{SelectOperation{0, 1, 2, 0}, ReturnOperation{0}};
+        auto const function = detail::encode(operations, 3);
+        REQUIRE(function.stack_size == 4);
+        REQUIRE(function.instructions.front() == Instruction{Opcode::assign, 2, 3});
+        REQUIRE(function(1, 2, 3) == Variable{2});
+        REQUIRE(function(0, 2, 3) == Variable{3});
+    }
+
+    TEST_CASE("compile rejects malformed loops") {
+        REQUIRE_THROWS(compile("def func():\n    while 1:\n    return 1"));
+        REQUIRE_THROWS(compile("def func():\n    for i in range(1, 2, 3, 4):\n        i = 1"));
+        REQUIRE_THROWS(compile("def func():\n    for i in range(1, 2, 0):\n        i = 1"));
+        REQUIRE_THROWS(compile("def func():\n    while j < 1:\n        j = 1"));
+    }
+
+    TEST_CASE("encode remaps jump targets past superinstructions") {
+        static constexpr auto operations = std::array<Operation, 6>{
+                ConstantOperation{1, 1},  // fused with the addition
+                AdditionOperation{0, 1, 0},
+                BranchOperation{0, 5},
+                ConstantOperation{1, 2},
+                JumpOperation{0},
+                ReturnOperation{0}};
+        auto const function = detail::encode(operations, 1);
+        auto const expected = std::vector<Instruction>{
+                {Opcode::add_constant, 0, 0, 0},
+                {Opcode::branch, 0, 4},
+                {Opcode::constant, 1, 1},
+                {Opcode::jump, 0},
+                {Opcode::return_, 0}};
+        REQUIRE(function.instructions == expected);
+    }
+
+    TEST_CASE("encode fuses superinstructions") {
+        static constexpr auto operations = std::array<Operation, 5>{
+                ConstantOperation{1, 5},
+                AdditionOperation{0, 1, 1},
+                AssignOperation{1, 2},
+                AdditionOperation{1, 2, 0},
+                ReturnOperation{0}};
+        auto const function = detail::encode(operations, 1);
+        auto const expected = std::vector<Instruction>{
+                {Opcode::add_constant, 0, 0, 1},
+                {Opcode::assign, 1, 2},
+                {Opcode::add_return, 1, 2}};
+        REQUIRE(function.instructions == expected);
+        REQUIRE(function.stack_size == 3);
+        REQUIRE(function(Variable{2}) == Variable{14});
+        REQUIRE(function(1.5) == Variable{13.0});
+    }
+
+    TEST_CASE("encode keeps constants read later") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                ConstantOperation{1, 5}, AdditionOperation{0, 1, 2}, AdditionOperation{1, 2, 0}};
+        auto const function = detail::encode(operations, 1);
+        auto const expected = std::vector<Instruction>{
+                {Opcode::constant, 0, 1},
+                {Opcode::add, 0, 1, 2},
+                {Opcode::add, 1, 2, 0},
+                {Opcode::constant_return, 1}};
+        REQUIRE(function.instructions == expected);
+        REQUIRE(function.constants == std::vector<Variable>{5, Variable{}});
+    }
+
+    TEST_CASE("compile annotated parameters") {
+        auto const function = compile("def func(a: float, b: int, c):\n    return a + b + c\n");
+        REQUIRE(function.signature == std::vector{Type::double_, Type::int_, Type::empty});
+        REQUIRE(function(1, 2, 3) == Variable{6.0});
+        REQUIRE(function(1, 2, 3.5) == Variable{6.5});
+        REQUIRE_THROWS_AS(function(1, 2.5, 3), std::invalid_argument);
+        REQUIRE_THROWS(compile("def func(a: bool):\n    return a\n"));
+    }
+
+    TEST_CASE("compile arithmetic") {
+        auto const function =
+                compile("def func(a, b):\n    return -a ** 2 + a * b // 3 % 4 - a / b\n");
+        REQUIRE(function(3, 2) == Variable{-9 + 2 - 1.5});
+        REQUIRE(function(2.0, 4) == Variable{-4.0 + 2.0 - 0.5});
+        REQUIRE_THROWS_AS(function(1, 0), std::domain_error);
+        auto const unused = compile("def func(a):\n    b = 1 // a\n    return 5\n");
+        REQUIRE(unused(2) == Variable{5});
+        REQUIRE_THROWS_AS(unused(0), std::domain_error);
+    }
+
+    TEST_CASE("compile throws for ints which overflow") {
+        auto const function = compile(R"(def func(n):
+    total = 1
+    for i in range(n):
+        total = total * 2
+    return total)");
+        REQUIRE(function(30) == Variable{1073741824});
+        REQUIRE_THROWS_AS(function(31), std::overflow_error);
+        auto const division = compile("def func(a, b):\n    return a // b + a % b\n");
+        REQUIRE_THROWS_AS(division(-2147483647 - 1, -1), std::overflow_error);
+        REQUIRE_THROWS_AS(compile("def func():\n    return 2147483648\n"), std::out_of_range);
+    }
+
+    TEST_CASE("RuntimeFunction matches Function") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{2, 5},
+                AdditionOperation{0, 1, 3},
+                AdditionOperation{2, 3, 3},
+                ReturnOperation{3}};
+        auto const function = detail::encode(operations, 2);
+        auto const expected =
+                Function<4, 2, 4>{operations[0], operations[1], operations[2], operations[3]};
+        REQUIRE(function(1, 2) == expected(1, 2));
+        REQUIRE(function(1, 2.5) == expected(1, 2.5));
+        REQUIRE_THROWS_AS(function(1), std::invalid_argument);
+    }
+
+    // Counts the bytes allocated from the default resource which have not been freed
+    class CountingResource final : public std::pmr::memory_resource {
+      public:
+        std::size_t allocations = 0;
+        std::size_t outstanding = 0;
+
+      private:
+        void*
+        do_allocate(std::size_t const bytes, std::size_t const alignment) override {
+            ++allocations;
+            outstanding += bytes;
+            return std::pmr::get_default_resource()->allocate(bytes, alignment);
+        }
+
+        void
+        do_deallocate(void* const pointer, std::size_t const bytes, std::size_t const alignment)
+                override {
+            outstanding -= bytes;
+            std::pmr::get_default_resource()->deallocate(pointer, bytes, alignment);
+        }
+
+        [[nodiscard]] bool
+        do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    TEST_CASE("RuntimeModule") {
+        auto resource = CountingResource{};
+        {
+            auto const module = RuntimeModule{R"(def square(x: int):
+    return x * x
+
+def func(a, b):
+    total = 0
+    for i in range(a):
+        total = total + square(i)
+    return total if total < b else b
+)",
+                                              &resource};
+            REQUIRE(module.size() == 2);
+            auto const square = module.function("square");
+            auto const func = module.function("func");
+            REQUIRE(square(7) == Variable{49});
+            REQUIRE_THROWS(square(1.5));
+            REQUIRE(func(4, 100) == Variable{14});
+            REQUIRE(func(4, 10) == Variable{10});
+            REQUIRE_THROWS_AS(module.function("cube"), std::out_of_range);
+            // Functions follow each other in the arena
+            REQUIRE(static_cast<void const*>(square.signature.data()) <
+                    static_cast<void const*>(func.instructions.data()));
+            REQUIRE(resource.outstanding > 0);
+        }
+        REQUIRE(resource.outstanding == 0);
+    }
+
+    TEST_CASE("RuntimeModule calls functions it cannot inline") {
+        auto const module = RuntimeModule{R"(def polynomial(x):
+    a = x * x
+    b = a * x
+    c = b * x
+    d = c * x
+    return 1 + 2 * x + 3 * a + 4 * b + 5 * c + 6 * d
+
+def difference(x):
+    return polynomial(x) - polynomial(x - 1)
+
+def count(n):
+    while n < 5:
+        return count(n + 1)
+    return n
+)"};
+        auto const difference = module.function("difference");
+        REQUIRE(std::ranges::any_of(difference.instructions, [](Instruction const& instruction) {
+            return instruction.opcode == Opcode::call;
+        }));
+        REQUIRE(difference(2) == Variable{300});
+        REQUIRE(difference(2.0) == Variable{300.0});
+        REQUIRE(module.function("count")(1) == Variable{5});
+        REQUIRE(module.function("count")(7) == Variable{7});
+    }
+
+    TEST_CASE("RuntimeModule converts the arguments of annotated callees") {
+        auto const module = RuntimeModule{R"(def half(x: float):
+    return x // 2
+
+def func(a):
+    return half(a)
+)"};
+        REQUIRE(module.function("half")(7) == Variable{3.0});
+        REQUIRE(module.function("func")(7) == Variable{3.0});
+        REQUIRE_THROWS_AS(module.function("func")("x"), std::invalid_argument);
+    }
+
+    TEST_CASE("strings at run time") {
+        using namespace std::string_view_literals;
+        auto const source = std::string{R"(def func(s: str, n):
+    if s.startswith('ab'):
+        return s[n:-1]
+    return s[n] if len(s) > n else '')"};
+        auto const function = compile(source);
+        REQUIRE(function("abcdef", 1) == Variable{"bcde"sv});
+        REQUIRE(function("xyz", 1) == Variable{"y"sv});
+        REQUIRE(function("xyz", 5) == Variable{""sv});
+        REQUIRE_THROWS_AS(function("xyz", -4), std::out_of_range);
+        REQUIRE_THROWS(function(1, 1));
+        REQUIRE_THROWS(compile("def func():\n    return 'a' + 'b'\n"));
+        auto const concatenate = compile("def func(a, b):\n    return a + b\n");
+        REQUIRE_THROWS_AS(concatenate("a", "b"), std::invalid_argument);
+        REQUIRE_THROWS_AS(concatenate("a", 1), std::invalid_argument);
+        auto const module = RuntimeModule{"def func(s):\n    return s == 'a' + 'b' 'c'\n"};
+        REQUIRE(module.function("func")("abc") == Variable{1});
+        REQUIRE(module.function("func")(1) == Variable{0});
+    }
+
+    TEST_CASE("dictionaries at run time") {
+        using namespace std::string_view_literals;
+        REQUIRE_THROWS(compile("def func(k):\n    return {1: 2}[k]\n"));
+        auto const module = RuntimeModule{R"(def grade(score):
+    grades = {90: 'a', 80: 'b',
+              70: 'c'}
+    return grades[score // 10 * 10] if score // 10 * 10 in grades else 'f'
+
+def known(name):
+    return name in {'ab' 'c': 1, 'd': 2})"};
+        auto const grade = module.function("grade");
+        REQUIRE(grade.dictionaries.size() == 1);
+        REQUIRE(grade(95) == Variable{"a"sv});
+        REQUIRE(grade(71.5) == Variable{"c"sv});
+        REQUIRE(grade(12) == Variable{"f"sv});
+        REQUIRE(module.function("known")("abc") == Variable{1});
+        REQUIRE(module.function("known")("ab") == Variable{0});
+        auto const missing = RuntimeModule{
+                "def f(k):\n    return {1: 2}[k]\ndef g():\n    return {1: 2}[3]\n"};
+        REQUIRE(missing.function("f")(1) == Variable{2});
+        REQUIRE_THROWS_AS(missing.function("f")(3), std::out_of_range);
+        REQUIRE_THROWS_AS(missing.function("g")(), std::out_of_range);
+    }
+
+    TEST_CASE("encode slices with their bounds in adjacent slots") {
+        // return [0][[2]:[1]]
+        static constexpr auto operations =
+                std::array<Operation, 2>{SliceOperation{0, 2, 1, 3}, ReturnOperation{3}};
+        auto const function = detail::encode(operations, 3);
+        REQUIRE(function.stack_size == 6);
+        REQUIRE(function.instructions[0] == Instruction{Opcode::assign, 2, 4});
+        REQUIRE(function.instructions[1] == Instruction{Opcode::assign, 1, 5});
+        REQUIRE(function.instructions[2] == Instruction{Opcode::slice, 0, 4, 3});
+        REQUIRE(function(std::string_view{"abcdef"}, 4, 1) == Variable{std::string_view{"bcd"}});
+    }
+
+    TEST_CASE("encode calls with their arguments in adjacent slots") {
+        // return functions[0]([1], [0])
+        static constexpr auto operations = std::array<Operation, 2>{
+                CallOperation{0, {1, 0}, 2, 2}, ReturnOperation{2}};
+        auto const function = detail::encode(operations, 2);
+        REQUIRE(function.stack_size == 5);
+        REQUIRE(function.instructions[0] == Instruction{Opcode::assign, 1, 3});
+        REQUIRE(function.instructions[1] == Instruction{Opcode::assign, 0, 4});
+        REQUIRE(function.instructions[2] == Instruction{Opcode::call, 0, 3, 2});
+        static constexpr auto adjacent = std::array<Operation, 2>{
+                CallOperation{0, {0, 1}, 2, 2}, ReturnOperation{2}};
+        REQUIRE(detail::encode(adjacent, 2).instructions[0] == Instruction{Opcode::call, 0, 0, 2});
+    }
+
+}  // namespace
+
+}  // namespace ctpy
@@ -1,6 +1,7 @@
 #include "lexer.h"
 #include <doctest/doctest.h>
 #include <ostream>
+#include <string>
 
 using namespace std::string_view_literals;
 
@@ -26,6 +27,19 @@ namespace {
         REQUIRE(result->second == " abc"sv);
     }
 
+    TEST_CASE("is_keyword only whole words") {
+        REQUIRE_FALSE(detail::is_keyword("define").has_value());
+        REQUIRE_FALSE(detail::is_keyword("returned abc").has_value());
+        REQUIRE_FALSE(detail::is_keyword("+ def").has_value());
+    }
+
+    TEST_CASE("is_keyword return") {
+        static constexpr auto result = detail::is_keyword("return 1");
+        REQUIRE(result.has_value());
+        REQUIRE(result->first == Keyword::return_);
+        REQUIRE(result->second == " 1"sv);
+    }
+
     TEST_CASE("is_operator plus") {
         static constexpr auto result = detail::is_operator("+ abc");
         REQUIRE(result.has_value());
@@ -40,6 +54,26 @@ namespace {
         REQUIRE(result->second == " abc"sv);
     }
 
+    TEST_CASE("is_identifier with digits and underscores") {
+        static constexpr auto result = detail::is_identifier("_a1_B2[c]");
+        REQUIRE(result.has_value());
+        REQUIRE(result->first == Identifier{"_a1_B2"});
+        REQUIRE(result->second == "[c]"sv);
+    }
+
+    TEST_CASE("is_identifier excludes characters between Z and a") {
+        static constexpr auto result = detail::is_identifier("ab[c");
+        REQUIRE(result->first == Identifier{"ab"});
+    }
+
+    TEST_CASE("is_literal") {
+        static constexpr auto result = detail::is_literal("123)");
+        REQUIRE(result.has_value());
+        REQUIRE(result->first == Literal{"123"});
+        REQUIRE(result->second == ")"sv);
+        REQUIRE_FALSE(detail::is_literal("abc").has_value());
+    }
+
     TEST_CASE("is_identifier 123") {
         static constexpr auto result = detail::is_identifier("123");
         REQUIRE_FALSE(result.has_value());
@@ -79,7 +113,7 @@ namespace {
                     std::in_place, Operator::plus, "def"};
         };
         static constexpr auto result =
-                detail::is_lexeme<is_keyword_mock, is_operator_mock>("content");
+                detail::is_lexeme<is_keyword_mock, is_operator_mock>("+content");
         REQUIRE(result.first == Lexeme{Operator::plus});
         REQUIRE(result.second == "def");
     }
@@ -97,19 +131,6 @@ namespace {
         REQUIRE(result.second == "def");
     }
 
-    TEST_CASE("lexemes_length 0") {
-        REQUIRE(detail::lexeme_length("") == 0);
-    }
-
-    TEST_CASE("lexemes_length 1") {
-        REQUIRE(detail::lexeme_length("def") == 1);
-    }
-
-    TEST_CASE("lexemes_length 3") {
-        static constexpr auto result = detail::lexeme_length("def def abc");
-        REQUIRE(result == 3);
-    }
-
     TEST_CASE("lex function header") {
         static constexpr auto content = Content{R"(def func():
 )"};
@@ -141,11 +162,122 @@ namespace {
                         Operator::bracketright,
                         Operator::semicolon,
                         Operator::linebreak,
+                        Indentation{4},
                         Keyword::return_,
                         Literal{"123"}};
         REQUIRE(result == expected);
     }
 
+    TEST_CASE("lex indentation only at line starts of non-blank lines") {
+        static constexpr auto content = Content{"while a:\n  \n\tb = 1\n  \n"};
+        static constexpr auto result = lex<content>();
+        static constexpr auto expected =
+                Lexemes{Keyword::while_,
+                        Identifier{"a"},
+                        Operator::semicolon,
+                        Operator::linebreak,
+                        Operator::linebreak,
+                        Indentation{1},
+                        Identifier{"b"},
+                        Operator::equal,
+                        Literal{"1"},
+                        Operator::linebreak,
+                        Operator::linebreak};
+        REQUIRE(result == expected);
+    }
+
+    TEST_CASE("lex loop keywords") {
+        static constexpr auto content = Content{"for i in range while"};
+        REQUIRE(lex<content>() == Lexemes{Keyword::for_,
+                                          Identifier{"i"},
+                                          Keyword::in,
+                                          Identifier{"range"},
+                                          Keyword::while_});
+    }
+
+    TEST_CASE("lex conditional keywords") {
+        static constexpr auto content = Content{"if elif else iffy"};
+        REQUIRE(lex<content>() ==
+                Lexemes{Keyword::if_, Keyword::elif, Keyword::else_, Identifier{"iffy"}});
+    }
+
+    TEST_CASE("is_operator comparisons") {
+        REQUIRE(detail::is_operator("<= 1")->first == Operator::lessequal);
+        REQUIRE(detail::is_operator("< 1")->first == Operator::less);
+        REQUIRE(detail::is_operator(">=")->first == Operator::greaterequal);
+        REQUIRE(detail::is_operator(">")->first == Operator::greater);
+        REQUIRE(detail::is_operator("==")->first == Operator::equalequal);
+        REQUIRE(detail::is_operator("= =")->first == Operator::equal);
+        REQUIRE(detail::is_operator("!=")->first == Operator::exclamequal);
+        REQUIRE(detail::is_operator("!=")->second.empty());
+        REQUIRE_FALSE(detail::is_operator("!").has_value());
+    }
+
+    TEST_CASE("is_operator arithmetic") {
+        REQUIRE(detail::is_operator("-")->first == Operator::minus);
+        REQUIRE(detail::is_operator("* 2")->first == Operator::asterisk);
+        REQUIRE(detail::is_operator("**2")->first == Operator::asteriskasterisk);
+        REQUIRE(detail::is_operator("**2")->second == "2");
+        REQUIRE(detail::is_operator("/ /")->first == Operator::slash);
+        REQUIRE(detail::is_operator("//")->first == Operator::slashslash);
+        REQUIRE(detail::is_operator("%")->first == Operator::percent);
+        REQUIRE(detail::is_operator("++")->first == Operator::plus);
+    }
+
+    TEST_CASE("lex ignores trailing spaces") {
+        static constexpr auto content = Content{"def  return  "};
+        REQUIRE(lex<content>() == Lexemes{Keyword::def, Keyword::return_});
+    }
+
+    TEST_CASE("lex empty") {
+        static constexpr auto content = Content{"   "};
+        REQUIRE(lex<content>() == Lexemes<0>{});
+    }
+
+    TEST_CASE("lex_bounded trims to lexeme count") {
+        static constexpr auto result = detail::lex_bounded<9>("def abc 1", detail::is_lexeme<>);
+        REQUIRE(result.size == 3);
+        REQUIRE(result.elements[2] == Lexeme{Literal{"1"}});
+    }
+
+    TEST_CASE("LexemeStream") {
+        auto stream = LexemeStream{"def f():\n    return 1"};
+        REQUIRE(stream.next() == Lexeme{Keyword::def});
+        REQUIRE(stream.next() == Lexeme{Identifier{"f"}});
+        REQUIRE(stream.rest() == "():\n    return 1");
+        for (auto i = 0; i < 4; ++i) {
+            REQUIRE(stream.next().has_value());
+        }
+        REQUIRE(stream.next() == Lexeme{Indentation{4}});
+        REQUIRE(stream.next() == Lexeme{Keyword::return_});
+        REQUIRE(stream.next() == Lexeme{Literal{"1"}});
+        REQUIRE_FALSE(stream.next().has_value());
+        REQUIRE_FALSE(stream.next().has_value());
+    }
+
+    TEST_CASE("span_length at run time") {
+        auto const identifier = std::string(70, 'a') + "_Z9" + std::string(40, 'x') + "+";
+        for (auto offset = std::size_t{0}; offset < identifier.size(); ++offset) {
+            auto const content = std::string_view{identifier}.substr(offset);
+            REQUIRE(detail::span_length(content, detail::identifier_continue) ==
+                    content.size() - 1);
+            REQUIRE(detail::span_length(content, detail::identifier_continue) ==
+                    detail::scalar_span_length(content, detail::identifier_continue));
+        }
+        auto const spaces = std::string(33, ' ') + "\t\r\n" + std::string(20, ' ');
+        REQUIRE(detail::span_length(spaces, detail::space) == 35);
+        REQUIRE(detail::span_length("0123456789012345678901234567890123/", detail::digit) == 34);
+        REQUIRE(detail::span_length(std::string(40, '\xff'), detail::digit) == 0);
+        static constexpr auto at_compile_time = detail::span_length("  x", detail::space);
+        REQUIRE(at_compile_time == 2);
+    }
+
+    TEST_CASE("character_ranges") {
+        REQUIRE(detail::character_ranges<detail::digit>.size() == 1);
+        REQUIRE(detail::character_ranges<detail::identifier_continue>.size() == 4);
+        REQUIRE(detail::character_ranges<detail::space>.size() == 3);
+    }
+
     TEST_CASE("Identifier comparison") {
         REQUIRE(Identifier{"abc"} == Identifier{"abc"});
         REQUIRE_FALSE(Identifier{"abc"} == Identifier{"def"});
@@ -160,6 +292,36 @@ namespace {
         REQUIRE(Literal{"abc"} != Literal{"def"});
     }
 
+    TEST_CASE("is_string_literal") {
+        static constexpr auto result = detail::is_string_literal("'a b' + x");
+        REQUIRE(result->first == Literal{"'a b'"});
+        REQUIRE(result->second == " + x"sv);
+        REQUIRE(detail::is_string_literal(R"("it's")")->first == Literal{R"("it's")"});
+        REQUIRE_FALSE(detail::is_string_literal("abc").has_value());
+        REQUIRE_THROWS(detail::is_string_literal("'abc"));
+        REQUIRE_THROWS(detail::is_string_literal("'a\nb'"));
+        REQUIRE_THROWS(detail::is_string_literal("'a\\nb'"));
+    }
+
+    TEST_CASE("lex strings and subscripts") {
+        static constexpr auto content = Content{"s[1:] == 'a' 'b' or s.startswith(\"c\")"};
+        REQUIRE(lex<content>() == Lexemes{Identifier{"s"},
+                                          Operator::squarebracketleft,
+                                          Literal{"1"},
+                                          Operator::semicolon,
+                                          Operator::squarebracketright,
+                                          Operator::equalequal,
+                                          Literal{"'a'"},
+                                          Literal{"'b'"},
+                                          Identifier{"or"},
+                                          Identifier{"s"},
+                                          Operator::period,
+                                          Identifier{"startswith"},
+                                          Operator::bracketleft,
+                                          Literal{"\"c\""},
+                                          Operator::bracketright});
+    }
+
 }  // namespace
 
 }  // namespace ctpy
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "optimizer.h"
+#include <algorithm>
+#include <doctest/doctest.h>
+#include <string_view>
+#include <vector>
+
+namespace ctpy {
+
+namespace {
+
+    TEST_CASE("determine_stack_size") {
+        static constexpr auto operations =
+                std::array<Operation, 2>{ConstantOperation{1, 1}, AdditionOperation{0, 1, 3}};
+        REQUIRE(detail::determine_stack_size(operations) == 4);
+    }
+
+    TEST_CASE("fold_constants addition chain") {
+        static constexpr auto operations = std::array<Operation, 5>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 2},
+                AdditionOperation{0, 1, 2},
+                AdditionOperation{2, 2, 3},
+                ReturnOperation{3}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 2},
+                ConstantOperation{2, 3},
+                ConstantOperation{3, 6},
+                ReturnOperation{3}};
+        REQUIRE(detail::fold_constants(operations) == expected);
+    }
+
+    TEST_CASE("fold_constants keeps parameters") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                ConstantOperation{1, 2}, AdditionOperation{0, 1, 2}, ReturnOperation{2}};
+        REQUIRE(detail::fold_constants(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("fold_constants forgets overwritten constants") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{1, 2},
+                AssignOperation{0, 1},
+                AdditionOperation{1, 1, 2},
+                ReturnOperation{2}};
+        REQUIRE(detail::fold_constants(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("propagate_copies") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                AssignOperation{0, 1}, AdditionOperation{1, 1, 2}, ReturnOperation{2}};
+        auto const expected = std::vector<Operation>{
+                AssignOperation{0, 1}, AdditionOperation{0, 0, 2}, ReturnOperation{2}};
+        REQUIRE(detail::propagate_copies(operations) == expected);
+    }
+
+    TEST_CASE("propagate_copies stops at overwrites") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                AssignOperation{0, 1},
+                ConstantOperation{1, 5},
+                AdditionOperation{0, 1, 2},
+                ReturnOperation{2}};
+        REQUIRE(detail::propagate_copies(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("eliminate_dead_stores") {
+        static constexpr auto operations = std::array<Operation, 5>{
+                ConstantOperation{1, 1},
+                ConstantOperation{1, 2},
+                ConstantOperation{2, 3},
+                ReturnOperation{2},
+                ReturnOperation{1}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{2, 3}, ReturnOperation{2}, ReturnOperation{1}};
+        REQUIRE(detail::eliminate_dead_stores(operations) == expected);
+    }
+
+    TEST_CASE("eliminate_dead_stores keeps values read in later iterations") {
+        static constexpr auto operations = std::array<Operation, 6>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 7},  // dead, overwritten before every read
+                ConstantOperation{1, 2},
+                AdditionOperation{0, 1, 0},
+                JumpOperation{2},
+                ReturnOperation{0}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 2},
+                AdditionOperation{0, 1, 0},
+                JumpOperation{1},
+                ReturnOperation{0}};
+        REQUIRE(detail::eliminate_dead_stores(operations) == expected);
+    }
+
+    TEST_CASE("eliminate_dead_stores keeps operations which may fail") {
+        // [1] = 1 // [0], [2] = f([0]), return 5
+        static constexpr auto operations = std::array<Operation, 5>{
+                ConstantOperation{1, 1},
+                FloorDivisionOperation{1, 0, 1},
+                CallOperation{0, {0}, 1, 2},
+                ConstantOperation{3, 5},
+                ReturnOperation{3}};
+        REQUIRE(detail::eliminate_dead_stores(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("eliminate_unreachable_operations") {
+        static constexpr auto operations = std::array<Operation, 6>{
+                ConstantOperation{0, 1},
+                BranchOperation{0, 4},
+                ReturnOperation{0},
+                ConstantOperation{0, 2},
+                JumpOperation{0},
+                ReturnOperation{0}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{0, 1},
+                BranchOperation{0, 3},
+                ReturnOperation{0},
+                JumpOperation{0}};
+        REQUIRE(detail::eliminate_unreachable_operations(operations) == expected);
+    }
+
+    TEST_CASE("fold_constants forgets constants at jump targets") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{0, 1},
+                AdditionOperation{0, 0, 0},
+                JumpOperation{1},
+                ReturnOperation{0}};
+        REQUIRE(detail::fold_constants(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    // total = 0, i = 0, while i < [0]: k = [0] + 1, total = total + k, i = i + 1
+    constexpr auto loop = std::array<Operation, 11>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 0},
+            ConstantOperation{3, 1},
+            LessOperation{2, 0, 4},
+            BranchOperation{4, 10},
+            ConstantOperation{5, 1},
+            AdditionOperation{0, 5, 6},
+            AdditionOperation{1, 6, 1},
+            AdditionOperation{2, 3, 2},
+            JumpOperation{3},
+            ReturnOperation{1}};
+
+    TEST_CASE("hoist_loop_invariants") {
+        auto const first = detail::hoist_loop_invariants(loop);
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 0},
+                ConstantOperation{2, 0},
+                ConstantOperation{3, 1},
+                ConstantOperation{5, 1},
+                LessOperation{2, 0, 4},
+                BranchOperation{4, 10},
+                AdditionOperation{0, 5, 6},
+                AdditionOperation{1, 6, 1},
+                AdditionOperation{2, 3, 2},
+                JumpOperation{4},
+                ReturnOperation{1}};
+        REQUIRE(first == expected);
+        // The addition may overflow, so it is hoisted behind a copy of the loop test
+        auto const second = detail::hoist_loop_invariants(first);
+        REQUIRE(second.size() == 13);
+        REQUIRE(second[4] == Operation{LessOperation{2, 0, 4}});
+        REQUIRE(second[5] == Operation{BranchOperation{4, 12}});
+        REQUIRE(second[6] == Operation{AdditionOperation{0, 5, 6}});
+        REQUIRE(second[11] == Operation{JumpOperation{7}});
+        REQUIRE(detail::hoist_loop_invariants(second) == second);
+    }
+
+    TEST_CASE("hoist_loop_invariants keeps loop-carried values") {
+        static constexpr auto operations = std::array<Operation, 5>{
+                ConstantOperation{0, 1},
+                BranchOperation{0, 4},
+                AdditionOperation{0, 0, 1},
+                JumpOperation{1},
+                ReturnOperation{1}};
+        auto const result = detail::hoist_loop_invariants(operations);
+        REQUIRE(result == std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("allocate_slots keeps values live across loop iterations apart") {
+        static constexpr auto operations = std::array<Operation, 7>{
+                ConstantOperation{3, 0},
+                ConstantOperation{4, 1},
+                LessOperation{3, 0, 5},
+                BranchOperation{5, 6},
+                AdditionOperation{3, 4, 3},
+                JumpOperation{2},
+                ReturnOperation{3}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 0},
+                ConstantOperation{2, 1},
+                LessOperation{1, 0, 3},
+                BranchOperation{3, 6},
+                AdditionOperation{1, 2, 1},
+                JumpOperation{2},
+                ReturnOperation{1}};
+        REQUIRE(detail::allocate_slots(operations, 1) == expected);
+    }
+
+    TEST_CASE("optimize loop") {
+        auto const result = detail::optimize(loop);
+        REQUIRE(result.size() == 13);
+        REQUIRE(result[11] == Operation{JumpOperation{7}});
+        auto function = Function<7, 1, 13>{};
+        std::ranges::copy(result, function.operations.begin());
+        REQUIRE(function(4) == Variable{20});
+    }
+
+    TEST_CASE("eliminate_dead_stores without return") {
+        static constexpr auto operations = std::array<Operation, 2>{
+                ConstantOperation{0, 1}, EqualOperation{0, 0, 1}};
+        REQUIRE(detail::eliminate_dead_stores(operations).empty());
+    }
+
+    TEST_CASE("allocate_slots reuses dead temporaries") {
+        static constexpr auto operations = std::array<Operation, 6>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 2},
+                AdditionOperation{0, 1, 2},
+                ConstantOperation{3, 3},
+                AdditionOperation{2, 3, 4},
+                ReturnOperation{4}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 2},
+                AdditionOperation{0, 1, 0},
+                ConstantOperation{1, 3},
+                AdditionOperation{0, 1, 0},
+                ReturnOperation{0}};
+        auto const result = detail::allocate_slots(operations);
+        REQUIRE(result == expected);
+        REQUIRE(detail::determine_stack_size(result) == 2);
+    }
+
+    TEST_CASE("allocate_slots keeps parameters in place") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{7, 5},
+                AdditionOperation{1, 7, 4},
+                AdditionOperation{0, 4, 9},
+                ReturnOperation{9}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{2, 5},
+                AdditionOperation{1, 2, 1},
+                AdditionOperation{0, 1, 0},
+                ReturnOperation{0}};
+        REQUIRE(detail::allocate_slots(operations, 2) == expected);
+    }
+
+    TEST_CASE("allocate_slots keeps values read before being written") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                ConstantOperation{0, 5}, AdditionOperation{0, 3, 1}, ReturnOperation{1}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 5}, AdditionOperation{1, 0, 0}, ReturnOperation{0}};
+        REQUIRE(detail::allocate_slots(operations) == expected);
+    }
+
+    TEST_CASE("allocate_slots never read value") {
+        static constexpr auto operations = std::array<Operation, 3>{
+                ConstantOperation{3, 1}, ConstantOperation{4, 2}, ReturnOperation{4}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{0, 1}, ConstantOperation{0, 2}, ReturnOperation{0}};
+        REQUIRE(detail::allocate_slots(operations) == expected);
+    }
+
+    TEST_CASE("optimize parameterless function to constant return") {
+        static constexpr auto operations = std::array<Operation, 6>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 2.5},
+                AssignOperation{0, 2},
+                AdditionOperation{2, 1, 3},
+                AdditionOperation{3, 3, 4},
+                ReturnOperation{4}};
+        auto const expected = std::vector<Operation>{ConstantOperation{4, 7.0}, ReturnOperation{4}};
+        REQUIRE(detail::optimize(operations) == expected);
+    }
+
+    TEST_CASE("optimize with parameters") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                AssignOperation{0, 2},
+                ConstantOperation{3, 1},
+                AdditionOperation{2, 3, 4},
+                ReturnOperation{4}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{3, 1}, AdditionOperation{0, 3, 4}, ReturnOperation{4}};
+        REQUIRE(detail::optimize(operations) == expected);
+    }
+
+    TEST_CASE("eliminate_common_subexpressions") {
+        // ([0] + [1]) * ([1] + [0]) with a copy of [0] and an overwrite
+        static constexpr auto operations = std::array<Operation, 7>{
+                AdditionOperation{0, 1, 2},
+                AssignOperation{0, 3},
+                AdditionOperation{1, 3, 4},
+                MultiplicationOperation{2, 4, 5},
+                ConstantOperation{2, 1},
+                AdditionOperation{0, 1, 6},
+                ReturnOperation{5}};
+        auto const expected = std::vector<Operation>{
+                AdditionOperation{0, 1, 2},
+                AssignOperation{0, 3},
+                AssignOperation{2, 4},
+                MultiplicationOperation{2, 4, 5},
+                ConstantOperation{2, 1},
+                AssignOperation{4, 6},
+                ReturnOperation{5}};
+        REQUIRE(detail::eliminate_common_subexpressions(operations) == expected);
+    }
+
+    TEST_CASE("eliminate_common_subexpressions forgets values at jump targets") {
+        static constexpr auto operations = std::array<Operation, 5>{
+                SubtractionOperation{0, 1, 2},
+                BranchOperation{2, 3},
+                AssignOperation{1, 0},
+                SubtractionOperation{0, 1, 3},
+                ReturnOperation{3}};
+        REQUIRE(detail::eliminate_common_subexpressions(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("optimize repeated terms") {
+        // ([0] * [0] + 1) * ([0] ** 2 + 1)
+        static constexpr auto operations = std::array<Operation, 8>{
+                MultiplicationOperation{0, 0, 1},
+                ConstantOperation{2, 1},
+                AdditionOperation{1, 2, 3},
+                ConstantOperation{4, 2},
+                PowerOperation{0, 4, 5},
+                AdditionOperation{5, 2, 6},
+                MultiplicationOperation{3, 6, 7},
+                ReturnOperation{7}};
+        auto const expected = std::vector<Operation>{
+                MultiplicationOperation{0, 0, 1},
+                ConstantOperation{2, 1},
+                AdditionOperation{1, 2, 3},
+                MultiplicationOperation{3, 3, 7},
+                ReturnOperation{7}};
+        REQUIRE(detail::optimize(operations) == expected);
+    }
+
+    TEST_CASE("fold_constants selects by known conditions") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{1, 0},
+                ConstantOperation{2, 5},
+                SelectOperation{1, 0, 2, 3},
+                SelectOperation{0, 3, 3, 4}};
+        auto const result = detail::fold_constants(operations);
+        REQUIRE(result[2] == Operation{ConstantOperation{3, 5}});
+        REQUIRE(result[3] == Operation{ConstantOperation{4, 5}});
+        REQUIRE(detail::fold_constants(std::array<Operation, 1>{SelectOperation{0, 1, 2, 3}}) ==
+                std::vector<Operation>{SelectOperation{0, 1, 2, 3}});
+    }
+
+    TEST_CASE("hoist_loop_invariants keeps divisions behind their conditions") {
+        // while [0] < [1]: if [1] != 0: [4] = [2] // [1], [0] = [0] + [4]
+        static constexpr auto operations = std::array<Operation, 7>{
+                LessOperation{0, 1, 3},
+                BranchOperation{3, 7},
+                BranchOperation{1, 6},
+                FloorDivisionOperation{2, 1, 4},
+                AdditionOperation{0, 4, 0},
+                JumpOperation{0},
+                JumpOperation{0}};
+        REQUIRE(detail::hoist_loop_invariants(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("hoist_loop_invariants moves divisions behind a copy of the loop test") {
+        // while [0] < [1]: [3] = [2] // [1], [0] = [0] + [3]
+        static constexpr auto operations = std::array<Operation, 5>{
+                LessOperation{0, 1, 4},
+                BranchOperation{4, 5},
+                FloorDivisionOperation{2, 1, 3},
+                AdditionOperation{0, 3, 0},
+                JumpOperation{0}};
+        auto const expected = std::vector<Operation>{
+                LessOperation{0, 1, 4},
+                BranchOperation{4, 7},
+                FloorDivisionOperation{2, 1, 3},
+                LessOperation{0, 1, 4},
+                BranchOperation{4, 7},
+                AdditionOperation{0, 3, 0},
+                JumpOperation{3}};
+        REQUIRE(detail::hoist_loop_invariants(operations) == expected);
+    }
+
+    TEST_CASE("fold_constants keeps divisions by zero") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{0, 1},
+                ConstantOperation{1, 0},
+                FloorDivisionOperation{0, 1, 2},
+                ReturnOperation{2}};
+        REQUIRE(detail::fold_constants(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("fold_constants keeps indexes past the end of strings") {
+        static constexpr auto operations = std::array<Operation, 4>{
+                ConstantOperation{0, std::string_view{"ab"}},
+                ConstantOperation{1, 2},
+                SubscriptOperation{0, 1, 2},
+                ReturnOperation{2}};
+        REQUIRE(detail::fold_constants(operations) ==
+                std::vector<Operation>(operations.begin(), operations.end()));
+    }
+
+    TEST_CASE("fold_constants strings") {
+        using namespace std::string_view_literals;
+        static constexpr auto operations = std::array<Operation, 6>{
+                ConstantOperation{0, "#tag"sv},
+                ConstantOperation{1, 1},
+                LengthOperation{0, 2},
+                SliceOperation{0, 1, 2, 3},
+                StartsWithOperation{3, 0, 4},
+                SliceOperation{5, 1, 2, 6}};
+        auto const result = detail::fold_constants(operations);
+        REQUIRE(result[2] == Operation{ConstantOperation{2, 4}});
+        REQUIRE(result[3] == Operation{ConstantOperation{3, "tag"sv}});
+        REQUIRE(result[4] == Operation{ConstantOperation{4, 0}});
+        REQUIRE(result[5] == operations[5]);
+    }
+
+    TEST_CASE("is_inlinable") {
+        static constexpr auto small = std::array<Operation, 2>{
+                AdditionOperation{0, 0, 1}, ReturnOperation{1}};
+        REQUIRE(detail::is_inlinable(small));
+        static constexpr auto early_return = std::array<Operation, 4>{
+                BranchOperation{0, 2}, ReturnOperation{0}, ConstantOperation{0, 1},
+                ReturnOperation{0}};
+        REQUIRE_FALSE(detail::is_inlinable(early_return));
+        static constexpr auto calling = std::array<Operation, 2>{
+                CallOperation{0, {0}, 1, 1}, ReturnOperation{1}};
+        REQUIRE_FALSE(detail::is_inlinable(calling));
+    }
+
+    TEST_CASE("inline_call") {
+        static constexpr auto caller = std::array<Operation, 5>{
+                ConstantOperation{0, 1},
+                CallOperation{0, {0, 0}, 2, 1},
+                BranchOperation{1, 4},
+                JumpOperation{1},
+                ReturnOperation{1}};
+        // [0] + [1] with a loop
+        static constexpr auto callee = std::array<Operation, 4>{
+                AdditionOperation{0, 1, 2},
+                BranchOperation{2, 3},
+                JumpOperation{0},
+                ReturnOperation{2}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{0, 1},
+                AssignOperation{0, 2},
+                AssignOperation{0, 3},
+                AdditionOperation{2, 3, 4},
+                BranchOperation{4, 6},
+                JumpOperation{3},
+                AssignOperation{4, 1},
+                BranchOperation{1, 9},
+                JumpOperation{1},
+                ReturnOperation{1}};
+        REQUIRE(detail::inline_call(caller, 1, callee) == expected);
+    }
+
+}  // namespace
+
+}  // namespace ctpy
@@ -0,0 +1,92 @@
+#include "packed.h"
+#include <doctest/doctest.h>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ctpy {
+
+namespace {
+    // total = 0, i = 0, while i < [0]: total = total + i, i = i + 1, return total
+    constexpr auto loop_operations = Function<5, 1, 10>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 0},
+            ConstantOperation{3, 1},
+            LessOperation{2, 0, 4},
+            BranchOperation{4, 8},
+            AdditionOperation{1, 2, 1},
+            AdditionOperation{2, 3, 2},
+            JumpOperation{3},
+            ReturnOperation{1},
+            ReturnOperation{0}};
+
+    TEST_CASE("pack") {
+        static constexpr auto func = PackedFunction<loop_operations>{};
+        REQUIRE(std::is_same_v<decltype(func.packed.operations[0].a), std::uint8_t>);
+        REQUIRE(sizeof(func.packed.operations) == 4 * 10);
+        REQUIRE(func.packed.constants == std::array{Variable{0}, Variable{1}});
+        REQUIRE(func.packed.operations[1] == PackedOperation<std::uint8_t>{4, 0, 2});
+        REQUIRE(func.packed.operations[7] == PackedOperation<std::uint8_t>{12, 3});
+    }
+
+    TEST_CASE("PackedFunction runs like Function") {
+        static constexpr auto func = PackedFunction<loop_operations>{};
+        static constexpr auto result = func(5);
+        REQUIRE(result == Variable{10});
+        REQUIRE(func(100) == loop_operations(100));
+        REQUIRE(func.call(std::array{Variable{4}}) == Variable{6});
+    }
+
+    // return [0] % [1]
+    constexpr auto modulo_operations = Function<3, 2, 2>{
+            ModuloOperation{0, 1, 2}, ReturnOperation{2}};
+
+    TEST_CASE("PackedFunction throws for divisions by zero") {
+        static constexpr auto func = PackedFunction<modulo_operations>{};
+        REQUIRE(func(-7, 3) == Variable{2});
+        REQUIRE_THROWS_AS(func(7, 0), std::domain_error);
+    }
+
+    TEST_CASE("PackedIndex") {
+        REQUIRE(std::is_same_v<PackedIndex<255>, std::uint8_t>);
+        REQUIRE(std::is_same_v<PackedIndex<256>, std::uint16_t>);
+        REQUIRE(std::is_same_v<PackedIndex<65536>, std::uint32_t>);
+    }
+
+    // [0] = 0, [1] = 1, then 300 times [0] = [0] + [1]
+    constexpr auto long_operations = [] {
+        auto function = Function<2, 0, 303>{};
+        function.operations.front() = ConstantOperation{0, 0};
+        function.operations[1] = ConstantOperation{1, 1};
+        for (auto i = 2U; i < function.operations.size() - 1; ++i) {
+            function.operations[i] = AdditionOperation{0, 1, 0};
+        }
+        function.operations.back() = ReturnOperation{0};
+        return function;
+    }();
+
+    TEST_CASE("PackedFunction with hundreds of operations") {
+        static constexpr auto func = PackedFunction<long_operations>{};
+        REQUIRE(std::is_same_v<decltype(func.packed.operations[0].a), std::uint16_t>);
+        REQUIRE(func() == Variable{300});
+    }
+
+    // return [0] + callees[1]([0])
+    constexpr auto calling_operations = Function<2, 1, 3>{
+            CallOperation{1, {0}, 1, 1}, AdditionOperation{0, 1, 1}, ReturnOperation{1}};
+
+    constexpr auto twice = [](std::size_t const function, std::span<Variable const> arguments) {
+        return function == 1 ? detail::evaluate(detail::Plus{}, arguments[0], arguments[0])
+                             : Variable{};
+    };
+
+    TEST_CASE("PackedFunction resolves calls with the callees") {
+        static constexpr auto func = PackedFunction<calling_operations, twice>{};
+        REQUIRE(func.packed.arguments == std::array<std::uint8_t, 2>{1, 0});
+        REQUIRE(func(2) == Variable{6});
+        REQUIRE(func(2.5) == Variable{7.5});
+    }
+
+}  // namespace
+
+}  // namespace ctpy
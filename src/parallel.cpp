@@ -0,0 +1,107 @@
+#include "parallel.h"
+#include <doctest/doctest.h>
+#include <latch>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace ctpy {
+
+namespace {
+
+    // [2] = 5, [3] = [0] + [1], [3] = [2] + [3], return [3]
+    constexpr auto sum_plus_five = Function<4, 2, 4>{
+            ConstantOperation{2, 5},
+            AdditionOperation{0, 1, 3},
+            AdditionOperation{2, 3, 3},
+            ReturnOperation{3}};
+
+    TEST_CASE("ThreadPool runs every task") {
+        auto pool = ThreadPool{3};
+        REQUIRE(pool.size() == 3);
+        auto counts = std::vector<int>(100);
+        auto done = std::latch{100};
+        for (auto i = 0; i < 100; ++i) {
+            pool.submit([&counts, &done, i] {
+                ++counts[i];
+                done.count_down();
+            });
+        }
+        done.wait();
+        REQUIRE(counts == std::vector<int>(100, 1));
+    }
+
+    TEST_CASE("chunk_size") {
+        REQUIRE(detail::chunk_size(1'000'000, 4) % detail::batch_size == 0);
+        REQUIRE(detail::chunk_size(1'000'000, 4) * 16 >= 1'000'000);
+        REQUIRE(detail::chunk_size(10, 4) == detail::batch_size);
+    }
+
+    TEST_CASE("parallel_batch over many chunks") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto pool = ThreadPool{4};
+        auto const rows = detail::parallel_threshold * 3 + 17;
+        auto lhs = std::vector<int>(rows);
+        auto rhs = std::vector<double>(rows);
+        std::iota(lhs.begin(), lhs.end(), 0);
+        std::iota(rhs.begin(), rhs.end(), 0.5);
+        auto results = std::vector<double>(rows);
+        parallel_batch(pool, func, results, lhs, rhs);
+        auto expected = std::vector<double>(rows);
+        batch(func, expected, lhs, rhs);
+        REQUIRE(results == expected);
+        REQUIRE(results.back() == func(lhs.back(), rhs.back()));
+    }
+
+    // total = 0, i = 0, while i < [0]: total = total + i, i = i + 1, return total
+    constexpr auto loop_operations = Function<5, 1, 10>{
+            ConstantOperation{1, 0},
+            ConstantOperation{2, 0},
+            ConstantOperation{3, 1},
+            LessOperation{2, 0, 4},
+            BranchOperation{4, 8},
+            AdditionOperation{1, 2, 1},
+            AdditionOperation{2, 3, 2},
+            JumpOperation{3},
+            ReturnOperation{1},
+            ReturnOperation{0}};
+
+    TEST_CASE("parallel_map with control flow") {
+        static constexpr auto func = LoweredFunction<loop_operations>{};
+        auto values = std::vector<int>(detail::parallel_threshold + 1);
+        for (auto i = std::size_t{0}; i < values.size(); ++i) {
+            values[i] = static_cast<int>(i % 100);
+        }
+        auto const results = parallel_map<long>(func, values);
+        for (auto i = std::size_t{0}; i < values.size(); ++i) {
+            REQUIRE(results[i] == func(values[i]));
+        }
+        REQUIRE(parallel_map<int>(func, std::vector<int>{4, 5}) == std::vector<int>{6, 10});
+    }
+
+    // return 1 / [0]
+    constexpr auto reciprocal = Function<3, 1, 3>{
+            ConstantOperation{1, 1}, DivisionOperation{1, 0, 2}, ReturnOperation{2}};
+
+    TEST_CASE("parallel_map rethrows what a chunk throws") {
+        static constexpr auto func = LoweredFunction<reciprocal>{};
+        auto pool = ThreadPool{4};
+        auto values = std::vector<int>(detail::parallel_threshold * 2, 4);
+        auto results = std::vector<double>(values.size());
+        parallel_batch(pool, func, results, values);
+        REQUIRE(results.back() == 0.25);
+        values[detail::parallel_threshold + 3] = 0;
+        REQUIRE_THROWS_AS(parallel_batch(pool, func, results, values), std::domain_error);
+    }
+
+    TEST_CASE("parallel_batch with mismatched columns") {
+        static constexpr auto func = LoweredFunction<sum_plus_five>{};
+        auto results = std::vector<int>(3);
+        REQUIRE_THROWS_AS(
+                parallel_batch(func, results, std::vector<int>(3), std::vector<int>(2)),
+                std::invalid_argument);
+    }
+
+}  // namespace
+
+}  // namespace ctpy
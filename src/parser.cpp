@@ -1,6 +1,11 @@
 #include "parser.h"
 #include <algorithm>
+#include <array>
 #include <doctest/doctest.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace ctpy {
 
@@ -34,14 +39,123 @@ namespace {
         REQUIRE(parse<lexemes>() == expected);
     }
 
-    TEST_CASE("parse_return_subexpression") {
+    TEST_CASE("function returning constant lowered") {
+        static constexpr auto lexemes =
+                Lexemes{Keyword::def,
+                        Identifier{"func"},
+                        Operator::bracketleft,
+                        Operator::bracketright,
+                        Operator::semicolon,
+                        Operator::linebreak,
+                        //
+                        Keyword::return_,
+                        Literal{"123"}};
+        static constexpr auto function = parse<lexemes, Mode::lowered>();
+        REQUIRE(function() == 123);
+    }
+
+    TEST_CASE("parse_expression literal") {
         static constexpr auto lexemes = Lexemes{Literal{"123"}};
-        static constexpr auto result = detail::parse_return_subexpression(lexemes.elements);
-        REQUIRE(result.operation == Operation{ConstantOperation{0, Variable{123}}});
-        REQUIRE(result.return_index == 0);
+        auto state = detail::ParseState{};
+        auto const result = detail::parse_expression(state, lexemes.elements);
+        REQUIRE(state.operations == std::vector<Operation>{ConstantOperation{0, Variable{123}}});
+        REQUIRE(result.index == 0);
         REQUIRE(result.remaining_lexemes.empty());
     }
 
+    TEST_CASE("parse_expression binds addition tighter than comparison") {
+        static constexpr auto lexemes =
+                Lexemes{Identifier{"a"}, Operator::less, Literal{"1"}, Operator::plus,
+                        Identifier{"a"}, Operator::linebreak};
+        auto state = detail::ParseState{};
+        auto const a = state.variable("a");
+        auto const result = detail::parse_expression(state, lexemes.elements);
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 1}, AdditionOperation{1, a, 2}, LessOperation{a, 2, 3}};
+        REQUIRE(state.operations == expected);
+        REQUIRE(result.index == 3);
+        REQUIRE(result.remaining_lexemes.size() == 1);
+    }
+
+    TEST_CASE("parse_expression precedence and associativity") {
+        // a - 2 * a ** 2 ** a
+        static constexpr auto lexemes =
+                Lexemes{Identifier{"a"}, Operator::minus, Literal{"2"}, Operator::asterisk,
+                        Identifier{"a"}, Operator::asteriskasterisk, Literal{"2"},
+                        Operator::asteriskasterisk, Identifier{"a"}};
+        auto state = detail::ParseState{};
+        auto const a = state.variable("a");
+        auto const result = detail::parse_expression(state, lexemes.elements);
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 2},
+                ConstantOperation{2, 2},
+                PowerOperation{2, a, 3},
+                PowerOperation{a, 3, 4},
+                MultiplicationOperation{1, 4, 5},
+                SubtractionOperation{a, 5, 6}};
+        REQUIRE(state.operations == expected);
+        REQUIRE(result.index == 6);
+    }
+
+    TEST_CASE("parse_expression unary minus") {
+        // -a ** 2 // -3
+        static constexpr auto lexemes =
+                Lexemes{Operator::minus, Identifier{"a"}, Operator::asteriskasterisk,
+                        Literal{"2"}, Operator::slashslash, Operator::minus, Literal{"3"}};
+        auto state = detail::ParseState{};
+        auto const a = state.variable("a");
+        auto const result = detail::parse_expression(state, lexemes.elements);
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 2},
+                PowerOperation{a, 1, 2},
+                ConstantOperation{3, -1},
+                MultiplicationOperation{3, 2, 4},
+                ConstantOperation{5, -3},
+                FloorDivisionOperation{4, 5, 6}};
+        REQUIRE(state.operations == expected);
+        REQUIRE(result.index == 6);
+    }
+
+    TEST_CASE("parse_expression rejects undefined names and chained comparisons") {
+        auto state = detail::ParseState{};
+        REQUIRE_THROWS(detail::parse_expression(state, Lexemes{Identifier{"a"}}.elements));
+        REQUIRE_THROWS(detail::parse_expression(
+                state,
+                Lexemes{Literal{"1"}, Operator::less, Literal{"2"}, Operator::less, Literal{"3"}}
+                        .elements));
+    }
+
+    TEST_CASE("build_operations while loop") {
+        static constexpr auto lexemes =
+                Lexemes{Identifier{"i"}, Operator::equal, Literal{"0"}, Operator::linebreak,
+                        Keyword::while_, Identifier{"i"}, Operator::less, Literal{"3"},
+                        Operator::semicolon, Operator::linebreak,
+                        //
+                        Indentation{4}, Identifier{"i"}, Operator::equal, Identifier{"i"},
+                        Operator::plus, Literal{"1"}, Operator::linebreak,
+                        //
+                        Keyword::return_, Identifier{"i"}};
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 0},
+                ConstantOperation{2, 3},
+                LessOperation{1, 2, 3},
+                BranchOperation{3, 7},
+                ConstantOperation{4, 1},
+                AdditionOperation{1, 4, 1},
+                JumpOperation{1},
+                ReturnOperation{1}};
+        REQUIRE(detail::build_operations(lexemes.elements) == expected);
+    }
+
+    TEST_CASE("build_operations rejects malformed blocks") {
+        auto const indented = Lexemes{Keyword::return_, Literal{"1"}, Operator::linebreak,
+                                      Indentation{2}, Keyword::return_, Literal{"2"}};
+        REQUIRE_THROWS(detail::build_operations(indented.elements));
+        auto const empty_loop = Lexemes{Keyword::while_, Literal{"1"}, Operator::semicolon,
+                                        Operator::linebreak, Keyword::return_, Literal{"2"}};
+        REQUIRE_THROWS(detail::build_operations(empty_loop.elements));
+    }
+
     TEST_CASE("calculate_parameters_count") {
         static constexpr auto result =
                 detail::calculate_function_parameters(Lexemes{Keyword::def,
@@ -62,14 +176,50 @@ namespace {
 
     TEST_CASE("calculate_operation_count non-empty") {
         static constexpr auto build_operations_mock =
-                [](std::span<Lexeme const> const lexemes) -> detail::BuildOperationsReturn {
-            return std::vector<Operation>(2);
+                [](std::span<Lexeme const> const lexemes,
+                   detail::Scope const&) -> detail::BuildOperationsReturn {
+            return std::vector<Operation>{ConstantOperation{0, 1}, ReturnOperation{0}};
         };
         REQUIRE(detail::calculate_function_parameters<build_operations_mock>(
                         Lexemes<2>{Identifier{"1"}, Identifier{"2"}}.elements)
                         .operation_count == 2);
     }
 
+    TEST_CASE("calculate_operation_count optimized") {
+        static constexpr auto build_operations_mock =
+                [](std::span<Lexeme const> const lexemes,
+                   detail::Scope const&) -> detail::BuildOperationsReturn {
+            return std::vector<Operation>{
+                    ConstantOperation{0, 1},
+                    ConstantOperation{1, 2},
+                    AdditionOperation{0, 1, 2},
+                    ReturnOperation{2}};
+        };
+        static constexpr auto result =
+                detail::calculate_function_parameters<build_operations_mock>(Lexemes{}.elements);
+        REQUIRE(result.operation_count == 2);
+    }
+
+    TEST_CASE("calculate_stack_size after slot allocation") {
+        static constexpr auto build_operations_mock =
+                [](std::span<Lexeme const> const lexemes,
+                   detail::Scope const&) -> detail::BuildOperationsReturn {
+            return std::vector<Operation>{
+                    ConstantOperation{3, 1},
+                    ConstantOperation{5, 2},
+                    AdditionOperation{3, 5, 7},
+                    ReturnOperation{7}};
+        };
+        static constexpr auto optimize_mock = [](std::span<Operation const> const operations) {
+            return std::vector<Operation>(operations.begin(), operations.end());
+        };
+        static constexpr auto result =
+                detail::calculate_function_parameters<build_operations_mock, optimize_mock>(
+                        Lexemes{}.elements);
+        REQUIRE(result.stack_size == 2);
+        REQUIRE(result.operation_count == 4);
+    }
+
     TEST_CASE("build_operations") {
         static constexpr auto lexemes = std::array<Lexeme, 2>{Keyword::return_, Literal{"123"}};
         auto const expected =
@@ -78,11 +228,14 @@ namespace {
         REQUIRE(result == expected);
     }
 
-    TEST_CASE("check_function_header") {
+    TEST_CASE("parse_function_header") {
         static constexpr auto lexemes =
                 Lexemes{Keyword::def,
                         Identifier{"func"},
                         Operator::bracketleft,
+                        Identifier{"a"},
+                        Operator::comma,
+                        Identifier{"b"},
                         Operator::bracketright,
                         Operator::semicolon,
                         Operator::linebreak,
@@ -90,10 +243,378 @@ namespace {
                         Keyword::return_,
                         Literal{"123"}};
         static auto constexpr expected = Lexemes{Keyword::return_, Literal{"123"}};
-        static auto constexpr result = detail::check_function_header<lexemes>();
-        REQUIRE(std::ranges::equal(result, expected.elements));
+        auto const result = detail::parse_function_header(lexemes.elements);
+        REQUIRE(result.name == "func");
+        REQUIRE(result.parameters == std::vector<std::string_view>{"a", "b"});
+        REQUIRE(std::ranges::equal(result.body, expected.elements));
+    }
+
+    TEST_CASE("parse_function_header rejects malformed parameters") {
+        auto const duplicate = Lexemes{Keyword::def, Identifier{"func"}, Operator::bracketleft,
+                                       Identifier{"a"}, Operator::comma, Identifier{"a"},
+                                       Operator::bracketright, Operator::semicolon,
+                                       Operator::linebreak};
+        REQUIRE_THROWS(detail::parse_function_header(duplicate.elements));
+        auto const missing_comma = Lexemes{Keyword::def, Identifier{"func"}, Operator::bracketleft,
+                                           Identifier{"a"}, Identifier{"b"},
+                                           Operator::bracketright, Operator::semicolon,
+                                           Operator::linebreak};
+        REQUIRE_THROWS(detail::parse_function_header(missing_comma.elements));
+    }
+
+    TEST_CASE("parse_function_header with annotations") {
+        static constexpr auto lexemes =
+                Lexemes{Keyword::def, Identifier{"func"}, Operator::bracketleft, Identifier{"a"},
+                        Operator::semicolon, Identifier{"int"}, Operator::comma, Identifier{"b"},
+                        Operator::comma, Identifier{"c"}, Operator::semicolon, Identifier{"float"},
+                        Operator::bracketright, Operator::semicolon, Operator::linebreak};
+        auto const result = detail::parse_function_header(lexemes.elements);
+        REQUIRE(result.parameters == std::vector<std::string_view>{"a", "b", "c"});
+        REQUIRE(result.annotations == std::vector{Type::int_, Type::empty, Type::double_});
+        auto const unsupported = Lexemes{Keyword::def, Identifier{"func"}, Operator::bracketleft,
+                                         Identifier{"a"}, Operator::semicolon, Identifier{"bool"},
+                                         Operator::bracketright, Operator::semicolon,
+                                         Operator::linebreak};
+        REQUIRE_THROWS(detail::parse_function_header(unsupported.elements));
+    }
+
+    TEST_CASE("parse_function_header with table decorator") {
+        static constexpr auto lexemes =
+                Lexemes{Operator::at, Identifier{"table"}, Operator::bracketleft, Operator::minus,
+                        Literal{"4"}, Operator::comma, Literal{"16"}, Operator::bracketright,
+                        Operator::linebreak, Keyword::def, Identifier{"func"},
+                        Operator::bracketleft, Identifier{"a"}, Operator::bracketright,
+                        Operator::semicolon, Operator::linebreak};
+        auto const result = detail::parse_function_header(lexemes.elements);
+        REQUIRE(result.name == "func");
+        REQUIRE(result.table == Domain{-4, 16});
+        auto const empty = Lexemes{Operator::at, Identifier{"table"}, Operator::bracketleft,
+                                   Literal{"4"}, Operator::comma, Literal{"4"},
+                                   Operator::bracketright, Operator::linebreak, Keyword::def,
+                                   Identifier{"func"}, Operator::bracketleft, Identifier{"a"},
+                                   Operator::bracketright, Operator::semicolon,
+                                   Operator::linebreak};
+        REQUIRE_THROWS(detail::parse_function_header(empty.elements));
+        auto const two_parameters = Lexemes{Operator::at, Identifier{"table"},
+                                            Operator::bracketleft, Literal{"0"}, Operator::comma,
+                                            Literal{"4"}, Operator::bracketright,
+                                            Operator::linebreak, Keyword::def, Identifier{"func"},
+                                            Operator::bracketleft, Identifier{"a"},
+                                            Operator::comma, Identifier{"b"},
+                                            Operator::bracketright, Operator::semicolon,
+                                            Operator::linebreak};
+        REQUIRE_THROWS(detail::parse_function_header(two_parameters.elements));
+    }
+
+    TEST_CASE("function with parameters") {
+        static constexpr auto lexemes =
+                Lexemes{Keyword::def, Identifier{"func"}, Operator::bracketleft, Identifier{"a"},
+                        Operator::comma, Identifier{"b"}, Operator::bracketright,
+                        Operator::semicolon, Operator::linebreak,
+                        //
+                        Keyword::return_, Identifier{"a"}, Operator::plus, Identifier{"b"}};
+        static constexpr auto function = parse<lexemes>();
+        REQUIRE(function(1, 2.5) == Variable{3.5});
+        REQUIRE(parse<lexemes, Mode::lowered>()(1, 2) == 3);
+    }
+
+    TEST_CASE("parse_declarations") {
+        static constexpr auto content = Content{R"(
+def first(a):
+    b = a
+
+    return b
+def second():
+    return first(1)
+)"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        REQUIRE(declarations.size() == 2);
+        REQUIRE(declarations[0].name == "first");
+        REQUIRE(declarations[0].parameters == std::vector<std::string_view>{"a"});
+        REQUIRE(declarations[0].body.size() == 10);
+        REQUIRE(declarations[1].name == "second");
+        REQUIRE(declarations[1].body.size() == 7);
+    }
+
+    TEST_CASE("parse_declarations rejects unindented statements") {
+        static constexpr auto content = Content{"def first():\n    return 1\nreturn 2"};
+        static constexpr auto lexemes = lex<content>();
+        REQUIRE_THROWS(detail::parse_declarations(lexemes.elements));
+    }
+
+    TEST_CASE("build_operations call") {
+        static constexpr auto content =
+                Content{"def f(a, b):\n    return a\ndef g():\n    x = 1\n    return f(x, 2)"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        auto const result = detail::build_operations(
+                declarations[1].body, {{}, declarations, {}, {}, {}});
+        auto const expected = std::vector<Operation>{
+                ConstantOperation{1, 1},
+                ConstantOperation{2, 2},
+                CallOperation{0, {1, 2}, 2, 3},
+                ReturnOperation{3}};
+        REQUIRE(result == expected);
+        REQUIRE_THROWS(detail::build_operations(declarations[1].body));
+    }
+
+    TEST_CASE("build_operations rejects wrong calls") {
+        static constexpr auto content =
+                Content{"def f(a):\n    return a\ndef g():\n    return f(1, 2)"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        REQUIRE_THROWS(detail::build_operations(
+                declarations[1].body, {{}, declarations, {}, {}, {}}));
+    }
+
+    TEST_CASE("build_operations yield") {
+        static constexpr auto content =
+                Content{"def f():\n    yield 1\ndef g():\n    return f()"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        REQUIRE(detail::is_generator(declarations[0].body));
+        REQUIRE(detail::build_operations(declarations[0].body) ==
+                std::vector<Operation>{ConstantOperation{0, 1}, YieldOperation{0}});
+        REQUIRE_THROWS(detail::build_operations(
+                declarations[1].body, {{}, declarations, {}, {}, {}}));
+    }
+
+    template<class T>
+    bool
+    contains(std::vector<Operation> const& operations) {
+        return std::ranges::any_of(operations, [](Operation const& operation) {
+            return std::holds_alternative<T>(operation);
+        });
+    }
+
+    TEST_CASE("build_operations if without control flow selects") {
+        static constexpr auto content = Content{
+                "def f(a, b):\n    if a < b:\n        a = b\n    elif a == 0:\n        a = 9\n"
+                "    return a"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        auto const result = detail::build_operations(
+                declarations[0].body, {declarations[0].parameters, {}, {}, {}, {}});
+        REQUIRE(contains<SelectOperation>(result));
+        REQUIRE_FALSE(contains<BranchOperation>(result));
+    }
+
+    TEST_CASE("build_operations if with returns or divisions branches") {
+        static constexpr auto content = Content{
+                "def f(a, b):\n    if a < b:\n        return b\n    return a\n"
+                "def g(a, b):\n    if b != 0:\n        a = a // b\n    return a"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        for (auto const& declaration: declarations) {
+            auto const result = detail::build_operations(
+                    declaration.body, {declaration.parameters, {}, {}, {}, {}});
+            REQUIRE(contains<BranchOperation>(result));
+            REQUIRE_FALSE(contains<SelectOperation>(result));
+        }
+    }
+
+    TEST_CASE("build_operations conditional expression") {
+        static constexpr auto content =
+                Content{"def f(a, b):\n    return a if a > b else b\n"
+                        "def g(a):\n    return 1 // a if a else 0"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        auto const select = detail::build_operations(
+                declarations[0].body, {declarations[0].parameters, {}, {}, {}, {}});
+        REQUIRE(contains<SelectOperation>(select));
+        REQUIRE_FALSE(contains<BranchOperation>(select));
+        auto const branch = detail::build_operations(
+                declarations[1].body, {declarations[1].parameters, {}, {}, {}, {}});
+        REQUIRE(contains<BranchOperation>(branch));
+        REQUIRE_FALSE(contains<SelectOperation>(branch));
+    }
+
+    TEST_CASE("parse_expression strings") {
+        static constexpr auto content = Content{"'ab' 'c' + 'd' == s[1:len(s)].endswith('x')"};
+        static constexpr auto lexemes = lex<content>();
+        auto const parameters = std::array{std::string_view{"s"}};
+        auto state = detail::ParseState{{parameters, {}, {}, {}, {}}};
+        auto const result = detail::parse_expression(state, lexemes.elements);
+        REQUIRE(result.remaining_lexemes.empty());
+        REQUIRE(state.operations[0] == Operation{ConstantOperation{1, std::string_view{"abcd"}}});
+        REQUIRE(contains<LengthOperation>(state.operations));
+        REQUIRE(contains<SliceOperation>(state.operations));
+        REQUIRE(contains<EndsWithOperation>(state.operations));
+        REQUIRE(std::ranges::count_if(state.built, [](auto const& string) {
+                    return std::string_view{string.data(), string.size()} == "abcd";
+                }) == 1);
+    }
+
+    TEST_CASE("build_operations needs a pool for built strings") {
+        static constexpr auto content =
+                Content{"def f(s: str):\n    return s[0] + s[-1:] + ('a' + 'b')"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        REQUIRE(declarations[0].annotations == std::vector{Type::string});
+        auto const& body = declarations[0].body;
+        REQUIRE_THROWS(detail::build_operations(
+                body, {declarations[0].parameters, {}, {}, {}, {}}));
+        auto const strings = detail::collect_strings(declarations);
+        REQUIRE(strings == std::vector<std::string>{"ab"});
+        auto const pool = std::array{std::string_view{strings[0]}};
+        auto const result =
+                detail::build_operations(body, {declarations[0].parameters, {}, {}, pool, {}});
+        REQUIRE(contains<SubscriptOperation>(result));
+        REQUIRE(std::ranges::find(result, Operation{ConstantOperation{7, pool[0]}}) !=
+                result.end());
+    }
+
+    TEST_CASE("build_operations rejects wrong string operations") {
+        static constexpr auto content = Content{
+                "def f(s):\n    return -'a'\n"
+                "def g(s):\n    return s.upper()\n"
+                "def h(s):\n    return s[]\n"
+                "def i(s):\n    return len(s, s)"};
+        static constexpr auto lexemes = lex<content>();
+        for (auto const& declaration: detail::parse_declarations(lexemes.elements)) {
+            REQUIRE_THROWS(detail::build_operations(
+                    declaration.body, {declaration.parameters, {}, {}, {}, {}}));
+        }
+    }
+
+    TEST_CASE("parse_expression dictionaries") {
+        using namespace std::string_view_literals;
+        static constexpr auto content =
+                Content{"{'a': 1, 'b': 2,\n    'a': 3}[s] + (s in {})"};
+        static constexpr auto lexemes = lex<content>();
+        auto const parameters = std::array{std::string_view{"s"}};
+        auto state = detail::ParseState{{parameters, {}, {}, {}, {}}};
+        auto const result = detail::parse_expression(state, lexemes.elements);
+        REQUIRE(result.remaining_lexemes.empty());
+        REQUIRE(state.dictionary_literals ==
+                std::vector<detail::DictionaryEntries>{
+                        {{Variable{"a"sv}, Variable{3}}, {Variable{"b"sv}, Variable{2}}}, {}});
+        auto const& lookup = std::get<LookupOperation>(state.operations[0]);
+        REQUIRE(lookup.key == 0);
+        REQUIRE(lookup.dictionary == nullptr);
+        REQUIRE(contains<ContainsOperation>(state.operations));
+    }
+
+    TEST_CASE("build_operations needs a pool for dictionaries") {
+        using namespace std::string_view_literals;
+        static constexpr auto content = Content{R"(def f(k):
+    d = {
+        'ab': 1,
+        'a' + 'b': 2,
+        -1: 'c',
+    }
+    return d[k] if k in d else 0)"};
+        static constexpr auto lexemes = lex<content>();
+        auto const declarations = detail::parse_declarations(lexemes.elements);
+        auto const& body = declarations[0].body;
+        REQUIRE_THROWS(detail::build_operations(
+                body, {declarations[0].parameters, {}, {}, {}, {}}));
+        auto const strings = detail::collect_strings(declarations);
+        auto const string_pool = std::array{std::string_view{strings[0]}};
+        auto const dictionaries = detail::collect_dictionaries(declarations, string_pool);
+        REQUIRE(dictionaries.size() == 1);
+        auto const& entries = dictionaries[0];
+        REQUIRE(entries.size() == 2);
+        auto const layout = detail::dictionary_layout(entries);
+        auto const pool = std::array{Dictionary{
+                layout.seed,
+                layout.displacements,
+                layout.slots,
+                entries,
+                detail::dictionary_value_type(entries)}};
+        REQUIRE(pool[0].value_type == Type::variable);
+        REQUIRE(pool[0]["ab"sv] == Variable{2});
+        REQUIRE(pool[0][-1.0] == Variable{"c"sv});
+        REQUIRE(pool[0].find(1) == nullptr);
+        REQUIRE_THROWS_AS(pool[0][1], std::out_of_range);
+        auto const result = detail::build_operations(
+                body, {declarations[0].parameters, {}, {}, string_pool, pool});
+        REQUIRE(std::ranges::all_of(result, [&pool](Operation const& operation) {
+            auto const* const lookup = std::get_if<LookupOperation>(&operation);
+            return lookup == nullptr or lookup->dictionary == pool.data();
+        }));
+        REQUIRE(contains<ContainsOperation>(result));
+    }
+
+    TEST_CASE("build_operations rejects wrong dictionary uses") {
+        static constexpr auto content = Content{
+                "def f(x):\n    return {x: 1}[1]\n"
+                "def g(x):\n    d = {1: 2}\n    d = 3\n"
+                "def h(x):\n    d = {1: 2}\n    return d\n"
+                "def i(x):\n    x = {1: 2}\n"
+                "def j(x):\n    return x in 2\n"
+                "def k(x):\n    return {1: 2, 3}[x]"};
+        static constexpr auto lexemes = lex<content>();
+        for (auto const& declaration: detail::parse_declarations(lexemes.elements)) {
+            auto state = detail::ParseState{{declaration.parameters, {}, {}, {}, {}}};
+            REQUIRE_THROWS(detail::parse_body(state, declaration.body));
+        }
+    }
+
+    constexpr auto strings_code = Content{R"(def tag(s: str):
+    if s.startswith('#'):
+        return s[1:]
+    return 'no' + ' ' + 'tag'
+
+def func(s):
+    return len(tag(s)) * 10 + (tag(s) == 'rule'))"};
+    constexpr auto strings_lexed = lex<strings_code>();
+
+    TEST_CASE("strings") {
+        using namespace std::string_view_literals;
+        static constexpr auto module = parse_module<strings_lexed>();
+        static constexpr auto result = module.function<"tag">()("#rule");
+        REQUIRE(result == Variable{"rule"sv});
+        REQUIRE(module.function<"tag">()("rule") == Variable{"no tag"sv});
+        REQUIRE(module.function<"func">()("#rule") == Variable{41});
+        static constexpr auto lowered = parse_module<strings_lexed, Mode::lowered>();
+        REQUIRE(lowered.function<"func">()("#abc") == Variable{30});
+        static constexpr auto packed = parse_module<strings_lexed, Mode::packed>();
+        REQUIRE(packed.function<"tag">()("no") == Variable{"no tag"sv});
+        REQUIRE(detail::string_pool<strings_lexed, true>.size() == 2);
+    }
+
+    constexpr auto dictionaries_code = Content{R"(def score(code: str):
+    weights = {
+        'low': 1,
+        'mid': 5,
+        'high': 10,
+        'hi' + 'gh': 20,
+    }
+    return weights[code] if code in weights else -1
+
+def bonus(n):
+    return {1: 5, 2: 15}[n] + {'a': 1}['a']
+
+def missing():
+    return {1: 5, 2: 15}[3])"};
+    constexpr auto dictionaries_lexed = lex<dictionaries_code>();
+
+    TEST_CASE("dictionaries") {
+        static constexpr auto module = parse_module<dictionaries_lexed>();
+        static constexpr auto result = module.function<"score">()("mid");
+        REQUIRE(result == Variable{5});
+        REQUIRE(module.function<"score">()("high") == Variable{20});
+        REQUIRE(module.function<"score">()("none") == Variable{-1});
+        REQUIRE(module.function<"bonus">()(2) == Variable{16});
+        REQUIRE(module.function<"bonus">()(1.0) == Variable{6});
+        REQUIRE_THROWS_AS(module.function<"bonus">()(3), std::out_of_range);
+        // Missing constant keys are left to fail at run time
+        REQUIRE_THROWS_AS(module.function<"missing">()(), std::out_of_range);
+        static constexpr auto lowered = parse_module<dictionaries_lexed, Mode::lowered>();
+        REQUIRE(lowered.function<"score">()("low") == Variable{1});
+        REQUIRE(lowered.function<"bonus">()(1) == 6);
+        static constexpr auto packed = parse_module<dictionaries_lexed, Mode::packed>();
+        REQUIRE(packed.function<"score">()("x") == Variable{-1});
+        REQUIRE(detail::dictionary_pool<dictionaries_lexed, true>.size() == 3);
+        // The lookup of a constant key is folded
+        static constexpr auto const& bonus = detail::module_function<dictionaries_lexed, 1>;
+        REQUIRE(std::ranges::count_if(bonus.operations, [](Operation const& operation) {
+                    return std::holds_alternative<LookupOperation>(operation);
+                }) == 1);
     }
 
 }  // namespace
 
-}  // namespace ctpy
\ No newline at end of file
+}  // namespace ctpy
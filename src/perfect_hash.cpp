@@ -0,0 +1,72 @@
+#include "perfect_hash.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <doctest/doctest.h>
+#include <string_view>
+
+using namespace std::string_view_literals;
+
+namespace ctpy {
+
+namespace {
+
+    TEST_CASE("PerfectHashMap string keys") {
+        static constexpr auto map = make_perfect_hash_map(std::array{
+                std::pair{"def"sv, 1}, std::pair{"return"sv, 2}, std::pair{"for"sv, 3}});
+        REQUIRE(*map.find("def"sv) == 1);
+        REQUIRE(*map.find("return"sv) == 2);
+        REQUIRE(*map.find("for"sv) == 3);
+        REQUIRE(map.find("while"sv) == nullptr);
+        REQUIRE_FALSE(map.contains("de"sv));
+        REQUIRE(map.size() == 3);
+    }
+
+    TEST_CASE("PerfectHashMap integer keys") {
+        static constexpr auto map = make_perfect_hash_map(
+                std::array{std::pair{1, 10.0}, std::pair{-7, 70.0}, std::pair{1000, 1.5}});
+        REQUIRE(*map.find(-7) == 70.0);
+        REQUIRE(*map.find(1000) == 1.5);
+        REQUIRE_FALSE(map.contains(2));
+    }
+
+    TEST_CASE("PerfectHashMap has no collisions") {
+        static constexpr auto map = make_perfect_hash_map([] {
+            auto entries = std::array<std::pair<int, int>, 64>{};
+            for (auto i = 0; i < 64; ++i) {
+                entries[i] = {i * 31, i};
+            }
+            return entries;
+        }());
+        for (auto i = 0; i < 64; ++i) {
+            REQUIRE(*map.find(i * 31) == i);
+        }
+    }
+
+    TEST_CASE("make_displaced_layout places every key in its own slot") {
+        static constexpr auto key_count = std::size_t{2000};
+        auto const hash = [](std::size_t const index, std::uint64_t const seed) {
+            return detail::hash(static_cast<int>(index * 7), seed);
+        };
+        auto const layout = detail::make_displaced_layout(key_count, hash);
+        REQUIRE(layout.displacements.size() == detail::displaced_bucket_count(key_count));
+        REQUIRE(layout.slots.size() == detail::displaced_capacity(key_count));
+        for (auto index = std::size_t{0}; index < key_count; ++index) {
+            auto const key_hash = hash(index, layout.seed);
+            auto const displacement = layout.displacements[detail::displaced_bucket(
+                    key_hash, layout.displacements.size())];
+            REQUIRE(layout.slots[detail::displaced_slot(
+                            key_hash, displacement, layout.slots.size())] == index);
+        }
+        REQUIRE(std::ranges::count(layout.slots, key_count) ==
+                static_cast<std::ptrdiff_t>(layout.slots.size() - key_count));
+    }
+
+    TEST_CASE("PerfectHashMap empty") {
+        static constexpr auto map = make_perfect_hash_map(std::array<std::pair<int, int>, 0>{});
+        REQUIRE_FALSE(map.contains(0));
+    }
+
+}  // namespace
+
+}  // namespace ctpy
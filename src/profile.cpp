@@ -0,0 +1,77 @@
+#include "parser.h"
+#include "profile.h"
+#include <algorithm>
+#include <doctest/doctest.h>
+#include <sstream>
+#include <string>
+
+namespace ctpy {
+
+namespace {
+    constexpr auto python_code = Content{R"(def func(n):
+    total = 0
+    for i in range(n):
+        total = total + i
+    return total)"};
+    constexpr auto lexed = lex<python_code>();
+
+    TEST_CASE("profiling does not change the operations") {
+        static constexpr auto func = parse<lexed, Mode::interpreted, Profiled>();
+        static constexpr auto plain = parse<lexed>();
+        REQUIRE(std::ranges::equal(func.operations, plain.operations));
+        REQUIRE(sizeof(plain) == sizeof(plain.operations));
+        REQUIRE(func.profile.locations.front() == SourceLocation{2, 5});
+        REQUIRE(func.profile.locations.back() == SourceLocation{5, 5});
+        REQUIRE(detail::locate(lexed.elements, 0) == SourceLocation{1, 1});
+    }
+
+    TEST_CASE("profiled function counts every operation") {
+        static constexpr auto func = parse<lexed, Mode::interpreted, Profiled>();
+        reset_profile(func);
+        REQUIRE(func(10) == Variable{45});
+        auto const& locations = func.profile.locations;
+        auto const& counters = *func.profile.counters;
+        for (auto index = std::size_t{0}; index < locations.size(); ++index) {
+            if (locations[index].line == 4) {
+                REQUIRE(counters[index].hits == 10);
+            } else if (locations[index].line == 5) {
+                REQUIRE(counters[index].hits == 1);
+            }
+        }
+        REQUIRE(std::ranges::count(locations, SourceLocation{4, 9}) > 0);
+        static constexpr auto result = func(3);
+        REQUIRE(result == Variable{3});
+        REQUIRE(counters.back().hits == 1);  // Not counted at compile time
+    }
+
+    TEST_CASE("profiled lowered function counts straight runs") {
+        static constexpr auto func = parse<lexed, Mode::lowered, Profiled>();
+        auto const& function = detail::interpreted_function<lexed, Profiled>;
+        reset_profile(function);
+        REQUIRE(func(4) == 6);
+        auto const addition = std::ranges::find_if(function.operations, [](auto const& operation) {
+            return std::holds_alternative<AdditionOperation>(operation);
+        });
+        auto const index = static_cast<std::size_t>(addition - function.operations.begin());
+        REQUIRE((*function.profile.counters)[index].hits == 4);
+        REQUIRE(function.profile.counters->back().hits == 1);
+    }
+
+    TEST_CASE("profile reports") {
+        static constexpr auto func = parse<lexed, Mode::interpreted, Profiled>();
+        reset_profile(func);
+        func(2);
+        auto flat = std::ostringstream{};
+        write_flat_profile(flat, func);
+        REQUIRE(flat.str().starts_with("line:column operation"));
+        REQUIRE(flat.str().find("   4:9      add") != std::string::npos);
+        auto folded = std::ostringstream{};
+        write_folded_profile(folded, func, "func");
+        REQUIRE(folded.str().find("func;line 4;add ") != std::string::npos);
+        REQUIRE(folded.str().find("func;line 5;return ") != std::string::npos);
+        REQUIRE(operation_name(Operation{YieldOperation{0}}) == "yield");
+    }
+
+}  // namespace
+
+}  // namespace ctpy
@@ -0,0 +1,65 @@
+#include "source.h"
+#include <doctest/doctest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace ctpy {
+
+namespace {
+
+    // Writes `content` to a file in the temporary directory which is removed again afterwards
+    struct TemporaryFile final {
+        std::filesystem::path path;
+
+        TemporaryFile(std::string const& name, std::string_view const content)
+            : path{std::filesystem::temp_directory_path() / name} {
+            auto stream = std::ofstream{path, std::ios::binary};
+            stream << content;
+        }
+
+        TemporaryFile(TemporaryFile const&) = delete;
+        TemporaryFile&
+        operator=(TemporaryFile const&) = delete;
+
+        ~TemporaryFile() {
+            std::filesystem::remove(path);
+        }
+    };
+
+    TEST_CASE("MappedFile") {
+        auto const source = std::string{"def func(a, b):\n    total = a * b\n    return total\n"};
+        auto const file = TemporaryFile{"ctpy_source_test.py", source};
+        auto mapped = MappedFile{file.path};
+        REQUIRE(mapped.content() == source);
+        auto lexemes = std::vector<Lexeme>{};
+        auto stream = mapped.lexemes();
+        while (auto const lexeme = stream.next()) {
+            lexemes.push_back(*lexeme);
+        }
+        REQUIRE(lexemes == lex(source));
+        auto const& name = std::get<Identifier>(lexemes[1]).value;
+        REQUIRE(name.data() == mapped.content().data() + 4);
+        auto const moved = MappedFile{std::move(mapped)};
+        REQUIRE(moved.content() == source);
+        REQUIRE(moved.content().data() == name.data() - 4);
+    }
+
+    TEST_CASE("MappedFile of an empty file") {
+        auto const file = TemporaryFile{"ctpy_source_test_empty.py", ""};
+        auto const mapped = MappedFile{file.path};
+        REQUIRE(mapped.content().empty());
+        REQUIRE_FALSE(mapped.lexemes().next().has_value());
+    }
+
+    TEST_CASE("MappedFile of a missing file") {
+        REQUIRE_THROWS_AS(
+                MappedFile{std::filesystem::temp_directory_path() / "ctpy_missing.py"},
+                std::system_error);
+    }
+
+}  // namespace
+
+}  // namespace ctpy
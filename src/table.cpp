@@ -0,0 +1,79 @@
+#include "parser.h"
+#include "table.h"
+#include <doctest/doctest.h>
+#include <type_traits>
+
+namespace ctpy {
+
+namespace {
+    // return [0] * [0]
+    constexpr auto square_operations =
+            Function<2, 1, 2>{MultiplicationOperation{0, 0, 1}, ReturnOperation{1}};
+    constexpr auto lowered_square = LoweredFunction<square_operations>{};
+
+    TEST_CASE("TabulatedFunction") {
+        static constexpr auto func = TabulatedFunction<lowered_square, Domain{-2, 3}>{};
+        REQUIRE(func.table == std::array{4, 1, 0, 1, 4});
+        static constexpr auto result = func(2);
+        REQUIRE(result == 4);
+        REQUIRE(func(-2) == 4);
+        REQUIRE(func(3) == 9);  // Outside of the domain
+        REQUIRE(func(1.5) == 2.25);
+        REQUIRE(func(Variable{-1}) == Variable{1});
+        REQUIRE(func.lookup(3) == std::nullopt);
+    }
+
+    TEST_CASE("TabulatedFunction of an interpreted function") {
+        static constexpr auto func = TabulatedFunction<square_operations, Domain{0, 4}>{};
+        REQUIRE(std::is_same_v<decltype(func(1)), Variable>);
+        REQUIRE(func.lookup(3) == Variable{9});
+        REQUIRE(func(10) == Variable{100});
+    }
+
+    constexpr auto python_code = Content{R"(@table(0, 64)
+def func(n):
+    total = 0
+    for i in range(n):
+        total = total + i * i
+    return total)"};
+    constexpr auto lexed = lex<python_code>();
+
+    TEST_CASE("table decorator") {
+        static constexpr auto func = parse<lexed>();
+        REQUIRE(func.table[4] == Variable{14});
+        REQUIRE(func(4) == Variable{14});
+        REQUIRE(func(100) == Variable{328350});
+        static constexpr auto lowered = parse<lexed, Mode::lowered>();
+        REQUIRE(std::is_same_v<decltype(lowered.table)::value_type, int>);
+        REQUIRE(lowered(63) == 81375);
+        REQUIRE(lowered(64) == 85344);
+        static constexpr auto packed = parse<lexed, Mode::packed>();
+        REQUIRE(packed(5) == Variable{30});
+    }
+
+    constexpr auto module_code = Content{R"(@table(0, 8)
+def square(n):
+    return n * n
+
+def func(n):
+    return square(n) + square(n + 8))"};
+    constexpr auto module_lexed = lex<module_code>();
+
+    TEST_CASE("tabulated module function") {
+        static constexpr auto module = parse_module<module_lexed>();
+        REQUIRE(module.function<"square">().table[3] == Variable{9});
+        REQUIRE(module.function<"func">()(2) == Variable{104});
+        REQUIRE(std::ranges::any_of(
+                detail::module_function<module_lexed, module.find("func")>.operations,
+                [](Operation const& operation) {
+                    return std::holds_alternative<CallOperation>(operation);
+                }));
+        static constexpr auto lowered = parse_module<module_lexed, Mode::lowered>();
+        REQUIRE(lowered.function<"func">()(2) == Variable{104});
+        static constexpr auto packed = parse_module<module_lexed, Mode::packed>();
+        REQUIRE(packed.function<"func">()(2) == Variable{104});
+    }
+
+}  // namespace
+
+}  // namespace ctpy